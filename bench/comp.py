@@ -0,0 +1,12 @@
+# Building lists, sets and dicts with comprehensions.
+
+def build(n):
+    total = 0
+    for k in range(n):
+        squares = [i * i for i in range(100)]
+        evens = {i for i in squares if i % 2 == 0}
+        index = {i: i + k for i in range(50)}
+        total += len(squares) + len(evens) + len(index)
+    return total
+
+print(build(20000))
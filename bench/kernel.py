@@ -0,0 +1,34 @@
+# Fully annotated numeric kernels, for run --specialize.
+
+def fib(n: int) -> int:
+    if n < 2:
+        return n
+    return fib(n - 1) + fib(n - 2)
+
+def collatz(limit: int) -> int:
+    longest = 0
+    for start in range(1, limit):
+        n = start
+        steps = 0
+        while n != 1:
+            if n % 2 == 0:
+                n = n // 2
+            else:
+                n = 3 * n + 1
+            steps += 1
+        if steps > longest:
+            longest = steps
+    return longest
+
+def integrate(a: float, b: float, n: int) -> float:
+    h = (b - a) / n
+    s = 0.0
+    x = a
+    for i in range(n):
+        s = s + x * x * h
+        x = x + h
+    return s
+
+print(fib(25))
+print(collatz(30000))
+print(integrate(0.0, 3.0, 1000000))
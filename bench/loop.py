@@ -0,0 +1,21 @@
+# Tight numeric loops over locals, no calls inside.
+
+def loop(n):
+    total = 0
+    i = 0
+    while i < n:
+        if i % 3 == 0:
+            total += i * 2
+        else:
+            total -= 1
+        i += 1
+    return total
+
+def floats(n):
+    x = 0.0
+    for i in range(n):
+        x = x * 0.5 + i / 3.0
+    return x
+
+print(loop(3000000))
+print(floats(1000000))
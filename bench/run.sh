@@ -0,0 +1,50 @@
+#!/bin/sh
+# Arbusto: A Python Compiler.
+# Alejandro Santos, @alejolp.
+# Licence: BSD
+#
+# Times the interpreter on the microbenchmarks, built with computed goto
+# dispatch and with the plain switch, and the goto one with run
+# --specialize, then the program of build --specialize, the best of a few
+# runs of each:
+#
+#   bench/run.sh [runs]
+
+set -e
+
+RUNS=${1:-5}
+SRC=$(cd "$(dirname "$0")/.." && pwd)
+OUT=${BENCH_BUILD_DIR:-$SRC/_bench_build}
+
+build() {
+    cmake -S "$SRC" -B "$OUT/$1" -DCMAKE_BUILD_TYPE=Release -DARBUSTO_SWITCH_DISPATCH=$2 > /dev/null
+    cmake --build "$OUT/$1" -j"$(nproc)" > /dev/null
+}
+
+# The best wall time of RUNS runs, in seconds, of arbusto $1 running $2, or
+# of the program $1 when $2 is native
+best() {
+    b=""
+    i=0
+    while [ $i -lt "$RUNS" ]; do
+        s=$(date +%s.%N)
+        if [ "$2" = native ]; then "$1" > /dev/null; else "$1" run "$2" $3 > /dev/null; fi
+        e=$(date +%s.%N)
+        b=$(echo "$s $e $b" | awk '{ t = $2 - $1; if ($3 == "" || t < $3) print t; else print $3 }')
+        i=$((i + 1))
+    done
+    echo "$b"
+}
+
+build goto OFF
+build switch ON
+
+printf "%-12s %10s %10s %8s %12s %10s\n" benchmark goto switch speedup specialized native
+for f in "$SRC"/bench/*.py; do
+    g=$(best "$OUT/goto/arbusto" "$f")
+    s=$(best "$OUT/switch/arbusto" "$f")
+    t=$(best "$OUT/goto/arbusto" "$f" --specialize)
+    "$OUT/goto/arbusto" build "$f" -o "$OUT/native" --specialize
+    n=$(best "$OUT/native" native)
+    printf "%-12s %10.3f %10.3f %7.2fx %12.3f %10.3f\n" "$(basename "$f" .py)" "$g" "$s" "$(echo "$g $s" | awk '{ print $2 / $1 }')" "$t" "$n"
+done
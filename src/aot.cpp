@@ -0,0 +1,649 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+#include "aot.h"
+#include "aotconfig.h"
+
+namespace arbusto {
+
+static const char* const binary_op_names[] = {
+	"BIN_ADD", "BIN_SUB", "BIN_MUL", "BIN_MATMUL", "BIN_TRUEDIV", "BIN_MOD", "BIN_POW",
+	"BIN_LSHIFT", "BIN_RSHIFT", "BIN_BITOR", "BIN_BITXOR", "BIN_BITAND", "BIN_FLOORDIV"
+};
+
+static const char* const compare_op_names[] = {
+	"CMP_OP_LT", "CMP_OP_LE", "CMP_OP_EQ", "CMP_OP_NE", "CMP_OP_GT", "CMP_OP_GE"
+};
+
+static const char* const constant_kind_names[] = {
+	"CK_NONE", "CK_BOOL", "CK_INT", "CK_BIGINT", "CK_FLOAT", "CK_STR", "CK_TUPLE"
+};
+
+/* s as a C++ string literal, the bytes that are not printable ASCII in octal */
+static std::string cpp_string(const std::string& s) {
+	std::string r = "\"";
+	for (unsigned char c : s) {
+		if (c == '"' || c == '\\' || c == '?') {
+			r += '\\';
+			r += c;
+		} else if (c >= 0x20 && c < 0x7f) {
+			r += c;
+		} else {
+			char oct[8];
+			std::snprintf(oct, sizeof(oct), "\\%03o", c);
+			r += oct;
+		}
+	}
+	return r + "\"";
+}
+
+/* The argument for a const std::string&, which may hold NULs */
+static std::string cpp_std_string(const std::string& s) {
+	if (s.find('\0') == std::string::npos) {
+		return cpp_string(s);
+	}
+	return "std::string(" + cpp_string(s) + ", " + std::to_string(s.size()) + ")";
+}
+
+static std::string cpp_int(int64_t i) {
+	return i == INT64_MIN ? "INT64_MIN" : std::to_string(i) + "ll";
+}
+
+static void preorder(const code_object& co, std::vector<const code_object*>& all) {
+	all.push_back(&co);
+	for (auto& child : co.children) {
+		preorder(*child, all);
+	}
+}
+
+static bool is_jump(opcode op) {
+	switch (op) {
+	case BC_JMP: case BC_JMPIF: case BC_JMPIFNOT: case BC_JMPIF_B: case BC_JMPIFNOT_B: case BC_FORITER:
+	case BC_FORITER_I:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Where the generic code goes on when the typed instruction op cannot give its value: this instruction or the next */
+static int deopt_to(opcode op) {
+	switch (op) {
+	case BC_ADD_II: case BC_SUB_II: case BC_MUL_II: case BC_FLOORDIV_II: case BC_MOD_II: case BC_TRUEDIV_FF:
+		return 0;
+	case BC_FORITER_I: case BC_CALL_I: case BC_CALL_F:
+		return 1;
+	default:
+		return -1;
+	}
+}
+
+/* Whether op may raise, so that pc must say where it is for the handlers and the traceback */
+static bool may_raise(opcode op) {
+	switch (op) {
+	case BC_NOP: case BC_MOVE: case BC_LOADK: case BC_STOREGLOBAL: case BC_STOREDEREF: case BC_CLEAR: case BC_IS:
+	case BC_ISNOT: case BC_JMP: case BC_BUILDLIST: case BC_BUILDTUPLE: case BC_BUILDSLICE: case BC_LISTAPPEND:
+	case BC_MAKEFUNC: case BC_RETURN:
+		return false;
+	default:
+		return op < BC_ADD_II || deopt_to(op) == 1;
+	}
+}
+
+/*
+ * One copy of the code of a function, the generic one or the specialized
+ * one, and the instructions of it that are gone to by a goto.
+ */
+struct native_body {
+	const std::vector<instruction>* code;
+	char prefix; /* of its labels */
+	std::vector<bool> labels; /* one past the end too */
+};
+
+static std::string label(const native_body& b, uint32_t pc) {
+	return b.prefix + std::to_string(pc);
+}
+
+static void write_instruction(std::ostream& out, const native_body& b, const native_body& generic, uint32_t pc) {
+	const char* T = "\t\t\t";
+	instruction ins = (*b.code)[pc];
+	opcode op = op_of(ins);
+	unsigned a = arg_a(ins);
+	unsigned rb = arg_b(ins);
+	unsigned rc = arg_c(ins);
+	std::string A = "R[" + std::to_string(a) + "]";
+	std::string B = "R[" + std::to_string(rb) + "]";
+	std::string C = "R[" + std::to_string(rc) + "]";
+	std::string target = is_jump(op) ? label(b, pc + 1 + arg_sbx(ins)) : "";
+	std::string deopt = deopt_to(op) >= 0 ? label(generic, pc + deopt_to(op)) : "";
+
+	out << T << "/* " << pc << " " << opcode_name(op) << " */" << std::endl;
+	if (may_raise(op)) {
+		out << T << "pc = " << pc << ";" << std::endl;
+	}
+
+	switch (op) {
+	case BC_NOP:
+		break;
+	case BC_MOVE:
+		out << T << A << " = " << B << ";" << std::endl;
+		break;
+	case BC_LOADK:
+		out << T << A << " = K[" << arg_bx(ins) << "];" << std::endl;
+		break;
+	case BC_LOADGLOBAL:
+		out << T << A << " = I.load_global(co.names[" << arg_bx(ins) << "]);" << std::endl;
+		break;
+	case BC_STOREGLOBAL:
+		out << T << "I.store_global(co.names[" << arg_bx(ins) << "], " << A << ");" << std::endl;
+		break;
+	case BC_DELGLOBAL:
+		out << T << "I.del_global(co.names[" << arg_bx(ins) << "]);" << std::endl;
+		break;
+	case BC_LOADDEREF:
+	case BC_DELDEREF:
+		out << T << "{" << std::endl;
+		out << T << "\tcell_object* c = as<cell_object>(D[" << rb << "]);" << std::endl;
+		out << T << "\tif (!c->v.bound()) {" << std::endl;
+		out << T << "\t\tunbound_cell(co, " << rb << ");" << std::endl;
+		out << T << "\t}" << std::endl;
+		if (op == BC_LOADDEREF) {
+			out << T << "\t" << A << " = c->v;" << std::endl;
+		} else {
+			out << T << "\tc->v = value();" << std::endl;
+		}
+		out << T << "}" << std::endl;
+		break;
+	case BC_STOREDEREF:
+		out << T << "as<cell_object>(D[" << rb << "])->v = " << A << ";" << std::endl;
+		break;
+	case BC_CHECKBOUND:
+	case BC_DELFAST:
+		out << T << "if (!" << A << ".bound()) {" << std::endl;
+		out << T << "\tunbound_local(co, " << a << ");" << std::endl;
+		out << T << "}" << std::endl;
+		if (op == BC_DELFAST) {
+			out << T << A << " = value();" << std::endl;
+		}
+		break;
+	case BC_CLEAR:
+		for (unsigned i = 0; i < rb; ++i) {
+			out << T << "R[" << a + i << "] = value();" << std::endl;
+		}
+		break;
+
+	case BC_ADD: case BC_SUB: case BC_MUL:
+		out << T << A << " = arith<" << binary_op_names[op - BC_ADD] << ">(" << B << ", " << C << ");" << std::endl;
+		break;
+	case BC_MATMUL: case BC_TRUEDIV: case BC_MOD: case BC_POW: case BC_LSHIFT: case BC_RSHIFT: case BC_BITOR:
+	case BC_BITXOR: case BC_BITAND: case BC_FLOORDIV:
+		out << T << A << " = binary(" << binary_op_names[op - BC_ADD] << ", " << B << ", " << C << ");" << std::endl;
+		break;
+	case BC_IADD:
+		out << T << "if (is_type(" << B << ", list_type)) {" << std::endl;
+		out << T << "\t" << A << " = inplace_add(" << B << ", " << C << ");" << std::endl;
+		out << T << "} else {" << std::endl;
+		out << T << "\t" << A << " = arith<BIN_ADD>(" << B << ", " << C << ");" << std::endl;
+		out << T << "}" << std::endl;
+		break;
+
+	case BC_NEG:
+		out << T << A << " = negative(" << B << ");" << std::endl;
+		break;
+	case BC_POS:
+		out << T << A << " = positive(" << B << ");" << std::endl;
+		break;
+	case BC_INVERT:
+		out << T << A << " = invert(" << B << ");" << std::endl;
+		break;
+	case BC_NOT:
+		out << T << A << " = make_bool(!truthy(" << B << "));" << std::endl;
+		break;
+
+	case BC_LT: case BC_LE: case BC_EQ: case BC_NE: case BC_GT: case BC_GE:
+		out << T << A << " = make_bool(relation<" << compare_op_names[op - BC_LT] << ">(" << B << ", " << C << "));"
+				<< std::endl;
+		break;
+	case BC_IS:
+		out << T << A << " = make_bool(" << B << ".is(" << C << "));" << std::endl;
+		break;
+	case BC_ISNOT:
+		out << T << A << " = make_bool(!" << B << ".is(" << C << "));" << std::endl;
+		break;
+	case BC_IN:
+		out << T << A << " = make_bool(contains(" << C << ", " << B << "));" << std::endl;
+		break;
+	case BC_NOTIN:
+		out << T << A << " = make_bool(!contains(" << C << ", " << B << "));" << std::endl;
+		break;
+
+	case BC_JMP:
+		out << T << "goto " << target << ";" << std::endl;
+		break;
+	case BC_JMPIF:
+	case BC_JMPIFNOT:
+		out << T << "if (" << (op == BC_JMPIF ? "" : "!") << "truth(" << A << ")) {" << std::endl;
+		out << T << "\tgoto " << target << ";" << std::endl;
+		out << T << "}" << std::endl;
+		break;
+
+	case BC_GETITEM:
+		out << T << A << " = get_item(" << B << ", " << C << ");" << std::endl;
+		break;
+	case BC_SETITEM:
+		out << T << "set_item(" << A << ", " << B << ", " << C << ");" << std::endl;
+		break;
+	case BC_DELITEM:
+		out << T << "del_item(" << A << ", " << B << ");" << std::endl;
+		break;
+	case BC_GETATTR:
+		out << T << A << " = get_attr(" << B << ", co.attrs[" << rc << "]);" << std::endl;
+		break;
+	case BC_SETATTR:
+		out << T << "set_attr(" << A << ", co.attrs[" << rb << "], " << C << ");" << std::endl;
+		break;
+
+	case BC_BUILDLIST:
+	case BC_BUILDTUPLE:
+		out << T << A << " = " << (op == BC_BUILDLIST ? "make_list" : "make_tuple") << "(std::vector<value>(R + " << rb
+				<< ", R + " << rb + rc << "));" << std::endl;
+		break;
+	case BC_BUILDSET:
+	case BC_BUILDDICT:
+		out << T << A << " = " << (op == BC_BUILDSET ? "build_set" : "build_dict") << "(R + " << rb << ", " << rc
+				<< ");" << std::endl;
+		break;
+	case BC_BUILDSLICE:
+		out << T << A << " = make_slice(" << B << ", R[" << rb + 1 << "], R[" << rb + 2 << "]);" << std::endl;
+		break;
+	case BC_LISTAPPEND:
+		out << T << "as<list_object>(" << A << ")->items.push_back(" << B << ");" << std::endl;
+		break;
+	case BC_SETADD:
+		out << T << "as<set_object>(" << A << ")->table.set(" << B << ", none());" << std::endl;
+		break;
+	case BC_RESERVE:
+		out << T << "reserve(" << A << ", " << B << ");" << std::endl;
+		break;
+	case BC_UNPACK:
+		out << T << "unpack(R + " << a << ", " << B << ", " << rc << ");" << std::endl;
+		break;
+
+	case BC_ITER:
+		out << T << A << " = get_iter(" << B << ");" << std::endl;
+		break;
+	case BC_FORITER:
+	case BC_FORITER_I:
+		out << T << "if (!for_next(" << A << ", R[" << a + 1 << "])) {" << std::endl;
+		out << T << "\tgoto " << target << ";" << std::endl;
+		out << T << "}" << std::endl;
+		if (op == BC_FORITER_I) {
+			out << T << "if (!R[" << a + 1 << "].is_small_int()) {" << std::endl;
+			out << T << "\tgoto " << deopt << ";" << std::endl;
+			out << T << "}" << std::endl;
+		}
+		break;
+
+	case BC_CALL:
+	case BC_CALL_I:
+	case BC_CALL_F:
+		out << T << A << " = call_at(R, " << a << ", " << rb << ", " << rc << ");" << std::endl;
+		if (op != BC_CALL) {
+			out << T << "if (!" << A << (op == BC_CALL_I ? ".is_small_int()" : ".is_real()") << ") {" << std::endl;
+			out << T << "\tgoto " << deopt << ";" << std::endl;
+			out << T << "}" << std::endl;
+		}
+		break;
+	case BC_MAKEFUNC:
+		out << T << A << " = I.make_closure(*rc.children[" << arg_bx(ins) << "], R + " << a << ", D);" << std::endl;
+		break;
+	case BC_RETURN:
+		out << T << "return " << A << ";" << std::endl;
+		break;
+	case BC_RAISE:
+		out << T << "raise_value(" << A << ");" << std::endl;
+		break;
+	case BC_EXCMATCH:
+		out << T << A << " = make_bool(exception_matches(" << B << ", " << C << "));" << std::endl;
+		break;
+
+	case BC_ADD_II: case BC_SUB_II: case BC_MUL_II: case BC_FLOORDIV_II: case BC_MOD_II:
+		out << T << "{" << std::endl;
+		out << T << "\tint64_t i = " << B << ".small_int_value();" << std::endl;
+		out << T << "\tint64_t j = " << C << ".small_int_value();" << std::endl;
+		out << T << "\tint64_t r;" << std::endl;
+		switch (op) {
+		case BC_ADD_II: out << T << "\tif (!value::fits_small_int(r = i + j)) {" << std::endl; break;
+		case BC_SUB_II: out << T << "\tif (!value::fits_small_int(r = i - j)) {" << std::endl; break;
+		case BC_MUL_II:
+			out << T << "\tif (__builtin_mul_overflow(i, j, &r) || !value::fits_small_int(r)) {" << std::endl;
+			break;
+		case BC_FLOORDIV_II: out << T << "\tif (!floordiv_small(i, j, r)) {" << std::endl; break;
+		default: out << T << "\tif (!mod_small(i, j, r)) {" << std::endl; break;
+		}
+		out << T << "\t\tgoto " << deopt << ";" << std::endl;
+		out << T << "\t}" << std::endl;
+		out << T << "\t" << A << " = value::small_int(r);" << std::endl;
+		out << T << "}" << std::endl;
+		break;
+	case BC_ADD_FF: case BC_SUB_FF: case BC_MUL_FF: case BC_TRUEDIV_FF:
+		{
+			static const char* const ops[] = { " + ", " - ", " * ", " / " };
+			if (op == BC_TRUEDIV_FF) {
+				out << T << "if (" << C << ".real_value() == 0) {" << std::endl;
+				out << T << "\tgoto " << deopt << ";" << std::endl;
+				out << T << "}" << std::endl;
+			}
+			out << T << A << " = value::real(" << B << ".real_value()" << ops[op - BC_ADD_FF] << C << ".real_value());"
+					<< std::endl;
+		}
+		break;
+	case BC_LT_II: case BC_LE_II: case BC_EQ_II: case BC_NE_II: case BC_GT_II: case BC_GE_II:
+	case BC_LT_FF: case BC_LE_FF: case BC_EQ_FF: case BC_NE_FF: case BC_GT_FF: case BC_GE_FF:
+		{
+			static const char* const ops[] = { " < ", " <= ", " == ", " != ", " > ", " >= " };
+			bool ints = op <= BC_GE_II;
+			const char* get = ints ? ".small_int_value()" : ".real_value()";
+			out << T << A << " = value::boolean(" << B << get << ops[op - (ints ? BC_LT_II : BC_LT_FF)] << C << get << ");"
+					<< std::endl;
+		}
+		break;
+	case BC_JMPIF_B:
+	case BC_JMPIFNOT_B:
+		out << T << "if (" << (op == BC_JMPIF_B ? "" : "!") << A << ".bool_value()) {" << std::endl;
+		out << T << "\tgoto " << target << ";" << std::endl;
+		out << T << "}" << std::endl;
+		break;
+
+	case N_OPCODES:
+		break;
+	}
+}
+
+static void write_body(std::ostream& out, const code_object& co, const native_body& b, const native_body& generic) {
+	uint32_t line = 0;
+	for (uint32_t pc = 0; pc < b.code->size(); ++pc) {
+		if (b.labels[pc]) {
+			out << "\t\t" << label(b, pc) << ":" << std::endl;
+		}
+		if (co.line_of(pc) != line) {
+			line = co.line_of(pc);
+			out << "\t\t\t/* line " << line << " */" << std::endl;
+		}
+		write_instruction(out, b, generic, pc);
+	}
+	/* Only dead code jumps past the end */
+	if (b.labels[b.code->size()]) {
+		out << "\t\t" << label(b, b.code->size()) << ":" << std::endl;
+		out << "\t\t\treturn none();" << std::endl;
+	}
+}
+
+static void write_function(std::ostream& out, const code_object& co, size_t index) {
+	native_body generic{ &co.code, 'g', std::vector<bool>(co.code.size() + 1, false) };
+	native_body specialized{ &co.specialized, 's', std::vector<bool>(co.specialized.size() + 1, false) };
+
+	for (auto& e : co.exception_table) {
+		generic.labels[e.handler] = true;
+	}
+	for (native_body* b : { &generic, &specialized }) {
+		for (uint32_t pc = 0; pc < b->code->size(); ++pc) {
+			instruction ins = (*b->code)[pc];
+			if (is_jump(op_of(ins))) {
+				b->labels[pc + 1 + arg_sbx(ins)] = true;
+			}
+			if (deopt_to(op_of(ins)) >= 0) {
+				generic.labels[pc + deopt_to(op_of(ins))] = true;
+			}
+		}
+	}
+	specialized.labels[0] = !co.specialized.empty();
+	bool handlers = !co.exception_table.empty();
+
+	out << "/* " << co.name << ", line " << co.first_line << " */" << std::endl;
+	out << "value code_" << index << "(interpreter& I, const runtime_code& rc, value* R, value* D, bool specialized) {"
+			<< std::endl;
+	out << "\tconst code_object& co = *rc.co;" << std::endl;
+	out << "\tconst value* K = rc.constants.data();" << std::endl;
+	out << "\tuint32_t pc = 0;" << std::endl;
+	out << std::endl;
+
+	out << "\tfor (;;) {" << std::endl;
+	out << "\t\ttry {" << std::endl;
+	if (handlers) {
+		out << "\t\t\tswitch (pc) {" << std::endl;
+		std::vector<bool> done(co.code.size(), false);
+		for (auto& e : co.exception_table) {
+			if (!done[e.handler]) {
+				done[e.handler] = true;
+				out << "\t\t\tcase " << e.handler << ":" << std::endl;
+				out << "\t\t\t\tgoto " << label(generic, e.handler) << ";" << std::endl;
+			}
+		}
+		out << "\t\t\t}" << std::endl;
+	}
+	if (!co.specialized.empty()) {
+		out << "\t\t\tif (specialized) {" << std::endl;
+		out << "\t\t\t\tgoto " << label(specialized, 0) << ";" << std::endl;
+		out << "\t\t\t}" << std::endl;
+	}
+	write_body(out, co, generic, generic);
+	if (!co.specialized.empty()) {
+		write_body(out, co, specialized, generic);
+	}
+	out << "\t\t} catch (py_exception& e) {" << std::endl;
+	if (handlers) {
+		out << "\t\t\tconst exception_entry* h = co.handler_of(pc);" << std::endl;
+		out << "\t\t\tif (!h) {" << std::endl;
+		out << "\t\t\t\tI.add_traceback(e, co, pc);" << std::endl;
+		out << "\t\t\t\tthrow;" << std::endl;
+		out << "\t\t\t}" << std::endl;
+		out << "\t\t\tR[h->reg] = e.exc;" << std::endl;
+		out << "\t\t\tpc = h->handler;" << std::endl;
+	} else {
+		out << "\t\t\tI.add_traceback(e, co, pc);" << std::endl;
+		out << "\t\t\tthrow;" << std::endl;
+	}
+	out << "\t\t}" << std::endl;
+	out << "\t}" << std::endl;
+	out << "}" << std::endl;
+	out << std::endl;
+}
+
+/* items as a braced list, each one as item writes it, eight on a line */
+template <class T, class F>
+static void write_list(std::ostream& out, const std::vector<T>& items, F item) {
+	out << "{";
+	for (size_t i = 0; i < items.size(); ++i) {
+		out << (i == 0 ? " " : i % 8 == 0 ? ",\n\t\t" : ", ");
+		item(items[i]);
+	}
+	out << (items.empty() ? "}" : " }");
+}
+
+static void write_names(std::ostream& out, const char* field, const std::vector<const char*>& names) {
+	out << "\tco->" << field << " = ";
+	write_list(out, names, [&](const char* name) {
+		out << (name ? "A.intern(" + cpp_string(name) + ")" : std::string("nullptr"));
+	});
+	out << ";" << std::endl;
+}
+
+template <class T>
+static void write_numbers(std::ostream& out, const char* field, const std::vector<T>& items) {
+	out << "\tco->" << field << " = ";
+	write_list(out, items, [&](T i) {
+		out << static_cast<int64_t>(i);
+	});
+	out << ";" << std::endl;
+}
+
+static void write_loader(std::ostream& out, const code_object& co, size_t index,
+		const std::vector<const code_object*>& all) {
+	out << "/* " << co.name << " */" << std::endl;
+	out << "std::unique_ptr<code_object> load_" << index << "(arena& A) {" << std::endl;
+	out << "\tstd::unique_ptr<code_object> co(new code_object());" << std::endl;
+	out << "\tco->name = A.intern(" << cpp_string(co.name) << ");" << std::endl;
+	out << "\tco->first_line = " << co.first_line << ";" << std::endl;
+	out << "\tco->flags = " << co.flags << ";" << std::endl;
+
+	out << "\tco->code = ";
+	write_list(out, co.code, [&](instruction ins) {
+		out << "0x" << std::hex << ins << std::dec << "u";
+	});
+	out << ";" << std::endl;
+
+	out << "\tco->constants = ";
+	write_list(out, co.constants, [&](const constant& k) {
+		uint64_t f;
+		std::memcpy(&f, &k.f, sizeof(f));
+		out << "native_constant(" << constant_kind_names[k.kind] << ", " << cpp_int(k.i) << ", 0x" << std::hex << f
+				<< std::dec << "ull, " << cpp_std_string(k.s) << ", ";
+		write_list(out, k.items, [&](uint32_t i) {
+			out << i;
+		});
+		out << ")";
+	});
+	out << ";" << std::endl;
+
+	write_names(out, "names", co.names);
+	write_names(out, "attrs", co.attrs);
+	write_numbers(out, "line_table", co.line_table);
+	out << "\tco->exception_table = ";
+	write_list(out, co.exception_table, [&](const exception_entry& e) {
+		out << "exception_entry{ " << e.start << ", " << e.end << ", " << e.handler << ", " << e.reg << " }";
+	});
+	out << ";" << std::endl;
+
+	out << "\tco->n_args = " << co.n_args << ";" << std::endl;
+	out << "\tco->n_kwonly = " << co.n_kwonly << ";" << std::endl;
+	out << "\tco->n_defaults = " << co.n_defaults << ";" << std::endl;
+	out << "\tco->kwonly_default = ";
+	write_list(out, co.kwonly_default, [&](bool b) {
+		out << (b ? "true" : "false");
+	});
+	out << ";" << std::endl;
+	out << "\tco->n_registers = " << co.n_registers << ";" << std::endl;
+	write_names(out, "varnames", co.varnames);
+
+	write_names(out, "cellvars", co.cellvars);
+	write_numbers(out, "cell_params", co.cell_params);
+	write_names(out, "freevars", co.freevars);
+	write_numbers(out, "closure", co.closure);
+
+	for (auto& child : co.children) {
+		size_t c = std::find(all.begin(), all.end(), child.get()) - all.begin();
+		out << "\tco->children.push_back(load_" << c << "(A));" << std::endl;
+	}
+
+	write_numbers(out, "param_types", co.param_types);
+	out << "\tco->return_type = " << static_cast<unsigned>(co.return_type) << ";" << std::endl;
+	out << "\tco->specialized = ";
+	write_list(out, co.specialized, [&](instruction ins) {
+		out << "0x" << std::hex << ins << std::dec << "u";
+	});
+	out << ";" << std::endl;
+	out << "\treturn co;" << std::endl;
+	out << "}" << std::endl;
+	out << std::endl;
+}
+
+void write_native(const code_object& co, const std::string& file_name, std::ostream& out) {
+	std::vector<const code_object*> all;
+	preorder(co, all);
+
+	out << "/*" << std::endl;
+	out << " * " << file_name << " compiled by arbusto build, do not edit." << std::endl;
+	out << " */" << std::endl;
+	out << std::endl;
+	out << "#include <iostream>" << std::endl;
+	out << "#include <memory>" << std::endl;
+	out << std::endl;
+	out << "#include \"native.h\"" << std::endl;
+	out << std::endl;
+	out << "using namespace arbusto;" << std::endl;
+	out << std::endl;
+	out << "namespace {" << std::endl;
+	out << std::endl;
+
+	for (size_t i = 0; i < all.size(); ++i) {
+		write_function(out, *all[i], i);
+	}
+	out << "/* In preorder, as interpreter::run_module takes them */" << std::endl;
+	out << "const native_code natives[] = {";
+	for (size_t i = 0; i < all.size(); ++i) {
+		out << (i == 0 ? " " : i % 8 == 0 ? ",\n\t" : ", ") << "code_" << i;
+	}
+	out << " };" << std::endl;
+	out << std::endl;
+
+	for (size_t i = 0; i < all.size(); ++i) {
+		out << "std::unique_ptr<code_object> load_" << i << "(arena& A);" << std::endl;
+	}
+	out << std::endl;
+	for (size_t i = 0; i < all.size(); ++i) {
+		write_loader(out, *all[i], i, all);
+	}
+
+	out << "} /* namespace */" << std::endl;
+	out << std::endl;
+	out << "int main() {" << std::endl;
+	out << "\tarena A;" << std::endl;
+	out << "\tstd::unique_ptr<code_object> co = load_0(A);" << std::endl;
+	out << "\tinterpreter I(A, A.intern(" << cpp_string(file_name) << "));" << std::endl;
+	out << "\ttry {" << std::endl;
+	out << "\t\tI.run_module(*co, natives);" << std::endl;
+	out << "\t} catch (py_exception& e) {" << std::endl;
+	out << "\t\tstd::cout.flush();" << std::endl;
+	out << "\t\tstd::cerr << format_exception(e.exc) << std::endl;" << std::endl;
+	out << "\t\treturn 1;" << std::endl;
+	out << "\t}" << std::endl;
+	out << "\treturn 0;" << std::endl;
+	out << "}" << std::endl;
+}
+
+/* s in single quotes for the shell */
+static std::string shell_quote(const std::string& s) {
+	std::string r = "'";
+	for (char c : s) {
+		r += c == '\'' ? std::string("'\\''") : std::string(1, c);
+	}
+	return r + "'";
+}
+
+void build_native(const code_object& co, const std::string& file_name, const native_options& opts) {
+	std::string source = opts.emit_cpp ? opts.output : opts.output + ".cpp";
+	{
+		std::ofstream out(source);
+		if (!out) {
+			throw std::runtime_error("cannot write " + source);
+		}
+		write_native(co, file_name, out);
+	}
+	if (opts.emit_cpp) {
+		return;
+	}
+
+	std::string command = (opts.cxx.empty() ? shell_quote(ARBUSTO_AOT_CXX) : opts.cxx) + " " + ARBUSTO_AOT_FLAGS
+			+ " -I" + shell_quote(ARBUSTO_AOT_INCLUDE) + " " + shell_quote(source) + " -o " + shell_quote(opts.output)
+			+ " " + ARBUSTO_AOT_LIBS;
+	if (std::system(command.c_str()) != 0) {
+		throw std::runtime_error("the host compiler failed, the C++ is in " + source + ": " + command);
+	}
+	std::remove(source.c_str());
+}
+
+} /* namespace arbusto */
@@ -0,0 +1,43 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef AOT_H_
+#define AOT_H_
+
+#include <string>
+#include <ostream>
+
+#include "bytecode.h"
+
+namespace arbusto {
+
+/*
+ * Ahead of time compilation of a module to a native program. Every code
+ * object becomes a C++ function, its instructions the code native.h has
+ * for them in order, so that a jump is a goto and the host compiler sees
+ * the loops. The typed instructions of co.specialized become int64_t and
+ * double arithmetic in a second copy of the function, which leaves for
+ * the generic copy where the interpreter would deopt.
+ *
+ * The program builds the code objects again, runs the module on an
+ * interpreter with the functions as their native code, and links with
+ * the runtime library arbusto_rt. An uncaught exception prints its
+ * traceback and exits with 1, as run does.
+ */
+void write_native(const code_object& co, const std::string& file_name, std::ostream& out);
+
+struct native_options {
+	std::string output; /* the executable, or the C++ with emit_cpp */
+	std::string cxx; /* the command of the host compiler, empty for the one arbusto was built with */
+	bool emit_cpp{false}; /* only write the C++ */
+};
+
+/* write_native, then the host compiler; throws std::runtime_error if it fails */
+void build_native(const code_object& co, const std::string& file_name, const native_options& opts);
+
+} /* namespace arbusto */
+
+#endif /* AOT_H_ */
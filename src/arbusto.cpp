@@ -5,11 +5,495 @@
  */
 
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <memory>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
 
 #include "grammarparser.h"
 #include "parsergen.h"
+#include "grammaropt.h"
 #include "tokenizer.h"
 
+#ifndef ARBUSTO_BOOTSTRAP
+#include "pyparser.h"
+#include "astfile.h"
+#include "reparse.h"
+#include "tokenstream.h"
+#include "literal.h"
+#include "astlower.h"
+#include "symtable.h"
+#include "astopt.h"
+#include "compiler.h"
+#include "passes.h"
+#include "interp.h"
+#include "aot.h"
+#endif
+
+/* s as a count, false unless it is all decimal digits */
+static bool parse_size(const char* s, size_t& out) {
+	if (!*s || std::strspn(s, "0123456789") != std::strlen(s)) {
+		return false;
+	}
+	errno = 0;
+	unsigned long long n = std::strtoull(s, nullptr, 10);
+	out = static_cast<size_t>(n);
+	return errno == 0;
+}
+
+
+#ifndef ARBUSTO_BOOTSTRAP
+/* leaf_text gives the text printed for a leaf node */
+template <typename LeafText>
+static void print_tree(const arbusto::astnode* first, size_t count, LeafText leaf_text) {
+	/* One pass over the preorder array, the open subtrees give the depth */
+	std::vector<const arbusto::astnode*> ends;
+
+	for (const arbusto::astnode* node = first; node != first + count; ++node) {
+		while (!ends.empty() && node == ends.back()) {
+			ends.pop_back();
+		}
+
+		for (size_t i = 0; i < ends.size(); ++i) {
+			std::cout << " ";
+		}
+
+		if (node->node_type == arbusto::NODE_TYPE_STRING) {
+			std::cout << leaf_text(*node) << std::endl;
+		} else {
+			std::cout << arbusto::node_type_name(node->node_type) << std::endl;
+		}
+
+		ends.push_back(node->next_sibling());
+	}
+}
+
+/*
+ * With a cache_dir, trees are stored there by source hash and mapped back on
+ * the next run. With lazy, function bodies are skipped, see lazy_suites.
+ * With pipeline, the tokenizer runs on another thread, see token_stream.
+ * With recover, every bad statement is reported and the parse goes on,
+ * tokenizer errors too.
+ */
+static int parse_python_file(const std::string& file_name, const std::string& cache_dir, bool lazy, bool pipeline, bool recover,
+		bool debug) {
+	typedef std::chrono::steady_clock clock;
+
+	arbusto::tokenizer T;
+	std::vector<arbusto::token> toks;
+	std::string file_str;
+	std::string cache_name;
+
+	{
+		std::ifstream ifile(file_name);
+		if (!ifile) {
+			std::cerr << file_name << ": cannot open the file" << std::endl;
+			return 1;
+		}
+		file_str.assign((std::istreambuf_iterator<char>(ifile)), std::istreambuf_iterator<char>());
+	}
+
+	if (!cache_dir.empty()) {
+		std::ostringstream name;
+		name << cache_dir << "/" << std::hex << arbusto::fnv1a_hash(file_str.data(), file_str.size()) << (lazy ? ".lazy.ast" : ".ast");
+		cache_name = name.str();
+
+		auto t0 = clock::now();
+		arbusto::ast_file F;
+
+		if (F.open(cache_name, arbusto::grammar_fingerprint()) && F.matches(file_str)) {
+			auto t1 = clock::now();
+
+			if (debug) {
+				print_tree(F.nodes(), F.node_count(), [&F](const arbusto::astnode& node) {
+					return arbusto::tokenizer::token2str(static_cast<arbusto::token_t>(F.token(node.token_index).tok))
+							+ " " + F.token_data(node.token_index);
+				});
+			}
+
+			std::cout << "file=" << file_name << " bytes=" << file_str.size() << " tokens=" << F.token_count()
+					<< " nodes=" << F.node_count() << " cache=hit" << std::endl;
+			std::cout << "load=" << std::chrono::duration<double>(t1 - t0).count() * 1e3 << "ms" << std::endl;
+			return 0;
+		}
+	}
+
+	arbusto::ast_tree tree;
+	bool ok;
+	size_t farthest = 0;
+	std::vector<int> expected;
+	std::vector<arbusto::parse_error> errors;
+
+	auto run = [&](arbusto::parser_session& P) {
+		P.lazy_bodies = lazy;
+		P.recovery = recover;
+		bool parsed = arbusto::parse_file_input(P);
+		if (parsed) {
+			P.build_tree(tree);
+			errors = P.errors;
+		}
+		farthest = P.farthest;
+		expected = P.expected();
+		return parsed;
+	};
+
+	auto t0 = clock::now();
+	auto t1 = t0;
+
+	if (pipeline) {
+		/* Both at once, the tokenize time is not known apart */
+		try {
+			arbusto::token_stream stream(file_str, arbusto::token_kind, recover);
+			arbusto::parser_session P(toks, stream);
+			ok = run(P);
+			stream.finish(toks);
+		} catch (const std::runtime_error& e) {
+			std::cerr << file_name << ": " << e.what() << std::endl;
+			return 1;
+		}
+	} else {
+		try {
+			T.error_tokens = recover;
+			T.tokenize_string(file_str, toks);
+			t1 = clock::now();
+
+			arbusto::parser_session P(toks, arbusto::token_kind);
+			ok = run(P);
+		} catch (const std::runtime_error& e) {
+			std::cerr << file_name << ": " << e.what() << std::endl;
+			return 1;
+		}
+	}
+
+	auto t2 = clock::now();
+
+	if (!ok) {
+		auto& t = toks[farthest];
+		std::cerr << file_name << ":" << t.line_num << ": " << arbusto::syntax_error_message(t, expected) << std::endl;
+		return 1;
+	}
+
+	for (auto& e : errors) {
+		auto& t = toks[e.token_index];
+		std::cerr << file_name << ":" << t.line_num << ": " << arbusto::syntax_error_message(t, e.expected) << std::endl;
+	}
+
+	if (debug) {
+		print_tree(tree.nodes.data(), tree.nodes.size(), [&toks](const arbusto::astnode& node) {
+			auto& t = toks[node.token_index];
+			return arbusto::tokenizer::token2str(t.tok) + " " + t.data;
+		});
+	}
+
+	if (!cache_name.empty() && errors.empty()) {
+		/* The cache only saves time, the parse is good without it */
+		try {
+			arbusto::write_ast_file(cache_name, tree, toks, file_str, arbusto::grammar_fingerprint());
+		} catch (const std::runtime_error& e) {
+			std::cerr << file_name << ": warning: " << e.what() << ", not cached" << std::endl;
+		}
+	}
+
+	double tok_s = std::chrono::duration<double>(t1 - t0).count();
+	double parse_s = std::chrono::duration<double>(t2 - t1).count();
+	double total_s = tok_s + parse_s;
+
+	std::cout << "file=" << file_name << " bytes=" << file_str.size() << " tokens=" << toks.size()
+			<< " nodes=" << tree.nodes.size() << " ast_bytes=" << tree.nodes.size() * sizeof(arbusto::astnode)
+			<< (cache_name.empty() ? "" : " cache=miss") << (recover ? " errors=" + std::to_string(errors.size()) : "") << std::endl;
+
+	if (lazy) {
+		size_t skipped = 0;
+		for (auto& node : tree.nodes) {
+			skipped += (node.node_type == arbusto::NODE_TYPE_LAZY);
+		}
+		std::cout << "lazy_suites=" << skipped << std::endl;
+	}
+
+	if (pipeline) {
+		std::cout << "tokenize+parse=" << total_s * 1e3 << "ms" << std::endl;
+	} else {
+		std::cout << "tokenize=" << tok_s * 1e3 << "ms parse=" << parse_s * 1e3 << "ms" << std::endl;
+	}
+
+	if (total_s > 0) {
+		std::cout << "throughput=" << (file_str.size() / total_s) / (1024 * 1024) << "MB/s "
+				<< (toks.size() / total_s) << "tokens/s" << std::endl;
+	}
+
+	return errors.empty() ? 0 : 1;
+}
+
+/* A source file lowered to the ast, which points into the tokens, literals and arena */
+struct lowered_file {
+	arbusto::literal_table literals;
+	std::vector<arbusto::token> toks;
+	arbusto::ast_tree tree;
+	arbusto::arena A;
+	std::unique_ptr<arbusto::lazy_suites> suites;
+	arbusto::ast_module* m{nullptr};
+	double parse_ms{0};
+	double lower_ms{0};
+};
+
+/* Tokenize, parse and lower file_name into L, false after printing the error */
+static bool lower_file(const std::string& file_name, bool lazy, lowered_file& L) {
+	typedef std::chrono::steady_clock clock;
+
+	arbusto::tokenizer T;
+	std::string file_str;
+
+	{
+		std::ifstream ifile(file_name);
+		if (!ifile) {
+			std::cerr << file_name << ": cannot open the file" << std::endl;
+			return false;
+		}
+		file_str.assign((std::istreambuf_iterator<char>(ifile)), std::istreambuf_iterator<char>());
+	}
+
+	auto t0 = clock::now();
+
+	T.literals = &L.literals;
+	try {
+		T.tokenize_string(file_str, L.toks);
+	} catch (std::runtime_error& e) {
+		std::cerr << file_name << ": " << e.what() << std::endl;
+		return false;
+	}
+
+	arbusto::parser_session P(L.toks, arbusto::token_kind);
+	P.lazy_bodies = lazy;
+
+	if (!arbusto::parse_file_input(P)) {
+		auto& t = L.toks[P.farthest];
+		std::cerr << file_name << ":" << t.line_num << ": " << arbusto::syntax_error_message(t, P.expected()) << std::endl;
+		return false;
+	}
+	P.build_tree(L.tree);
+
+	auto t1 = clock::now();
+
+	L.suites.reset(new arbusto::lazy_suites(L.toks));
+	try {
+		L.m = arbusto::lower_module(L.tree, L.toks, &L.literals, L.A, lazy ? L.suites.get() : nullptr);
+	} catch (std::runtime_error& e) {
+		std::cerr << file_name << ": " << e.what() << std::endl;
+		return false;
+	}
+
+	auto t2 = clock::now();
+	L.parse_ms = std::chrono::duration<double>(t1 - t0).count() * 1e3;
+	L.lower_ms = std::chrono::duration<double>(t2 - t1).count() * 1e3;
+
+	return true;
+}
+
+/*
+ * Parse and lower to the ast, printed as Python's ast.dump prints it. With
+ * symbols, print the scopes and symbols of the ast instead.
+ */
+static int lower_python_file(const std::string& file_name, bool lazy, bool symbols, bool debug) {
+	typedef std::chrono::steady_clock clock;
+
+	lowered_file L;
+	if (!lower_file(file_name, lazy, L)) {
+		return 1;
+	}
+
+	if (symbols) {
+		try {
+			auto t2 = clock::now();
+			arbusto::symtable S(L.m, L.A);
+			auto t3 = clock::now();
+
+			if (debug) {
+				S.dump(std::cout);
+			}
+			std::cout << "file=" << file_name << " scopes=" << S.scope_count() << std::endl;
+			std::cout << "symtable=" << std::chrono::duration<double>(t3 - t2).count() * 1e3 << "ms" << std::endl;
+		} catch (std::runtime_error& e) {
+			std::cerr << file_name << ": " << e.what() << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	if (debug) {
+		arbusto::ast_dump(L.m, std::cout);
+		std::cout << std::endl;
+	}
+
+	std::cout << "file=" << file_name << " tokens=" << L.toks.size() << " nodes=" << L.tree.nodes.size()
+			<< " literals=" << L.literals.size() << " arena_bytes=" << L.A.bytes_used() << std::endl;
+	std::cout << "tokenize+parse=" << L.parse_ms << "ms lower=" << L.lower_ms << "ms" << std::endl;
+
+	return 0;
+}
+
+/*
+ * Compile to bytecode and run it, or only print the bytecode (dis) or the
+ * ir after the passes (ir), or make a native program of it (build, see
+ * aot.h). optimize runs the AST optimizer and the passes of pipeline. An
+ * uncaught exception prints its traceback and exits with 1.
+ */
+static int run_python_file(const std::string& file_name, const std::string& command, bool optimize,
+		const std::string& pipeline, bool time_passes, arbusto::compile_options opts,
+		const arbusto::native_options& native) {
+	lowered_file L;
+	if (!lower_file(file_name, false, L)) {
+		return 1;
+	}
+
+	std::unique_ptr<arbusto::pass_manager> passes;
+	std::unique_ptr<arbusto::code_object> co;
+	try {
+		if (optimize || command == "ir") {
+			passes.reset(new arbusto::pass_manager(optimize ? pipeline : ""));
+			opts.passes = passes.get();
+			if (command == "ir") {
+				passes->dump = &std::cout;
+			}
+		}
+		arbusto::symtable S(L.m, L.A);
+		if (optimize) {
+			arbusto::optimize_ast(L.m, L.A);
+		}
+		co = arbusto::compile_module(L.m, S, L.A, opts);
+	} catch (std::runtime_error& e) {
+		std::cerr << file_name << ": " << e.what() << std::endl;
+		return 1;
+	}
+
+	if (time_passes && passes) {
+		passes->report(std::cerr);
+	}
+	if (command == "ir") {
+		return 0;
+	}
+	if (command == "dis") {
+		arbusto::disassemble(*co, std::cout);
+		return 0;
+	}
+	if (command == "build") {
+		try {
+			arbusto::build_native(*co, file_name, native);
+		} catch (std::runtime_error& e) {
+			std::cerr << file_name << ": " << e.what() << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	arbusto::interpreter I(L.A, L.A.intern(file_name));
+	try {
+		I.run_module(*co);
+	} catch (arbusto::py_exception& e) {
+		std::cout.flush();
+		std::cerr << arbusto::format_exception(e.exc) << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Whether reparse left F as parsing its source again gives it */
+static bool same_parse(const arbusto::parsed_file& F, const arbusto::parsed_file& N) {
+	if (F.tokens.size() != N.tokens.size() || F.tree.nodes.size() != N.tree.nodes.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < F.tokens.size(); ++i) {
+		auto& a = F.tokens[i];
+		auto& b = N.tokens[i];
+		if (a.tok != b.tok || a.pos != b.pos || a.len != b.len || a.line_num != b.line_num || a.data != b.data) {
+			return false;
+		}
+	}
+	for (size_t i = 0; i < F.tree.nodes.size(); ++i) {
+		auto& a = F.tree.nodes[i];
+		auto& b = N.tree.nodes[i];
+		if (a.node_type != b.node_type || a.token_index != b.token_index || a.size != b.size) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Parse, apply one edit incrementally, and compare with parsing the edited file again */
+static int edit_python_file(const std::string& file_name, const arbusto::text_edit& edit) {
+	typedef std::chrono::steady_clock clock;
+
+	arbusto::parsed_file F;
+
+	{
+		std::ifstream ifile(file_name);
+		if (!ifile) {
+			std::cerr << file_name << ": cannot open the file" << std::endl;
+			return 1;
+		}
+		F.source.assign((std::istreambuf_iterator<char>(ifile)), std::istreambuf_iterator<char>());
+	}
+
+	if (!arbusto::parse_source(F)) {
+		std::cerr << file_name << ": syntax error" << std::endl;
+		return 1;
+	}
+
+	arbusto::reparse_stats stats;
+	auto t0 = clock::now();
+	bool ok = arbusto::reparse(F, edit, &stats);
+	auto t1 = clock::now();
+
+	if (!ok && (edit.offset > F.source.size() || edit.removed > F.source.size() - edit.offset)) {
+		std::cerr << file_name << ": the edit is past the end" << std::endl;
+		return 1;
+	}
+
+	arbusto::parsed_file N;
+	N.source = ok ? F.source : F.source.substr(0, edit.offset) + edit.inserted + F.source.substr(edit.offset + edit.removed);
+	bool full = arbusto::parse_source(N);
+	auto t2 = clock::now();
+
+	if (!ok && !full) {
+		std::cerr << file_name << ": syntax error after the edit" << std::endl;
+		return 1;
+	}
+
+	if (!ok || !full || !same_parse(F, N)) {
+		std::cerr << file_name << ": the reparse differs from parsing the edited file" << std::endl;
+		return 1;
+	}
+
+	std::cout << "file=" << file_name << " tokens=" << F.tokens.size() << " nodes=" << F.tree.nodes.size()
+			<< " reused=" << stats.statements_reused << " reparsed=" << stats.statements_reparsed
+			<< " relexed=" << stats.tokens_relexed << std::endl;
+	std::cout << "reparse=" << std::chrono::duration<double>(t1 - t0).count() * 1e3 << "ms full="
+			<< std::chrono::duration<double>(t2 - t1).count() * 1e3 << "ms" << std::endl;
+
+	return 0;
+}
+#endif
+
+static int usage(const char* prog) {
+	std::cerr << "Usage: " << std::endl;
+	std::cerr << " " << prog << " parse_grammar grammar_file" << std::endl;
+	std::cerr << " " << prog << " gen_parser grammar_file [output_file] [--optimize] [--collapse] [--precedence] [--profile] [--profile-cycles] [--combinators] [--shards N]" << std::endl;
+	std::cerr << " " << prog << " parse_file py_file" << std::endl;
+#ifndef ARBUSTO_BOOTSTRAP
+	std::cerr << " " << prog << " parse py_file [--lazy] [--pipeline] [--recover] [--cache cache_dir]" << std::endl;
+	std::cerr << " " << prog << " ast py_file [--lazy]" << std::endl;
+	std::cerr << " " << prog << " symtable py_file [--lazy]" << std::endl;
+	std::cerr << " " << prog << " run py_file [--specialize] [--no-optimize] [--passes=p1,p2,...] [--time-passes]" << std::endl;
+	std::cerr << " " << prog << " dis py_file [--specialize] [--no-optimize] [--passes=p1,p2,...] [--time-passes]" << std::endl;
+	std::cerr << " " << prog << " ir py_file [--no-optimize] [--passes=p1,p2,...] [--time-passes]" << std::endl;
+	std::cerr << " " << prog << " build py_file [-o output] [--emit-cpp] [--cxx=compiler] [--specialize] [--no-optimize] [--passes=p1,p2,...]" << std::endl;
+	std::cerr << " " << prog << " edit py_file offset removed text" << std::endl;
+#endif
+	return 1;
+}
 
 int main(int argc, char **argv) {
 	bool debug = true;
@@ -27,10 +511,82 @@ int main(int argc, char **argv) {
 		return 0;
 	} else if (argc >= 3 && std::string(argv[1]) == "gen_parser") {
 		arbusto::grammar_parser G;
-		G.debug = debug;
+		arbusto::parser_options opts;
+		std::string output_file;
+		size_t shards = 0;
+		bool optimize = false;
+
+		for (int i = 3; i < argc; ++i) {
+			if (std::string(argv[i]) == "--optimize") {
+				optimize = true;
+			} else if (std::string(argv[i]) == "--collapse") {
+				opts.collapse_chains = true;
+			} else if (std::string(argv[i]) == "--precedence") {
+				opts.precedence_climbing = true;
+			} else if (std::string(argv[i]) == "--profile") {
+				opts.profile = true;
+			} else if (std::string(argv[i]) == "--profile-cycles") {
+				opts.profile = true;
+				opts.profile_cycles = true;
+			} else if (std::string(argv[i]) == "--combinators") {
+				opts.combinators = true;
+			} else if (std::string(argv[i]) == "--shards") {
+				if (i + 1 >= argc || !parse_size(argv[++i], shards)) {
+					std::cerr << "gen_parser: --shards needs a count" << std::endl;
+					return 1;
+				}
+			} else if (argv[i][0] == '-') {
+				std::cerr << "gen_parser: unknown option " << argv[i] << std::endl;
+				return usage(argv[0]);
+			} else if (output_file.empty()) {
+				output_file = argv[i];
+			} else {
+				std::cerr << "gen_parser: more than one output file" << std::endl;
+				return usage(argv[0]);
+			}
+		}
+
+		if (opts.combinators && opts.profile) {
+			std::cerr << "gen_parser: --profile does not work with --combinators" << std::endl;
+			return 1;
+		}
+
+		/* The rules are dumped as comments in the generated code anyway */
+		G.debug = false;
 		G.parse_grammar_file(argv[2]);
 
-		generate_parser(G);
+		if (optimize) {
+			/* Inlined rules lose their node, fine only if those would collapse anyway */
+			auto stats = arbusto::optimize_grammar(G, opts.start_rules, opts.collapse_chains);
+
+			if (debug && !output_file.empty()) {
+				std::cout << "inlined=" << stats.rules_inlined << " flattened=" << stats.nodes_flattened << " expanded=" << stats.heads_expanded
+						<< " factored=" << stats.choices_factored << " removed=" << stats.rules_removed << std::endl;
+			}
+		}
+
+		if (shards > 0) {
+			/* output_file is the directory for the pieces */
+			if (output_file.empty()) {
+				std::cerr << "gen_parser: --shards needs an output directory" << std::endl;
+				return 1;
+			}
+			try {
+				generate_parser_shards(G, output_file, shards, opts);
+			} catch (const std::runtime_error& e) {
+				std::cerr << e.what() << std::endl;
+				return 1;
+			}
+		} else if (output_file.empty()) {
+			generate_parser(G, std::cout, opts);
+		} else {
+			std::ofstream ofile(output_file);
+			if (!ofile) {
+				std::cerr << "gen_parser: cannot write " << output_file << std::endl;
+				return 1;
+			}
+			generate_parser(G, ofile, opts);
+		}
 
 		return 0;
 	} else if (argc >= 3 && std::string(argv[1]) == "parse_file") {
@@ -45,12 +601,98 @@ int main(int argc, char **argv) {
 		}
 
 		return 0;
+#ifndef ARBUSTO_BOOTSTRAP
+	} else if (argc >= 3 && std::string(argv[1]) == "parse") {
+		std::string cache_dir;
+		bool lazy = false;
+		bool pipeline = false;
+		bool recover = false;
+
+		for (int i = 3; i < argc; ++i) {
+			if (std::string(argv[i]) == "--cache") {
+				if (i + 1 >= argc) {
+					std::cerr << "parse: --cache needs a directory" << std::endl;
+					return 1;
+				}
+				cache_dir = argv[++i];
+			} else if (std::string(argv[i]) == "--lazy") {
+				lazy = true;
+			} else if (std::string(argv[i]) == "--pipeline") {
+				pipeline = true;
+			} else if (std::string(argv[i]) == "--recover") {
+				recover = true;
+			} else {
+				std::cerr << "parse: unknown argument " << argv[i] << std::endl;
+				return usage(argv[0]);
+			}
+		}
+
+		return parse_python_file(argv[2], cache_dir, lazy, pipeline, recover, debug);
+	} else if (argc >= 3 && (std::string(argv[1]) == "ast" || std::string(argv[1]) == "symtable")) {
+		bool lazy = false;
+		for (int i = 3; i < argc; ++i) {
+			if (std::string(argv[i]) == "--lazy") {
+				lazy = true;
+			} else {
+				std::cerr << argv[1] << ": unknown argument " << argv[i] << std::endl;
+				return usage(argv[0]);
+			}
+		}
+		return lower_python_file(argv[2], lazy, std::string(argv[1]) == "symtable", debug);
+	} else if (argc >= 3 && (std::string(argv[1]) == "run" || std::string(argv[1]) == "dis" || std::string(argv[1]) == "ir"
+			|| std::string(argv[1]) == "build")) {
+		arbusto::compile_options opts;
+		arbusto::native_options native;
+		bool optimize = true;
+		bool time_passes = false;
+		std::string pipeline = arbusto::DEFAULT_PASSES;
+		for (int i = 3; i < argc; ++i) {
+			std::string arg = argv[i];
+			if (arg == "--specialize") {
+				opts.specialize = true;
+			} else if (arg == "--no-optimize") {
+				optimize = false;
+			} else if (arg.compare(0, 9, "--passes=") == 0) {
+				pipeline = arg.substr(9);
+			} else if (arg == "--time-passes") {
+				time_passes = true;
+			} else if (arg == "-o") {
+				if (i + 1 >= argc) {
+					std::cerr << argv[1] << ": -o needs an output file" << std::endl;
+					return 1;
+				}
+				native.output = argv[++i];
+			} else if (arg == "--emit-cpp") {
+				native.emit_cpp = true;
+			} else if (arg.compare(0, 6, "--cxx=") == 0) {
+				native.cxx = arg.substr(6);
+			} else {
+				std::cerr << argv[1] << ": unknown argument " << arg << std::endl;
+				return usage(argv[0]);
+			}
+		}
+		if (native.output.empty()) {
+			/* prog.py gives prog, or prog.cpp */
+			std::string stem = argv[2];
+			size_t slash = stem.find_last_of('/');
+			stem = stem.substr(slash == std::string::npos ? 0 : slash + 1);
+			if (stem.size() > 3 && stem.compare(stem.size() - 3, 3, ".py") == 0) {
+				stem.resize(stem.size() - 3);
+			}
+			native.output = native.emit_cpp ? stem + ".cpp" : stem;
+		}
+		return run_python_file(argv[2], argv[1], optimize, pipeline, time_passes, opts, native);
+	} else if (argc >= 6 && std::string(argv[1]) == "edit") {
+		size_t offset, removed;
+		if (!parse_size(argv[3], offset) || !parse_size(argv[4], removed)) {
+			std::cerr << "edit: offset and removed are byte counts" << std::endl;
+			return 1;
+		}
+		arbusto::text_edit edit{offset, removed, argv[5]};
+		return edit_python_file(argv[2], edit);
+#endif
 	} else {
-		std::cerr << "Usage: " << std::endl;
-		std::cerr << " " << argv[0] << " parse_grammar grammar_file" << std::endl;
-		std::cerr << " " << argv[0] << " gen_parser grammar_file" << std::endl;
-		std::cerr << " " << argv[0] << " parse_file py_file" << std::endl;
-		return 1;
+		return usage(argv[0]);
 	}
 
 	return 0;
@@ -0,0 +1,99 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <new>
+#include <unordered_set>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace arbusto {
+
+/*
+ * Bump allocator for the data of one module: allocation is a pointer
+ * increment, and everything goes away at once with the arena. Destructors
+ * never run, so only trivially destructible types go in it.
+ */
+class arena {
+public:
+	explicit arena(size_t block_size_ = 64 * 1024) : block_size(block_size_), cur(nullptr), left(0), used(0), reserved(0) {}
+
+	arena(const arena&) = delete;
+	arena& operator=(const arena&) = delete;
+
+	void* allocate(size_t size, size_t align) {
+		size_t pad = (align - reinterpret_cast<uintptr_t>(cur) % align) % align;
+
+		if (pad + size > left) {
+			size_t n = size + align > block_size ? size + align : block_size;
+			blocks.emplace_back(new char[n]);
+			cur = blocks.back().get();
+			left = n;
+			reserved += n;
+			pad = (align - reinterpret_cast<uintptr_t>(cur) % align) % align;
+		}
+
+		void* p = cur + pad;
+		cur += pad + size;
+		left -= pad + size;
+		used += size;
+		return p;
+	}
+
+	template <class T, class... Args>
+	T* make(Args&&... args) {
+		static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+		return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+	}
+
+	/* A copy of items[0, n) */
+	template <class T>
+	T* copy(const T* items, size_t n) {
+		static_assert(std::is_trivially_copyable<T>::value, "arena arrays are copied as bytes");
+		if (n == 0) {
+			return nullptr;
+		}
+		T* p = static_cast<T*>(allocate(sizeof(T) * n, alignof(T)));
+		std::memcpy(p, items, sizeof(T) * n);
+		return p;
+	}
+
+	/* The same pointer for equal strings, so names compare by pointer */
+	const char* intern(const std::string& s) {
+		return names.insert(s).first->c_str();
+	}
+
+	/* A NUL terminated copy, for data that may hold NULs pass its size along */
+	const char* copy_string(const std::string& s) {
+		char* p = static_cast<char*>(allocate(s.size() + 1, 1));
+		std::memcpy(p, s.data(), s.size());
+		p[s.size()] = 0;
+		return p;
+	}
+
+	size_t bytes_used() const { return used; }
+	size_t bytes_reserved() const { return reserved; }
+
+private:
+	size_t block_size;
+	std::vector<std::unique_ptr<char[]> > blocks;
+	char* cur;
+	size_t left;
+	size_t used;
+	size_t reserved;
+	std::unordered_set<std::string> names;
+};
+
+} /* namespace arbusto */
+
+#endif /* ARENA_H_ */
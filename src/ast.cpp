@@ -0,0 +1,727 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include "ast.h"
+#include "literal.h"
+
+namespace arbusto {
+
+static const char* const ast_kind_names[] = {
+	"Module",
+	"FunctionDef",
+	"ClassDef",
+	"Return",
+	"Delete",
+	"Assign",
+	"AugAssign",
+	"For",
+	"While",
+	"If",
+	"With",
+	"Raise",
+	"Try",
+	"Assert",
+	"Import",
+	"ImportFrom",
+	"Global",
+	"Nonlocal",
+	"Expr",
+	"Pass",
+	"Break",
+	"Continue",
+	"BoolOp",
+	"BinOp",
+	"UnaryOp",
+	"Lambda",
+	"IfExp",
+	"Dict",
+	"Set",
+	"ListComp",
+	"SetComp",
+	"DictComp",
+	"GeneratorExp",
+	"Await",
+	"Yield",
+	"YieldFrom",
+	"Compare",
+	"Call",
+	"Constant",
+	"Attribute",
+	"Subscript",
+	"Starred",
+	"Name",
+	"List",
+	"Tuple",
+	"Slice",
+};
+
+static_assert(sizeof(ast_kind_names) / sizeof(ast_kind_names[0]) == N_AST_KINDS, "ast_kind_names is out of date");
+
+const char* ast_kind_name(ast_kind kind) {
+	return kind >= 0 && kind < N_AST_KINDS ? ast_kind_names[kind] : "<unknown>";
+}
+
+static const char* const context_names[] = { "Load()", "Store()", "Del()" };
+
+static const char* const operator_names[] = {
+	"Add()", "Sub()", "Mult()", "MatMult()", "Div()", "Mod()", "Pow()",
+	"LShift()", "RShift()", "BitOr()", "BitXor()", "BitAnd()", "FloorDiv()"
+};
+
+static const char* const unaryop_names[] = { "Invert()", "Not()", "UAdd()", "USub()" };
+
+static const char* const boolop_names[] = { "And()", "Or()" };
+
+static const char* const cmpop_names[] = {
+	"Eq()", "NotEq()", "Lt()", "LtE()", "Gt()", "GtE()", "Is()", "IsNot()", "In()", "NotIn()"
+};
+
+class ast_dumper {
+public:
+	explicit ast_dumper(std::ostream& out_) : out(out_) {}
+
+	void module(const ast_module* m) {
+		open("Module");
+		field("body");
+		body(m->body);
+		field("type_ignores");
+		out << "[]";
+		close();
+	}
+
+private:
+	/* Node(a=1, b=2): open, then field before each value, then close */
+	void open(const char* name) {
+		out << name << "(";
+		first.push_back(true);
+	}
+
+	void field(const char* name) {
+		if (!first.back()) {
+			out << ", ";
+		}
+		first.back() = false;
+		out << name << "=";
+	}
+
+	void close() {
+		out << ")";
+		first.pop_back();
+	}
+
+	/* Optional fields are left out when missing, like ast.dump does */
+	void opt_expr(const char* name, const ast_expr* e) {
+		if (e) {
+			field(name);
+			expr(e);
+		}
+	}
+
+	void opt_name(const char* name, const char* id) {
+		if (id) {
+			field(name);
+			identifier(id);
+		}
+	}
+
+	void identifier(const char* id) {
+		write_str_repr(out, id, std::strlen(id));
+	}
+
+	template <class T, class F>
+	void list(const ast_list<T>& items, F write) {
+		out << "[";
+		for (size_t i = 0; i < items.size(); ++i) {
+			if (i > 0) {
+				out << ", ";
+			}
+			write(items[i]);
+		}
+		out << "]";
+	}
+
+	void body(const ast_body& stmts) {
+		list(stmts, [this](const ast_stmt* s) { stmt(s); });
+	}
+
+	/* Missing elements, as in Dict.keys and arguments.kw_defaults, are None */
+	void exprs(const ast_exprs& items) {
+		list(items, [this](const ast_expr* e) {
+			if (e) {
+				expr(e);
+			} else {
+				out << "None";
+			}
+		});
+	}
+
+	void context(ast_context ctx) {
+		field("ctx");
+		out << context_names[ctx];
+	}
+
+	void arg(const ast_arg* a) {
+		open("arg");
+		field("arg");
+		identifier(a->arg);
+		opt_expr("annotation", a->annotation);
+		close();
+	}
+
+	void arguments(const ast_arguments* a) {
+		open("arguments");
+		field("posonlyargs");
+		out << "[]";
+		field("args");
+		list(a->args, [this](const ast_arg* x) { arg(x); });
+		if (a->vararg) {
+			field("vararg");
+			arg(a->vararg);
+		}
+		field("kwonlyargs");
+		list(a->kwonlyargs, [this](const ast_arg* x) { arg(x); });
+		field("kw_defaults");
+		exprs(a->kw_defaults);
+		if (a->kwarg) {
+			field("kwarg");
+			arg(a->kwarg);
+		}
+		field("defaults");
+		exprs(a->defaults);
+		close();
+	}
+
+	void keywords(const ast_list<ast_keyword>& items) {
+		list(items, [this](const ast_keyword& k) {
+			open("keyword");
+			opt_name("arg", k.arg);
+			field("value");
+			expr(k.value);
+			close();
+		});
+	}
+
+	void aliases(const ast_list<ast_alias>& items) {
+		list(items, [this](const ast_alias& a) {
+			open("alias");
+			field("name");
+			identifier(a.name);
+			opt_name("asname", a.asname);
+			close();
+		});
+	}
+
+	void generators(const ast_list<ast_comprehension>& items) {
+		list(items, [this](const ast_comprehension& c) {
+			open("comprehension");
+			field("target");
+			expr(c.target);
+			field("iter");
+			expr(c.iter);
+			field("ifs");
+			exprs(c.ifs);
+			field("is_async");
+			out << "0";
+			close();
+		});
+	}
+
+	void names(const ast_list<const char*>& items) {
+		list(items, [this](const char* id) { identifier(id); });
+	}
+
+	/* The Async variants are the same structs with is_async set */
+	void open_async(const char* name, bool is_async) {
+		open(is_async ? ("Async" + std::string(name)).c_str() : name);
+	}
+
+	void stmt(const ast_stmt* s);
+	void expr(const ast_expr* e);
+	void constant(const ast_constant* c);
+
+	std::ostream& out;
+	std::vector<bool> first;
+};
+
+void ast_dumper::stmt(const ast_stmt* s) {
+	switch (s->kind) {
+	case AST_FUNCTION_DEF:
+		{
+			auto n = static_cast<const ast_function_def*>(s);
+			open_async("FunctionDef", n->is_async);
+			field("name");
+			identifier(n->name);
+			field("args");
+			arguments(n->args);
+			field("body");
+			body(n->body);
+			field("decorator_list");
+			exprs(n->decorator_list);
+			opt_expr("returns", n->returns);
+			close();
+		}
+		break;
+	case AST_CLASS_DEF:
+		{
+			auto n = static_cast<const ast_class_def*>(s);
+			open("ClassDef");
+			field("name");
+			identifier(n->name);
+			field("bases");
+			exprs(n->bases);
+			field("keywords");
+			keywords(n->keywords);
+			field("body");
+			body(n->body);
+			field("decorator_list");
+			exprs(n->decorator_list);
+			close();
+		}
+		break;
+	case AST_RETURN:
+		open("Return");
+		opt_expr("value", static_cast<const ast_return*>(s)->value);
+		close();
+		break;
+	case AST_DELETE:
+		open("Delete");
+		field("targets");
+		exprs(static_cast<const ast_delete*>(s)->targets);
+		close();
+		break;
+	case AST_ASSIGN:
+		{
+			auto n = static_cast<const ast_assign*>(s);
+			open("Assign");
+			field("targets");
+			exprs(n->targets);
+			field("value");
+			expr(n->value);
+			close();
+		}
+		break;
+	case AST_AUG_ASSIGN:
+		{
+			auto n = static_cast<const ast_aug_assign*>(s);
+			open("AugAssign");
+			field("target");
+			expr(n->target);
+			field("op");
+			out << operator_names[n->op];
+			field("value");
+			expr(n->value);
+			close();
+		}
+		break;
+	case AST_FOR:
+		{
+			auto n = static_cast<const ast_for*>(s);
+			open_async("For", n->is_async);
+			field("target");
+			expr(n->target);
+			field("iter");
+			expr(n->iter);
+			field("body");
+			body(n->body);
+			field("orelse");
+			body(n->orelse);
+			close();
+		}
+		break;
+	case AST_WHILE:
+		{
+			auto n = static_cast<const ast_while*>(s);
+			open("While");
+			field("test");
+			expr(n->test);
+			field("body");
+			body(n->body);
+			field("orelse");
+			body(n->orelse);
+			close();
+		}
+		break;
+	case AST_IF:
+		{
+			auto n = static_cast<const ast_if*>(s);
+			open("If");
+			field("test");
+			expr(n->test);
+			field("body");
+			body(n->body);
+			field("orelse");
+			body(n->orelse);
+			close();
+		}
+		break;
+	case AST_WITH:
+		{
+			auto n = static_cast<const ast_with*>(s);
+			open_async("With", n->is_async);
+			field("items");
+			list(n->items, [this](const ast_with_item& w) {
+				open("withitem");
+				field("context_expr");
+				expr(w.context_expr);
+				opt_expr("optional_vars", w.optional_vars);
+				close();
+			});
+			field("body");
+			body(n->body);
+			close();
+		}
+		break;
+	case AST_RAISE:
+		{
+			auto n = static_cast<const ast_raise*>(s);
+			open("Raise");
+			opt_expr("exc", n->exc);
+			opt_expr("cause", n->cause);
+			close();
+		}
+		break;
+	case AST_TRY:
+		{
+			auto n = static_cast<const ast_try*>(s);
+			open("Try");
+			field("body");
+			body(n->body);
+			field("handlers");
+			list(n->handlers, [this](const ast_except_handler* h) {
+				open("ExceptHandler");
+				opt_expr("type", h->type);
+				opt_name("name", h->name);
+				field("body");
+				body(h->body);
+				close();
+			});
+			field("orelse");
+			body(n->orelse);
+			field("finalbody");
+			body(n->finalbody);
+			close();
+		}
+		break;
+	case AST_ASSERT:
+		{
+			auto n = static_cast<const ast_assert*>(s);
+			open("Assert");
+			field("test");
+			expr(n->test);
+			opt_expr("msg", n->msg);
+			close();
+		}
+		break;
+	case AST_IMPORT:
+		open("Import");
+		field("names");
+		aliases(static_cast<const ast_import*>(s)->names);
+		close();
+		break;
+	case AST_IMPORT_FROM:
+		{
+			auto n = static_cast<const ast_import_from*>(s);
+			open("ImportFrom");
+			opt_name("module", n->module);
+			field("names");
+			aliases(n->names);
+			field("level");
+			out << n->level;
+			close();
+		}
+		break;
+	case AST_GLOBAL:
+		open("Global");
+		field("names");
+		names(static_cast<const ast_global*>(s)->names);
+		close();
+		break;
+	case AST_NONLOCAL:
+		open("Nonlocal");
+		field("names");
+		names(static_cast<const ast_nonlocal*>(s)->names);
+		close();
+		break;
+	case AST_EXPR:
+		open("Expr");
+		field("value");
+		expr(static_cast<const ast_expr_stmt*>(s)->value);
+		close();
+		break;
+	case AST_PASS:
+	case AST_BREAK:
+	case AST_CONTINUE:
+		out << ast_kind_name(s->kind) << "()";
+		break;
+	default:
+		out << "<" << ast_kind_name(s->kind) << ">";
+		break;
+	}
+}
+
+void ast_dumper::expr(const ast_expr* e) {
+	switch (e->kind) {
+	case AST_BOOL_OP:
+		{
+			auto n = static_cast<const ast_bool_op*>(e);
+			open("BoolOp");
+			field("op");
+			out << boolop_names[n->op];
+			field("values");
+			exprs(n->values);
+			close();
+		}
+		break;
+	case AST_BIN_OP:
+		{
+			auto n = static_cast<const ast_bin_op*>(e);
+			open("BinOp");
+			field("left");
+			expr(n->left);
+			field("op");
+			out << operator_names[n->op];
+			field("right");
+			expr(n->right);
+			close();
+		}
+		break;
+	case AST_UNARY_OP:
+		{
+			auto n = static_cast<const ast_unary_op*>(e);
+			open("UnaryOp");
+			field("op");
+			out << unaryop_names[n->op];
+			field("operand");
+			expr(n->operand);
+			close();
+		}
+		break;
+	case AST_LAMBDA:
+		{
+			auto n = static_cast<const ast_lambda*>(e);
+			open("Lambda");
+			field("args");
+			arguments(n->args);
+			field("body");
+			expr(n->body);
+			close();
+		}
+		break;
+	case AST_IF_EXP:
+		{
+			auto n = static_cast<const ast_if_exp*>(e);
+			open("IfExp");
+			field("test");
+			expr(n->test);
+			field("body");
+			expr(n->body);
+			field("orelse");
+			expr(n->orelse);
+			close();
+		}
+		break;
+	case AST_DICT:
+		{
+			auto n = static_cast<const ast_dict*>(e);
+			open("Dict");
+			field("keys");
+			exprs(n->keys);
+			field("values");
+			exprs(n->values);
+			close();
+		}
+		break;
+	case AST_SET:
+		open("Set");
+		field("elts");
+		exprs(static_cast<const ast_set*>(e)->elts);
+		close();
+		break;
+	case AST_LIST_COMP:
+	case AST_SET_COMP:
+	case AST_GENERATOR_EXP:
+		{
+			auto n = static_cast<const ast_comp*>(e);
+			open(ast_kind_name(e->kind));
+			field("elt");
+			expr(n->elt);
+			field("generators");
+			generators(n->generators);
+			close();
+		}
+		break;
+	case AST_DICT_COMP:
+		{
+			auto n = static_cast<const ast_dict_comp*>(e);
+			open("DictComp");
+			field("key");
+			expr(n->key);
+			field("value");
+			expr(n->value);
+			field("generators");
+			generators(n->generators);
+			close();
+		}
+		break;
+	case AST_AWAIT:
+		open("Await");
+		field("value");
+		expr(static_cast<const ast_await*>(e)->value);
+		close();
+		break;
+	case AST_YIELD:
+		open("Yield");
+		opt_expr("value", static_cast<const ast_yield*>(e)->value);
+		close();
+		break;
+	case AST_YIELD_FROM:
+		open("YieldFrom");
+		field("value");
+		expr(static_cast<const ast_yield_from*>(e)->value);
+		close();
+		break;
+	case AST_COMPARE:
+		{
+			auto n = static_cast<const ast_compare*>(e);
+			open("Compare");
+			field("left");
+			expr(n->left);
+			field("ops");
+			list(n->ops, [this](ast_cmpop op) { out << cmpop_names[op]; });
+			field("comparators");
+			exprs(n->comparators);
+			close();
+		}
+		break;
+	case AST_CALL:
+		{
+			auto n = static_cast<const ast_call*>(e);
+			open("Call");
+			field("func");
+			expr(n->func);
+			field("args");
+			exprs(n->args);
+			field("keywords");
+			keywords(n->keywords);
+			close();
+		}
+		break;
+	case AST_CONSTANT:
+		constant(static_cast<const ast_constant*>(e));
+		break;
+	case AST_ATTRIBUTE:
+		{
+			auto n = static_cast<const ast_attribute*>(e);
+			open("Attribute");
+			field("value");
+			expr(n->value);
+			field("attr");
+			identifier(n->attr);
+			context(n->ctx);
+			close();
+		}
+		break;
+	case AST_SUBSCRIPT:
+		{
+			auto n = static_cast<const ast_subscript*>(e);
+			open("Subscript");
+			field("value");
+			expr(n->value);
+			field("slice");
+			expr(n->slice);
+			context(n->ctx);
+			close();
+		}
+		break;
+	case AST_STARRED:
+		{
+			auto n = static_cast<const ast_starred*>(e);
+			open("Starred");
+			field("value");
+			expr(n->value);
+			context(n->ctx);
+			close();
+		}
+		break;
+	case AST_NAME:
+		{
+			auto n = static_cast<const ast_name*>(e);
+			open("Name");
+			field("id");
+			identifier(n->id);
+			context(n->ctx);
+			close();
+		}
+		break;
+	case AST_LIST:
+		{
+			auto n = static_cast<const ast_list_expr*>(e);
+			open("List");
+			field("elts");
+			exprs(n->elts);
+			context(n->ctx);
+			close();
+		}
+		break;
+	case AST_TUPLE:
+		{
+			auto n = static_cast<const ast_tuple*>(e);
+			open("Tuple");
+			field("elts");
+			exprs(n->elts);
+			context(n->ctx);
+			close();
+		}
+		break;
+	case AST_SLICE:
+		{
+			auto n = static_cast<const ast_slice*>(e);
+			open("Slice");
+			opt_expr("lower", n->lower);
+			opt_expr("upper", n->upper);
+			opt_expr("step", n->step);
+			close();
+		}
+		break;
+	default:
+		out << "<" << ast_kind_name(e->kind) << ">";
+		break;
+	}
+}
+
+void ast_dumper::constant(const ast_constant* c) {
+	open("Constant");
+	field("value");
+
+	switch (c->value_kind) {
+	case CONST_NONE: out << "None"; break;
+	case CONST_BOOL: out << (c->i ? "True" : "False"); break;
+	case CONST_ELLIPSIS: out << "Ellipsis"; break;
+	case CONST_INT: out << c->i; break;
+	case CONST_BIGINT: out.write(c->str, c->str_size); break;
+	case CONST_FLOAT: out << float_repr(c->f, true); break;
+	case CONST_IMAG: out << float_repr(c->f, false) << "j"; break;
+	case CONST_STR: write_str_repr(out, c->str, c->str_size); break;
+	case CONST_BYTES: write_bytes_repr(out, c->str, c->str_size); break;
+	}
+
+	if (c->u_prefix) {
+		field("kind");
+		out << "'u'";
+	}
+
+	close();
+}
+
+void ast_dump(const ast_module* m, std::ostream& out) {
+	ast_dumper(out).module(m);
+}
+
+} /* namespace arbusto */
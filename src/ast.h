@@ -0,0 +1,498 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef AST_H_
+#define AST_H_
+
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+
+#include "arena.h"
+
+namespace arbusto {
+
+/*
+ * The abstract syntax tree, modeled on CPython's ast module: the same node
+ * kinds, with the same fields, so ast_dump can be compared with ast.dump.
+ *
+ * Nodes live in the arena of their module and are plain structs: children
+ * are pointers, lists are arena arrays, names are interned in the arena so
+ * equal names have equal pointers. lower_module builds it from a parse tree.
+ */
+
+enum ast_kind {
+	AST_MODULE,
+
+	/* statements */
+	AST_FUNCTION_DEF,
+	AST_CLASS_DEF,
+	AST_RETURN,
+	AST_DELETE,
+	AST_ASSIGN,
+	AST_AUG_ASSIGN,
+	AST_FOR,
+	AST_WHILE,
+	AST_IF,
+	AST_WITH,
+	AST_RAISE,
+	AST_TRY,
+	AST_ASSERT,
+	AST_IMPORT,
+	AST_IMPORT_FROM,
+	AST_GLOBAL,
+	AST_NONLOCAL,
+	AST_EXPR,
+	AST_PASS,
+	AST_BREAK,
+	AST_CONTINUE,
+
+	/* expressions */
+	AST_BOOL_OP,
+	AST_BIN_OP,
+	AST_UNARY_OP,
+	AST_LAMBDA,
+	AST_IF_EXP,
+	AST_DICT,
+	AST_SET,
+	AST_LIST_COMP,
+	AST_SET_COMP,
+	AST_DICT_COMP,
+	AST_GENERATOR_EXP,
+	AST_AWAIT,
+	AST_YIELD,
+	AST_YIELD_FROM,
+	AST_COMPARE,
+	AST_CALL,
+	AST_CONSTANT,
+	AST_ATTRIBUTE,
+	AST_SUBSCRIPT,
+	AST_STARRED,
+	AST_NAME,
+	AST_LIST,
+	AST_TUPLE,
+	AST_SLICE,
+
+	N_AST_KINDS
+};
+
+enum ast_context { CTX_LOAD, CTX_STORE, CTX_DEL };
+
+enum ast_operator {
+	OP_ADD, OP_SUB, OP_MULT, OP_MATMULT, OP_DIV, OP_MOD, OP_POW,
+	OP_LSHIFT, OP_RSHIFT, OP_BITOR, OP_BITXOR, OP_BITAND, OP_FLOORDIV
+};
+
+enum ast_unaryop { UOP_INVERT, UOP_NOT, UOP_UADD, UOP_USUB };
+
+enum ast_boolop { BOOL_AND, BOOL_OR };
+
+enum ast_cmpop { CMP_EQ, CMP_NOT_EQ, CMP_LT, CMP_LT_E, CMP_GT, CMP_GT_E, CMP_IS, CMP_IS_NOT, CMP_IN, CMP_NOT_IN };
+
+enum ast_constant_kind {
+	CONST_NONE,
+	CONST_BOOL, /* in i */
+	CONST_ELLIPSIS,
+	CONST_INT, /* in i */
+	CONST_BIGINT, /* decimal digits in str, after a '-' if folded from a negative one */
+	CONST_FLOAT, /* in f */
+	CONST_IMAG, /* the imaginary part in f */
+	CONST_STR, /* UTF-8 in str */
+	CONST_BYTES /* in str */
+};
+
+/* An arena array */
+template <class T>
+struct ast_list {
+	const T* items{nullptr};
+	uint32_t count{0};
+
+	const T* begin() const { return items; }
+	const T* end() const { return items + count; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	const T& operator[](size_t i) const { return items[i]; }
+};
+
+struct ast_node {
+	ast_kind kind;
+	uint32_t line;
+};
+
+struct ast_stmt : ast_node {};
+struct ast_expr : ast_node {};
+
+typedef ast_list<ast_stmt*> ast_body;
+typedef ast_list<ast_expr*> ast_exprs;
+
+/* The node of type T, or nullptr if n is something else */
+template <class T>
+inline T* ast_cast(ast_node* n) {
+	return n && n->kind == T::KIND ? static_cast<T*>(n) : nullptr;
+}
+
+template <class T>
+inline const T* ast_cast(const ast_node* n) {
+	return n && n->kind == T::KIND ? static_cast<const T*>(n) : nullptr;
+}
+
+/* The parts of nodes that are not nodes themselves */
+
+struct ast_arg {
+	const char* arg{nullptr};
+	ast_expr* annotation{nullptr};
+	uint32_t line{0};
+};
+
+struct ast_arguments {
+	ast_list<ast_arg*> args;
+	ast_arg* vararg{nullptr};
+	ast_list<ast_arg*> kwonlyargs;
+	ast_exprs kw_defaults; /* one per kwonlyargs, nullptr when it has none */
+	ast_arg* kwarg{nullptr};
+	ast_exprs defaults; /* of the last args */
+};
+
+struct ast_keyword {
+	const char* arg{nullptr}; /* nullptr for **value */
+	ast_expr* value{nullptr};
+};
+
+struct ast_alias {
+	const char* name{nullptr}; /* dotted, "os.path" */
+	const char* asname{nullptr};
+};
+
+struct ast_comprehension {
+	ast_expr* target{nullptr};
+	ast_expr* iter{nullptr};
+	ast_exprs ifs;
+};
+
+struct ast_except_handler {
+	ast_expr* type{nullptr};
+	const char* name{nullptr};
+	ast_body body;
+	uint32_t line{0};
+};
+
+struct ast_with_item {
+	ast_expr* context_expr{nullptr};
+	ast_expr* optional_vars{nullptr};
+};
+
+struct ast_module : ast_node {
+	static const ast_kind KIND = AST_MODULE;
+	ast_body body;
+};
+
+/* Statements */
+
+struct ast_function_def : ast_stmt {
+	static const ast_kind KIND = AST_FUNCTION_DEF;
+	const char* name{nullptr};
+	ast_arguments* args{nullptr};
+	ast_body body;
+	ast_exprs decorator_list;
+	ast_expr* returns{nullptr};
+	bool is_async{false};
+};
+
+struct ast_class_def : ast_stmt {
+	static const ast_kind KIND = AST_CLASS_DEF;
+	const char* name{nullptr};
+	ast_exprs bases;
+	ast_list<ast_keyword> keywords;
+	ast_body body;
+	ast_exprs decorator_list;
+};
+
+struct ast_return : ast_stmt {
+	static const ast_kind KIND = AST_RETURN;
+	ast_expr* value{nullptr};
+};
+
+struct ast_delete : ast_stmt {
+	static const ast_kind KIND = AST_DELETE;
+	ast_exprs targets;
+};
+
+struct ast_assign : ast_stmt {
+	static const ast_kind KIND = AST_ASSIGN;
+	ast_exprs targets;
+	ast_expr* value{nullptr};
+};
+
+struct ast_aug_assign : ast_stmt {
+	static const ast_kind KIND = AST_AUG_ASSIGN;
+	ast_expr* target{nullptr};
+	ast_operator op{OP_ADD};
+	ast_expr* value{nullptr};
+};
+
+struct ast_for : ast_stmt {
+	static const ast_kind KIND = AST_FOR;
+	ast_expr* target{nullptr};
+	ast_expr* iter{nullptr};
+	ast_body body;
+	ast_body orelse;
+	bool is_async{false};
+};
+
+struct ast_while : ast_stmt {
+	static const ast_kind KIND = AST_WHILE;
+	ast_expr* test{nullptr};
+	ast_body body;
+	ast_body orelse;
+};
+
+struct ast_if : ast_stmt {
+	static const ast_kind KIND = AST_IF;
+	ast_expr* test{nullptr};
+	ast_body body;
+	ast_body orelse;
+};
+
+struct ast_with : ast_stmt {
+	static const ast_kind KIND = AST_WITH;
+	ast_list<ast_with_item> items;
+	ast_body body;
+	bool is_async{false};
+};
+
+struct ast_raise : ast_stmt {
+	static const ast_kind KIND = AST_RAISE;
+	ast_expr* exc{nullptr};
+	ast_expr* cause{nullptr};
+};
+
+struct ast_try : ast_stmt {
+	static const ast_kind KIND = AST_TRY;
+	ast_body body;
+	ast_list<ast_except_handler*> handlers;
+	ast_body orelse;
+	ast_body finalbody;
+};
+
+struct ast_assert : ast_stmt {
+	static const ast_kind KIND = AST_ASSERT;
+	ast_expr* test{nullptr};
+	ast_expr* msg{nullptr};
+};
+
+struct ast_import : ast_stmt {
+	static const ast_kind KIND = AST_IMPORT;
+	ast_list<ast_alias> names;
+};
+
+struct ast_import_from : ast_stmt {
+	static const ast_kind KIND = AST_IMPORT_FROM;
+	const char* module{nullptr};
+	ast_list<ast_alias> names;
+	int level{0};
+};
+
+struct ast_global : ast_stmt {
+	static const ast_kind KIND = AST_GLOBAL;
+	ast_list<const char*> names;
+};
+
+struct ast_nonlocal : ast_stmt {
+	static const ast_kind KIND = AST_NONLOCAL;
+	ast_list<const char*> names;
+};
+
+/* An expression statement, Expr in CPython */
+struct ast_expr_stmt : ast_stmt {
+	static const ast_kind KIND = AST_EXPR;
+	ast_expr* value{nullptr};
+};
+
+struct ast_pass : ast_stmt {
+	static const ast_kind KIND = AST_PASS;
+};
+
+struct ast_break : ast_stmt {
+	static const ast_kind KIND = AST_BREAK;
+};
+
+struct ast_continue : ast_stmt {
+	static const ast_kind KIND = AST_CONTINUE;
+};
+
+/* Expressions */
+
+struct ast_bool_op : ast_expr {
+	static const ast_kind KIND = AST_BOOL_OP;
+	ast_boolop op{BOOL_AND};
+	ast_exprs values;
+};
+
+struct ast_bin_op : ast_expr {
+	static const ast_kind KIND = AST_BIN_OP;
+	ast_expr* left{nullptr};
+	ast_operator op{OP_ADD};
+	ast_expr* right{nullptr};
+};
+
+struct ast_unary_op : ast_expr {
+	static const ast_kind KIND = AST_UNARY_OP;
+	ast_unaryop op{UOP_NOT};
+	ast_expr* operand{nullptr};
+};
+
+struct ast_lambda : ast_expr {
+	static const ast_kind KIND = AST_LAMBDA;
+	ast_arguments* args{nullptr};
+	ast_expr* body{nullptr};
+};
+
+struct ast_if_exp : ast_expr {
+	static const ast_kind KIND = AST_IF_EXP;
+	ast_expr* test{nullptr};
+	ast_expr* body{nullptr};
+	ast_expr* orelse{nullptr};
+};
+
+struct ast_dict : ast_expr {
+	static const ast_kind KIND = AST_DICT;
+	ast_exprs keys; /* nullptr for **values[i] */
+	ast_exprs values;
+};
+
+struct ast_set : ast_expr {
+	static const ast_kind KIND = AST_SET;
+	ast_exprs elts;
+};
+
+/* ListComp, SetComp and GeneratorExp, told apart by kind */
+struct ast_comp : ast_expr {
+	ast_expr* elt{nullptr};
+	ast_list<ast_comprehension> generators;
+};
+
+struct ast_list_comp : ast_comp {
+	static const ast_kind KIND = AST_LIST_COMP;
+};
+
+struct ast_set_comp : ast_comp {
+	static const ast_kind KIND = AST_SET_COMP;
+};
+
+struct ast_generator_exp : ast_comp {
+	static const ast_kind KIND = AST_GENERATOR_EXP;
+};
+
+struct ast_dict_comp : ast_expr {
+	static const ast_kind KIND = AST_DICT_COMP;
+	ast_expr* key{nullptr};
+	ast_expr* value{nullptr};
+	ast_list<ast_comprehension> generators;
+};
+
+struct ast_await : ast_expr {
+	static const ast_kind KIND = AST_AWAIT;
+	ast_expr* value{nullptr};
+};
+
+struct ast_yield : ast_expr {
+	static const ast_kind KIND = AST_YIELD;
+	ast_expr* value{nullptr};
+};
+
+struct ast_yield_from : ast_expr {
+	static const ast_kind KIND = AST_YIELD_FROM;
+	ast_expr* value{nullptr};
+};
+
+struct ast_compare : ast_expr {
+	static const ast_kind KIND = AST_COMPARE;
+	ast_expr* left{nullptr};
+	ast_list<ast_cmpop> ops;
+	ast_exprs comparators;
+};
+
+struct ast_call : ast_expr {
+	static const ast_kind KIND = AST_CALL;
+	ast_expr* func{nullptr};
+	ast_exprs args;
+	ast_list<ast_keyword> keywords;
+};
+
+/* Decoded at lex time, see literal.h */
+struct ast_constant : ast_expr {
+	static const ast_kind KIND = AST_CONSTANT;
+	ast_constant_kind value_kind{CONST_NONE};
+	int64_t i{0};
+	double f{0};
+	const char* str{nullptr};
+	size_t str_size{0};
+	bool u_prefix{false};
+};
+
+struct ast_attribute : ast_expr {
+	static const ast_kind KIND = AST_ATTRIBUTE;
+	ast_expr* value{nullptr};
+	const char* attr{nullptr};
+	ast_context ctx{CTX_LOAD};
+};
+
+struct ast_subscript : ast_expr {
+	static const ast_kind KIND = AST_SUBSCRIPT;
+	ast_expr* value{nullptr};
+	ast_expr* slice{nullptr}; /* an ast_slice, or a tuple of them, or any expression */
+	ast_context ctx{CTX_LOAD};
+};
+
+struct ast_starred : ast_expr {
+	static const ast_kind KIND = AST_STARRED;
+	ast_expr* value{nullptr};
+	ast_context ctx{CTX_LOAD};
+};
+
+struct ast_name : ast_expr {
+	static const ast_kind KIND = AST_NAME;
+	const char* id{nullptr};
+	ast_context ctx{CTX_LOAD};
+};
+
+struct ast_list_expr : ast_expr {
+	static const ast_kind KIND = AST_LIST;
+	ast_exprs elts;
+	ast_context ctx{CTX_LOAD};
+};
+
+struct ast_tuple : ast_expr {
+	static const ast_kind KIND = AST_TUPLE;
+	ast_exprs elts;
+	ast_context ctx{CTX_LOAD};
+};
+
+struct ast_slice : ast_expr {
+	static const ast_kind KIND = AST_SLICE;
+	ast_expr* lower{nullptr};
+	ast_expr* upper{nullptr};
+	ast_expr* step{nullptr};
+};
+
+/* A new node of type T at line, in the arena */
+template <class T>
+inline T* ast_new(arena& A, uint32_t line) {
+	T* n = A.make<T>();
+	n->kind = T::KIND;
+	n->line = line;
+	return n;
+}
+
+/* Write m the way Python's ast.dump(ast.parse(source)) does */
+void ast_dump(const ast_module* m, std::ostream& out);
+
+/* The CPython class name of a node kind, "BinOp" */
+const char* ast_kind_name(ast_kind kind);
+
+} /* namespace arbusto */
+
+#endif /* AST_H_ */
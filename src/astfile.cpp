@@ -0,0 +1,186 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <type_traits>
+#include <cstring>
+#include <cstdio>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "astfile.h"
+
+namespace arbusto {
+
+static_assert(sizeof(astnode) == 12 && std::is_trivially_copyable<astnode>::value,
+		"astnode is stored as is in the AST files");
+
+static const char ast_file_magic[4] = {'A', 'R', 'B', 'T'};
+
+static uint32_t align8(size_t n) {
+	return static_cast<uint32_t>((n + 7) & ~static_cast<size_t>(7));
+}
+
+void write_ast_file(const std::string& file_name, const ast_tree& tree, const std::vector<token>& toks,
+		const std::string& source, uint64_t grammar) {
+	std::vector<ast_file_token> ftoks;
+	std::string strings;
+	std::unordered_map<std::string, uint32_t> interned;
+
+	ftoks.reserve(toks.size());
+
+	for (auto& t : toks) {
+		auto it = interned.find(t.data);
+
+		if (it == interned.end()) {
+			it = interned.emplace(t.data, static_cast<uint32_t>(strings.size())).first;
+			strings += t.data;
+		}
+
+		ftoks.push_back(ast_file_token{static_cast<uint32_t>(t.tok), static_cast<uint32_t>(t.line_num),
+				it->second, static_cast<uint32_t>(t.data.size())});
+	}
+
+	ast_file_header h;
+	std::memset(&h, 0, sizeof(h));
+	std::memcpy(h.magic, ast_file_magic, sizeof(h.magic));
+	h.version = AST_FILE_VERSION;
+	h.byte_order = 0x01020304;
+	h.grammar = grammar;
+	h.source_hash = fnv1a_hash(source.data(), source.size());
+	h.source_size = source.size();
+	h.node_count = static_cast<uint32_t>(tree.nodes.size());
+	h.nodes_offset = align8(sizeof(h));
+	h.token_count = static_cast<uint32_t>(ftoks.size());
+	h.tokens_offset = align8(h.nodes_offset + tree.nodes.size() * sizeof(astnode));
+	h.strings_size = static_cast<uint32_t>(strings.size());
+	h.strings_offset = align8(h.tokens_offset + ftoks.size() * sizeof(ast_file_token));
+
+	std::string tmp_name = file_name + ".tmp";
+
+	{
+		std::ofstream ofile(tmp_name, std::ios::binary | std::ios::trunc);
+		static const char zeros[8] = {0};
+
+		if (!ofile) {
+			throw std::runtime_error("can not write " + tmp_name);
+		}
+
+		ofile.write(reinterpret_cast<const char*>(&h), sizeof(h));
+		ofile.write(zeros, h.nodes_offset - sizeof(h));
+		ofile.write(reinterpret_cast<const char*>(tree.nodes.data()), tree.nodes.size() * sizeof(astnode));
+		ofile.write(zeros, h.tokens_offset - (h.nodes_offset + tree.nodes.size() * sizeof(astnode)));
+		ofile.write(reinterpret_cast<const char*>(ftoks.data()), ftoks.size() * sizeof(ast_file_token));
+		ofile.write(zeros, h.strings_offset - (h.tokens_offset + ftoks.size() * sizeof(ast_file_token)));
+		ofile.write(strings.data(), strings.size());
+
+		if (!ofile) {
+			throw std::runtime_error("can not write " + tmp_name);
+		}
+	}
+
+	if (std::rename(tmp_name.c_str(), file_name.c_str()) != 0) {
+		std::remove(tmp_name.c_str());
+		throw std::runtime_error("can not write " + file_name);
+	}
+}
+
+/*
+ * Whether the sections hold a tree that can be walked: every subtree
+ * inside its parent's, every token index and string inside its section.
+ * One pass, a damaged file is just a cache miss.
+ */
+static bool valid_payload(const ast_file_header& h, const astnode* nodes, const ast_file_token* toks) {
+	std::vector<uint32_t> ends;
+
+	for (uint32_t i = 0; i < h.node_count; ++i) {
+		while (!ends.empty() && ends.back() == i) {
+			ends.pop_back();
+		}
+
+		uint64_t end = uint64_t(i) + nodes[i].size;
+
+		if (nodes[i].size == 0 || end > (ends.empty() ? h.node_count : ends.back())
+				|| nodes[i].token_index >= h.token_count) {
+			return false;
+		}
+
+		ends.push_back(static_cast<uint32_t>(end));
+	}
+
+	for (uint32_t i = 0; i < h.token_count; ++i) {
+		if (uint64_t(toks[i].data_offset) + toks[i].data_size > h.strings_size) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool ast_file::open(const std::string& file_name, uint64_t grammar) {
+	close();
+
+	int fd = ::open(file_name.c_str(), O_RDONLY);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+
+	if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(ast_file_header)) {
+		::close(fd);
+		return false;
+	}
+
+	map_size = st.st_size;
+	map = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+
+	if (map == MAP_FAILED) {
+		map = nullptr;
+		map_size = 0;
+		return false;
+	}
+
+	const ast_file_header& h = header();
+
+	bool ok = std::memcmp(h.magic, ast_file_magic, sizeof(h.magic)) == 0
+			&& h.version == AST_FILE_VERSION
+			&& h.byte_order == 0x01020304
+			&& h.grammar == grammar
+			&& h.nodes_offset % 8 == 0 && h.tokens_offset % 8 == 0
+			&& h.nodes_offset + uint64_t(h.node_count) * sizeof(astnode) <= map_size
+			&& h.tokens_offset + uint64_t(h.token_count) * sizeof(ast_file_token) <= map_size
+			&& h.strings_offset + uint64_t(h.strings_size) <= map_size
+			&& h.node_count > 0 && nodes()[0].size == h.node_count
+			&& valid_payload(h, nodes(), reinterpret_cast<const ast_file_token*>(base() + h.tokens_offset));
+
+	if (!ok) {
+		close();
+	}
+
+	return ok;
+}
+
+void ast_file::close() {
+	if (map) {
+		munmap(map, map_size);
+		map = nullptr;
+		map_size = 0;
+	}
+}
+
+bool ast_file::matches(const std::string& source) const {
+	return header().source_size == source.size() && header().source_hash == fnv1a_hash(source.data(), source.size());
+}
+
+} /* namespace arbusto */
@@ -0,0 +1,121 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef ASTFILE_H_
+#define ASTFILE_H_
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include "tokenizer.h"
+#include "astnode.h"
+
+namespace arbusto {
+
+/* FNV-1a, for the source and grammar checks of the AST files */
+inline uint64_t fnv1a_hash(const char* data, size_t size) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < size; ++i) {
+		h ^= static_cast<unsigned char>(data[i]);
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/*
+ * Binary AST file. Everything is addressed by offsets from the start of the
+ * file, and sections are 8 byte aligned, so the mapped file is used as is:
+ *
+ *   header
+ *   nodes     node_count astnode, the ast_tree array in preorder
+ *   tokens    token_count ast_file_token, indexed by astnode::token_index
+ *   strings   the token texts; repeated names are stored once
+ *
+ * Native byte order, a file from another machine fails the byte_order check.
+ * Bump AST_FILE_VERSION on any change of the layout.
+ */
+enum { AST_FILE_VERSION = 1 };
+
+struct ast_file_header {
+	char magic[4]; /* "ARBT" */
+	uint32_t version;
+	uint32_t byte_order; /* 0x01020304 as written */
+	uint32_t reserved;
+	uint64_t grammar; /* grammar_fingerprint() of the parser that built the tree */
+	uint64_t source_hash; /* fnv1a_hash of the parsed source */
+	uint64_t source_size;
+	uint32_t node_count;
+	uint32_t nodes_offset;
+	uint32_t token_count;
+	uint32_t tokens_offset;
+	uint32_t strings_size;
+	uint32_t strings_offset;
+};
+
+struct ast_file_token {
+	uint32_t tok; /* token_t */
+	uint32_t line_num;
+	uint32_t data_offset; /* in the string pool */
+	uint32_t data_size;
+};
+
+/*
+ * Write the tree of a parsed source. The file is written under a temporary
+ * name and renamed into place, so readers never see a partial file.
+ */
+void write_ast_file(const std::string& file_name, const ast_tree& tree, const std::vector<token>& toks,
+		const std::string& source, uint64_t grammar);
+
+/*
+ * A read only mapping of an AST file. Nothing is decoded: nodes() points
+ * into the mapped file, and can be walked like ast_tree::nodes.
+ */
+class ast_file {
+public:
+	ast_file() : map(nullptr), map_size(0) {}
+	~ast_file() { close(); }
+
+	ast_file(const ast_file&) = delete;
+	ast_file& operator=(const ast_file&) = delete;
+
+	/*
+	 * Map file_name. Returns false when it does not exist, was not built
+	 * by this format version and grammar, or is damaged: a parse cache just
+	 * parses again.
+	 */
+	bool open(const std::string& file_name, uint64_t grammar);
+	void close();
+
+	/* True if the tree was parsed from exactly this source */
+	bool matches(const std::string& source) const;
+
+	const ast_file_header& header() const { return *static_cast<const ast_file_header*>(map); }
+
+	const astnode* nodes() const { return reinterpret_cast<const astnode*>(base() + header().nodes_offset); }
+	size_t node_count() const { return header().node_count; }
+
+	const ast_file_token& token(size_t i) const {
+		return reinterpret_cast<const ast_file_token*>(base() + header().tokens_offset)[i];
+	}
+	size_t token_count() const { return header().token_count; }
+
+	std::string token_data(size_t i) const {
+		const ast_file_token& t = token(i);
+		return std::string(base() + header().strings_offset + t.data_offset, t.data_size);
+	}
+
+private:
+	const char* base() const { return static_cast<const char*>(map); }
+
+	void* map;
+	size_t map_size;
+};
+
+} /* namespace arbusto */
+
+#endif /* ASTFILE_H_ */
@@ -0,0 +1,1624 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "astlower.h"
+#include "pyparser.h"
+
+namespace arbusto {
+
+/*
+ * What a grammar rule means to the lowering. Rules that always collapse,
+ * like stmt or comp_iter, have none: they are looked through.
+ */
+enum rule_role {
+	ROLE_NONE,
+	ROLE_FILE_INPUT,
+	ROLE_SUITE,
+	ROLE_SIMPLE_STMT,
+	ROLE_EXPR_STMT,
+	ROLE_AUGASSIGN,
+	ROLE_DEL_STMT,
+	ROLE_RETURN_STMT,
+	ROLE_RAISE_STMT,
+	ROLE_IMPORT_NAME,
+	ROLE_IMPORT_FROM,
+	ROLE_IMPORT_AS_NAME,
+	ROLE_IMPORT_AS_NAMES,
+	ROLE_DOTTED_AS_NAME,
+	ROLE_DOTTED_AS_NAMES,
+	ROLE_DOTTED_NAME,
+	ROLE_GLOBAL_STMT,
+	ROLE_NONLOCAL_STMT,
+	ROLE_ASSERT_STMT,
+	ROLE_IF_STMT,
+	ROLE_WHILE_STMT,
+	ROLE_FOR_STMT,
+	ROLE_TRY_STMT,
+	ROLE_EXCEPT_CLAUSE,
+	ROLE_WITH_STMT,
+	ROLE_WITH_ITEM,
+	ROLE_FUNCDEF,
+	ROLE_PARAMETERS,
+	ROLE_ARGSLIST, /* typedargslist, varargslist */
+	ROLE_PARAM, /* tfpdef, vfpdef */
+	ROLE_CLASSDEF,
+	ROLE_DECORATED,
+	ROLE_DECORATORS,
+	ROLE_DECORATOR,
+	ROLE_ASYNC, /* async_stmt, async_funcdef */
+	ROLE_TEST,
+	ROLE_LAMBDEF,
+	ROLE_BOOL_OP, /* or_test, and_test */
+	ROLE_NOT_TEST,
+	ROLE_COMPARISON,
+	ROLE_COMP_OP,
+	ROLE_STAR_EXPR,
+	ROLE_BIN_OP, /* expr down to term */
+	ROLE_FACTOR,
+	ROLE_POWER,
+	ROLE_ATOM_EXPR,
+	ROLE_ATOM,
+	ROLE_TESTLIST_COMP,
+	ROLE_TRAILER,
+	ROLE_SUBSCRIPTLIST,
+	ROLE_SUBSCRIPT,
+	ROLE_SLICEOP,
+	ROLE_TUPLE, /* testlist, exprlist, testlist_star_expr */
+	ROLE_DICTORSETMAKER,
+	ROLE_ARGLIST,
+	ROLE_ARGUMENT,
+	ROLE_COMP_FOR,
+	ROLE_COMP_IF,
+	ROLE_YIELD_EXPR,
+	ROLE_YIELD_ARG
+};
+
+static const struct {
+	const char* rule;
+	rule_role role;
+} rule_roles[] = {
+	{ "file_input", ROLE_FILE_INPUT },
+	{ "suite", ROLE_SUITE },
+	{ "simple_stmt", ROLE_SIMPLE_STMT },
+	{ "expr_stmt", ROLE_EXPR_STMT },
+	{ "augassign", ROLE_AUGASSIGN },
+	{ "del_stmt", ROLE_DEL_STMT },
+	{ "return_stmt", ROLE_RETURN_STMT },
+	{ "raise_stmt", ROLE_RAISE_STMT },
+	{ "import_name", ROLE_IMPORT_NAME },
+	{ "import_from", ROLE_IMPORT_FROM },
+	{ "import_as_name", ROLE_IMPORT_AS_NAME },
+	{ "import_as_names", ROLE_IMPORT_AS_NAMES },
+	{ "dotted_as_name", ROLE_DOTTED_AS_NAME },
+	{ "dotted_as_names", ROLE_DOTTED_AS_NAMES },
+	{ "dotted_name", ROLE_DOTTED_NAME },
+	{ "global_stmt", ROLE_GLOBAL_STMT },
+	{ "nonlocal_stmt", ROLE_NONLOCAL_STMT },
+	{ "assert_stmt", ROLE_ASSERT_STMT },
+	{ "if_stmt", ROLE_IF_STMT },
+	{ "while_stmt", ROLE_WHILE_STMT },
+	{ "for_stmt", ROLE_FOR_STMT },
+	{ "try_stmt", ROLE_TRY_STMT },
+	{ "except_clause", ROLE_EXCEPT_CLAUSE },
+	{ "with_stmt", ROLE_WITH_STMT },
+	{ "with_item", ROLE_WITH_ITEM },
+	{ "funcdef", ROLE_FUNCDEF },
+	{ "parameters", ROLE_PARAMETERS },
+	{ "typedargslist", ROLE_ARGSLIST },
+	{ "varargslist", ROLE_ARGSLIST },
+	{ "tfpdef", ROLE_PARAM },
+	{ "vfpdef", ROLE_PARAM },
+	{ "classdef", ROLE_CLASSDEF },
+	{ "decorated", ROLE_DECORATED },
+	{ "decorators", ROLE_DECORATORS },
+	{ "decorator", ROLE_DECORATOR },
+	{ "async_stmt", ROLE_ASYNC },
+	{ "async_funcdef", ROLE_ASYNC },
+	{ "test", ROLE_TEST },
+	{ "lambdef", ROLE_LAMBDEF },
+	{ "lambdef_nocond", ROLE_LAMBDEF },
+	{ "or_test", ROLE_BOOL_OP },
+	{ "and_test", ROLE_BOOL_OP },
+	{ "not_test", ROLE_NOT_TEST },
+	{ "comparison", ROLE_COMPARISON },
+	{ "comp_op", ROLE_COMP_OP },
+	{ "star_expr", ROLE_STAR_EXPR },
+	{ "expr", ROLE_BIN_OP },
+	{ "xor_expr", ROLE_BIN_OP },
+	{ "and_expr", ROLE_BIN_OP },
+	{ "shift_expr", ROLE_BIN_OP },
+	{ "arith_expr", ROLE_BIN_OP },
+	{ "term", ROLE_BIN_OP },
+	{ "factor", ROLE_FACTOR },
+	{ "power", ROLE_POWER },
+	{ "atom_expr", ROLE_ATOM_EXPR },
+	{ "atom", ROLE_ATOM },
+	{ "testlist_comp", ROLE_TESTLIST_COMP },
+	{ "trailer", ROLE_TRAILER },
+	{ "subscriptlist", ROLE_SUBSCRIPTLIST },
+	{ "subscript", ROLE_SUBSCRIPT },
+	{ "sliceop", ROLE_SLICEOP },
+	{ "testlist", ROLE_TUPLE },
+	{ "exprlist", ROLE_TUPLE },
+	{ "testlist_star_expr", ROLE_TUPLE },
+	{ "dictorsetmaker", ROLE_DICTORSETMAKER },
+	{ "arglist", ROLE_ARGLIST },
+	{ "argument", ROLE_ARGUMENT },
+	{ "comp_for", ROLE_COMP_FOR },
+	{ "comp_if", ROLE_COMP_IF },
+	{ "yield_expr", ROLE_YIELD_EXPR },
+	{ "yield_arg", ROLE_YIELD_ARG },
+};
+
+/* A node of a flat tree is a rule if it is none of the special leafs */
+static bool is_rule(const astnode* n) {
+	return n->node_type > NODE_TYPE_ERROR;
+}
+
+/* A rule node over a single child subtree */
+static bool is_chain(const astnode* n) {
+	return is_rule(n) && n->size > 1 && n[1].size == n->size - 1;
+}
+
+/* Where the meaning is: past the rules with one child */
+static const astnode* look(const astnode* n) {
+	while (is_chain(n)) {
+		++n;
+	}
+	return n;
+}
+
+class ast_lowering {
+public:
+	ast_lowering(const std::vector<token>& toks_, const literal_table* literals_, arena& A_, lazy_suites* lazy_)
+		: toks(toks_), literals(literals_), A(A_), lazy(lazy_) {
+		for (auto& r : rule_roles) {
+			int type = node_type_by_name(r.rule);
+			if (type < 0) {
+				/* Inlined by --optimize, never in a tree */
+				continue;
+			}
+			if (static_cast<size_t>(type) >= roles.size()) {
+				roles.resize(type + 1, ROLE_NONE);
+			}
+			roles[type] = r.role;
+		}
+	}
+
+	ast_module* module(const astnode* root) {
+		auto m = ast_new<ast_module>(A, 1);
+		m->body = body(root);
+		return m;
+	}
+
+private:
+	/*
+	 * The direct children of a node, by index. They live on top of the
+	 * shared kids stack until the view goes out of scope, so nested views
+	 * do not allocate.
+	 */
+	class children {
+	public:
+		children(std::vector<const astnode*>& stack_, const astnode* n) : stack(stack_), base(stack_.size()) {
+			for (auto& c : n->children()) {
+				stack.push_back(&c);
+			}
+			count = stack.size() - base;
+		}
+
+		/* With only_self, just n: a list that collapsed into its only item */
+		children(std::vector<const astnode*>& stack_, const astnode* n, bool only_self) : stack(stack_), base(stack_.size()) {
+			if (only_self) {
+				stack.push_back(n);
+			} else {
+				for (auto& c : n->children()) {
+					stack.push_back(&c);
+				}
+			}
+			count = stack.size() - base;
+		}
+
+		~children() { stack.resize(base); }
+
+		size_t size() const { return count; }
+		const astnode* operator[](size_t i) const { return stack[base + i]; }
+
+	private:
+		std::vector<const astnode*>& stack;
+		size_t base;
+		size_t count;
+	};
+
+	rule_role role(const astnode* n) const {
+		return static_cast<size_t>(n->node_type) < roles.size() ? roles[n->node_type] : ROLE_NONE;
+	}
+
+	const token& tok(const astnode* n) const { return toks[n->token_index]; }
+	uint32_t line(const astnode* n) const { return static_cast<uint32_t>(tok(n).line_num); }
+
+	bool is_tok(const astnode* n, token_t t) const {
+		return n->node_type == NODE_TYPE_STRING && tok(n).tok == t;
+	}
+
+	bool is_kw(const astnode* n, const char* kw) const {
+		return n->node_type == NODE_TYPE_STRING && tok(n).tok == TOK_NAME && tok(n).data == kw;
+	}
+
+	[[noreturn]] void fail(const astnode* n, const std::string& what) const {
+		throw std::runtime_error("line " + std::to_string(tok(n).line_num) + ": " + what);
+	}
+
+	const char* name(const astnode* n) {
+		if (!is_tok(n, TOK_NAME)) {
+			fail(n, "expected a name");
+		}
+		return A.intern(tok(n).data);
+	}
+
+	/* The items pushed on a scratch stack since mark, moved to the arena */
+	template <class T>
+	ast_list<T> take(std::vector<T>& items, size_t mark) {
+		ast_list<T> r;
+		r.items = A.copy(items.data() + mark, items.size() - mark);
+		r.count = static_cast<uint32_t>(items.size() - mark);
+		items.resize(mark);
+		return r;
+	}
+
+	template <class T>
+	ast_list<T> one(T item) {
+		ast_list<T> r;
+		r.items = A.copy(&item, 1);
+		r.count = 1;
+		return r;
+	}
+
+	/* Statements */
+
+	ast_body body(const astnode* n) {
+		size_t mark = stmt_stack.size();
+		statements(n);
+		return take(stmt_stack, mark);
+	}
+
+	void statements(const astnode* n);
+	ast_stmt* small_statement(const astnode* n);
+	ast_stmt* compound_statement(const astnode* n);
+	ast_stmt* expr_statement(const astnode* n);
+	ast_stmt* import_from(const astnode* n);
+	void aliases(const astnode* n);
+	const char* dotted_name(const astnode* n);
+	ast_stmt* if_statement(const astnode* n);
+	ast_stmt* try_statement(const astnode* n);
+	ast_stmt* with_statement(const astnode* n, bool is_async);
+	ast_stmt* for_statement(const astnode* n, bool is_async);
+	ast_stmt* function(const astnode* n, ast_exprs decorators, bool is_async);
+	ast_stmt* class_def(const astnode* n, ast_exprs decorators);
+	ast_stmt* decorated(const astnode* n);
+	ast_arguments* arguments(const astnode* n);
+	ast_arg* parameter(const astnode* n);
+
+	/* Expressions */
+
+	ast_expr* expr(const astnode* n);
+	ast_expr* leaf(const astnode* n);
+	ast_expr* constant(const astnode* n);
+	ast_expr* strings(const astnode* n);
+	ast_expr* atom(const astnode* n);
+	ast_expr* atom_expr(const astnode* n);
+	ast_expr* comparison(const astnode* n);
+	ast_expr* comprehension(const astnode* elt, const astnode* comp_for, ast_kind kind, uint32_t at);
+	ast_list<ast_comprehension> generators(const astnode* comp_for);
+	ast_expr* dict_or_set(const astnode* n, uint32_t at);
+	ast_expr* subscript(const astnode* n);
+	ast_expr* tuple(const astnode* n);
+	ast_expr* lambda(const astnode* n);
+	ast_expr* yield(const astnode* n);
+	void call_arguments(const astnode* n);
+	void call_argument(const astnode* n);
+
+	ast_expr* target(const astnode* n, ast_context ctx) {
+		ast_expr* e = expr(n);
+		set_context(e, ctx, n);
+		return e;
+	}
+
+	void set_context(ast_expr* e, ast_context ctx, const astnode* at);
+
+	const std::vector<token>& toks;
+	const literal_table* literals;
+	arena& A;
+	lazy_suites* lazy;
+	std::vector<rule_role> roles; /* by node type */
+
+	/* Scratch stacks for the lists being built, see take */
+	std::vector<const astnode*> kids;
+	std::vector<ast_stmt*> stmt_stack;
+	std::vector<ast_expr*> expr_stack;
+	std::vector<ast_arg*> arg_stack;
+	std::vector<ast_keyword> keyword_stack;
+	std::vector<ast_alias> alias_stack;
+	std::vector<ast_comprehension> comp_stack;
+	std::vector<ast_cmpop> cmpop_stack;
+	std::vector<const char*> name_stack;
+	std::vector<ast_except_handler*> handler_stack;
+	std::vector<ast_with_item> with_stack;
+};
+
+/* Push the statements of a file_input, a suite, a simple_stmt or a single statement */
+void ast_lowering::statements(const astnode* n) {
+	n = look(n);
+
+	if (n->node_type == NODE_TYPE_LAZY) {
+		if (!lazy) {
+			fail(n, "the tree was parsed lazily");
+		}
+		statements(lazy->get(*n).root());
+		return;
+	}
+	if (n->node_type == NODE_TYPE_ERROR) {
+		fail(n, "the tree has a syntax error");
+	}
+
+	switch (role(n)) {
+	case ROLE_FILE_INPUT:
+	case ROLE_SUITE:
+		{
+			children c(kids, n);
+			for (size_t i = 0; i < c.size(); ++i) {
+				if (!is_tok(c[i], TOK_NEWLINE) && !is_tok(c[i], TOK_INDENT) && !is_tok(c[i], TOK_DEDENT)
+						&& !is_tok(c[i], TOK_ENDMARKER)) {
+					statements(c[i]);
+				}
+			}
+		}
+		break;
+	case ROLE_SIMPLE_STMT:
+		{
+			children c(kids, n);
+			for (size_t i = 0; i < c.size(); ++i) {
+				if (!is_tok(c[i], TOK_SEMI) && !is_tok(c[i], TOK_NEWLINE)) {
+					stmt_stack.push_back(small_statement(c[i]));
+				}
+			}
+		}
+		break;
+	default:
+		if (is_tok(n, TOK_ENDMARKER) || is_tok(n, TOK_NEWLINE)) {
+			/* An empty file */
+			break;
+		}
+		stmt_stack.push_back(compound_statement(n));
+		break;
+	}
+}
+
+ast_stmt* ast_lowering::small_statement(const astnode* n) {
+	n = look(n);
+
+	if (n->node_type == NODE_TYPE_STRING) {
+		/* Keywords left alone by --collapse */
+		if (is_kw(n, "pass")) {
+			return ast_new<ast_pass>(A, line(n));
+		}
+		if (is_kw(n, "break")) {
+			return ast_new<ast_break>(A, line(n));
+		}
+		if (is_kw(n, "continue")) {
+			return ast_new<ast_continue>(A, line(n));
+		}
+		if (is_kw(n, "return")) {
+			return ast_new<ast_return>(A, line(n));
+		}
+		if (is_kw(n, "raise")) {
+			return ast_new<ast_raise>(A, line(n));
+		}
+	}
+
+	switch (role(n)) {
+	case ROLE_EXPR_STMT:
+		return expr_statement(n);
+	case ROLE_DEL_STMT:
+		{
+			children c(kids, n);
+			auto s = ast_new<ast_delete>(A, line(n));
+			const astnode* t = look(c[1]);
+			size_t mark = expr_stack.size();
+
+			/* del a, b deletes each one, not a tuple */
+			if (role(t) == ROLE_TUPLE) {
+				children items(kids, t);
+				for (size_t i = 0; i < items.size(); i += 2) {
+					expr_stack.push_back(target(items[i], CTX_DEL));
+				}
+			} else {
+				expr_stack.push_back(target(t, CTX_DEL));
+			}
+
+			s->targets = take(expr_stack, mark);
+			return s;
+		}
+	case ROLE_RETURN_STMT:
+		{
+			children c(kids, n);
+			auto s = ast_new<ast_return>(A, line(n));
+			s->value = expr(c[1]);
+			return s;
+		}
+	case ROLE_RAISE_STMT:
+		{
+			children c(kids, n);
+			auto s = ast_new<ast_raise>(A, line(n));
+			s->exc = expr(c[1]);
+			if (c.size() > 3) {
+				s->cause = expr(c[3]);
+			}
+			return s;
+		}
+	case ROLE_IMPORT_NAME:
+		{
+			children c(kids, n);
+			auto s = ast_new<ast_import>(A, line(n));
+			size_t mark = alias_stack.size();
+			aliases(c[1]);
+			s->names = take(alias_stack, mark);
+			return s;
+		}
+	case ROLE_IMPORT_FROM:
+		return import_from(n);
+	case ROLE_GLOBAL_STMT:
+	case ROLE_NONLOCAL_STMT:
+		{
+			children c(kids, n);
+			size_t mark = name_stack.size();
+
+			for (size_t i = 1; i < c.size(); i += 2) {
+				name_stack.push_back(name(c[i]));
+			}
+
+			if (role(n) == ROLE_GLOBAL_STMT) {
+				auto s = ast_new<ast_global>(A, line(n));
+				s->names = take(name_stack, mark);
+				return s;
+			}
+			auto s = ast_new<ast_nonlocal>(A, line(n));
+			s->names = take(name_stack, mark);
+			return s;
+		}
+	case ROLE_ASSERT_STMT:
+		{
+			children c(kids, n);
+			auto s = ast_new<ast_assert>(A, line(n));
+			s->test = expr(c[1]);
+			if (c.size() > 3) {
+				s->msg = expr(c[3]);
+			}
+			return s;
+		}
+	default:
+		{
+			/* An expression, expr_stmt collapsed over it */
+			auto s = ast_new<ast_expr_stmt>(A, line(n));
+			s->value = expr(n);
+			return s;
+		}
+	}
+}
+
+static bool augassign_operator(token_t t, ast_operator& op) {
+	switch (t) {
+	case TOK_PLUSEQUAL: op = OP_ADD; return true;
+	case TOK_MINEQUAL: op = OP_SUB; return true;
+	case TOK_STAREQUAL: op = OP_MULT; return true;
+	case TOK_ATEQUAL: op = OP_MATMULT; return true;
+	case TOK_SLASHEQUAL: op = OP_DIV; return true;
+	case TOK_PERCENTEQUAL: op = OP_MOD; return true;
+	case TOK_AMPEREQUAL: op = OP_BITAND; return true;
+	case TOK_VBAREQUAL: op = OP_BITOR; return true;
+	case TOK_CIRCUMFLEXEQUAL: op = OP_BITXOR; return true;
+	case TOK_LEFTSHIFTEQUAL: op = OP_LSHIFT; return true;
+	case TOK_RIGHTSHIFTEQUAL: op = OP_RSHIFT; return true;
+	case TOK_DOUBLESTAREQUAL: op = OP_POW; return true;
+	case TOK_DOUBLESLASHEQUAL: op = OP_FLOORDIV; return true;
+	default: return false;
+	}
+}
+
+ast_stmt* ast_lowering::expr_statement(const astnode* n) {
+	children c(kids, n);
+	const astnode* second = look(c[1]);
+	ast_operator op;
+
+	if (second->node_type == NODE_TYPE_STRING && augassign_operator(tok(second).tok, op)) {
+		auto s = ast_new<ast_aug_assign>(A, line(n));
+		s->target = expr(c[0]);
+		if (s->target->kind != AST_NAME && s->target->kind != AST_ATTRIBUTE && s->target->kind != AST_SUBSCRIPT) {
+			fail(n, "illegal expression for augmented assignment");
+		}
+		set_context(s->target, CTX_STORE, n);
+		s->op = op;
+		s->value = expr(c[2]);
+		return s;
+	}
+
+	/* a = b = value */
+	auto s = ast_new<ast_assign>(A, line(n));
+	size_t mark = expr_stack.size();
+
+	for (size_t i = 0; i + 1 < c.size(); i += 2) {
+		expr_stack.push_back(target(c[i], CTX_STORE));
+	}
+
+	s->targets = take(expr_stack, mark);
+	s->value = expr(c[c.size() - 1]);
+	return s;
+}
+
+const char* ast_lowering::dotted_name(const astnode* n) {
+	n = look(n);
+
+	if (n->node_type == NODE_TYPE_STRING) {
+		return name(n);
+	}
+
+	std::string dotted;
+	children c(kids, n);
+	for (size_t i = 0; i < c.size(); ++i) {
+		dotted += tok(c[i]).data;
+	}
+	return A.intern(dotted);
+}
+
+/* Push the aliases of dotted_as_names, import_as_names or one of their items */
+void ast_lowering::aliases(const astnode* n) {
+	n = look(n);
+
+	switch (role(n)) {
+	case ROLE_DOTTED_AS_NAMES:
+	case ROLE_IMPORT_AS_NAMES:
+		{
+			children c(kids, n);
+			for (size_t i = 0; i < c.size(); i += 2) {
+				aliases(c[i]);
+			}
+		}
+		break;
+	case ROLE_DOTTED_AS_NAME:
+	case ROLE_IMPORT_AS_NAME:
+		{
+			children c(kids, n);
+			ast_alias a;
+			a.name = dotted_name(c[0]);
+			a.asname = name(c[2]);
+			alias_stack.push_back(a);
+		}
+		break;
+	default:
+		{
+			ast_alias a;
+			a.name = dotted_name(n);
+			alias_stack.push_back(a);
+		}
+		break;
+	}
+}
+
+ast_stmt* ast_lowering::import_from(const astnode* n) {
+	children c(kids, n);
+	auto s = ast_new<ast_import_from>(A, line(n));
+	size_t i = 1;
+
+	for (; is_tok(c[i], TOK_DOT) || is_tok(c[i], TOK_ELLIPSIS); ++i) {
+		s->level += is_tok(c[i], TOK_DOT) ? 1 : 3;
+	}
+	if (!is_kw(c[i], "import")) {
+		s->module = dotted_name(c[i++]);
+	}
+	++i;
+
+	size_t mark = alias_stack.size();
+
+	if (is_tok(c[i], TOK_STAR)) {
+		ast_alias a;
+		a.name = A.intern("*");
+		alias_stack.push_back(a);
+	} else {
+		aliases(c[is_tok(c[i], TOK_LPAR) ? i + 1 : i]);
+	}
+
+	s->names = take(alias_stack, mark);
+	return s;
+}
+
+ast_stmt* ast_lowering::compound_statement(const astnode* n) {
+	switch (role(n)) {
+	case ROLE_IF_STMT:
+		return if_statement(n);
+	case ROLE_WHILE_STMT:
+		{
+			children c(kids, n);
+			auto s = ast_new<ast_while>(A, line(n));
+			s->test = expr(c[1]);
+			s->body = body(c[3]);
+			if (c.size() > 4) {
+				s->orelse = body(c[6]);
+			}
+			return s;
+		}
+	case ROLE_FOR_STMT:
+		return for_statement(n, false);
+	case ROLE_TRY_STMT:
+		return try_statement(n);
+	case ROLE_WITH_STMT:
+		return with_statement(n, false);
+	case ROLE_FUNCDEF:
+		return function(n, ast_exprs(), false);
+	case ROLE_CLASSDEF:
+		return class_def(n, ast_exprs());
+	case ROLE_DECORATED:
+		return decorated(n);
+	case ROLE_ASYNC:
+		{
+			children c(kids, n);
+			const astnode* s = look(c[1]);
+
+			switch (role(s)) {
+			case ROLE_FUNCDEF: return function(s, ast_exprs(), true);
+			case ROLE_FOR_STMT: return for_statement(s, true);
+			case ROLE_WITH_STMT: return with_statement(s, true);
+			default: break;
+			}
+			fail(n, "unexpected async " + node_type_name(s->node_type));
+		}
+	default:
+		break;
+	}
+
+	/* A bare small statement, from a tree without simple_stmt around it */
+	return small_statement(n);
+}
+
+ast_stmt* ast_lowering::if_statement(const astnode* n) {
+	children c(kids, n);
+	auto first = ast_new<ast_if>(A, line(n));
+	ast_if* cur = first;
+
+	first->test = expr(c[1]);
+	first->body = body(c[3]);
+
+	/* elif is an if in the orelse of the previous one */
+	for (size_t i = 4; i < c.size(); i += 4) {
+		if (is_kw(c[i], "else")) {
+			cur->orelse = body(c[i + 2]);
+			break;
+		}
+
+		auto next = ast_new<ast_if>(A, line(c[i]));
+		next->test = expr(c[i + 1]);
+		next->body = body(c[i + 3]);
+		cur->orelse = one<ast_stmt*>(next);
+		cur = next;
+	}
+
+	return first;
+}
+
+ast_stmt* ast_lowering::for_statement(const astnode* n, bool is_async) {
+	children c(kids, n);
+	auto s = ast_new<ast_for>(A, line(n));
+
+	s->target = target(c[1], CTX_STORE);
+	s->iter = expr(c[3]);
+	s->body = body(c[5]);
+	if (c.size() > 6) {
+		s->orelse = body(c[8]);
+	}
+	s->is_async = is_async;
+	return s;
+}
+
+ast_stmt* ast_lowering::try_statement(const astnode* n) {
+	children c(kids, n);
+	auto s = ast_new<ast_try>(A, line(n));
+	size_t mark = handler_stack.size();
+
+	s->body = body(c[2]);
+
+	for (size_t i = 3; i < c.size(); i += 3) {
+		const astnode* clause = look(c[i]);
+
+		if (is_kw(clause, "else")) {
+			s->orelse = body(c[i + 2]);
+		} else if (is_kw(clause, "finally")) {
+			s->finalbody = body(c[i + 2]);
+		} else {
+			auto h = A.make<ast_except_handler>();
+			h->line = line(clause);
+
+			if (role(clause) == ROLE_EXCEPT_CLAUSE) {
+				children e(kids, clause);
+				h->type = expr(e[1]);
+				if (e.size() > 2) {
+					h->name = name(e[3]);
+				}
+			}
+
+			h->body = body(c[i + 2]);
+			handler_stack.push_back(h);
+		}
+	}
+
+	s->handlers = take(handler_stack, mark);
+	return s;
+}
+
+ast_stmt* ast_lowering::with_statement(const astnode* n, bool is_async) {
+	children c(kids, n);
+	auto s = ast_new<ast_with>(A, line(n));
+	size_t mark = with_stack.size();
+
+	for (size_t i = 1; i + 2 < c.size(); i += 2) {
+		const astnode* item = look(c[i]);
+		ast_with_item w;
+
+		if (role(item) == ROLE_WITH_ITEM) {
+			children parts(kids, item);
+			w.context_expr = expr(parts[0]);
+			w.optional_vars = target(parts[2], CTX_STORE);
+		} else {
+			w.context_expr = expr(item);
+		}
+
+		with_stack.push_back(w);
+	}
+
+	s->items = take(with_stack, mark);
+	s->body = body(c[c.size() - 1]);
+	s->is_async = is_async;
+	return s;
+}
+
+ast_stmt* ast_lowering::decorated(const astnode* n) {
+	children c(kids, n);
+	const astnode* decorators = look(c[0]);
+	size_t mark = expr_stack.size();
+
+	auto decorator = [this](const astnode* d) {
+		children parts(kids, d);
+		const astnode* dotted = look(parts[1]);
+		ast_expr* e;
+
+		if (dotted->node_type == NODE_TYPE_STRING) {
+			auto nm = ast_new<ast_name>(A, line(dotted));
+			nm->id = name(dotted);
+			e = nm;
+		} else {
+			/* @a.b.c, dotted_name is NAME ('.' NAME)* */
+			children names(kids, dotted);
+			auto nm = ast_new<ast_name>(A, line(dotted));
+			nm->id = name(names[0]);
+			e = nm;
+			for (size_t i = 2; i < names.size(); i += 2) {
+				auto attr = ast_new<ast_attribute>(A, line(dotted));
+				attr->value = e;
+				attr->attr = name(names[i]);
+				e = attr;
+			}
+		}
+
+		if (is_tok(parts[2], TOK_LPAR)) {
+			auto call = ast_new<ast_call>(A, line(d));
+			call->func = e;
+			size_t args = expr_stack.size();
+			size_t kws = keyword_stack.size();
+			if (!is_tok(parts[3], TOK_RPAR)) {
+				call_arguments(parts[3]);
+			}
+			call->args = take(expr_stack, args);
+			call->keywords = take(keyword_stack, kws);
+			e = call;
+		}
+
+		expr_stack.push_back(e);
+	};
+
+	if (role(decorators) == ROLE_DECORATORS) {
+		children list(kids, decorators);
+		for (size_t i = 0; i < list.size(); ++i) {
+			decorator(look(list[i]));
+		}
+	} else {
+		decorator(decorators);
+	}
+
+	ast_exprs decorator_list = take(expr_stack, mark);
+	const astnode* def = look(c[1]);
+
+	switch (role(def)) {
+	case ROLE_FUNCDEF:
+		return function(def, decorator_list, false);
+	case ROLE_CLASSDEF:
+		return class_def(def, decorator_list);
+	case ROLE_ASYNC:
+		{
+			children parts(kids, def);
+			return function(look(parts[1]), decorator_list, true);
+		}
+	default:
+		fail(def, "unexpected decorated " + node_type_name(def->node_type));
+	}
+}
+
+ast_stmt* ast_lowering::function(const astnode* n, ast_exprs decorators, bool is_async) {
+	children c(kids, n);
+	auto s = ast_new<ast_function_def>(A, line(n));
+	children params(kids, c[2]);
+
+	s->name = name(c[1]);
+	s->args = arguments(params.size() > 2 ? params[1] : nullptr);
+	if (is_tok(c[3], TOK_RARROW)) {
+		s->returns = expr(c[4]);
+	}
+	s->body = body(c[c.size() - 1]);
+	s->decorator_list = decorators;
+	s->is_async = is_async;
+	return s;
+}
+
+ast_stmt* ast_lowering::class_def(const astnode* n, ast_exprs decorators) {
+	children c(kids, n);
+	auto s = ast_new<ast_class_def>(A, line(n));
+
+	s->name = name(c[1]);
+
+	/* The bases are call arguments */
+	size_t args = expr_stack.size();
+	size_t kws = keyword_stack.size();
+	if (is_tok(c[2], TOK_LPAR) && !is_tok(c[3], TOK_RPAR)) {
+		call_arguments(c[3]);
+	}
+	s->bases = take(expr_stack, args);
+	s->keywords = take(keyword_stack, kws);
+
+	s->body = body(c[c.size() - 1]);
+	s->decorator_list = decorators;
+	return s;
+}
+
+ast_arg* ast_lowering::parameter(const astnode* n) {
+	n = look(n);
+	auto a = A.make<ast_arg>();
+	a->line = line(n);
+
+	if (role(n) == ROLE_PARAM) {
+		/* NAME ':' test */
+		children c(kids, n);
+		a->arg = name(c[0]);
+		a->annotation = expr(c[2]);
+	} else {
+		a->arg = name(n);
+	}
+
+	return a;
+}
+
+/* The typedargslist or varargslist n, or a single parameter, or nullptr for none */
+ast_arguments* ast_lowering::arguments(const astnode* n) {
+	auto a = A.make<ast_arguments>();
+
+	if (!n) {
+		return a;
+	}
+
+	n = look(n);
+
+	/* A lone parameter is its own list */
+	children items(kids, n, role(n) != ROLE_ARGSLIST);
+	size_t args = arg_stack.size();
+	size_t defaults = expr_stack.size();
+	bool kwonly = false;
+
+	for (size_t i = 0; i < items.size(); ++i) {
+		const astnode* item = items[i];
+
+		if (is_tok(item, TOK_COMMA)) {
+			continue;
+		}
+
+		if (is_tok(item, TOK_STAR)) {
+			/* Everything after it is keyword only */
+			a->args = take(arg_stack, args);
+			a->defaults = take(expr_stack, defaults);
+			kwonly = true;
+			if (i + 1 < items.size() && !is_tok(items[i + 1], TOK_COMMA)) {
+				a->vararg = parameter(items[++i]);
+			}
+		} else if (is_tok(item, TOK_DOUBLESTAR)) {
+			a->kwarg = parameter(items[++i]);
+		} else if (is_tok(item, TOK_EQUAL)) {
+			ast_expr* value = expr(items[++i]);
+			if (kwonly) {
+				expr_stack.back() = value;
+			} else {
+				expr_stack.push_back(value);
+			}
+		} else {
+			arg_stack.push_back(parameter(item));
+			if (kwonly) {
+				/* Its default, if it has one, replaces the nullptr */
+				expr_stack.push_back(nullptr);
+			}
+		}
+	}
+
+	if (kwonly) {
+		a->kwonlyargs = take(arg_stack, args);
+		a->kw_defaults = take(expr_stack, defaults);
+	} else {
+		a->args = take(arg_stack, args);
+		a->defaults = take(expr_stack, defaults);
+	}
+
+	return a;
+}
+
+/* Expressions */
+
+void ast_lowering::set_context(ast_expr* e, ast_context ctx, const astnode* at) {
+	const char* what;
+
+	switch (e->kind) {
+	case AST_NAME: static_cast<ast_name*>(e)->ctx = ctx; return;
+	case AST_ATTRIBUTE: static_cast<ast_attribute*>(e)->ctx = ctx; return;
+	case AST_SUBSCRIPT: static_cast<ast_subscript*>(e)->ctx = ctx; return;
+	case AST_STARRED:
+		static_cast<ast_starred*>(e)->ctx = ctx;
+		set_context(static_cast<ast_starred*>(e)->value, ctx, at);
+		return;
+	case AST_LIST:
+	case AST_TUPLE:
+		{
+			ast_exprs& elts = e->kind == AST_LIST ? static_cast<ast_list_expr*>(e)->elts : static_cast<ast_tuple*>(e)->elts;
+			if (e->kind == AST_LIST) {
+				static_cast<ast_list_expr*>(e)->ctx = ctx;
+			} else {
+				static_cast<ast_tuple*>(e)->ctx = ctx;
+			}
+			for (auto elt : elts) {
+				set_context(elt, ctx, at);
+			}
+		}
+		return;
+	case AST_CALL: what = "function call"; break;
+	case AST_CONSTANT: what = "literal"; break;
+	case AST_COMPARE: what = "comparison"; break;
+	case AST_LAMBDA: what = "lambda"; break;
+	case AST_IF_EXP: what = "conditional expression"; break;
+	case AST_YIELD: case AST_YIELD_FROM: what = "yield expression"; break;
+	case AST_AWAIT: what = "await expression"; break;
+	case AST_GENERATOR_EXP: what = "generator expression"; break;
+	case AST_LIST_COMP: case AST_SET_COMP: case AST_DICT_COMP: what = "comprehension"; break;
+	case AST_DICT: what = "dict literal"; break;
+	case AST_SET: what = "set display"; break;
+	default: what = "expression"; break;
+	}
+
+	fail(at, std::string(ctx == CTX_DEL ? "cannot delete " : "cannot assign to ") + what);
+}
+
+ast_expr* ast_lowering::expr(const astnode* n) {
+	n = look(n);
+
+	if (n->node_type == NODE_TYPE_STRING) {
+		return leaf(n);
+	}
+
+	switch (role(n)) {
+	case ROLE_TEST:
+		{
+			/* body 'if' test 'else' orelse */
+			children c(kids, n);
+			auto e = ast_new<ast_if_exp>(A, line(n));
+			e->body = expr(c[0]);
+			e->test = expr(c[2]);
+			e->orelse = expr(c[4]);
+			return e;
+		}
+	case ROLE_LAMBDEF:
+		return lambda(n);
+	case ROLE_BOOL_OP:
+		{
+			children c(kids, n);
+			auto e = ast_new<ast_bool_op>(A, line(n));
+			size_t mark = expr_stack.size();
+			e->op = is_kw(c[1], "or") ? BOOL_OR : BOOL_AND;
+			for (size_t i = 0; i < c.size(); i += 2) {
+				expr_stack.push_back(expr(c[i]));
+			}
+			e->values = take(expr_stack, mark);
+			return e;
+		}
+	case ROLE_NOT_TEST:
+		{
+			children c(kids, n);
+			auto e = ast_new<ast_unary_op>(A, line(n));
+			e->op = UOP_NOT;
+			e->operand = expr(c[1]);
+			return e;
+		}
+	case ROLE_COMPARISON:
+		return comparison(n);
+	case ROLE_STAR_EXPR:
+		{
+			children c(kids, n);
+			auto e = ast_new<ast_starred>(A, line(n));
+			e->value = expr(c[1]);
+			return e;
+		}
+	case ROLE_BIN_OP:
+		{
+			/* Left associative: a - b - c is (a - b) - c */
+			children c(kids, n);
+			ast_expr* left = expr(c[0]);
+
+			for (size_t i = 1; i + 1 < c.size(); i += 2) {
+				auto e = ast_new<ast_bin_op>(A, line(n));
+				e->left = left;
+				switch (tok(c[i]).tok) {
+				case TOK_VBAR: e->op = OP_BITOR; break;
+				case TOK_CIRCUMFLEX: e->op = OP_BITXOR; break;
+				case TOK_AMPER: e->op = OP_BITAND; break;
+				case TOK_LEFTSHIFT: e->op = OP_LSHIFT; break;
+				case TOK_RIGHTSHIFT: e->op = OP_RSHIFT; break;
+				case TOK_PLUS: e->op = OP_ADD; break;
+				case TOK_MINUS: e->op = OP_SUB; break;
+				case TOK_STAR: e->op = OP_MULT; break;
+				case TOK_AT: e->op = OP_MATMULT; break;
+				case TOK_SLASH: e->op = OP_DIV; break;
+				case TOK_PERCENT: e->op = OP_MOD; break;
+				case TOK_DOUBLESLASH: e->op = OP_FLOORDIV; break;
+				default: fail(c[i], "unexpected operator " + tok(c[i]).data);
+				}
+				e->right = expr(c[i + 1]);
+				left = e;
+			}
+
+			return left;
+		}
+	case ROLE_FACTOR:
+		{
+			children c(kids, n);
+			auto e = ast_new<ast_unary_op>(A, line(n));
+			switch (tok(c[0]).tok) {
+			case TOK_PLUS: e->op = UOP_UADD; break;
+			case TOK_MINUS: e->op = UOP_USUB; break;
+			default: e->op = UOP_INVERT; break;
+			}
+			e->operand = expr(c[1]);
+			return e;
+		}
+	case ROLE_POWER:
+		{
+			children c(kids, n);
+			auto e = ast_new<ast_bin_op>(A, line(n));
+			e->left = expr(c[0]);
+			e->op = OP_POW;
+			e->right = expr(c[2]);
+			return e;
+		}
+	case ROLE_ATOM_EXPR:
+		return atom_expr(n);
+	case ROLE_ATOM:
+		return atom(n);
+	case ROLE_TUPLE:
+	case ROLE_TESTLIST_COMP:
+		return tuple(n);
+	case ROLE_YIELD_EXPR:
+		return yield(n);
+	default:
+		fail(n, "unexpected " + node_type_name(n->node_type) + " in an expression");
+	}
+}
+
+ast_expr* ast_lowering::leaf(const astnode* n) {
+	const token& t = tok(n);
+
+	switch (t.tok) {
+	case TOK_NAME:
+		{
+			if (t.data == "None" || t.data == "True" || t.data == "False") {
+				auto c = ast_new<ast_constant>(A, line(n));
+				c->value_kind = t.data == "None" ? CONST_NONE : CONST_BOOL;
+				c->i = t.data == "True";
+				return c;
+			}
+			if (t.data == "yield") {
+				return ast_new<ast_yield>(A, line(n));
+			}
+			auto e = ast_new<ast_name>(A, line(n));
+			e->id = A.intern(t.data);
+			return e;
+		}
+	case TOK_NUMBER:
+		return constant(n);
+	case TOK_STRING:
+		return strings(n);
+	case TOK_ELLIPSIS:
+		{
+			auto c = ast_new<ast_constant>(A, line(n));
+			c->value_kind = CONST_ELLIPSIS;
+			return c;
+		}
+	default:
+		fail(n, "unexpected " + tokenizer::token2str(t.tok) + " in an expression");
+	}
+}
+
+ast_expr* ast_lowering::constant(const astnode* n) {
+	const literal* lit = literals ? literals->find(n->token_index) : nullptr;
+	literal decoded;
+
+	if (!lit) {
+		decoded = decode_literal(tok(n));
+		lit = &decoded;
+	}
+
+	auto c = ast_new<ast_constant>(A, line(n));
+
+	switch (lit->kind) {
+	case LIT_INT: c->value_kind = CONST_INT; c->i = lit->i; break;
+	case LIT_FLOAT: c->value_kind = CONST_FLOAT; c->f = lit->f; break;
+	case LIT_IMAG: c->value_kind = CONST_IMAG; c->f = lit->f; break;
+	case LIT_BIGINT:
+	case LIT_STR:
+	case LIT_BYTES:
+		c->value_kind = lit->kind == LIT_BIGINT ? CONST_BIGINT : lit->kind == LIT_STR ? CONST_STR : CONST_BYTES;
+		c->str = A.copy_string(lit->s);
+		c->str_size = lit->s.size();
+		break;
+	}
+
+	c->u_prefix = lit->u_prefix;
+	return c;
+}
+
+/* One STRING leaf, or an atom of adjacent ones, which are joined */
+ast_expr* ast_lowering::strings(const astnode* n) {
+	if (n->node_type == NODE_TYPE_STRING) {
+		return constant(n);
+	}
+
+	children c(kids, n);
+	std::string joined;
+	bool bytes = false;
+	bool u_prefix = false;
+
+	for (size_t i = 0; i < c.size(); ++i) {
+		const literal* lit = literals ? literals->find(c[i]->token_index) : nullptr;
+		literal decoded;
+
+		if (!lit) {
+			decoded = decode_literal(tok(c[i]));
+			lit = &decoded;
+		}
+
+		if (i == 0) {
+			bytes = lit->kind == LIT_BYTES;
+			u_prefix = lit->u_prefix;
+		} else if (bytes != (lit->kind == LIT_BYTES)) {
+			fail(c[i], "cannot mix bytes and nonbytes literals");
+		}
+
+		joined += lit->s;
+	}
+
+	auto e = ast_new<ast_constant>(A, line(n));
+	e->value_kind = bytes ? CONST_BYTES : CONST_STR;
+	e->str = A.copy_string(joined);
+	e->str_size = joined.size();
+	e->u_prefix = u_prefix;
+	return e;
+}
+
+ast_expr* ast_lowering::atom(const astnode* n) {
+	children c(kids, n);
+
+	if (is_tok(c[0], TOK_STRING)) {
+		return strings(n);
+	}
+
+	bool empty = c.size() == 2;
+	const astnode* inner = empty ? nullptr : look(c[1]);
+
+	if (is_tok(c[0], TOK_LPAR)) {
+		if (empty) {
+			return ast_new<ast_tuple>(A, line(n));
+		}
+		if (role(inner) == ROLE_TESTLIST_COMP) {
+			children items(kids, inner);
+			if (items.size() == 2 && role(look(items[1])) == ROLE_COMP_FOR) {
+				return comprehension(items[0], items[1], AST_GENERATOR_EXP, line(n));
+			}
+		}
+		/* A parenthesized expression is the expression, (a, b) is a testlist_comp */
+		return expr(inner);
+	}
+
+	if (is_tok(c[0], TOK_LSQB)) {
+		auto e = ast_new<ast_list_expr>(A, line(n));
+
+		if (empty) {
+			return e;
+		}
+		if (role(inner) == ROLE_TESTLIST_COMP) {
+			children items(kids, inner);
+			if (items.size() == 2 && role(look(items[1])) == ROLE_COMP_FOR) {
+				return comprehension(items[0], items[1], AST_LIST_COMP, line(n));
+			}
+			size_t mark = expr_stack.size();
+			for (size_t i = 0; i < items.size(); i += 2) {
+				expr_stack.push_back(expr(items[i]));
+			}
+			e->elts = take(expr_stack, mark);
+			return e;
+		}
+		e->elts = one(expr(inner));
+		return e;
+	}
+
+	if (is_tok(c[0], TOK_LBRACE)) {
+		if (empty) {
+			return ast_new<ast_dict>(A, line(n));
+		}
+		if (role(inner) == ROLE_DICTORSETMAKER) {
+			return dict_or_set(inner, line(n));
+		}
+		auto e = ast_new<ast_set>(A, line(n));
+		e->elts = one(expr(inner));
+		return e;
+	}
+
+	fail(n, "unexpected atom");
+}
+
+/* A testlist, exprlist, testlist_star_expr or testlist_comp: elements and commas */
+ast_expr* ast_lowering::tuple(const astnode* n) {
+	children c(kids, n);
+	auto e = ast_new<ast_tuple>(A, line(n));
+	size_t mark = expr_stack.size();
+
+	for (size_t i = 0; i < c.size(); i += 2) {
+		expr_stack.push_back(expr(c[i]));
+	}
+
+	e->elts = take(expr_stack, mark);
+	return e;
+}
+
+ast_expr* ast_lowering::atom_expr(const astnode* n) {
+	children c(kids, n);
+	bool await = is_tok(c[0], TOK_AWAIT);
+	size_t i = await ? 1 : 0;
+	ast_expr* e = expr(c[i++]);
+
+	for (; i < c.size(); ++i) {
+		children t(kids, c[i]);
+
+		if (is_tok(t[0], TOK_DOT)) {
+			auto a = ast_new<ast_attribute>(A, line(c[i]));
+			a->value = e;
+			a->attr = name(t[1]);
+			e = a;
+		} else if (is_tok(t[0], TOK_LPAR)) {
+			auto call = ast_new<ast_call>(A, line(n));
+			size_t args = expr_stack.size();
+			size_t kws = keyword_stack.size();
+			call->func = e;
+			if (t.size() > 2) {
+				call_arguments(t[1]);
+			}
+			call->args = take(expr_stack, args);
+			call->keywords = take(keyword_stack, kws);
+			e = call;
+		} else {
+			auto s = ast_new<ast_subscript>(A, line(n));
+			s->value = e;
+			s->slice = subscript(t[1]);
+			e = s;
+		}
+	}
+
+	if (await) {
+		auto a = ast_new<ast_await>(A, line(n));
+		a->value = e;
+		e = a;
+	}
+
+	return e;
+}
+
+/* An arglist or a single argument: push onto expr_stack and keyword_stack */
+void ast_lowering::call_arguments(const astnode* n) {
+	n = look(n);
+
+	if (role(n) == ROLE_ARGLIST) {
+		children c(kids, n);
+		for (size_t i = 0; i < c.size(); i += 2) {
+			call_argument(c[i]);
+		}
+	} else {
+		call_argument(n);
+	}
+}
+
+void ast_lowering::call_argument(const astnode* n) {
+	n = look(n);
+
+	if (role(n) != ROLE_ARGUMENT) {
+		expr_stack.push_back(expr(n));
+		return;
+	}
+
+	children c(kids, n);
+
+	if (is_tok(c[0], TOK_STAR)) {
+		auto e = ast_new<ast_starred>(A, line(n));
+		e->value = expr(c[1]);
+		expr_stack.push_back(e);
+	} else if (is_tok(c[0], TOK_DOUBLESTAR)) {
+		ast_keyword k;
+		k.value = expr(c[1]);
+		keyword_stack.push_back(k);
+	} else if (is_tok(c[1], TOK_EQUAL)) {
+		const astnode* key = look(c[0]);
+		if (!is_tok(key, TOK_NAME)) {
+			fail(n, "expression cannot contain assignment");
+		}
+		ast_keyword k;
+		k.arg = name(key);
+		k.value = expr(c[2]);
+		keyword_stack.push_back(k);
+	} else {
+		/* f(x for x in y) */
+		expr_stack.push_back(comprehension(c[0], c[1], AST_GENERATOR_EXP, line(n)));
+	}
+}
+
+/* The slice of a subscript trailer */
+ast_expr* ast_lowering::subscript(const astnode* n) {
+	n = look(n);
+
+	if (role(n) == ROLE_SUBSCRIPTLIST) {
+		/* x[a:b, c] is a tuple of slices */
+		children c(kids, n);
+		auto e = ast_new<ast_tuple>(A, line(n));
+		size_t mark = expr_stack.size();
+		for (size_t i = 0; i < c.size(); i += 2) {
+			expr_stack.push_back(subscript(c[i]));
+		}
+		e->elts = take(expr_stack, mark);
+		return e;
+	}
+
+	if (is_tok(n, TOK_COLON)) {
+		return ast_new<ast_slice>(A, line(n));
+	}
+
+	if (role(n) != ROLE_SUBSCRIPT) {
+		return expr(n);
+	}
+
+	/* [lower] ':' [upper] [sliceop], sliceop is ':' [step] */
+	children c(kids, n);
+	auto s = ast_new<ast_slice>(A, line(n));
+	size_t i = 0;
+
+	if (!is_tok(c[0], TOK_COLON)) {
+		s->lower = expr(c[i++]);
+	}
+	++i;
+	if (i < c.size() && role(look(c[i])) != ROLE_SLICEOP && !is_tok(look(c[i]), TOK_COLON)) {
+		s->upper = expr(c[i++]);
+	}
+	if (i < c.size() && role(look(c[i])) == ROLE_SLICEOP) {
+		children step(kids, look(c[i]));
+		s->step = expr(step[1]);
+	}
+
+	return s;
+}
+
+ast_expr* ast_lowering::comparison(const astnode* n) {
+	children c(kids, n);
+	auto e = ast_new<ast_compare>(A, line(n));
+	size_t ops = cmpop_stack.size();
+	size_t comparators = expr_stack.size();
+
+	e->left = expr(c[0]);
+
+	for (size_t i = 1; i + 1 < c.size(); i += 2) {
+		const astnode* op = look(c[i]);
+		ast_cmpop cmp;
+
+		if (role(op) == ROLE_COMP_OP) {
+			/* not in, is not */
+			children words(kids, op);
+			cmp = is_kw(words[0], "not") ? CMP_NOT_IN : CMP_IS_NOT;
+		} else {
+			switch (tok(op).tok) {
+			case TOK_LESS: cmp = CMP_LT; break;
+			case TOK_GREATER: cmp = CMP_GT; break;
+			case TOK_EQEQUAL: cmp = CMP_EQ; break;
+			case TOK_GREATEREQUAL: cmp = CMP_GT_E; break;
+			case TOK_LESSEQUAL: cmp = CMP_LT_E; break;
+			case TOK_NOTEQUAL: cmp = CMP_NOT_EQ; break;
+			default:
+				if (is_kw(op, "in")) {
+					cmp = CMP_IN;
+				} else if (is_kw(op, "is")) {
+					cmp = CMP_IS;
+				} else if (tok(op).data == "<>") {
+					cmp = CMP_NOT_EQ;
+				} else {
+					fail(op, "unexpected comparison " + tok(op).data);
+				}
+				break;
+			}
+		}
+
+		cmpop_stack.push_back(cmp);
+		expr_stack.push_back(expr(c[i + 1]));
+	}
+
+	e->ops = take(cmpop_stack, ops);
+	e->comparators = take(expr_stack, comparators);
+	return e;
+}
+
+/* comp_for: 'for' exprlist 'in' or_test [comp_iter], comp_if: 'if' test_nocond [comp_iter] */
+ast_list<ast_comprehension> ast_lowering::generators(const astnode* n) {
+	size_t gens = comp_stack.size();
+	size_t ifs = 0;
+	ast_comprehension cur;
+
+	for (n = look(n); n; ) {
+		children c(kids, n);
+		const astnode* next = c.size() > (role(n) == ROLE_COMP_FOR ? 4u : 2u) ? look(c[c.size() - 1]) : nullptr;
+
+		if (role(n) == ROLE_COMP_FOR) {
+			if (cur.target) {
+				cur.ifs = take(expr_stack, ifs);
+				comp_stack.push_back(cur);
+			}
+			cur = ast_comprehension();
+			cur.target = target(c[1], CTX_STORE);
+			cur.iter = expr(c[3]);
+			ifs = expr_stack.size();
+		} else {
+			expr_stack.push_back(expr(c[1]));
+		}
+
+		n = next;
+	}
+
+	cur.ifs = take(expr_stack, ifs);
+	comp_stack.push_back(cur);
+	return take(comp_stack, gens);
+}
+
+/* at is the line of the opening bracket, which is the line of the comprehension's scope */
+ast_expr* ast_lowering::comprehension(const astnode* elt, const astnode* comp_for, ast_kind kind, uint32_t at) {
+	ast_comp* e;
+
+	switch (kind) {
+	case AST_LIST_COMP: e = ast_new<ast_list_comp>(A, at); break;
+	case AST_SET_COMP: e = ast_new<ast_set_comp>(A, at); break;
+	default: e = ast_new<ast_generator_exp>(A, at); break;
+	}
+
+	e->elt = expr(elt);
+	e->generators = generators(comp_for);
+	return e;
+}
+
+ast_expr* ast_lowering::dict_or_set(const astnode* n, uint32_t at) {
+	children c(kids, n);
+	bool dict = is_tok(c[0], TOK_DOUBLESTAR) || (c.size() > 1 && is_tok(c[1], TOK_COLON));
+
+	if (!dict) {
+		if (c.size() == 2 && role(look(c[1])) == ROLE_COMP_FOR) {
+			return comprehension(c[0], c[1], AST_SET_COMP, at);
+		}
+		auto e = ast_new<ast_set>(A, at);
+		size_t mark = expr_stack.size();
+		for (size_t i = 0; i < c.size(); i += 2) {
+			expr_stack.push_back(expr(c[i]));
+		}
+		e->elts = take(expr_stack, mark);
+		return e;
+	}
+
+	if (c.size() == 4 && role(look(c[3])) == ROLE_COMP_FOR) {
+		auto e = ast_new<ast_dict_comp>(A, at);
+		e->key = expr(c[0]);
+		e->value = expr(c[2]);
+		e->generators = generators(c[3]);
+		return e;
+	}
+
+	/* Keys and values go on the stack in pairs, a nullptr key for **mapping */
+	size_t mark = expr_stack.size();
+
+	for (size_t i = 0; i < c.size(); ) {
+		if (is_tok(c[i], TOK_DOUBLESTAR)) {
+			expr_stack.push_back(nullptr);
+			expr_stack.push_back(expr(c[i + 1]));
+			i += 2;
+		} else {
+			expr_stack.push_back(expr(c[i]));
+			expr_stack.push_back(expr(c[i + 2]));
+			i += 3;
+		}
+		i += (i < c.size() && is_tok(c[i], TOK_COMMA));
+	}
+
+	auto e = ast_new<ast_dict>(A, at);
+	size_t pairs = (expr_stack.size() - mark) / 2;
+	ast_expr** keys = static_cast<ast_expr**>(A.allocate(sizeof(ast_expr*) * pairs, alignof(ast_expr*)));
+	ast_expr** values = static_cast<ast_expr**>(A.allocate(sizeof(ast_expr*) * pairs, alignof(ast_expr*)));
+
+	for (size_t i = 0; i < pairs; ++i) {
+		keys[i] = expr_stack[mark + 2 * i];
+		values[i] = expr_stack[mark + 2 * i + 1];
+	}
+	expr_stack.resize(mark);
+
+	e->keys.items = keys;
+	e->keys.count = static_cast<uint32_t>(pairs);
+	e->values.items = values;
+	e->values.count = static_cast<uint32_t>(pairs);
+	return e;
+}
+
+ast_expr* ast_lowering::lambda(const astnode* n) {
+	children c(kids, n);
+	auto e = ast_new<ast_lambda>(A, line(n));
+
+	e->args = arguments(c.size() > 3 ? c[1] : nullptr);
+	e->body = expr(c[c.size() - 1]);
+	return e;
+}
+
+/* 'yield' [yield_arg], yield_arg is 'from' test or a testlist */
+ast_expr* ast_lowering::yield(const astnode* n) {
+	children c(kids, n);
+	const astnode* arg = look(c[1]);
+
+	if (role(arg) == ROLE_YIELD_ARG) {
+		children parts(kids, arg);
+		auto e = ast_new<ast_yield_from>(A, line(n));
+		e->value = expr(parts[1]);
+		return e;
+	}
+
+	auto e = ast_new<ast_yield>(A, line(n));
+	e->value = expr(arg);
+	return e;
+}
+
+ast_module* lower_module(const ast_tree& tree, const std::vector<token>& toks, const literal_table* literals, arena& A,
+		lazy_suites* lazy) {
+	if (!tree.root()) {
+		return ast_new<ast_module>(A, 1);
+	}
+	return ast_lowering(toks, literals, A, lazy).module(tree.root());
+}
+
+} /* namespace arbusto */
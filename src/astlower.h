@@ -0,0 +1,38 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef ASTLOWER_H_
+#define ASTLOWER_H_
+
+#include <vector>
+
+#include "tokenizer.h"
+#include "astnode.h"
+#include "ast.h"
+#include "arena.h"
+#include "literal.h"
+
+namespace arbusto {
+
+class lazy_suites;
+
+/*
+ * The ast of a file_input tree, with its nodes in A. The tree may come
+ * from a parser built with or without --optimize and --collapse: rules
+ * with a single child are looked through. NUMBER and STRING values are
+ * taken from literals when it has them, see tokenizer::literals, and
+ * decoded from toks otherwise. NODE_TYPE_LAZY suites are parsed through
+ * lazy, which is needed if the tree has any.
+ *
+ * Throws std::runtime_error with the line for what the grammar accepts but
+ * Python does not, like assigning to a call, and for NODE_TYPE_ERROR.
+ */
+ast_module* lower_module(const ast_tree& tree, const std::vector<token>& toks, const literal_table* literals, arena& A,
+		lazy_suites* lazy = nullptr);
+
+} /* namespace arbusto */
+
+#endif /* ASTLOWER_H_ */
@@ -0,0 +1,42 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include "astnode.h"
+
+namespace arbusto {
+
+void ast_tree::assign_postorder(const astnode* first, const astnode* last) {
+	nodes.clear();
+
+	if (first == last) {
+		return;
+	}
+
+	nodes.reserve((last - 1)->size);
+
+	/*
+	 * Depth first from the root, the children of a postorder node are
+	 * found walking back from it, last child first. Pushing them in that
+	 * order leaves the first child on top.
+	 */
+	std::vector<size_t> pending;
+	pending.push_back(last - first - 1);
+
+	while (!pending.empty()) {
+		size_t n = pending.back();
+		pending.pop_back();
+
+		nodes.push_back(first[n]);
+
+		/* The subtree of n is [n + 1 - size, n], the children end at n */
+		size_t begin = n + 1 - first[n].size;
+		for (size_t end = n; end > begin; end -= first[end - 1].size) {
+			pending.push_back(end - 1);
+		}
+	}
+}
+
+} /* namespace arbusto */
@@ -4,11 +4,97 @@
  * Licence: BSD
  */
 
+#ifndef ASTNODE_H_
+#define ASTNODE_H_
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <iterator>
+
+#include "tokenizer.h"
+
+namespace arbusto {
+
+/*
+ * Leafs holding a token, leafs standing for a suite that was skipped by a
+ * lazy parse, and nodes over the tokens error recovery skipped. Rule nodes
+ * use the NODE_RULE_ values after them.
+ */
+enum { NODE_TYPE_STRING = 0, NODE_TYPE_LAZY = 1, NODE_TYPE_ERROR = 2 };
+
+class astnode_children;
+
+/*
+ * A node of a flat tree. The nodes of a tree live in one array in preorder,
+ * so the children of a node are the nodes right after it, and its next
+ * sibling is size nodes away. No pointers, no per node allocation.
+ */
 struct astnode {
-    astnode(int node_type_) : node_type(node_type_) {}
-    astnode(int node_type_, token_t t) : node_type(node_type_), token(t) {}
+    astnode(int node_type_, size_t token_index_, size_t size_)
+        : node_type(node_type_), token_index(static_cast<uint32_t>(token_index_)), size(static_cast<uint32_t>(size_)) {}
+
+    bool is_leaf() const { return size == 1; }
+
+    const astnode* next_sibling() const { return this + size; }
 
-    int node_type;
-    token_t token;
-    std::vector<astnode*> childs;
+    inline astnode_children children() const;
+
+    int32_t node_type;
+    uint32_t token_index; /* in the parsed token stream: the leaf token, or the first token of a rule */
+    uint32_t size; /* nodes in the subtree, this one included */
 };
+
+/* Forward iteration over the direct children of a node */
+class astnode_children {
+public:
+    class iterator : public std::iterator<std::forward_iterator_tag, const astnode> {
+    public:
+        explicit iterator(const astnode* p_) : p(p_) {}
+
+        const astnode& operator*() const { return *p; }
+        const astnode* operator->() const { return p; }
+        iterator& operator++() { p += p->size; return *this; }
+        iterator operator++(int) { iterator r(*this); p += p->size; return r; }
+        bool operator==(const iterator& o) const { return p == o.p; }
+        bool operator!=(const iterator& o) const { return p != o.p; }
+
+    private:
+        const astnode* p;
+    };
+
+    explicit astnode_children(const astnode* parent_) : parent(parent_) {}
+
+    iterator begin() const { return iterator(parent + 1); }
+    iterator end() const { return iterator(parent + parent->size); }
+    bool empty() const { return parent->size == 1; }
+
+private:
+    const astnode* parent;
+};
+
+inline astnode_children astnode::children() const {
+    return astnode_children(this);
+}
+
+/*
+ * A parsed tree, the root is nodes[0]. Passes that do not care about the
+ * shape just scan the array; the depth of each node can be tracked with a
+ * stack of subtree ends.
+ */
+class ast_tree {
+public:
+    const astnode* root() const { return nodes.empty() ? nullptr : nodes.data(); }
+
+    /*
+     * Rebuild from nodes in postorder, the order parser_session makes them:
+     * every subtree is followed by its root. Takes the last tree in the range.
+     */
+    void assign_postorder(const astnode* first, const astnode* last);
+
+    std::vector<astnode> nodes;
+};
+
+} /* namespace arbusto */
+
+#endif /* ASTNODE_H_ */
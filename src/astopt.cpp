@@ -0,0 +1,596 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+#include "astopt.h"
+#include "runtime.h"
+
+namespace arbusto {
+
+/* The largest results folded, as CPython's MAX_INT_SIZE and MAX_STR_SIZE */
+static const uint64_t MAX_INT_BITS = 128;
+static const size_t MAX_STR_SIZE = 4096;
+
+/* The value of the constant e, false for the other nodes and the kinds the runtime has no value for */
+static bool constant_value(const ast_expr* e, value& out) {
+	auto c = ast_cast<ast_constant>(e);
+	if (!c) {
+		return false;
+	}
+	switch (c->value_kind) {
+	case CONST_NONE: out = none(); return true;
+	case CONST_BOOL: out = make_bool(c->i != 0); return true;
+	case CONST_INT: out = make_int(c->i); return true;
+	case CONST_FLOAT: out = make_float(c->f); return true;
+	case CONST_STR: out = make_str(std::string(c->str, c->str_size)); return true;
+	case CONST_BIGINT:
+		{
+			std::string digits(c->str, c->str_size);
+			bool neg = !digits.empty() && digits[0] == '-';
+			bigint i;
+			if (!bigint::parse(neg ? digits.substr(1) : digits, 10, i)) {
+				return false;
+			}
+			out = make_int(neg ? -i : i);
+		}
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Whether op on x and y is cheap enough to do, the size of its result is checked after */
+static bool cheap(ast_operator op, const value& x, const value& y) {
+	if (is_str(x) || is_str(y)) {
+		if (op == OP_MOD) {
+			/* Formatting, which a width can make as large as it likes */
+			return false;
+		}
+		if (op == OP_MULT && is_intlike(is_str(x) ? y : x)) {
+			size_t size = str_of(is_str(x) ? x : y).size();
+			bigint n = bigint_of(is_str(x) ? y : x);
+			int64_t k;
+			return size == 0 || n.negative() || (n.to_int64(k) && static_cast<uint64_t>(k) <= MAX_STR_SIZE / size);
+		}
+		return true;
+	}
+	if (!is_intlike(x) || !is_intlike(y)) {
+		return true;
+	}
+
+	bigint a = bigint_of(x);
+	bigint b = bigint_of(y);
+	int64_t k;
+	switch (op) {
+	case OP_POW:
+		/* 0, 1 and -1 stay small, anything else has at least bits - 1 bits per unit of exponent */
+		return b.negative() || a.bit_length() <= 1
+				|| (b.to_int64(k) && k <= static_cast<int64_t>(MAX_INT_BITS) && (a.bit_length() - 1) * k <= MAX_INT_BITS);
+	case OP_LSHIFT:
+		return a.is_zero() || b.negative() || (b.to_int64(k) && k <= static_cast<int64_t>(MAX_INT_BITS));
+	default:
+		return true;
+	}
+}
+
+/* The comparison of constants a op b, false if it is not folded */
+static bool compare_constants(ast_cmpop op, const value& a, const value& b, bool& out) {
+	switch (op) {
+	case CMP_EQ: out = compare(CMP_OP_EQ, a, b); return true;
+	case CMP_NOT_EQ: out = compare(CMP_OP_NE, a, b); return true;
+	case CMP_LT: out = compare(CMP_OP_LT, a, b); return true;
+	case CMP_LT_E: out = compare(CMP_OP_LE, a, b); return true;
+	case CMP_GT: out = compare(CMP_OP_GT, a, b); return true;
+	case CMP_GT_E: out = compare(CMP_OP_GE, a, b); return true;
+	case CMP_IN: out = contains(b, a); return true;
+	case CMP_NOT_IN: out = !contains(b, a); return true;
+	default:
+		/* Identity of constants is up to the implementation */
+		return false;
+	}
+}
+
+static bool terminates(const ast_stmt* s) {
+	return s->kind == AST_RETURN || s->kind == AST_RAISE || s->kind == AST_BREAK || s->kind == AST_CONTINUE;
+}
+
+class ast_optimizer {
+public:
+	explicit ast_optimizer(arena& A_) : A(A_) {}
+
+	void module(ast_module* m) {
+		body(m->body);
+	}
+
+private:
+	arena& A;
+
+	template <class T>
+	void replace(ast_list<T>& l, const std::vector<T>& items) {
+		l.items = A.copy(items.data(), items.size());
+		l.count = static_cast<uint32_t>(items.size());
+	}
+
+	/* Statements */
+
+	void body(ast_body& b) {
+		std::vector<ast_stmt*> out;
+		for (auto s : b) {
+			stmt(s, out);
+			if (!out.empty() && terminates(out.back())) {
+				break;
+			}
+		}
+
+		if (out.size() == b.size() && std::equal(out.begin(), out.end(), b.begin())) {
+			return;
+		}
+		if (out.empty() && !b.empty()) {
+			out.push_back(ast_new<ast_pass>(A, b[0]->line));
+		}
+		replace(b, out);
+	}
+
+	/* Append to out what s becomes */
+	void stmt(ast_stmt* s, std::vector<ast_stmt*>& out) {
+		switch (s->kind) {
+		case AST_FUNCTION_DEF:
+			{
+				auto n = static_cast<ast_function_def*>(s);
+				exprs(n->decorator_list);
+				arguments(n->args);
+				n->returns = expr(n->returns);
+				body(n->body);
+			}
+			break;
+		case AST_CLASS_DEF:
+			{
+				auto n = static_cast<ast_class_def*>(s);
+				exprs(n->decorator_list);
+				exprs(n->bases);
+				keywords(n->keywords);
+				body(n->body);
+			}
+			break;
+		case AST_RETURN:
+			{
+				auto n = static_cast<ast_return*>(s);
+				n->value = expr(n->value);
+			}
+			break;
+		case AST_DELETE:
+			exprs(static_cast<ast_delete*>(s)->targets);
+			break;
+		case AST_ASSIGN:
+			{
+				auto n = static_cast<ast_assign*>(s);
+				exprs(n->targets);
+				n->value = expr(n->value);
+			}
+			break;
+		case AST_AUG_ASSIGN:
+			{
+				auto n = static_cast<ast_aug_assign*>(s);
+				n->target = expr(n->target);
+				n->value = expr(n->value);
+			}
+			break;
+		case AST_FOR:
+			{
+				auto n = static_cast<ast_for*>(s);
+				n->target = expr(n->target);
+				n->iter = expr(n->iter);
+				body(n->body);
+				body(n->orelse);
+			}
+			break;
+		case AST_WHILE:
+			{
+				auto n = static_cast<ast_while*>(s);
+				n->test = expr(n->test);
+				body(n->body);
+				body(n->orelse);
+				value test;
+				if (constant_value(n->test, test) && !truthy(test)) {
+					out.insert(out.end(), n->orelse.begin(), n->orelse.end());
+					return;
+				}
+			}
+			break;
+		case AST_IF:
+			{
+				auto n = static_cast<ast_if*>(s);
+				n->test = expr(n->test);
+				body(n->body);
+				body(n->orelse);
+				value test;
+				if (constant_value(n->test, test)) {
+					const ast_body& taken = truthy(test) ? n->body : n->orelse;
+					out.insert(out.end(), taken.begin(), taken.end());
+					return;
+				}
+			}
+			break;
+		case AST_WITH:
+			{
+				auto n = static_cast<ast_with*>(s);
+				std::vector<ast_with_item> items(n->items.begin(), n->items.end());
+				for (auto& w : items) {
+					w.context_expr = expr(w.context_expr);
+					w.optional_vars = expr(w.optional_vars);
+				}
+				replace(n->items, items);
+				body(n->body);
+			}
+			break;
+		case AST_RAISE:
+			{
+				auto n = static_cast<ast_raise*>(s);
+				n->exc = expr(n->exc);
+				n->cause = expr(n->cause);
+			}
+			break;
+		case AST_TRY:
+			{
+				auto n = static_cast<ast_try*>(s);
+				body(n->body);
+				for (auto h : n->handlers) {
+					h->type = expr(h->type);
+					body(h->body);
+				}
+				body(n->orelse);
+				body(n->finalbody);
+			}
+			break;
+		case AST_ASSERT:
+			{
+				auto n = static_cast<ast_assert*>(s);
+				n->test = expr(n->test);
+				n->msg = expr(n->msg);
+			}
+			break;
+		case AST_EXPR:
+			{
+				auto n = static_cast<ast_expr_stmt*>(s);
+				n->value = expr(n->value);
+			}
+			break;
+		default:
+			break;
+		}
+		out.push_back(s);
+	}
+
+	void arguments(ast_arguments* a) {
+		for (auto arg : a->args) {
+			arg->annotation = expr(arg->annotation);
+		}
+		for (auto arg : a->kwonlyargs) {
+			arg->annotation = expr(arg->annotation);
+		}
+		if (a->vararg) {
+			a->vararg->annotation = expr(a->vararg->annotation);
+		}
+		if (a->kwarg) {
+			a->kwarg->annotation = expr(a->kwarg->annotation);
+		}
+		exprs(a->kw_defaults);
+		exprs(a->defaults);
+	}
+
+	void keywords(ast_list<ast_keyword>& l) {
+		std::vector<ast_keyword> items(l.begin(), l.end());
+		for (auto& k : items) {
+			k.value = expr(k.value);
+		}
+		replace(l, items);
+	}
+
+	void generators(ast_list<ast_comprehension>& l) {
+		std::vector<ast_comprehension> items(l.begin(), l.end());
+		for (auto& g : items) {
+			g.target = expr(g.target);
+			g.iter = expr(g.iter);
+			exprs(g.ifs);
+		}
+		replace(l, items);
+	}
+
+	/* Expressions */
+
+	void exprs(ast_exprs& l) {
+		std::vector<ast_expr*> items(l.begin(), l.end());
+		bool changed = false;
+		for (auto& e : items) {
+			ast_expr* f = expr(e);
+			changed |= f != e;
+			e = f;
+		}
+		if (changed) {
+			replace(l, items);
+		}
+	}
+
+	/* What e becomes, e itself with its parts folded if it is not a constant */
+	ast_expr* expr(ast_expr* e) {
+		if (!e) {
+			return nullptr;
+		}
+
+		switch (e->kind) {
+		case AST_BOOL_OP:
+			{
+				auto n = static_cast<ast_bool_op*>(e);
+				exprs(n->values);
+				return bool_op(n);
+			}
+		case AST_BIN_OP:
+			{
+				auto n = static_cast<ast_bin_op*>(e);
+				n->left = expr(n->left);
+				n->right = expr(n->right);
+				return bin_op(n);
+			}
+		case AST_UNARY_OP:
+			{
+				auto n = static_cast<ast_unary_op*>(e);
+				n->operand = expr(n->operand);
+				return unary_op(n);
+			}
+		case AST_LAMBDA:
+			{
+				auto n = static_cast<ast_lambda*>(e);
+				arguments(n->args);
+				n->body = expr(n->body);
+			}
+			break;
+		case AST_IF_EXP:
+			{
+				auto n = static_cast<ast_if_exp*>(e);
+				n->test = expr(n->test);
+				n->body = expr(n->body);
+				n->orelse = expr(n->orelse);
+				value test;
+				if (constant_value(n->test, test)) {
+					return truthy(test) ? n->body : n->orelse;
+				}
+			}
+			break;
+		case AST_DICT:
+			{
+				auto n = static_cast<ast_dict*>(e);
+				exprs(n->keys);
+				exprs(n->values);
+			}
+			break;
+		case AST_SET:
+			exprs(static_cast<ast_set*>(e)->elts);
+			break;
+		case AST_LIST_COMP:
+		case AST_SET_COMP:
+		case AST_GENERATOR_EXP:
+			{
+				auto n = static_cast<ast_comp*>(e);
+				n->elt = expr(n->elt);
+				generators(n->generators);
+			}
+			break;
+		case AST_DICT_COMP:
+			{
+				auto n = static_cast<ast_dict_comp*>(e);
+				n->key = expr(n->key);
+				n->value = expr(n->value);
+				generators(n->generators);
+			}
+			break;
+		case AST_AWAIT:
+			{
+				auto n = static_cast<ast_await*>(e);
+				n->value = expr(n->value);
+			}
+			break;
+		case AST_YIELD:
+			{
+				auto n = static_cast<ast_yield*>(e);
+				n->value = expr(n->value);
+			}
+			break;
+		case AST_YIELD_FROM:
+			{
+				auto n = static_cast<ast_yield_from*>(e);
+				n->value = expr(n->value);
+			}
+			break;
+		case AST_COMPARE:
+			{
+				auto n = static_cast<ast_compare*>(e);
+				n->left = expr(n->left);
+				exprs(n->comparators);
+				return compare_op(n);
+			}
+		case AST_CALL:
+			{
+				auto n = static_cast<ast_call*>(e);
+				n->func = expr(n->func);
+				exprs(n->args);
+				keywords(n->keywords);
+			}
+			break;
+		case AST_ATTRIBUTE:
+			{
+				auto n = static_cast<ast_attribute*>(e);
+				n->value = expr(n->value);
+			}
+			break;
+		case AST_SUBSCRIPT:
+			{
+				auto n = static_cast<ast_subscript*>(e);
+				n->value = expr(n->value);
+				n->slice = expr(n->slice);
+			}
+			break;
+		case AST_STARRED:
+			{
+				auto n = static_cast<ast_starred*>(e);
+				n->value = expr(n->value);
+			}
+			break;
+		case AST_NAME:
+			{
+				auto n = static_cast<ast_name*>(e);
+				if (n->ctx == CTX_LOAD && std::strcmp(n->id, "__debug__") == 0) {
+					return constant(make_bool(true), e->line);
+				}
+			}
+			break;
+		case AST_LIST:
+			exprs(static_cast<ast_list_expr*>(e)->elts);
+			break;
+		case AST_TUPLE:
+			/* A tuple of constants is one constant of the pool */
+			exprs(static_cast<ast_tuple*>(e)->elts);
+			break;
+		case AST_SLICE:
+			{
+				auto n = static_cast<ast_slice*>(e);
+				n->lower = expr(n->lower);
+				n->upper = expr(n->upper);
+				n->step = expr(n->step);
+			}
+			break;
+		default:
+			break;
+		}
+		return e;
+	}
+
+	/* The constant node of v, nullptr if there is none or it is over the limits */
+	ast_expr* constant(const value& v, uint32_t line) {
+		ast_constant* c = ast_new<ast_constant>(A, line);
+		if (v.is_none()) {
+			c->value_kind = CONST_NONE;
+		} else if (v.is_bool()) {
+			c->value_kind = CONST_BOOL;
+			c->i = v.bool_value();
+		} else if (is_int(v)) {
+			bigint i = bigint_of(v);
+			if (i.bit_length() > MAX_INT_BITS) {
+				return nullptr;
+			}
+			if (i.to_int64(c->i)) {
+				c->value_kind = CONST_INT;
+			} else {
+				std::string digits = i.to_string();
+				c->value_kind = CONST_BIGINT;
+				c->str = A.copy_string(digits);
+				c->str_size = digits.size();
+			}
+		} else if (is_float(v)) {
+			c->value_kind = CONST_FLOAT;
+			c->f = float_of(v);
+		} else if (is_str(v)) {
+			const std::string& s = str_of(v);
+			if (s.size() > MAX_STR_SIZE) {
+				return nullptr;
+			}
+			c->value_kind = CONST_STR;
+			c->str = A.copy_string(s);
+			c->str_size = s.size();
+		} else {
+			return nullptr;
+		}
+		return c;
+	}
+
+	ast_expr* bin_op(ast_bin_op* n) {
+		value x, y;
+		if (!constant_value(n->left, x) || !constant_value(n->right, y) || !cheap(n->op, x, y)) {
+			return n;
+		}
+		try {
+			/* binary_op lists the operators in the order of ast_operator */
+			ast_expr* c = constant(binary(static_cast<binary_op>(n->op), x, y), n->line);
+			return c ? c : n;
+		} catch (py_exception&) {
+			return n;
+		}
+	}
+
+	ast_expr* unary_op(ast_unary_op* n) {
+		value x;
+		if (!constant_value(n->operand, x)) {
+			return n;
+		}
+		try {
+			value r;
+			switch (n->op) {
+			case UOP_INVERT: r = invert(x); break;
+			case UOP_NOT: r = make_bool(!truthy(x)); break;
+			case UOP_UADD: r = positive(x); break;
+			case UOP_USUB: r = negative(x); break;
+			}
+			ast_expr* c = constant(r, n->line);
+			return c ? c : n;
+		} catch (py_exception&) {
+			return n;
+		}
+	}
+
+	ast_expr* compare_op(ast_compare* n) {
+		std::vector<value> operands(n->comparators.size() + 1);
+		if (!constant_value(n->left, operands[0])) {
+			return n;
+		}
+		for (size_t i = 0; i < n->comparators.size(); ++i) {
+			if (!constant_value(n->comparators[i], operands[i + 1])) {
+				return n;
+			}
+		}
+
+		/* Like the chain, stopping at the first false one */
+		bool result = true;
+		try {
+			for (size_t i = 0; i < n->ops.size() && result; ++i) {
+				if (!compare_constants(n->ops[i], operands[i], operands[i + 1], result)) {
+					return n;
+				}
+			}
+		} catch (py_exception&) {
+			return n;
+		}
+		return constant(make_bool(result), n->line);
+	}
+
+	/* The constants that do not decide it go away, the first one that does is the value */
+	ast_expr* bool_op(ast_bool_op* n) {
+		std::vector<ast_expr*> kept;
+		for (size_t i = 0; i < n->values.size(); ++i) {
+			ast_expr* e = n->values[i];
+			value v;
+			if (!kept.empty() || i + 1 == n->values.size() || !constant_value(e, v)) {
+				kept.push_back(e);
+			} else if (truthy(v) == (n->op == BOOL_OR)) {
+				return e;
+			}
+		}
+		if (kept.size() == 1) {
+			return kept[0];
+		}
+		if (kept.size() != n->values.size()) {
+			replace(n->values, kept);
+		}
+		return n;
+	}
+};
+
+void optimize_ast(ast_module* m, arena& A) {
+	ast_optimizer(A).module(m);
+}
+
+} /* namespace arbusto */
@@ -0,0 +1,34 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef ASTOPT_H_
+#define ASTOPT_H_
+
+#include "ast.h"
+#include "arena.h"
+
+namespace arbusto {
+
+/*
+ * Rewrites m in place, with new nodes from A, as CPython's ast_opt.c
+ * does: operators, comparisons, and/or and conditional expressions of
+ * constants become their constant, __debug__ becomes True, an if or a
+ * while whose test is a constant keeps only the branch that runs, and the
+ * statements after a return, raise, break or continue go away.
+ *
+ * Operations are done by the runtime, so they give what running them
+ * would, and one that raises is left for run time to raise. None makes an
+ * int over 128 bits or a str over 4096 bytes, so 2 ** 10000 or 'x' * 10**9
+ * stay in the code as they are.
+ *
+ * It runs after the symtable: a name bound only in removed code is still
+ * a local, as it is in CPython.
+ */
+void optimize_ast(ast_module* m, arena& A);
+
+} /* namespace arbusto */
+
+#endif /* ASTOPT_H_ */
@@ -0,0 +1,507 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <climits>
+
+#include "bigint.h"
+
+namespace arbusto {
+
+/* Magnitudes, 32-bit digits least significant first */
+
+typedef std::vector<uint32_t> digits;
+
+static void trim_digits(digits& m) {
+	while (!m.empty() && !m.back()) {
+		m.pop_back();
+	}
+}
+
+static int compare_digits(const digits& a, const digits& b) {
+	if (a.size() != b.size()) {
+		return a.size() < b.size() ? -1 : 1;
+	}
+	for (size_t i = a.size(); i-- > 0; ) {
+		if (a[i] != b[i]) {
+			return a[i] < b[i] ? -1 : 1;
+		}
+	}
+	return 0;
+}
+
+static digits add_digits(const digits& a, const digits& b) {
+	const digits& x = a.size() >= b.size() ? a : b;
+	const digits& y = a.size() >= b.size() ? b : a;
+	digits r(x.size() + 1);
+	uint64_t carry = 0;
+
+	for (size_t i = 0; i < x.size(); ++i) {
+		uint64_t s = static_cast<uint64_t>(x[i]) + (i < y.size() ? y[i] : 0) + carry;
+		r[i] = static_cast<uint32_t>(s);
+		carry = s >> 32;
+	}
+	r[x.size()] = static_cast<uint32_t>(carry);
+	trim_digits(r);
+	return r;
+}
+
+/* a - b, a is not smaller than b */
+static digits sub_digits(const digits& a, const digits& b) {
+	digits r(a.size());
+	uint32_t borrow = 0;
+
+	for (size_t i = 0; i < a.size(); ++i) {
+		uint64_t d = static_cast<uint64_t>(a[i]) - (i < b.size() ? b[i] : 0) - borrow;
+		r[i] = static_cast<uint32_t>(d);
+		borrow = (d >> 32) != 0;
+	}
+	trim_digits(r);
+	return r;
+}
+
+static digits mul_digits(const digits& a, const digits& b) {
+	if (a.empty() || b.empty()) {
+		return digits();
+	}
+
+	digits r(a.size() + b.size());
+	for (size_t i = 0; i < a.size(); ++i) {
+		uint64_t carry = 0;
+		for (size_t j = 0; j < b.size(); ++j) {
+			uint64_t t = static_cast<uint64_t>(a[i]) * b[j] + r[i + j] + carry;
+			r[i + j] = static_cast<uint32_t>(t);
+			carry = t >> 32;
+		}
+		r[i + b.size()] = static_cast<uint32_t>(carry);
+	}
+	trim_digits(r);
+	return r;
+}
+
+/* a = a / d, the remainder returned; d is not zero */
+static uint32_t divmod_digit(digits& a, uint32_t d) {
+	uint64_t rem = 0;
+
+	for (size_t i = a.size(); i-- > 0; ) {
+		uint64_t cur = rem << 32 | a[i];
+		a[i] = static_cast<uint32_t>(cur / d);
+		rem = cur % d;
+	}
+	trim_digits(a);
+	return static_cast<uint32_t>(rem);
+}
+
+/* Truncated u / v and u % v, Knuth's algorithm D; v is not zero */
+static void divmod_digits(const digits& u, const digits& v, digits& q, digits& r) {
+	if (compare_digits(u, v) < 0) {
+		q.clear();
+		r = u;
+		return;
+	}
+	if (v.size() == 1) {
+		q = u;
+		uint32_t rem = divmod_digit(q, v[0]);
+		r.assign(rem ? 1 : 0, rem);
+		return;
+	}
+
+	/* Normalize so the top digit of v has its high bit set, then the estimates of qhat are off by 2 at most */
+	size_t m = u.size();
+	size_t n = v.size();
+	int s = __builtin_clz(v[n - 1]);
+	digits vn(n);
+	digits un(m + 1);
+
+	for (size_t i = n - 1; i > 0; --i) {
+		vn[i] = v[i] << s | (s ? v[i - 1] >> (32 - s) : 0);
+	}
+	vn[0] = v[0] << s;
+	un[m] = s ? u[m - 1] >> (32 - s) : 0;
+	for (size_t i = m - 1; i > 0; --i) {
+		un[i] = u[i] << s | (s ? u[i - 1] >> (32 - s) : 0);
+	}
+	un[0] = u[0] << s;
+
+	const uint64_t base = uint64_t(1) << 32;
+	q.assign(m - n + 1, 0);
+
+	for (size_t j = m - n + 1; j-- > 0; ) {
+		uint64_t num = static_cast<uint64_t>(un[j + n]) << 32 | un[j + n - 1];
+		uint64_t qhat = num / vn[n - 1];
+		uint64_t rhat = num % vn[n - 1];
+
+		while (qhat >= base || qhat * vn[n - 2] > (rhat << 32 | un[j + n - 2])) {
+			--qhat;
+			rhat += vn[n - 1];
+			if (rhat >= base) {
+				break;
+			}
+		}
+
+		/* un[j..j+n] -= qhat * vn */
+		int64_t borrow = 0;
+		int64_t t;
+		for (size_t i = 0; i < n; ++i) {
+			uint64_t p = qhat * vn[i];
+			t = static_cast<int64_t>(un[i + j]) - borrow - static_cast<int64_t>(p & 0xffffffff);
+			un[i + j] = static_cast<uint32_t>(t);
+			borrow = static_cast<int64_t>(p >> 32) - (t >> 32);
+		}
+		t = static_cast<int64_t>(un[j + n]) - borrow;
+		un[j + n] = static_cast<uint32_t>(t);
+
+		q[j] = static_cast<uint32_t>(qhat);
+		if (t < 0) {
+			/* qhat was one too many, add v back */
+			--q[j];
+			uint64_t carry = 0;
+			for (size_t i = 0; i < n; ++i) {
+				uint64_t sum = static_cast<uint64_t>(un[i + j]) + vn[i] + carry;
+				un[i + j] = static_cast<uint32_t>(sum);
+				carry = sum >> 32;
+			}
+			un[j + n] += static_cast<uint32_t>(carry);
+		}
+	}
+
+	r.assign(n, 0);
+	for (size_t i = 0; i < n; ++i) {
+		r[i] = un[i] >> s | (s ? un[i + 1] << (32 - s) : 0);
+	}
+	trim_digits(q);
+	trim_digits(r);
+}
+
+/* bigint */
+
+bigint::bigint(int64_t v) : neg(v < 0) {
+	uint64_t m = neg ? 0 - static_cast<uint64_t>(v) : static_cast<uint64_t>(v);
+	mag.push_back(static_cast<uint32_t>(m));
+	mag.push_back(static_cast<uint32_t>(m >> 32));
+	trim();
+}
+
+void bigint::trim() {
+	trim_digits(mag);
+	if (mag.empty()) {
+		neg = false;
+	}
+}
+
+static unsigned digit_value(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'z') {
+		return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'Z') {
+		return c - 'A' + 10;
+	}
+	return 99;
+}
+
+bool bigint::parse(const std::string& s, unsigned base, bigint& out) {
+	out = bigint();
+	if (s.empty()) {
+		return false;
+	}
+
+	for (char c : s) {
+		unsigned d = digit_value(c);
+		if (d >= base) {
+			return false;
+		}
+		uint64_t carry = d;
+		for (auto& x : out.mag) {
+			uint64_t t = static_cast<uint64_t>(x) * base + carry;
+			x = static_cast<uint32_t>(t);
+			carry = t >> 32;
+		}
+		if (carry) {
+			out.mag.push_back(static_cast<uint32_t>(carry));
+		}
+	}
+	out.trim();
+	return true;
+}
+
+bigint bigint::from_double(double d) {
+	d = std::trunc(d);
+	if (std::fabs(d) < 1) {
+		return bigint();
+	}
+
+	/* d is m * 2^e with m an integer of 53 bits */
+	int e;
+	double f = std::frexp(std::fabs(d), &e);
+	bigint r(static_cast<int64_t>(std::ldexp(f, 53)));
+	r = e >= 53 ? r << (e - 53) : r >> (53 - e);
+	r.neg = d < 0;
+	return r;
+}
+
+bool bigint::to_int64(int64_t& out) const {
+	if (mag.size() > 2) {
+		return false;
+	}
+
+	uint64_t m = 0;
+	for (size_t i = mag.size(); i-- > 0; ) {
+		m = m << 32 | mag[i];
+	}
+	if (neg ? m > uint64_t(1) << 63 : m > static_cast<uint64_t>(INT64_MAX)) {
+		return false;
+	}
+	out = neg ? static_cast<int64_t>(0 - m) : static_cast<int64_t>(m);
+	return true;
+}
+
+bool bigint::to_double(double& out) const {
+	uint64_t bits = bit_length();
+
+	if (bits <= 64) {
+		uint64_t m = 0;
+		for (size_t i = mag.size(); i-- > 0; ) {
+			m = m << 32 | mag[i];
+		}
+		out = static_cast<double>(m);
+	} else {
+		/*
+		 * The top 64 bits, with the lowest one set if any bit below them
+		 * is, round to the same 53 as the whole magnitude does
+		 */
+		bigint top = (neg ? -*this : *this) >> (bits - 64);
+		uint64_t m = static_cast<uint64_t>(top.mag[1]) << 32 | top.mag[0];
+		for (size_t i = 0; i < (bits - 64) / 32 && !(m & 1); ++i) {
+			m |= mag[i] != 0;
+		}
+		if ((bits - 64) % 32 && !(m & 1)) {
+			m |= (mag[(bits - 64) / 32] & ((uint32_t(1) << (bits - 64) % 32) - 1)) != 0;
+		}
+		out = std::ldexp(static_cast<double>(m), static_cast<int>(std::min<uint64_t>(bits - 64, 2000)));
+	}
+	if (std::isinf(out)) {
+		return false;
+	}
+	if (neg) {
+		out = -out;
+	}
+	return true;
+}
+
+std::string bigint::to_string(unsigned base) const {
+	if (mag.empty()) {
+		return "0";
+	}
+
+	/* Several digits at a time: chunk is the largest power of base in a digit */
+	uint32_t chunk = base;
+	unsigned per_chunk = 1;
+	while (static_cast<uint64_t>(chunk) * base <= UINT32_MAX) {
+		chunk *= base;
+		++per_chunk;
+	}
+
+	std::string r;
+	digits m = mag;
+	while (!m.empty()) {
+		uint32_t rem = divmod_digit(m, chunk);
+		for (unsigned i = 0; i < per_chunk && (rem || !m.empty()); ++i) {
+			r += "0123456789abcdefghijklmnopqrstuvwxyz"[rem % base];
+			rem /= base;
+		}
+	}
+	if (neg) {
+		r += '-';
+	}
+	std::reverse(r.begin(), r.end());
+	return r;
+}
+
+uint64_t bigint::bit_length() const {
+	if (mag.empty()) {
+		return 0;
+	}
+	return (mag.size() - 1) * 32 + (32 - __builtin_clz(mag.back()));
+}
+
+int compare(const bigint& a, const bigint& b) {
+	if (a.neg != b.neg) {
+		return a.neg ? -1 : 1;
+	}
+	int c = compare_digits(a.mag, b.mag);
+	return a.neg ? -c : c;
+}
+
+bigint operator-(const bigint& a) {
+	bigint r = a;
+	r.neg = !a.neg && !a.mag.empty();
+	return r;
+}
+
+bigint operator+(const bigint& a, const bigint& b) {
+	bigint r;
+	if (a.neg == b.neg) {
+		r.mag = add_digits(a.mag, b.mag);
+		r.neg = a.neg;
+	} else if (compare_digits(a.mag, b.mag) >= 0) {
+		r.mag = sub_digits(a.mag, b.mag);
+		r.neg = a.neg;
+	} else {
+		r.mag = sub_digits(b.mag, a.mag);
+		r.neg = b.neg;
+	}
+	r.trim();
+	return r;
+}
+
+bigint operator-(const bigint& a, const bigint& b) {
+	return a + -b;
+}
+
+bigint operator*(const bigint& a, const bigint& b) {
+	bigint r;
+	r.mag = mul_digits(a.mag, b.mag);
+	r.neg = a.neg != b.neg;
+	r.trim();
+	return r;
+}
+
+bigint operator<<(const bigint& a, uint64_t n) {
+	if (a.mag.empty()) {
+		return a;
+	}
+
+	size_t whole = n / 32;
+	unsigned part = n % 32;
+	bigint r;
+	r.mag.assign(whole, 0);
+	uint32_t carry = 0;
+	for (auto x : a.mag) {
+		r.mag.push_back(x << part | carry);
+		carry = part ? x >> (32 - part) : 0;
+	}
+	r.mag.push_back(carry);
+	r.neg = a.neg;
+	r.trim();
+	return r;
+}
+
+bigint operator>>(const bigint& a, uint64_t n) {
+	if (a.neg) {
+		/* Rounds to minus infinity: -((-a - 1) >> n) - 1 */
+		return -((-a - bigint(1)) >> n) - bigint(1);
+	}
+
+	size_t whole = n / 32;
+	unsigned part = n % 32;
+	bigint r;
+	for (size_t i = whole; i < a.mag.size(); ++i) {
+		uint32_t hi = i + 1 < a.mag.size() ? a.mag[i + 1] : 0;
+		r.mag.push_back(a.mag[i] >> part | (part ? hi << (32 - part) : 0));
+	}
+	r.trim();
+	return r;
+}
+
+/* In n digits of two's complement, n is more than the digits of the magnitude */
+digits bigint::twos_complement(size_t n) const {
+	digits r(mag);
+	r.resize(n, 0);
+	if (neg) {
+		uint64_t carry = 1;
+		for (auto& x : r) {
+			uint64_t t = static_cast<uint64_t>(static_cast<uint32_t>(~x)) + carry;
+			x = static_cast<uint32_t>(t);
+			carry = t >> 32;
+		}
+	}
+	return r;
+}
+
+bigint bigint::from_twos_complement(digits d) {
+	bigint r;
+	r.neg = !d.empty() && (d.back() >> 31) != 0;
+	if (r.neg) {
+		/* -(~d + 1) */
+		uint64_t carry = 1;
+		for (auto& x : d) {
+			uint64_t t = static_cast<uint64_t>(static_cast<uint32_t>(~x)) + carry;
+			x = static_cast<uint32_t>(t);
+			carry = t >> 32;
+		}
+	}
+	r.mag = std::move(d);
+	r.trim();
+	return r;
+}
+
+template <class Op>
+static digits bitwise(const digits& x, const digits& y, Op op) {
+	digits z(x.size());
+	for (size_t i = 0; i < x.size(); ++i) {
+		z[i] = op(x[i], y[i]);
+	}
+	return z;
+}
+
+bigint operator&(const bigint& a, const bigint& b) {
+	size_t n = std::max(a.mag.size(), b.mag.size()) + 1;
+	return bigint::from_twos_complement(bitwise(a.twos_complement(n), b.twos_complement(n),
+			[](uint32_t x, uint32_t y) { return x & y; }));
+}
+
+bigint operator|(const bigint& a, const bigint& b) {
+	size_t n = std::max(a.mag.size(), b.mag.size()) + 1;
+	return bigint::from_twos_complement(bitwise(a.twos_complement(n), b.twos_complement(n),
+			[](uint32_t x, uint32_t y) { return x | y; }));
+}
+
+bigint operator^(const bigint& a, const bigint& b) {
+	size_t n = std::max(a.mag.size(), b.mag.size()) + 1;
+	return bigint::from_twos_complement(bitwise(a.twos_complement(n), b.twos_complement(n),
+			[](uint32_t x, uint32_t y) { return x ^ y; }));
+}
+
+bigint operator~(const bigint& a) {
+	return -a - bigint(1);
+}
+
+void divmod(const bigint& a, const bigint& b, bigint& q, bigint& r) {
+	digits qm, rm;
+	divmod_digits(a.mag, b.mag, qm, rm);
+	q.mag = std::move(qm);
+	q.neg = a.neg != b.neg;
+	q.trim();
+	r.mag = std::move(rm);
+	r.neg = a.neg;
+	r.trim();
+
+	if (!r.is_zero() && r.neg != b.neg) {
+		q = q - bigint(1);
+		r = r + b;
+	}
+}
+
+bigint pow(const bigint& a, uint64_t e) {
+	bigint r(1);
+	bigint x = a;
+	while (e) {
+		if (e & 1) {
+			r = r * x;
+		}
+		e >>= 1;
+		if (e) {
+			x = x * x;
+		}
+	}
+	return r;
+}
+
+} /* namespace arbusto */
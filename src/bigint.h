@@ -0,0 +1,75 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef BIGINT_H_
+#define BIGINT_H_
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace arbusto {
+
+/*
+ * Arbitrary precision integer, for the Python ints that do not fit a
+ * tagged value. A sign and the magnitude in 32-bit digits, the least
+ * significant first and without leading zero digits, so zero is empty
+ * and never negative. Division, modulo and right shifts round to minus
+ * infinity and the bitwise operators work on the infinite two's
+ * complement, both as Python does.
+ */
+class bigint {
+public:
+	bigint() : neg(false) {}
+	explicit bigint(int64_t v);
+
+	/* Digits in base 2 to 36, no sign, prefix or underscores; false if there are none or one is out of base */
+	static bool parse(const std::string& digits, unsigned base, bigint& out);
+	/* The integral part of d, which must be finite */
+	static bigint from_double(double d);
+
+	bool is_zero() const { return mag.empty(); }
+	bool negative() const { return neg; }
+
+	/* False if it does not fit */
+	bool to_int64(int64_t& out) const;
+	/* Rounded to nearest, false if it is too large for a double */
+	bool to_double(double& out) const;
+	/* In base 2 to 36, lower case, with a '-' if it is negative */
+	std::string to_string(unsigned base = 10) const;
+	/* Of the magnitude, 0 for zero */
+	uint64_t bit_length() const;
+
+	friend int compare(const bigint& a, const bigint& b);
+
+	friend bigint operator-(const bigint& a);
+	friend bigint operator+(const bigint& a, const bigint& b);
+	friend bigint operator-(const bigint& a, const bigint& b);
+	friend bigint operator*(const bigint& a, const bigint& b);
+	friend bigint operator<<(const bigint& a, uint64_t n);
+	friend bigint operator>>(const bigint& a, uint64_t n);
+	friend bigint operator&(const bigint& a, const bigint& b);
+	friend bigint operator|(const bigint& a, const bigint& b);
+	friend bigint operator^(const bigint& a, const bigint& b);
+	friend bigint operator~(const bigint& a);
+
+	/* Floor quotient and modulo with the sign of b, which is not zero */
+	friend void divmod(const bigint& a, const bigint& b, bigint& q, bigint& r);
+	friend bigint pow(const bigint& a, uint64_t e);
+
+private:
+	void trim();
+	std::vector<uint32_t> twos_complement(size_t n) const;
+	static bigint from_twos_complement(std::vector<uint32_t> d);
+
+	bool neg;
+	std::vector<uint32_t> mag;
+};
+
+} /* namespace arbusto */
+
+#endif /* BIGINT_H_ */
@@ -0,0 +1,1498 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <initializer_list>
+#include <cmath>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+
+#include "runtime.h"
+#include "literal.h"
+
+namespace arbusto {
+
+/* Argument checks */
+
+static void check_count(const char* name, size_t n, size_t min, size_t max) {
+	if (n < min) {
+		raise_error(&type_error_type, std::string(name) + " expected at least " + std::to_string(min)
+				+ " argument" + (min == 1 ? "" : "s") + ", got " + std::to_string(n));
+	}
+	if (n > max) {
+		raise_error(&type_error_type, std::string(name) + " expected at most " + std::to_string(max) + " argument"
+				+ (max == 1 ? "" : "s") + ", got " + std::to_string(n));
+	}
+}
+
+static void check_keywords(const char* name, const keyword_args* kw, std::initializer_list<const char*> allowed) {
+	for (size_t i = 0; kw && i < kw->n; ++i) {
+		const std::string& k = str_of(kw->names[i]);
+		bool ok = false;
+		for (auto a : allowed) {
+			ok = ok || k == a;
+		}
+		if (!ok) {
+			raise_error(&type_error_type, std::string(name) + "() got an unexpected keyword argument '" + k + "'");
+		}
+	}
+}
+
+static void no_keywords(const char* name, const keyword_args* kw) {
+	if (kw && kw->n) {
+		raise_error(&type_error_type, std::string(name) + "() takes no keyword arguments");
+	}
+}
+
+/* The keyword argument called name, unbound if the call has none */
+static value keyword(const keyword_args* kw, const char* name) {
+	for (size_t i = 0; kw && i < kw->n; ++i) {
+		if (str_of(kw->names[i]) == name) {
+			return kw->values[i];
+		}
+	}
+	return value();
+}
+
+static const std::string& str_arg(const char* name, const value& v) {
+	if (!is_str(v)) {
+		raise_error(&type_error_type, std::string(name) + " argument must be str, not " + type_name(v));
+	}
+	return str_of(v);
+}
+
+static value arg_or(const value* args, size_t n, size_t i, const keyword_args* kw, const char* name) {
+	return i < n ? args[i] : keyword(kw, name);
+}
+
+static bool is_none(const value& v) {
+	return !v.bound() || is_type(v, none_type);
+}
+
+/* Strings are UTF-8, their length and indices count code points */
+
+static size_t char_count(const std::string& s) {
+	size_t n = 0;
+	for (unsigned char c : s) {
+		n += (c & 0xc0) != 0x80;
+	}
+	return n;
+}
+
+/* Sorting, for sorted and list.sort */
+
+static void sort_items(std::vector<value>& items, const value& key, bool reverse) {
+	std::vector<size_t> order(items.size());
+	std::vector<value> keys(items.size());
+
+	for (size_t i = 0; i < items.size(); ++i) {
+		order[i] = i;
+		keys[i] = is_none(key) ? items[i] : call(key, &items[i], 1);
+	}
+
+	/* Reversing the comparison keeps equal items in order, as Python does */
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return reverse ? compare(CMP_OP_LT, keys[b], keys[a]) : compare(CMP_OP_LT, keys[a], keys[b]);
+	});
+
+	std::vector<value> sorted(items.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		sorted[i] = items[order[i]];
+	}
+	items.swap(sorted);
+}
+
+/* format() and str.format: [[fill]align][sign][#][0][width][,][.precision][type] */
+
+static std::string group_thousands(const std::string& digits) {
+	std::string r;
+	size_t n = digits.size();
+	for (size_t i = 0; i < n; ++i) {
+		r += digits[i];
+		if ((n - i - 1) % 3 == 0 && i + 1 < n) {
+			r += ',';
+		}
+	}
+	return r;
+}
+
+static std::string format_value(const value& v, const std::string& spec) {
+	size_t i = 0;
+	std::string fill = " ";
+	char align = 0;
+	char sign = '-';
+	bool alternate = false;
+	bool zero = false;
+	int width = -1;
+	bool grouping = false;
+	int precision = -1;
+	char type = 0;
+
+	if (spec.size() >= 2 && std::strchr("<>=^", spec[1])) {
+		fill = spec.substr(0, 1);
+		align = spec[1];
+		i = 2;
+	} else if (!spec.empty() && std::strchr("<>=^", spec[0])) {
+		align = spec[0];
+		i = 1;
+	}
+	if (i < spec.size() && std::strchr("+- ", spec[i])) {
+		sign = spec[i++];
+	}
+	if (i < spec.size() && spec[i] == '#') {
+		alternate = true;
+		++i;
+	}
+	if (i < spec.size() && spec[i] == '0') {
+		zero = true;
+		++i;
+	}
+	for (; i < spec.size() && std::isdigit(static_cast<unsigned char>(spec[i])); ++i) {
+		width = (width < 0 ? 0 : width * 10) + (spec[i] - '0');
+	}
+	if (i < spec.size() && spec[i] == ',') {
+		grouping = true;
+		++i;
+	}
+	if (i < spec.size() && spec[i] == '.') {
+		precision = 0;
+		for (++i; i < spec.size() && std::isdigit(static_cast<unsigned char>(spec[i])); ++i) {
+			precision = precision * 10 + (spec[i] - '0');
+		}
+	}
+	if (i < spec.size()) {
+		type = spec[i++];
+	}
+	if (i != spec.size()) {
+		raise_error(&value_error_type, "Invalid format specifier");
+	}
+	if (zero && !align) {
+		fill = "0";
+		align = '=';
+	}
+
+	std::string prefix;
+	std::string body;
+	bool number = is_intlike(v) || is_float(v);
+
+	if (!number || type == 's') {
+		if (type && type != 's') {
+			raise_error(&value_error_type, std::string("Unknown format code '") + type + "' for object of type '"
+					+ type_name(v) + "'");
+		}
+		body = to_str(v);
+		if (precision >= 0 && char_count(body) > static_cast<size_t>(precision)) {
+			size_t end = 0;
+			for (int c = 0; c < precision; ++c) {
+				do {
+					++end;
+				} while (end < body.size() && (static_cast<unsigned char>(body[end]) & 0xc0) == 0x80);
+			}
+			body = body.substr(0, end);
+		}
+		if (!align) {
+			align = '<';
+		}
+	} else if (is_intlike(v) && (!type || std::strchr("dnxXobc", type))) {
+		bigint x = bigint_of(v);
+
+		if (type == 'c') {
+			body = utf8_encode(int_of(v));
+		} else {
+			unsigned base = type == 'x' || type == 'X' ? 16 : type == 'o' ? 8 : type == 'b' ? 2 : 10;
+			body = (x.negative() ? -x : x).to_string(base);
+			if (type == 'X') {
+				std::transform(body.begin(), body.end(), body.begin(), ::toupper);
+			}
+			if (grouping) {
+				body = group_thousands(body);
+			}
+			if (alternate && type && std::strchr("xXob", type)) {
+				body = std::string("0") + (type == 'X' ? 'X' : type) + body;
+			}
+			prefix = x.negative() ? "-" : sign == '+' ? "+" : sign == ' ' ? " " : "";
+		}
+	} else {
+		if (type && !std::strchr("eEfFgG%", type)) {
+			raise_error(&value_error_type, std::string("Unknown format code '") + type + "' for object of type '"
+					+ type_name(v) + "'");
+		}
+		double x = number_of(v);
+
+		if (!type && precision < 0) {
+			body = float_repr(std::fabs(x));
+		} else if (type == '%') {
+			body = printf_string("%.*f", precision < 0 ? 6 : precision, std::fabs(x) * 100) + "%";
+		} else {
+			char conv = type ? type : 'g';
+			body = printf_string((std::string("%.*") + conv).c_str(), precision < 0 ? 6 : precision, std::fabs(x));
+		}
+		if (grouping) {
+			size_t dot = body.find_first_not_of("0123456789");
+			body = group_thousands(body.substr(0, dot)) + (dot == std::string::npos ? "" : body.substr(dot));
+		}
+		prefix = std::signbit(x) && x == x ? "-" : sign == '+' ? "+" : sign == ' ' ? " " : "";
+	}
+
+	if (!align) {
+		align = '>';
+	}
+
+	size_t len = char_count(prefix) + char_count(body);
+	if (width < 0 || len >= static_cast<size_t>(width)) {
+		return prefix + body;
+	}
+
+	size_t pad = width - len;
+	auto fills = [&](size_t k) {
+		std::string r;
+		for (size_t j = 0; j < k; ++j) {
+			r += fill;
+		}
+		return r;
+	};
+
+	switch (align) {
+	case '<': return prefix + body + fills(pad);
+	case '^': return fills(pad / 2) + prefix + body + fills(pad - pad / 2);
+	case '=': return prefix + fills(pad) + body;
+	default: return fills(pad) + prefix + body;
+	}
+}
+
+static std::string format_string(const std::string& format, const value* args, size_t n, const keyword_args* kw) {
+	std::string out;
+	size_t next = 0;
+
+	for (size_t i = 0; i < format.size(); ++i) {
+		char c = format[i];
+
+		if (c == '}') {
+			if (i + 1 < format.size() && format[i + 1] == '}') {
+				out += '}';
+				++i;
+				continue;
+			}
+			raise_error(&value_error_type, "Single '}' encountered in format string");
+		}
+		if (c != '{') {
+			out += c;
+			continue;
+		}
+		if (i + 1 < format.size() && format[i + 1] == '{') {
+			out += '{';
+			++i;
+			continue;
+		}
+
+		size_t close = format.find('}', i);
+		if (close == std::string::npos) {
+			raise_error(&value_error_type, "Single '{' encountered in format string");
+		}
+
+		std::string field = format.substr(i + 1, close - i - 1);
+		std::string spec;
+		char conversion = 0;
+		size_t colon = field.find(':');
+		if (colon != std::string::npos) {
+			spec = field.substr(colon + 1);
+			field = field.substr(0, colon);
+		}
+		size_t bang = field.find('!');
+		if (bang != std::string::npos) {
+			conversion = bang + 1 < field.size() ? field[bang + 1] : 0;
+			field = field.substr(0, bang);
+		}
+
+		value v;
+		if (field.empty()) {
+			if (next >= n) {
+				raise_error(&index_error_type, "Replacement index " + std::to_string(next)
+						+ " out of range for positional args tuple");
+			}
+			v = args[next++];
+		} else if (std::isdigit(static_cast<unsigned char>(field[0]))) {
+			size_t k = std::strtoul(field.c_str(), nullptr, 10);
+			if (k >= n) {
+				raise_error(&index_error_type, "Replacement index " + std::to_string(k)
+						+ " out of range for positional args tuple");
+			}
+			v = args[k];
+		} else {
+			v = keyword(kw, field.c_str());
+			if (!v.bound()) {
+				throw py_exception(make_exception(&key_error_type, make_tuple({ make_str(field) })));
+			}
+		}
+
+		if (conversion == 'r') {
+			v = make_str(repr(v));
+		} else if (conversion == 's') {
+			v = make_str(to_str(v));
+		}
+		out += format_value(v, spec);
+		i = close;
+	}
+
+	return out;
+}
+
+/* Builtin functions */
+
+static value builtin_print(const value* args, size_t n, const keyword_args* kw) {
+	check_keywords("print", kw, { "sep", "end", "flush" });
+	value sep = keyword(kw, "sep");
+	value end = keyword(kw, "end");
+	std::string out;
+
+	for (size_t i = 0; i < n; ++i) {
+		if (i) {
+			out += is_none(sep) ? " " : str_arg("sep", sep);
+		}
+		out += to_str(args[i]);
+	}
+	out += is_none(end) ? "\n" : str_arg("end", end);
+
+	std::cout << out;
+	return none();
+}
+
+static value builtin_len(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("len", kw);
+	check_count("len", n, 1, 1);
+	const value& v = args[0];
+
+	switch (v.type()->id) {
+	case TYPE_STR: return make_int(char_count(str_of(v)));
+	case TYPE_LIST: return make_int(as<list_object>(v)->items.size());
+	case TYPE_TUPLE: return make_int(as<tuple_object>(v)->items.size());
+	case TYPE_DICT: return make_int(as<dict_object>(v)->table.size());
+	case TYPE_SET: return make_int(as<set_object>(v)->table.size());
+	case TYPE_RANGE: return make_int(range_length(as<range_object>(v)));
+	default:
+		raise_error(&type_error_type, std::string("object of type '") + type_name(v) + "' has no len()");
+	}
+}
+
+static value builtin_abs(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("abs", kw);
+	check_count("abs", n, 1, 1);
+	if (is_float(args[0])) {
+		return make_float(std::fabs(float_of(args[0])));
+	}
+	if (is_intlike(args[0])) {
+		return compare(CMP_OP_LT, args[0], make_int(0)) ? negative(args[0]) : positive(args[0]);
+	}
+	raise_error(&type_error_type, std::string("bad operand type for abs(): '") + type_name(args[0]) + "'");
+}
+
+static value min_max(const char* name, compare_op op, const value* args, size_t n, const keyword_args* kw) {
+	check_keywords(name, kw, { "key", "default" });
+	if (n == 0) {
+		raise_error(&type_error_type, std::string(name) + " expected at least 1 argument, got 0");
+	}
+
+	std::vector<value> items = n == 1 ? items_of(args[0]) : std::vector<value>(args, args + n);
+	value key = keyword(kw, "key");
+
+	if (items.empty()) {
+		value dflt = keyword(kw, "default");
+		if (dflt.bound()) {
+			return dflt;
+		}
+		raise_error(&value_error_type, std::string(name) + "() arg is an empty sequence");
+	}
+
+	value best = items[0];
+	value best_key = is_none(key) ? best : call(key, &best, 1);
+	for (size_t i = 1; i < items.size(); ++i) {
+		value k = is_none(key) ? items[i] : call(key, &items[i], 1);
+		if (compare(op, k, best_key)) {
+			best = items[i];
+			best_key = k;
+		}
+	}
+	return best;
+}
+
+static value builtin_min(const value* args, size_t n, const keyword_args* kw) {
+	return min_max("min", CMP_OP_LT, args, n, kw);
+}
+
+static value builtin_max(const value* args, size_t n, const keyword_args* kw) {
+	return min_max("max", CMP_OP_GT, args, n, kw);
+}
+
+static value builtin_sum(const value* args, size_t n, const keyword_args* kw) {
+	check_keywords("sum", kw, { "start" });
+	check_count("sum", n, 1, 2);
+	value acc = arg_or(args, n, 1, kw, "start");
+	if (!acc.bound()) {
+		acc = make_int(0);
+	}
+	if (is_str(acc)) {
+		raise_error(&type_error_type, "sum() can't sum strings [use ''.join(seq) instead]");
+	}
+
+	value it = get_iter(args[0]);
+	value x;
+	while (iter_next(it, x)) {
+		acc = binary(BIN_ADD, acc, x);
+	}
+	return acc;
+}
+
+static value builtin_sorted(const value* args, size_t n, const keyword_args* kw) {
+	check_keywords("sorted", kw, { "key", "reverse" });
+	check_count("sorted", n, 1, 1);
+	std::vector<value> items = items_of(args[0]);
+	value reverse = keyword(kw, "reverse");
+	sort_items(items, keyword(kw, "key"), reverse.bound() && truthy(reverse));
+	return make_list(std::move(items));
+}
+
+static value builtin_reversed(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("reversed", kw);
+	check_count("reversed", n, 1, 1);
+	const value& v = args[0];
+
+	if (is_type(v, list_type) || is_type(v, tuple_type)) {
+		size_t len = is_type(v, list_type) ? as<list_object>(v)->items.size() : as<tuple_object>(v)->items.size();
+		return make_iterator(ITER_REVERSED, v, static_cast<int64_t>(len) - 1);
+	}
+	if (is_type(v, range_type)) {
+		std::vector<value> items = items_of(v);
+		std::reverse(items.begin(), items.end());
+		return get_iter(make_list(std::move(items)));
+	}
+	if (is_str(v)) {
+		std::vector<value> items = items_of(v);
+		std::reverse(items.begin(), items.end());
+		return get_iter(make_list(std::move(items)));
+	}
+	raise_error(&type_error_type, std::string("'") + type_name(v) + "' object is not reversible");
+}
+
+static value builtin_enumerate(const value* args, size_t n, const keyword_args* kw) {
+	check_keywords("enumerate", kw, { "start" });
+	check_count("enumerate", n, 1, 2);
+	value start = arg_or(args, n, 1, kw, "start");
+	return make_iterator(ITER_ENUMERATE, get_iter(args[0]), start.bound() ? index_of(start) : 0);
+}
+
+static value builtin_zip(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("zip", kw);
+	value z = make_iterator(ITER_ZIP, none());
+	for (size_t i = 0; i < n; ++i) {
+		as<iterator_object>(z)->its.push_back(get_iter(args[i]));
+	}
+	return z;
+}
+
+static value builtin_map(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("map", kw);
+	check_count("map", n, 2, 2);
+	value m = make_iterator(ITER_MAP, get_iter(args[1]));
+	as<iterator_object>(m)->fn = args[0];
+	return m;
+}
+
+static value builtin_filter(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("filter", kw);
+	check_count("filter", n, 2, 2);
+	value f = make_iterator(ITER_FILTER, get_iter(args[1]));
+	as<iterator_object>(f)->fn = args[0];
+	return f;
+}
+
+static value builtin_repr(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("repr", kw);
+	check_count("repr", n, 1, 1);
+	return make_str(repr(args[0]));
+}
+
+static value builtin_format(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("format", kw);
+	check_count("format", n, 1, 2);
+	return make_str(format_value(args[0], n > 1 ? str_arg("format()", args[1]) : ""));
+}
+
+static value builtin_isinstance(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("isinstance", kw);
+	check_count("isinstance", n, 2, 2);
+	std::vector<value> types = is_type(args[1], tuple_type) ? as<tuple_object>(args[1])->items
+			: std::vector<value>{ args[1] };
+
+	for (auto& t : types) {
+		if (!is_type(t, type_type)) {
+			raise_error(&type_error_type, "isinstance() arg 2 must be a type, a tuple of types, or a union");
+		}
+		if (is_instance(args[0], static_cast<const type_object*>(t.get()))) {
+			return make_bool(true);
+		}
+	}
+	return make_bool(false);
+}
+
+static value builtin_iter(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("iter", kw);
+	check_count("iter", n, 1, 1);
+	return get_iter(args[0]);
+}
+
+static value builtin_next(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("next", kw);
+	check_count("next", n, 1, 2);
+	value x;
+	if (iter_next(args[0], x)) {
+		return x;
+	}
+	if (n > 1) {
+		return args[1];
+	}
+	throw py_exception(make_exception(&stop_iteration_type, make_tuple({})));
+}
+
+static value builtin_chr(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("chr", kw);
+	check_count("chr", n, 1, 1);
+	int64_t cp = index_of(args[0]);
+	if (cp < 0 || cp > 0x10ffff) {
+		raise_error(&value_error_type, "chr() arg not in range(0x110000)");
+	}
+	return make_str(utf8_encode(cp));
+}
+
+static value builtin_ord(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("ord", kw);
+	check_count("ord", n, 1, 1);
+	if (!is_str(args[0])) {
+		raise_error(&type_error_type, std::string("ord() expected string of length 1, but ") + type_name(args[0])
+				+ " found");
+	}
+	const std::string& s = str_of(args[0]);
+	size_t len = char_count(s);
+	if (len != 1) {
+		raise_error(&type_error_type, "ord() expected a character, but string of length " + std::to_string(len)
+				+ " found");
+	}
+
+	const unsigned char* p = reinterpret_cast<const unsigned char*>(s.data());
+	switch (s.size()) {
+	case 1: return make_int(p[0]);
+	case 2: return make_int(((p[0] & 0x1f) << 6) | (p[1] & 0x3f));
+	case 3: return make_int(((p[0] & 0x0f) << 12) | ((p[1] & 0x3f) << 6) | (p[2] & 0x3f));
+	default: return make_int(((p[0] & 0x07) << 18) | ((p[1] & 0x3f) << 12) | ((p[2] & 0x3f) << 6) | (p[3] & 0x3f));
+	}
+}
+
+/*
+ * Python's round(x, ndigits): x rounded at the decimal digit ndigits, a
+ * half to even by the exact value of x, as the decimal string of x is.
+ */
+static double round_digits(double x, int64_t ndigits) {
+	/* Past the digits a double can have, as float.__round__ */
+	if (ndigits > 323) {
+		return x;
+	}
+	if (ndigits < -308) {
+		return 0.0 * x;
+	}
+	if (x == 0 || !std::isfinite(x)) {
+		return x;
+	}
+
+	if (ndigits >= 0) {
+		/* printf rounds the exact binary value correctly */
+		return std::strtod(printf_string("%.*f", static_cast<int>(ndigits), x).c_str(), nullptr);
+	}
+
+	/* The integer digits of x are exact, the fraction only breaks a tie */
+	double whole;
+	bool fraction = std::modf(std::fabs(x), &whole) != 0;
+	std::string digits = printf_string("%.0f", whole);
+	size_t dropped = static_cast<size_t>(-ndigits);
+	std::string kept = digits.size() > dropped ? digits.substr(0, digits.size() - dropped) : "";
+	std::string rest = digits.size() > dropped ? digits.substr(digits.size() - dropped) : std::string(dropped - digits.size(), '0') + digits;
+
+	int half = rest[0] < '5' ? -1 : rest[0] > '5' ? 1 : 0;
+	if (half == 0) {
+		half = rest.find_first_not_of('0', 1) != std::string::npos || fraction ? 1 : 0;
+	}
+	if (half > 0 || (half == 0 && !kept.empty() && (kept.back() - '0') % 2 == 1)) {
+		/* One up, with the carry */
+		size_t i = kept.size();
+		while (i > 0 && kept[i - 1] == '9') {
+			kept[--i] = '0';
+		}
+		if (i == 0) {
+			kept.insert(0, 1, '1');
+		} else {
+			++kept[i - 1];
+		}
+	}
+
+	double r = std::strtod((kept.empty() ? "0" : kept + std::string(dropped, '0')).c_str(), nullptr);
+	if (std::isinf(r)) {
+		raise_error(&overflow_error_type, "rounded value too large to represent");
+	}
+	return std::copysign(r, x);
+}
+
+static value builtin_round(const value* args, size_t n, const keyword_args* kw) {
+	check_keywords("round", kw, { "ndigits" });
+	check_count("round", n, 1, 2);
+	value digits = arg_or(args, n, 1, kw, "ndigits");
+
+	if (is_intlike(args[0])) {
+		return positive(args[0]);
+	}
+	if (!is_float(args[0])) {
+		raise_error(&type_error_type, std::string("type ") + type_name(args[0]) + " doesn't define __round__ method");
+	}
+
+	/* nearbyint rounds halves to even, like Python */
+	double x = float_of(args[0]);
+	if (is_none(digits)) {
+		return int_from_float(std::nearbyint(x));
+	}
+	return make_float(round_digits(x, index_of(digits)));
+}
+
+static value builtin_divmod(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("divmod", kw);
+	check_count("divmod", n, 2, 2);
+	return make_tuple({ binary(BIN_FLOORDIV, args[0], args[1]), binary(BIN_MOD, args[0], args[1]) });
+}
+
+static value builtin_hash(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("hash", kw);
+	check_count("hash", n, 1, 1);
+	return make_int(static_cast<int64_t>(hash_of(args[0])));
+}
+
+static value builtin_any(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("any", kw);
+	check_count("any", n, 1, 1);
+	value it = get_iter(args[0]);
+	value x;
+	while (iter_next(it, x)) {
+		if (truthy(x)) {
+			return make_bool(true);
+		}
+	}
+	return make_bool(false);
+}
+
+static value builtin_all(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("all", kw);
+	check_count("all", n, 1, 1);
+	value it = get_iter(args[0]);
+	value x;
+	while (iter_next(it, x)) {
+		if (!truthy(x)) {
+			return make_bool(false);
+		}
+	}
+	return make_bool(true);
+}
+
+static value builtin_callable(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("callable", kw);
+	check_count("callable", n, 1, 1);
+	type_id id = args[0].type()->id;
+	return make_bool(id == TYPE_FUNCTION || id == TYPE_BUILTIN || id == TYPE_TYPE);
+}
+
+/* Types, called to make instances */
+
+static std::string strip_spaces(const std::string& s) {
+	size_t b = s.find_first_not_of(" \t\n\r\f\v");
+	if (b == std::string::npos) {
+		return "";
+	}
+	return s.substr(b, s.find_last_not_of(" \t\n\r\f\v") - b + 1);
+}
+
+static value parse_int(const std::string& text, int64_t base) {
+	std::string s = strip_spaces(text);
+	std::string shown = "invalid literal for int() with base " + std::to_string(base) + ": " + repr(make_str(text));
+	size_t i = 0;
+	bool neg = false;
+
+	if (i < s.size() && (s[i] == '+' || s[i] == '-')) {
+		neg = s[i++] == '-';
+	}
+	if (base == 0 || base == 16 || base == 8 || base == 2) {
+		if (i + 1 < s.size() && s[i] == '0' && std::strchr("xXoObB", s[i + 1])) {
+			int64_t prefixed = std::tolower(s[i + 1]) == 'x' ? 16 : std::tolower(s[i + 1]) == 'o' ? 8 : 2;
+			if (base != 0 && base != prefixed) {
+				raise_error(&value_error_type, shown);
+			}
+			base = prefixed;
+			i += 2;
+		} else if (base == 0) {
+			base = 10;
+		}
+	}
+	if (base < 2 || base > 36) {
+		raise_error(&value_error_type, "int() base must be >= 2 and <= 36, or 0");
+	}
+
+	std::string digits;
+	for (; i < s.size(); ++i) {
+		if (s[i] == '_' && !digits.empty() && i + 1 < s.size() && s[i + 1] != '_') {
+			continue;
+		}
+		digits += s[i];
+	}
+	bigint r;
+	if (!bigint::parse(digits, static_cast<unsigned>(base), r)) {
+		raise_error(&value_error_type, shown);
+	}
+	return make_int(neg ? -r : r);
+}
+
+static value int_new(const value* args, size_t n, const keyword_args* kw) {
+	check_keywords("int", kw, { "base" });
+	check_count("int", n, 0, 2);
+	value base = arg_or(args, n, 1, kw, "base");
+
+	if (n == 0) {
+		return make_int(0);
+	}
+	if (base.bound()) {
+		return parse_int(str_arg("int()", args[0]), index_of(base));
+	}
+	if (is_intlike(args[0])) {
+		return positive(args[0]);
+	}
+	if (is_float(args[0])) {
+		return int_from_float(float_of(args[0]));
+	}
+	if (is_str(args[0])) {
+		return parse_int(str_of(args[0]), 10);
+	}
+	raise_error(&type_error_type, std::string("int() argument must be a string, a bytes-like object or a real number, "
+			"not '") + type_name(args[0]) + "'");
+}
+
+static value float_new(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("float", kw);
+	check_count("float", n, 0, 1);
+
+	if (n == 0) {
+		return make_float(0);
+	}
+	if (is_float(args[0])) {
+		return args[0];
+	}
+	if (is_intlike(args[0])) {
+		return make_float(number_of(args[0]));
+	}
+	if (is_str(args[0])) {
+		std::string s = strip_spaces(str_of(args[0]));
+		std::string t;
+		for (char c : s) {
+			if (c != '_') {
+				t += static_cast<char>(std::tolower(c));
+			}
+		}
+		char* end = nullptr;
+		double x = std::strtod(t.c_str(), &end);
+		bool hex = t.find('x') != std::string::npos;
+		if (t.empty() || hex || *end) {
+			raise_error(&value_error_type, "could not convert string to float: " + repr(args[0]));
+		}
+		return make_float(x);
+	}
+	raise_error(&type_error_type, std::string("float() argument must be a string or a real number, not '")
+			+ type_name(args[0]) + "'");
+}
+
+static value str_new(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("str", kw);
+	check_count("str", n, 0, 1);
+	return n == 0 ? make_str("") : make_str(to_str(args[0]));
+}
+
+static value bool_new(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("bool", kw);
+	check_count("bool", n, 0, 1);
+	return make_bool(n == 1 && truthy(args[0]));
+}
+
+static value list_new(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("list", kw);
+	check_count("list", n, 0, 1);
+	return make_list(n == 0 ? std::vector<value>() : items_of(args[0]));
+}
+
+static value tuple_new(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("tuple", kw);
+	check_count("tuple", n, 0, 1);
+	if (n == 1 && is_type(args[0], tuple_type)) {
+		return args[0];
+	}
+	return make_tuple(n == 0 ? std::vector<value>() : items_of(args[0]));
+}
+
+static void dict_update(const value& d, const value* args, size_t n, const keyword_args* kw) {
+	dict_table& table = as<dict_object>(d)->table;
+
+	if (n == 1 && is_type(args[0], dict_type)) {
+		for (auto& e : as<dict_object>(args[0])->table.all()) {
+			if (e.key.bound()) {
+				table.set(e.key, e.v);
+			}
+		}
+	} else if (n == 1) {
+		value it = get_iter(args[0]);
+		value pair;
+		for (size_t i = 0; iter_next(it, pair); ++i) {
+			std::vector<value> kv = items_of(pair);
+			if (kv.size() != 2) {
+				raise_error(&value_error_type, "dictionary update sequence element #" + std::to_string(i)
+						+ " has length " + std::to_string(kv.size()) + "; 2 is required");
+			}
+			table.set(kv[0], kv[1]);
+		}
+	}
+
+	for (size_t i = 0; kw && i < kw->n; ++i) {
+		table.set(kw->names[i], kw->values[i]);
+	}
+}
+
+static value dict_new(const value* args, size_t n, const keyword_args* kw) {
+	check_count("dict", n, 0, 1);
+	value d = make_dict();
+	dict_update(d, args, n, kw);
+	return d;
+}
+
+static value set_new(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("set", kw);
+	check_count("set", n, 0, 1);
+	value s = make_set();
+	if (n == 1) {
+		value it = get_iter(args[0]);
+		value x;
+		while (iter_next(it, x)) {
+			as<set_object>(s)->table.set(x, none());
+		}
+	}
+	return s;
+}
+
+static value range_new(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("range", kw);
+	check_count("range", n, 1, 3);
+
+	int64_t start = n == 1 ? 0 : index_of(args[0]);
+	int64_t stop = n == 1 ? index_of(args[0]) : index_of(args[1]);
+	int64_t step = n == 3 ? index_of(args[2]) : 1;
+	if (step == 0) {
+		raise_error(&value_error_type, "range() arg 3 must not be zero");
+	}
+	return make_range(start, stop, step);
+}
+
+static value type_new(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("type", kw);
+	check_count("type", n, 1, 1);
+	return value::borrow(const_cast<type_object*>(args[0].type()));
+}
+
+template <type_object* T>
+static value exception_new(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords(T->name, kw);
+	return make_exception(T, make_tuple(std::vector<value>(args, args + n)));
+}
+
+/* Methods, self is args[0] */
+
+static list_object* self_list(const char* name, const value* args, size_t n, size_t min, size_t max) {
+	check_count(name, n - 1, min, max);
+	return as<list_object>(args[0]);
+}
+
+static value list_append(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("append", kw);
+	self_list("append", args, n, 1, 1)->items.push_back(args[1]);
+	return none();
+}
+
+static value list_extend(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("extend", kw);
+	list_object* l = self_list("extend", args, n, 1, 1);
+	std::vector<value> items = items_of(args[1]);
+	l->items.insert(l->items.end(), items.begin(), items.end());
+	return none();
+}
+
+static value list_pop(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("pop", kw);
+	list_object* l = self_list("pop", args, n, 0, 1);
+	if (l->items.empty()) {
+		raise_error(&index_error_type, "pop from empty list");
+	}
+	int64_t i = n > 1 ? index_of(args[1]) : -1;
+	if (i < 0) {
+		i += l->items.size();
+	}
+	if (i < 0 || i >= static_cast<int64_t>(l->items.size())) {
+		raise_error(&index_error_type, "pop index out of range");
+	}
+	value v = l->items[i];
+	l->items.erase(l->items.begin() + i);
+	return v;
+}
+
+static value list_insert(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("insert", kw);
+	list_object* l = self_list("insert", args, n, 2, 2);
+	int64_t size = l->items.size();
+	int64_t i = index_of(args[1]);
+	if (i < 0) {
+		i = std::max<int64_t>(0, i + size);
+	}
+	l->items.insert(l->items.begin() + std::min(i, size), args[2]);
+	return none();
+}
+
+static value list_remove(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("remove", kw);
+	list_object* l = self_list("remove", args, n, 1, 1);
+	for (size_t i = 0; i < l->items.size(); ++i) {
+		if (l->items[i].is(args[1]) || equals(l->items[i], args[1])) {
+			l->items.erase(l->items.begin() + i);
+			return none();
+		}
+	}
+	raise_error(&value_error_type, "list.remove(x): x not in list");
+}
+
+static value sequence_index(const char* what, const std::vector<value>& items, const value& x) {
+	for (size_t i = 0; i < items.size(); ++i) {
+		if (items[i].is(x) || equals(items[i], x)) {
+			return make_int(i);
+		}
+	}
+	raise_error(&value_error_type, std::string(what) + ".index(x): x not in " + what);
+}
+
+static value sequence_count(const std::vector<value>& items, const value& x) {
+	int64_t count = 0;
+	for (auto& item : items) {
+		count += item.is(x) || equals(item, x);
+	}
+	return make_int(count);
+}
+
+static value list_index(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("index", kw);
+	return sequence_index("list", self_list("index", args, n, 1, 1)->items, args[1]);
+}
+
+static value list_count(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("count", kw);
+	return sequence_count(self_list("count", args, n, 1, 1)->items, args[1]);
+}
+
+static value list_reverse(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("reverse", kw);
+	list_object* l = self_list("reverse", args, n, 0, 0);
+	std::reverse(l->items.begin(), l->items.end());
+	return none();
+}
+
+static value list_sort(const value* args, size_t n, const keyword_args* kw) {
+	check_keywords("sort", kw, { "key", "reverse" });
+	list_object* l = self_list("sort", args, n, 0, 0);
+	value reverse = keyword(kw, "reverse");
+	sort_items(l->items, keyword(kw, "key"), reverse.bound() && truthy(reverse));
+	return none();
+}
+
+static value list_copy(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("copy", kw);
+	return make_list(self_list("copy", args, n, 0, 0)->items);
+}
+
+static value list_clear(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("clear", kw);
+	self_list("clear", args, n, 0, 0)->items.clear();
+	return none();
+}
+
+static value tuple_index(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("index", kw);
+	check_count("index", n - 1, 1, 1);
+	return sequence_index("tuple", as<tuple_object>(args[0])->items, args[1]);
+}
+
+static value tuple_count(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("count", kw);
+	check_count("count", n - 1, 1, 1);
+	return sequence_count(as<tuple_object>(args[0])->items, args[1]);
+}
+
+static dict_table& self_dict(const char* name, const value* args, size_t n, size_t min, size_t max) {
+	check_count(name, n - 1, min, max);
+	return as<dict_object>(args[0])->table;
+}
+
+static value dict_get(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("get", kw);
+	value* v = self_dict("get", args, n, 1, 2).find(args[1]);
+	return v ? *v : n > 2 ? args[2] : none();
+}
+
+/* keys, values and items give lists, not views */
+static value dict_keys(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("keys", kw);
+	std::vector<value> r;
+	for (auto& e : self_dict("keys", args, n, 0, 0).all()) {
+		if (e.key.bound()) {
+			r.push_back(e.key);
+		}
+	}
+	return make_list(std::move(r));
+}
+
+static value dict_values(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("values", kw);
+	std::vector<value> r;
+	for (auto& e : self_dict("values", args, n, 0, 0).all()) {
+		if (e.key.bound()) {
+			r.push_back(e.v);
+		}
+	}
+	return make_list(std::move(r));
+}
+
+static value dict_items(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("items", kw);
+	std::vector<value> r;
+	for (auto& e : self_dict("items", args, n, 0, 0).all()) {
+		if (e.key.bound()) {
+			r.push_back(make_tuple({ e.key, e.v }));
+		}
+	}
+	return make_list(std::move(r));
+}
+
+static value dict_pop(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("pop", kw);
+	dict_table& t = self_dict("pop", args, n, 1, 2);
+	value* v = t.find(args[1]);
+	if (!v) {
+		if (n > 2) {
+			return args[2];
+		}
+		throw py_exception(make_exception(&key_error_type, make_tuple({ args[1] })));
+	}
+	value r = *v;
+	t.erase(args[1]);
+	return r;
+}
+
+static value dict_setdefault(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("setdefault", kw);
+	dict_table& t = self_dict("setdefault", args, n, 1, 2);
+	value* v = t.find(args[1]);
+	if (v) {
+		return *v;
+	}
+	value dflt = n > 2 ? args[2] : none();
+	t.set(args[1], dflt);
+	return dflt;
+}
+
+static value dict_update_method(const value* args, size_t n, const keyword_args* kw) {
+	check_count("update", n - 1, 0, 1);
+	dict_update(args[0], args + 1, n - 1, kw);
+	return none();
+}
+
+static value dict_copy(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("copy", kw);
+	check_count("copy", n - 1, 0, 0);
+	value d = make_dict();
+	dict_update(d, args, 1, nullptr);
+	return d;
+}
+
+static value dict_clear(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("clear", kw);
+	self_dict("clear", args, n, 0, 0).clear();
+	return none();
+}
+
+static value set_add(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("add", kw);
+	check_count("add", n - 1, 1, 1);
+	as<set_object>(args[0])->table.set(args[1], none());
+	return none();
+}
+
+static value set_remove(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("remove", kw);
+	check_count("remove", n - 1, 1, 1);
+	if (!as<set_object>(args[0])->table.erase(args[1])) {
+		throw py_exception(make_exception(&key_error_type, make_tuple({ args[1] })));
+	}
+	return none();
+}
+
+static value set_discard(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("discard", kw);
+	check_count("discard", n - 1, 1, 1);
+	as<set_object>(args[0])->table.erase(args[1]);
+	return none();
+}
+
+static value set_clear(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("clear", kw);
+	check_count("clear", n - 1, 0, 0);
+	as<set_object>(args[0])->table.clear();
+	return none();
+}
+
+static const std::string& self_str(const char* name, const value* args, size_t n, size_t min, size_t max) {
+	check_count(name, n - 1, min, max);
+	return str_of(args[0]);
+}
+
+static value str_join(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("join", kw);
+	const std::string& sep = self_str("join", args, n, 1, 1);
+	std::vector<value> items = items_of(args[1]);
+	std::string r;
+
+	for (size_t i = 0; i < items.size(); ++i) {
+		if (!is_str(items[i])) {
+			raise_error(&type_error_type, "sequence item " + std::to_string(i) + ": expected str instance, "
+					+ type_name(items[i]) + " found");
+		}
+		if (i) {
+			r += sep;
+		}
+		r += str_of(items[i]);
+	}
+	return make_str(r);
+}
+
+static value str_split(const value* args, size_t n, const keyword_args* kw) {
+	check_keywords("split", kw, { "sep", "maxsplit" });
+	const std::string& s = self_str("split", args, n, 0, 2);
+	value sep = arg_or(args, n, 1, kw, "sep");
+	value maxv = arg_or(args, n, 2, kw, "maxsplit");
+	int64_t max = is_none(maxv) ? -1 : index_of(maxv);
+	std::vector<value> parts;
+
+	if (is_none(sep)) {
+		size_t i = 0;
+		while (true) {
+			i = s.find_first_not_of(" \t\n\r\f\v", i);
+			if (i == std::string::npos) {
+				break;
+			}
+			if (max >= 0 && static_cast<int64_t>(parts.size()) == max) {
+				size_t end = s.find_last_not_of(" \t\n\r\f\v");
+				parts.push_back(make_str(s.substr(i, end - i + 1)));
+				break;
+			}
+			size_t j = s.find_first_of(" \t\n\r\f\v", i);
+			parts.push_back(make_str(s.substr(i, j == std::string::npos ? std::string::npos : j - i)));
+			if (j == std::string::npos) {
+				break;
+			}
+			i = j;
+		}
+		return make_list(std::move(parts));
+	}
+
+	const std::string& delim = str_arg("split()", sep);
+	if (delim.empty()) {
+		raise_error(&value_error_type, "empty separator");
+	}
+	size_t i = 0;
+	while (max < 0 || static_cast<int64_t>(parts.size()) < max) {
+		size_t j = s.find(delim, i);
+		if (j == std::string::npos) {
+			break;
+		}
+		parts.push_back(make_str(s.substr(i, j - i)));
+		i = j + delim.size();
+	}
+	parts.push_back(make_str(s.substr(i)));
+	return make_list(std::move(parts));
+}
+
+static value strip_chars(const char* name, const value* args, size_t n, const keyword_args* kw, bool left, bool right) {
+	no_keywords(name, kw);
+	const std::string& s = self_str(name, args, n, 0, 1);
+	std::string chars = n > 1 && !is_none(args[1]) ? str_arg(name, args[1]) : std::string(" \t\n\r\f\v");
+	size_t b = left ? s.find_first_not_of(chars) : 0;
+	if (b == std::string::npos) {
+		return make_str("");
+	}
+	size_t e = right ? s.find_last_not_of(chars) : s.size() - 1;
+	return make_str(s.substr(b, e - b + 1));
+}
+
+static value str_strip(const value* args, size_t n, const keyword_args* kw) {
+	return strip_chars("strip", args, n, kw, true, true);
+}
+
+static value str_lstrip(const value* args, size_t n, const keyword_args* kw) {
+	return strip_chars("lstrip", args, n, kw, true, false);
+}
+
+static value str_rstrip(const value* args, size_t n, const keyword_args* kw) {
+	return strip_chars("rstrip", args, n, kw, false, true);
+}
+
+static value str_upper(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("upper", kw);
+	std::string s = self_str("upper", args, n, 0, 0);
+	for (auto& c : s) {
+		c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+	}
+	return make_str(s);
+}
+
+static value str_lower(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("lower", kw);
+	std::string s = self_str("lower", args, n, 0, 0);
+	for (auto& c : s) {
+		c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+	}
+	return make_str(s);
+}
+
+static value str_replace(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("replace", kw);
+	const std::string& s = self_str("replace", args, n, 2, 3);
+	const std::string& from = str_arg("replace()", args[1]);
+	const std::string& to = str_arg("replace()", args[2]);
+	int64_t count = n > 3 ? index_of(args[3]) : -1;
+	std::string r;
+	size_t i = 0;
+
+	if (from.empty()) {
+		return make_str(s);
+	}
+	for (; count != 0; --count) {
+		size_t j = s.find(from, i);
+		if (j == std::string::npos) {
+			break;
+		}
+		r += s.substr(i, j - i) + to;
+		i = j + from.size();
+	}
+	return make_str(r + s.substr(i));
+}
+
+static value affix_test(const char* name, const value* args, size_t n, const keyword_args* kw, bool prefix) {
+	no_keywords(name, kw);
+	const std::string& s = self_str(name, args, n, 1, 1);
+	std::vector<value> affixes = is_type(args[1], tuple_type) ? as<tuple_object>(args[1])->items
+			: std::vector<value>{ args[1] };
+
+	for (auto& a : affixes) {
+		const std::string& t = str_arg(name, a);
+		if (t.size() <= s.size() && s.compare(prefix ? 0 : s.size() - t.size(), t.size(), t) == 0) {
+			return make_bool(true);
+		}
+	}
+	return make_bool(false);
+}
+
+static value str_startswith(const value* args, size_t n, const keyword_args* kw) {
+	return affix_test("startswith", args, n, kw, true);
+}
+
+static value str_endswith(const value* args, size_t n, const keyword_args* kw) {
+	return affix_test("endswith", args, n, kw, false);
+}
+
+static value str_find(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("find", kw);
+	const std::string& s = self_str("find", args, n, 1, 1);
+	size_t i = s.find(str_arg("find()", args[1]));
+	return make_int(i == std::string::npos ? -1 : static_cast<int64_t>(char_count(s.substr(0, i))));
+}
+
+static value str_index(const value* args, size_t n, const keyword_args* kw) {
+	value i = str_find(args, n, kw);
+	if (int_of(i) < 0) {
+		raise_error(&value_error_type, "substring not found");
+	}
+	return i;
+}
+
+static value str_count(const value* args, size_t n, const keyword_args* kw) {
+	no_keywords("count", kw);
+	const std::string& s = self_str("count", args, n, 1, 1);
+	const std::string& sub = str_arg("count()", args[1]);
+	if (sub.empty()) {
+		return make_int(char_count(s) + 1);
+	}
+	int64_t count = 0;
+	for (size_t i = s.find(sub); i != std::string::npos; i = s.find(sub, i + sub.size())) {
+		++count;
+	}
+	return make_int(count);
+}
+
+static value str_format_method(const value* args, size_t n, const keyword_args* kw) {
+	return make_str(format_string(str_of(args[0]), args + 1, n - 1, kw));
+}
+
+static value char_class(const char* name, const value* args, size_t n, const keyword_args* kw, int (*test)(int)) {
+	no_keywords(name, kw);
+	const std::string& s = self_str(name, args, n, 0, 0);
+	if (s.empty()) {
+		return make_bool(false);
+	}
+	for (unsigned char c : s) {
+		if (!test(c)) {
+			return make_bool(false);
+		}
+	}
+	return make_bool(true);
+}
+
+static value str_isdigit(const value* args, size_t n, const keyword_args* kw) {
+	return char_class("isdigit", args, n, kw, isdigit);
+}
+
+static value str_isalpha(const value* args, size_t n, const keyword_args* kw) {
+	return char_class("isalpha", args, n, kw, isalpha);
+}
+
+static value str_isspace(const value* args, size_t n, const keyword_args* kw) {
+	return char_class("isspace", args, n, kw, isspace);
+}
+
+static const method_def list_methods[] = {
+	{ "append", list_append }, { "extend", list_extend }, { "pop", list_pop }, { "insert", list_insert },
+	{ "remove", list_remove }, { "index", list_index }, { "count", list_count }, { "reverse", list_reverse },
+	{ "sort", list_sort }, { "copy", list_copy }, { "clear", list_clear }, { nullptr, nullptr }
+};
+
+static const method_def tuple_methods[] = {
+	{ "index", tuple_index }, { "count", tuple_count }, { nullptr, nullptr }
+};
+
+static const method_def dict_methods[] = {
+	{ "get", dict_get }, { "keys", dict_keys }, { "values", dict_values }, { "items", dict_items },
+	{ "pop", dict_pop }, { "setdefault", dict_setdefault }, { "update", dict_update_method }, { "copy", dict_copy },
+	{ "clear", dict_clear }, { nullptr, nullptr }
+};
+
+static const method_def set_methods[] = {
+	{ "add", set_add }, { "remove", set_remove }, { "discard", set_discard }, { "clear", set_clear },
+	{ nullptr, nullptr }
+};
+
+static const method_def str_methods[] = {
+	{ "join", str_join }, { "split", str_split }, { "strip", str_strip }, { "lstrip", str_lstrip },
+	{ "rstrip", str_rstrip }, { "upper", str_upper }, { "lower", str_lower }, { "replace", str_replace },
+	{ "startswith", str_startswith }, { "endswith", str_endswith }, { "find", str_find }, { "index", str_index },
+	{ "count", str_count }, { "format", str_format_method }, { "isdigit", str_isdigit }, { "isalpha", str_isalpha },
+	{ "isspace", str_isspace }, { nullptr, nullptr }
+};
+
+type_object type_type(TYPE_TYPE, "type", nullptr, type_new, nullptr);
+type_object none_type(TYPE_NONE, "NoneType", nullptr, nullptr, nullptr);
+type_object int_type(TYPE_INT, "int", nullptr, int_new, nullptr);
+type_object bool_type(TYPE_BOOL, "bool", &int_type, bool_new, nullptr);
+type_object float_type(TYPE_FLOAT, "float", nullptr, float_new, nullptr);
+type_object str_type(TYPE_STR, "str", nullptr, str_new, str_methods);
+type_object tuple_type(TYPE_TUPLE, "tuple", nullptr, tuple_new, tuple_methods);
+type_object list_type(TYPE_LIST, "list", nullptr, list_new, list_methods);
+type_object dict_type(TYPE_DICT, "dict", nullptr, dict_new, dict_methods);
+type_object set_type(TYPE_SET, "set", nullptr, set_new, set_methods);
+type_object range_type(TYPE_RANGE, "range", nullptr, range_new, nullptr);
+type_object slice_type(TYPE_SLICE, "slice", nullptr, nullptr, nullptr);
+type_object function_type(TYPE_FUNCTION, "function", nullptr, nullptr, nullptr);
+type_object builtin_type(TYPE_BUILTIN, "builtin_function_or_method", nullptr, nullptr, nullptr);
+type_object cell_type(TYPE_CELL, "cell", nullptr, nullptr, nullptr);
+type_object iterator_type(TYPE_ITERATOR, "iterator", nullptr, nullptr, nullptr);
+
+type_object base_exception_type(TYPE_EXCEPTION, "BaseException", nullptr, exception_new<&base_exception_type>, nullptr);
+type_object exception_type(TYPE_EXCEPTION, "Exception", &base_exception_type, exception_new<&exception_type>, nullptr);
+type_object arithmetic_error_type(TYPE_EXCEPTION, "ArithmeticError", &exception_type,
+		exception_new<&arithmetic_error_type>, nullptr);
+type_object zero_division_error_type(TYPE_EXCEPTION, "ZeroDivisionError", &arithmetic_error_type,
+		exception_new<&zero_division_error_type>, nullptr);
+type_object overflow_error_type(TYPE_EXCEPTION, "OverflowError", &arithmetic_error_type,
+		exception_new<&overflow_error_type>, nullptr);
+type_object lookup_error_type(TYPE_EXCEPTION, "LookupError", &exception_type, exception_new<&lookup_error_type>,
+		nullptr);
+type_object index_error_type(TYPE_EXCEPTION, "IndexError", &lookup_error_type, exception_new<&index_error_type>,
+		nullptr);
+type_object key_error_type(TYPE_EXCEPTION, "KeyError", &lookup_error_type, exception_new<&key_error_type>, nullptr);
+type_object value_error_type(TYPE_EXCEPTION, "ValueError", &exception_type, exception_new<&value_error_type>,
+		nullptr);
+type_object type_error_type(TYPE_EXCEPTION, "TypeError", &exception_type, exception_new<&type_error_type>, nullptr);
+type_object name_error_type(TYPE_EXCEPTION, "NameError", &exception_type, exception_new<&name_error_type>, nullptr);
+type_object unbound_local_error_type(TYPE_EXCEPTION, "UnboundLocalError", &name_error_type,
+		exception_new<&unbound_local_error_type>, nullptr);
+type_object attribute_error_type(TYPE_EXCEPTION, "AttributeError", &exception_type,
+		exception_new<&attribute_error_type>, nullptr);
+type_object assertion_error_type(TYPE_EXCEPTION, "AssertionError", &exception_type,
+		exception_new<&assertion_error_type>, nullptr);
+type_object runtime_error_type(TYPE_EXCEPTION, "RuntimeError", &exception_type, exception_new<&runtime_error_type>,
+		nullptr);
+type_object recursion_error_type(TYPE_EXCEPTION, "RecursionError", &runtime_error_type,
+		exception_new<&recursion_error_type>, nullptr);
+type_object not_implemented_error_type(TYPE_EXCEPTION, "NotImplementedError", &runtime_error_type,
+		exception_new<&not_implemented_error_type>, nullptr);
+type_object stop_iteration_type(TYPE_EXCEPTION, "StopIteration", &exception_type, exception_new<&stop_iteration_type>,
+		nullptr);
+
+void add_builtins(std::unordered_map<const char*, value>& table, arena& A) {
+	static const struct {
+		const char* name;
+		builtin_fn fn;
+	} functions[] = {
+		{ "print", builtin_print }, { "len", builtin_len }, { "abs", builtin_abs }, { "min", builtin_min },
+		{ "max", builtin_max }, { "sum", builtin_sum }, { "sorted", builtin_sorted }, { "reversed", builtin_reversed },
+		{ "enumerate", builtin_enumerate }, { "zip", builtin_zip }, { "map", builtin_map },
+		{ "filter", builtin_filter }, { "repr", builtin_repr }, { "format", builtin_format },
+		{ "isinstance", builtin_isinstance }, { "iter", builtin_iter }, { "next", builtin_next },
+		{ "chr", builtin_chr }, { "ord", builtin_ord }, { "round", builtin_round }, { "divmod", builtin_divmod },
+		{ "hash", builtin_hash }, { "any", builtin_any }, { "all", builtin_all }, { "callable", builtin_callable }
+	};
+
+	static type_object* const types[] = {
+		&int_type, &bool_type, &float_type, &str_type, &tuple_type, &list_type, &dict_type, &set_type, &range_type,
+		&type_type, &base_exception_type, &exception_type, &arithmetic_error_type, &zero_division_error_type,
+		&overflow_error_type, &lookup_error_type, &index_error_type, &key_error_type, &value_error_type,
+		&type_error_type, &name_error_type, &unbound_local_error_type, &attribute_error_type, &assertion_error_type,
+		&runtime_error_type, &recursion_error_type, &not_implemented_error_type, &stop_iteration_type
+	};
+
+	for (auto& f : functions) {
+		table[A.intern(f.name)] = make_builtin(f.name, f.fn);
+	}
+	for (auto t : types) {
+		table[A.intern(t->name)] = value::borrow(t);
+	}
+	/* Asserts are always on, there is no -O */
+	table[A.intern("__debug__")] = make_bool(true);
+}
+
+} /* namespace arbusto */
@@ -0,0 +1,240 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <sstream>
+#include <iomanip>
+
+#include "bytecode.h"
+#include "literal.h"
+
+namespace arbusto {
+
+static const char* const opcode_names[] = {
+	"NOP", "MOVE", "LOADK", "LOADGLOBAL", "STOREGLOBAL", "DELGLOBAL", "LOADDEREF", "STOREDEREF", "DELDEREF",
+	"CHECKBOUND", "DELFAST", "CLEAR",
+	"ADD", "SUB", "MUL", "MATMUL", "TRUEDIV", "MOD", "POW", "LSHIFT", "RSHIFT", "BITOR", "BITXOR", "BITAND",
+	"FLOORDIV", "IADD",
+	"NEG", "POS", "INVERT", "NOT",
+	"LT", "LE", "EQ", "NE", "GT", "GE", "IS", "ISNOT", "IN", "NOTIN",
+	"JMP", "JMPIF", "JMPIFNOT",
+	"GETITEM", "SETITEM", "DELITEM", "GETATTR", "SETATTR",
+	"BUILDLIST", "BUILDTUPLE", "BUILDSET", "BUILDDICT", "BUILDSLICE", "LISTAPPEND", "SETADD", "RESERVE", "UNPACK",
+	"ITER", "FORITER",
+	"CALL", "MAKEFUNC", "RETURN", "RAISE", "EXCMATCH",
+	"ADD_II", "SUB_II", "MUL_II", "FLOORDIV_II", "MOD_II", "ADD_FF", "SUB_FF", "MUL_FF", "TRUEDIV_FF",
+	"LT_II", "LE_II", "EQ_II", "NE_II", "GT_II", "GE_II", "LT_FF", "LE_FF", "EQ_FF", "NE_FF", "GT_FF", "GE_FF",
+	"JMPIF_B", "JMPIFNOT_B", "FORITER_I", "CALL_I", "CALL_F"
+};
+
+static_assert(sizeof(opcode_names) / sizeof(opcode_names[0]) == N_OPCODES, "opcode_names is out of date");
+
+const char* opcode_name(opcode op) {
+	return op < N_OPCODES ? opcode_names[op] : "?";
+}
+
+static void write_varint(std::vector<uint8_t>& out, uint32_t v) {
+	while (v >= 0x80) {
+		out.push_back(static_cast<uint8_t>(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back(static_cast<uint8_t>(v));
+}
+
+static uint32_t read_varint(const std::vector<uint8_t>& in, size_t& i) {
+	uint32_t v = 0;
+	for (int shift = 0; i < in.size(); shift += 7) {
+		uint8_t b = in[i++];
+		v |= static_cast<uint32_t>(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			break;
+		}
+	}
+	return v;
+}
+
+std::vector<uint8_t> encode_line_table(const std::vector<uint32_t>& lines, uint32_t first_line) {
+	std::vector<uint8_t> table;
+	uint32_t prev = first_line;
+
+	for (size_t i = 0; i < lines.size(); ) {
+		size_t j = i;
+		while (j < lines.size() && lines[j] == lines[i]) {
+			++j;
+		}
+
+		int32_t delta = static_cast<int32_t>(lines[i] - prev);
+		write_varint(table, static_cast<uint32_t>(j - i));
+		write_varint(table, (static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31));
+		prev = lines[i];
+		i = j;
+	}
+
+	return table;
+}
+
+uint32_t code_object::line_of(uint32_t pc) const {
+	uint32_t line = first_line;
+	uint32_t end = 0;
+
+	for (size_t i = 0; i < line_table.size(); ) {
+		end += read_varint(line_table, i);
+		uint32_t zz = read_varint(line_table, i);
+		line += static_cast<uint32_t>(static_cast<int32_t>(zz >> 1) ^ -static_cast<int32_t>(zz & 1));
+		if (pc < end) {
+			break;
+		}
+	}
+
+	return line;
+}
+
+const exception_entry* code_object::handler_of(uint32_t pc) const {
+	for (auto& e : exception_table) {
+		if (pc >= e.start && pc < e.end) {
+			return &e;
+		}
+	}
+	return nullptr;
+}
+
+std::string constant_repr(const code_object& co, uint32_t index) {
+	const constant& k = co.constants[index];
+	std::ostringstream out;
+
+	switch (k.kind) {
+	case CK_NONE: out << "None"; break;
+	case CK_BOOL: out << (k.i ? "True" : "False"); break;
+	case CK_INT: out << k.i; break;
+	case CK_BIGINT: out << k.s; break;
+	case CK_FLOAT: out << float_repr(k.f); break;
+	case CK_STR: write_str_repr(out, k.s.data(), k.s.size()); break;
+	case CK_TUPLE:
+		out << "(";
+		for (size_t i = 0; i < k.items.size(); ++i) {
+			out << (i ? ", " : "") << constant_repr(co, k.items[i]);
+		}
+		out << (k.items.size() == 1 ? ",)" : ")");
+		break;
+	}
+
+	return out.str();
+}
+
+/* Operand formats, for the listing */
+enum operand_format { FMT_NONE, FMT_A, FMT_AB, FMT_ABC, FMT_ABX, FMT_ASBX, FMT_SBX };
+
+static operand_format format_of(opcode op) {
+	switch (op) {
+	case BC_NOP:
+		return FMT_NONE;
+	case BC_CHECKBOUND: case BC_DELFAST: case BC_RETURN: case BC_RAISE:
+		return FMT_A;
+	case BC_MOVE: case BC_LOADDEREF: case BC_STOREDEREF: case BC_DELDEREF: case BC_NEG: case BC_POS:
+	case BC_INVERT: case BC_NOT: case BC_DELITEM: case BC_BUILDSLICE: case BC_LISTAPPEND: case BC_SETADD:
+	case BC_ITER: case BC_CLEAR: case BC_RESERVE:
+		return FMT_AB;
+	case BC_LOADK: case BC_LOADGLOBAL: case BC_STOREGLOBAL: case BC_DELGLOBAL: case BC_MAKEFUNC:
+		return FMT_ABX;
+	case BC_JMPIF: case BC_JMPIFNOT: case BC_FORITER: case BC_JMPIF_B: case BC_JMPIFNOT_B: case BC_FORITER_I:
+		return FMT_ASBX;
+	case BC_JMP:
+		return FMT_SBX;
+	default:
+		return FMT_ABC;
+	}
+}
+
+/* The instructions of code, co.code or co.specialized */
+static void list_code(const code_object& co, const std::vector<instruction>& code, std::ostream& out) {
+	uint32_t prev_line = 0;
+
+	for (uint32_t pc = 0; pc < code.size(); ++pc) {
+		instruction ins = code[pc];
+		opcode op = op_of(ins);
+		uint32_t line = co.line_of(pc);
+		std::ostringstream args;
+		std::string note;
+
+		switch (format_of(op)) {
+		case FMT_NONE: break;
+		case FMT_A: args << arg_a(ins); break;
+		case FMT_AB: args << arg_a(ins) << " " << arg_b(ins); break;
+		case FMT_ABC: args << arg_a(ins) << " " << arg_b(ins) << " " << arg_c(ins); break;
+		case FMT_ABX: args << arg_a(ins) << " " << arg_bx(ins); break;
+		case FMT_ASBX: args << arg_a(ins) << " " << arg_sbx(ins); break;
+		case FMT_SBX: args << arg_sbx(ins); break;
+		}
+
+		switch (op) {
+		case BC_LOADK: note = constant_repr(co, arg_bx(ins)); break;
+		case BC_LOADGLOBAL: case BC_STOREGLOBAL: case BC_DELGLOBAL: note = co.names[arg_bx(ins)]; break;
+		case BC_GETATTR: note = co.attrs[arg_c(ins)]; break;
+		case BC_SETATTR: note = co.attrs[arg_b(ins)]; break;
+		case BC_MAKEFUNC: note = co.children[arg_bx(ins)]->name; break;
+		case BC_JMP: case BC_JMPIF: case BC_JMPIFNOT: case BC_FORITER: case BC_JMPIF_B: case BC_JMPIFNOT_B:
+		case BC_FORITER_I:
+			note = "to " + std::to_string(pc + 1 + arg_sbx(ins));
+			break;
+		case BC_LOADDEREF: case BC_STOREDEREF: case BC_DELDEREF:
+			{
+				size_t d = arg_b(ins);
+				note = d < co.cellvars.size() ? co.cellvars[d] : co.freevars[d - co.cellvars.size()];
+			}
+			break;
+		default:
+			break;
+		}
+
+		out << std::setw(6) << (line != prev_line ? std::to_string(line) : "") << std::setw(6) << pc << "  "
+				<< std::left << std::setw(12) << opcode_name(op) << std::setw(12) << args.str() << std::right;
+		if (!note.empty()) {
+			out << "; " << note;
+		}
+		out << std::endl;
+		prev_line = line;
+	}
+}
+
+static void disassemble_one(const code_object& co, std::ostream& out) {
+	out << "code " << co.name << " line " << co.first_line << " registers=" << co.n_registers << " params="
+			<< co.n_params() << " slots=" << co.varnames.size() << " cells=" << co.cellvars.size() << " frees="
+			<< co.freevars.size() << std::endl;
+
+	for (size_t i = 0; i < co.varnames.size(); ++i) {
+		if (co.varnames[i]) {
+			out << "  slot " << i << " " << co.varnames[i] << std::endl;
+		}
+	}
+	for (size_t i = 0; i < co.cellvars.size() + co.freevars.size(); ++i) {
+		out << "  cell " << i << " " << (i < co.cellvars.size() ? co.cellvars[i] : co.freevars[i - co.cellvars.size()])
+				<< std::endl;
+	}
+
+	list_code(co, co.code, out);
+	if (!co.specialized.empty()) {
+		static const char* const type_names[] = { "any", "int", "float" };
+		out << "  specialized for (";
+		for (size_t i = 0; i < co.param_types.size(); ++i) {
+			out << (i ? ", " : "") << type_names[co.param_types[i]];
+		}
+		out << ")" << std::endl;
+		list_code(co, co.specialized, out);
+	}
+
+	for (auto& e : co.exception_table) {
+		out << "  handler " << e.start << " to " << e.end << " -> " << e.handler << " reg " << e.reg << std::endl;
+	}
+	out << std::endl;
+}
+
+void disassemble(const code_object& co, std::ostream& out) {
+	disassemble_one(co, out);
+	for (auto& child : co.children) {
+		disassemble(*child, out);
+	}
+}
+
+} /* namespace arbusto */
@@ -0,0 +1,280 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef BYTECODE_H_
+#define BYTECODE_H_
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <ostream>
+#include <cstdint>
+
+namespace arbusto {
+
+/*
+ * Register bytecode. Every instruction is one 32-bit word, the opcode in
+ * the low byte and then either three byte operands A B C, or A and a 16
+ * bit Bx, or A and a signed 16 bit sBx:
+ *
+ *   iABC   op:8 A:8 B:8 C:8
+ *   iABx   op:8 A:8 Bx:16
+ *   iAsBx  op:8 A:8 sBx:16    (Bx - SBX_BIAS)
+ *
+ * R[n] is register n of the frame. The first registers of a function are
+ * its fast locals, in the slots the symtable gave them, and temporaries
+ * come after them. K[n] is constant n of the code object, N[n] its name n
+ * (a global), T[n] its attribute name n, and D[n] its cell n (the cells,
+ * then the free variables). Jumps are relative to the next instruction.
+ */
+enum opcode {
+	BC_NOP,
+	BC_MOVE, /* A B      R[A] = R[B] */
+	BC_LOADK, /* A Bx     R[A] = K[Bx] */
+	BC_LOADGLOBAL, /* A Bx     R[A] = globals[N[Bx]], or the builtin */
+	BC_STOREGLOBAL, /* A Bx     globals[N[Bx]] = R[A] */
+	BC_DELGLOBAL, /* A Bx     del globals[N[Bx]] */
+	BC_LOADDEREF, /* A B      R[A] = D[B] */
+	BC_STOREDEREF, /* A B      D[B] = R[A] */
+	BC_DELDEREF, /* A B      del D[B] */
+	BC_CHECKBOUND, /* A        UnboundLocalError if R[A] is unbound */
+	BC_DELFAST, /* A        del R[A] */
+	BC_CLEAR, /* A B      R[A], ... R[A+B-1] = unbound */
+
+	/* A B C    R[A] = R[B] op R[C], in the order of ast_operator */
+	BC_ADD,
+	BC_SUB,
+	BC_MUL,
+	BC_MATMUL,
+	BC_TRUEDIV,
+	BC_MOD,
+	BC_POW,
+	BC_LSHIFT,
+	BC_RSHIFT,
+	BC_BITOR,
+	BC_BITXOR,
+	BC_BITAND,
+	BC_FLOORDIV,
+	BC_IADD, /* A B C    R[A] = R[B] += R[C], lists extend in place */
+
+	/* A B      R[A] = op R[B] */
+	BC_NEG,
+	BC_POS,
+	BC_INVERT,
+	BC_NOT,
+
+	/* A B C    R[A] = R[B] op R[C], a bool */
+	BC_LT,
+	BC_LE,
+	BC_EQ,
+	BC_NE,
+	BC_GT,
+	BC_GE,
+	BC_IS,
+	BC_ISNOT,
+	BC_IN,
+	BC_NOTIN,
+
+	BC_JMP, /* sBx      pc += sBx */
+	BC_JMPIF, /* A sBx    if R[A]: pc += sBx */
+	BC_JMPIFNOT, /* A sBx    if not R[A]: pc += sBx */
+
+	BC_GETITEM, /* A B C    R[A] = R[B][R[C]] */
+	BC_SETITEM, /* A B C    R[A][R[B]] = R[C] */
+	BC_DELITEM, /* A B      del R[A][R[B]] */
+	BC_GETATTR, /* A B C    R[A] = R[B].T[C] */
+	BC_SETATTR, /* A B C    R[A].T[B] = R[C] */
+
+	BC_BUILDLIST, /* A B C    R[A] = [R[B], ... R[B+C-1]] */
+	BC_BUILDTUPLE, /* A B C    R[A] = (R[B], ... R[B+C-1]) */
+	BC_BUILDSET, /* A B C    R[A] = {R[B], ... R[B+C-1]} */
+	BC_BUILDDICT, /* A B C    R[A] = {R[B]: R[B+1], ...}, C pairs */
+	BC_BUILDSLICE, /* A B      R[A] = slice(R[B], R[B+1], R[B+2]) */
+	BC_LISTAPPEND, /* A B      R[A].append(R[B]) */
+	BC_SETADD, /* A B      R[A].add(R[B]) */
+	BC_RESERVE, /* A B      room in the empty list, set or dict R[A] for the items of R[B], if it knows how many */
+	BC_UNPACK, /* A B C    R[A], ... R[A+C-1] = R[B] */
+
+	BC_ITER, /* A B      R[A] = iter(R[B]) */
+	BC_FORITER, /* A sBx    R[A+1] = next(R[A]), or pc += sBx when it is exhausted */
+
+	/*
+	 * A B C    R[A] = R[A](R[A+1], ... R[A+B]) with C keyword arguments:
+	 * their values in R[A+B+1], ... R[A+B+C] and the tuple of their names
+	 * in R[A+B+C+1].
+	 */
+	BC_CALL,
+	BC_MAKEFUNC, /* A Bx     R[A] = function of child code Bx, its defaults in R[A], ... */
+	BC_RETURN, /* A        return R[A] */
+	BC_RAISE, /* A        raise R[A] */
+	BC_EXCMATCH, /* A B C    R[A] = the exception R[B] matches R[C], as in except R[C]: */
+
+	/*
+	 * Typed instructions, only in code_object::specialized, with the
+	 * operands of the generic one they replace. _II ones read two small
+	 * ints, _FF ones two floats, _B ones a bool. Where the generic one would
+	 * give something else, an int that does not fit a small int or an
+	 * exception, they deopt instead: the generic code goes on from the same
+	 * instruction.
+	 */
+	BC_ADD_II,
+	BC_SUB_II,
+	BC_MUL_II,
+	BC_FLOORDIV_II,
+	BC_MOD_II,
+	BC_ADD_FF,
+	BC_SUB_FF,
+	BC_MUL_FF,
+	BC_TRUEDIV_FF,
+	BC_LT_II,
+	BC_LE_II,
+	BC_EQ_II,
+	BC_NE_II,
+	BC_GT_II,
+	BC_GE_II,
+	BC_LT_FF,
+	BC_LE_FF,
+	BC_EQ_FF,
+	BC_NE_FF,
+	BC_GT_FF,
+	BC_GE_FF,
+	BC_JMPIF_B,
+	BC_JMPIFNOT_B,
+	/* As the generic one, then the generic code goes on from the next instruction unless R[A+1] is a small int */
+	BC_FORITER_I,
+	/* The same for R[A], a small int or a float */
+	BC_CALL_I,
+	BC_CALL_F,
+
+	N_OPCODES
+};
+
+const char* opcode_name(opcode op);
+
+typedef uint32_t instruction;
+
+const int SBX_BIAS = 0x7fff;
+const int MAX_SBX = 0xffff - SBX_BIAS;
+const unsigned MAX_BX = 0xffff;
+const unsigned MAX_REGISTERS = 256;
+
+inline instruction encode_abc(opcode op, unsigned a, unsigned b, unsigned c) {
+	return op | a << 8 | b << 16 | c << 24;
+}
+
+inline instruction encode_abx(opcode op, unsigned a, unsigned bx) {
+	return op | a << 8 | bx << 16;
+}
+
+inline instruction encode_asbx(opcode op, unsigned a, int sbx) {
+	return op | a << 8 | static_cast<uint32_t>(sbx + SBX_BIAS) << 16;
+}
+
+inline opcode op_of(instruction i) { return static_cast<opcode>(i & 0xff); }
+inline unsigned arg_a(instruction i) { return (i >> 8) & 0xff; }
+inline unsigned arg_b(instruction i) { return (i >> 16) & 0xff; }
+inline unsigned arg_c(instruction i) { return i >> 24; }
+inline unsigned arg_bx(instruction i) { return i >> 16; }
+inline int arg_sbx(instruction i) { return static_cast<int>(i >> 16) - SBX_BIAS; }
+
+enum constant_kind { CK_NONE, CK_BOOL, CK_INT, CK_BIGINT, CK_FLOAT, CK_STR, CK_TUPLE };
+
+/* A constant pool entry, independent of the runtime that loads it */
+struct constant {
+	constant_kind kind{CK_NONE};
+	int64_t i{0}; /* CK_BOOL and CK_INT */
+	double f{0};
+	std::string s; /* CK_STR in UTF-8, the decimal digits of CK_BIGINT, maybe after a '-' */
+	std::vector<uint32_t> items; /* CK_TUPLE, indices of other constants of the pool */
+};
+
+/* Exceptions raised at pc in [start, end) go to handler, with the exception in R[reg] */
+struct exception_entry {
+	uint32_t start;
+	uint32_t end;
+	uint32_t handler;
+	uint32_t reg;
+};
+
+/* What an annotation promises of a parameter or a return value */
+enum value_type { VT_ANY, VT_INT, VT_FLOAT };
+
+enum code_flags {
+	CODE_VARARGS = 1, /* has *args, the slot after the keyword only ones */
+	CODE_VARKEYWORDS = 2 /* has **kwargs, the slot after *args */
+};
+
+/*
+ * The code of a module, function, lambda or comprehension. Parameters
+ * take the first slots: n_args positional ones, n_kwonly keyword only
+ * ones, then *args and **kwargs. Names are the ones interned in the arena
+ * of the module, so they compare by pointer.
+ */
+struct code_object {
+	const char* name{nullptr};
+	uint32_t first_line{0};
+	unsigned flags{0};
+
+	std::vector<instruction> code;
+	std::vector<constant> constants;
+	std::vector<const char*> names; /* N, globals */
+	std::vector<const char*> attrs; /* T, attribute names */
+	std::vector<uint8_t> line_table; /* see line_of */
+	std::vector<exception_entry> exception_table; /* one entry at most for each pc */
+
+	uint32_t n_args{0};
+	uint32_t n_kwonly{0};
+	uint32_t n_defaults{0}; /* of the last positional parameters */
+	std::vector<bool> kwonly_default; /* the keyword only parameters with a default, in order */
+	uint32_t n_registers{0};
+	/* The name of each slot, then of the registers of inlined comprehension locals, nullptr for temporaries */
+	std::vector<const char*> varnames;
+
+	std::vector<const char*> cellvars;
+	std::vector<int32_t> cell_params; /* the slot each cell starts from, -1 if it is not a parameter */
+	std::vector<const char*> freevars;
+	std::vector<uint32_t> closure; /* the cell of the enclosing code each free variable is */
+
+	std::vector<std::unique_ptr<code_object> > children; /* of BC_MAKEFUNC */
+
+	std::vector<uint8_t> param_types; /* value_type of the named parameters, from their annotations */
+	uint8_t return_type{VT_ANY};
+	/*
+	 * Empty, or code for the calls whose arguments have the types of
+	 * param_types: as long as code and with the same registers, lines and
+	 * handlers, some instructions replaced by typed ones, so that it can
+	 * switch to code at any instruction. See specialize.h.
+	 */
+	std::vector<instruction> specialized;
+
+	/* The source line of the instruction at pc */
+	uint32_t line_of(uint32_t pc) const;
+
+	/* The handler entry for pc, nullptr if there is none */
+	const exception_entry* handler_of(uint32_t pc) const;
+
+	size_t n_params() const {
+		return n_args + n_kwonly + ((flags & CODE_VARARGS) != 0) + ((flags & CODE_VARKEYWORDS) != 0);
+	}
+};
+
+/*
+ * The line table of the instructions with the lines in lines: for every
+ * run of instructions on one line, the length of the run and then the
+ * line minus the line of the previous run, both as LEB128 varints, the
+ * line delta zigzag encoded.
+ */
+std::vector<uint8_t> encode_line_table(const std::vector<uint32_t>& lines, uint32_t first_line);
+
+/* A constant the way Python's repr writes it */
+std::string constant_repr(const code_object& co, uint32_t index);
+
+/* A listing of co and its children */
+void disassemble(const code_object& co, std::ostream& out);
+
+} /* namespace arbusto */
+
+#endif /* BYTECODE_H_ */
@@ -0,0 +1,1773 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+#include "compiler.h"
+#include "specialize.h"
+#include "passes.h"
+
+namespace arbusto {
+
+/*
+ * One code object being compiled. Registers below n_slots are the fast
+ * locals, the temporaries are a stack above them: top is the first free
+ * one, and every statement and expression gives back what it took.
+ *
+ * defined holds the locals bound on every path to the current instruction,
+ * which need no CHECKBOUND; reachable is false after return, raise, break
+ * and continue, until a jump target merges some other path in.
+ */
+struct unit {
+	unit(code_object* co_, const scope* sc_) : co(co_), sc(sc_) {}
+
+	code_object* co;
+	const scope* sc;
+	uint32_t n_slots{0};
+	uint32_t top{0};
+	uint32_t line{0};
+
+	std::vector<uint32_t> lines; /* of each instruction */
+	std::map<std::string, uint32_t> constants;
+	std::unordered_map<const char*, uint32_t> names;
+	std::unordered_map<const char*, uint32_t> attrs;
+
+	std::vector<bool> defined;
+	bool reachable{true};
+
+	struct loop {
+		uint32_t head; /* where continue goes */
+		std::vector<uint32_t> breaks;
+		size_t handlers;
+		size_t finallies;
+	};
+	std::vector<loop> loops;
+
+	/* The try blocks around the current instruction, innermost last */
+	struct handler {
+		uint32_t id; /* in handler_pcs */
+		uint32_t reg;
+	};
+	std::vector<handler> handlers;
+	std::vector<uint32_t> handler_pcs;
+	uint32_t segment_start{0};
+
+	/* The finally bodies that return, break and continue run on their way out */
+	struct finally {
+		const ast_body* body;
+		size_t handlers;
+	};
+	std::vector<finally> finallies;
+
+	std::vector<uint32_t> except_regs; /* of the except blocks around, for a bare raise */
+
+	/* The inlined comprehensions around, innermost last, their locals in the registers from base on */
+	struct inline_scope {
+		const scope* sc;
+		uint32_t base;
+	};
+	std::vector<inline_scope> inlined;
+};
+
+enum name_kind { NAME_FAST, NAME_GLOBAL, NAME_DEREF };
+
+struct name_ref {
+	name_kind kind;
+	uint32_t index; /* slot, N index or D index */
+};
+
+class compiler {
+public:
+	compiler(const symtable& st_, arena& A_, const compile_options& opts_) : st(st_), A(A_), opts(opts_), u(nullptr) {
+		int_name = A.intern("int");
+		float_name = A.intern("float");
+	}
+
+	std::unique_ptr<code_object> module(const ast_module* m) {
+		std::unique_ptr<code_object> co(new code_object());
+		co->name = A.intern("<module>");
+		co->first_line = 1;
+
+		/* What the functions of the module promise to return, for the calls of them in specialized code */
+		for (auto s : m->body) {
+			if (s->kind == AST_FUNCTION_DEF) {
+				auto f = static_cast<const ast_function_def*>(s);
+				value_type t = annotated_type(f->returns);
+				if (t != VT_ANY) {
+					returns[f->name] = t;
+				} else {
+					returns.erase(f->name);
+				}
+			}
+		}
+
+		unit mu(co.get(), st.top());
+		u = &mu;
+		body(m->body);
+		finish();
+		u = nullptr;
+
+		if (opts.passes) {
+			opts.passes->run(*co);
+		}
+
+		return co;
+	}
+
+private:
+	[[noreturn]] void fail(uint32_t line, const std::string& what) {
+		throw std::runtime_error("line " + std::to_string(line) + ": " + what);
+	}
+
+	[[noreturn]] void unsupported(const ast_node* n, const std::string& what) {
+		fail(n->line, what + " is not supported");
+	}
+
+	/* Emitting */
+
+	uint32_t pc() const {
+		return static_cast<uint32_t>(u->co->code.size());
+	}
+
+	uint32_t emit(instruction i) {
+		u->co->code.push_back(i);
+		u->lines.push_back(u->line);
+		return pc() - 1;
+	}
+
+	uint32_t emit_abc(opcode op, unsigned a, unsigned b = 0, unsigned c = 0) {
+		return emit(encode_abc(op, a, b, c));
+	}
+
+	uint32_t emit_abx(opcode op, unsigned a, unsigned bx) {
+		return emit(encode_abx(op, a, bx));
+	}
+
+	/* A jump to patch later */
+	uint32_t emit_jump(opcode op, unsigned a = 0) {
+		return emit(encode_asbx(op, a, 0));
+	}
+
+	void patch(uint32_t at, uint32_t target) {
+		int offset = static_cast<int>(target) - static_cast<int>(at + 1);
+		if (offset < -SBX_BIAS || offset > MAX_SBX) {
+			fail(u->line, "jump too far, the function is too large");
+		}
+		instruction i = u->co->code[at];
+		u->co->code[at] = encode_asbx(op_of(i), arg_a(i), offset);
+	}
+
+	void patch_here(const std::vector<uint32_t>& jumps) {
+		for (auto j : jumps) {
+			patch(j, pc());
+		}
+	}
+
+	void jump_back(uint32_t target) {
+		patch(emit_jump(BC_JMP), target);
+	}
+
+	/* Registers */
+
+	uint32_t temp() {
+		if (u->top >= MAX_REGISTERS) {
+			fail(u->line, "expression too complex, it needs more than " + std::to_string(MAX_REGISTERS) + " registers");
+		}
+		uint32_t r = u->top++;
+		if (u->top > u->co->n_registers) {
+			u->co->n_registers = u->top;
+		}
+		return r;
+	}
+
+	/* n consecutive temporaries, the first one */
+	uint32_t temps(size_t n) {
+		uint32_t base = u->top;
+		for (size_t i = 0; i < n; ++i) {
+			temp();
+		}
+		return base;
+	}
+
+	bool is_local(uint32_t reg) const {
+		if (reg < u->n_slots) {
+			return true;
+		}
+		for (auto& i : u->inlined) {
+			if (reg >= i.base && reg < i.base + i.sc->slots.size()) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/* n consecutive registers for an instruction whose result goes to dst, from dst if it is the last temporary */
+	uint32_t base_for(uint32_t dst, size_t n) {
+		if (!is_local(dst) && dst + 1 == u->top) {
+			temps(n - 1);
+			return dst;
+		}
+		return temps(n);
+	}
+
+	/* Pools */
+
+	uint32_t add_constant(const std::string& key, const constant& k) {
+		auto it = u->constants.find(key);
+		if (it != u->constants.end()) {
+			return it->second;
+		}
+		if (u->co->constants.size() > MAX_BX) {
+			fail(u->line, "too many constants");
+		}
+		uint32_t index = static_cast<uint32_t>(u->co->constants.size());
+		u->co->constants.push_back(k);
+		u->constants[key] = index;
+		return index;
+	}
+
+	uint32_t none_constant() {
+		return add_constant("n", constant());
+	}
+
+	uint32_t str_constant(const std::string& s) {
+		constant k;
+		k.kind = CK_STR;
+		k.s = s;
+		return add_constant("s" + s, k);
+	}
+
+	/* The pool index of e, -1 if e is not a constant or a tuple of constants */
+	int64_t constant_index(const ast_expr* e) {
+		if (auto c = ast_cast<ast_constant>(e)) {
+			constant k;
+			switch (c->value_kind) {
+			case CONST_NONE:
+				return none_constant();
+			case CONST_BOOL:
+				k.kind = CK_BOOL;
+				k.i = c->i;
+				return add_constant(c->i ? "b1" : "b0", k);
+			case CONST_INT:
+				k.kind = CK_INT;
+				k.i = c->i;
+				return add_constant("i" + std::to_string(c->i), k);
+			case CONST_FLOAT:
+				{
+					k.kind = CK_FLOAT;
+					k.f = c->f;
+					uint64_t bits;
+					std::memcpy(&bits, &c->f, sizeof(bits));
+					return add_constant("f" + std::to_string(bits), k);
+				}
+			case CONST_STR:
+				return str_constant(std::string(c->str, c->str_size));
+			case CONST_BIGINT:
+				k.kind = CK_BIGINT;
+				k.s = std::string(c->str, c->str_size);
+				return add_constant("n" + k.s, k);
+			case CONST_ELLIPSIS:
+				unsupported(e, "Ellipsis");
+			case CONST_IMAG:
+				unsupported(e, "a complex number");
+			case CONST_BYTES:
+				unsupported(e, "bytes");
+			}
+		}
+
+		if (auto t = ast_cast<ast_tuple>(e)) {
+			constant k;
+			k.kind = CK_TUPLE;
+			std::string key = "t";
+			for (auto item : t->elts) {
+				int64_t i = constant_index(item);
+				if (i < 0) {
+					return -1;
+				}
+				k.items.push_back(static_cast<uint32_t>(i));
+				key += std::to_string(i) + ",";
+			}
+			return add_constant(key, k);
+		}
+
+		return -1;
+	}
+
+	uint32_t name_index(const char* name) {
+		auto it = u->names.find(name);
+		if (it != u->names.end()) {
+			return it->second;
+		}
+		if (u->co->names.size() > MAX_BX) {
+			fail(u->line, "too many global names");
+		}
+		uint32_t index = static_cast<uint32_t>(u->co->names.size());
+		u->co->names.push_back(name);
+		u->names[name] = index;
+		return index;
+	}
+
+	uint32_t attr_index(const char* name) {
+		auto it = u->attrs.find(name);
+		if (it != u->attrs.end()) {
+			return it->second;
+		}
+		if (u->co->attrs.size() >= 256) {
+			fail(u->line, "more than 256 attribute names in one function");
+		}
+		uint32_t index = static_cast<uint32_t>(u->co->attrs.size());
+		u->co->attrs.push_back(name);
+		u->attrs[name] = index;
+		return index;
+	}
+
+	/* Names, the module ones are all globals */
+
+	name_ref resolve(const char* id) {
+		const char* name = mangle(u->sc->private_name, id, A);
+
+		/* The free names of an inlined comprehension are the ones of the code around it */
+		for (size_t i = u->inlined.size(); i-- > 0;) {
+			const symbol* s = u->inlined[i].sc->lookup(name);
+			if (s && s->scope == SYM_LOCAL) {
+				return name_ref{ NAME_FAST, u->inlined[i].base + static_cast<uint32_t>(s->slot) };
+			}
+			if (!s || s->scope != SYM_FREE) {
+				return name_ref{ NAME_GLOBAL, name_index(name) };
+			}
+		}
+
+		const symbol* s = u->sc->lookup(name);
+
+		if (s && u->sc->kind == SCOPE_FUNCTION) {
+			switch (s->scope) {
+			case SYM_LOCAL:
+				return name_ref{ NAME_FAST, static_cast<uint32_t>(s->slot) };
+			case SYM_CELL:
+			case SYM_FREE:
+				return name_ref{ NAME_DEREF, static_cast<uint32_t>(s->cell) };
+			default:
+				break;
+			}
+		}
+		return name_ref{ NAME_GLOBAL, name_index(name) };
+	}
+
+	void check_bound(uint32_t slot) {
+		if (!u->defined[slot]) {
+			emit_abc(BC_CHECKBOUND, slot);
+			u->defined[slot] = true;
+		}
+	}
+
+	/*
+	 * The slots that code may leave unbound: del targets and the names of
+	 * except blocks, which are deleted when the block ends.
+	 */
+	void unbound_by(const ast_body& b, std::vector<bool>& out) {
+		for (auto s : b) {
+			unbound_by(s, out);
+		}
+	}
+
+	void unbound_name(const char* id, std::vector<bool>& out) {
+		name_ref r = resolve(id);
+		if (r.kind == NAME_FAST) {
+			out[r.index] = true;
+		}
+	}
+
+	void unbound_by(const ast_stmt* s, std::vector<bool>& out) {
+		switch (s->kind) {
+		case AST_DELETE:
+			for (auto t : static_cast<const ast_delete*>(s)->targets) {
+				unbound_by_target(t, out);
+			}
+			break;
+		case AST_IF:
+			unbound_by(static_cast<const ast_if*>(s)->body, out);
+			unbound_by(static_cast<const ast_if*>(s)->orelse, out);
+			break;
+		case AST_WHILE:
+			unbound_by(static_cast<const ast_while*>(s)->body, out);
+			unbound_by(static_cast<const ast_while*>(s)->orelse, out);
+			break;
+		case AST_FOR:
+			unbound_by(static_cast<const ast_for*>(s)->body, out);
+			unbound_by(static_cast<const ast_for*>(s)->orelse, out);
+			break;
+		case AST_TRY:
+			{
+				auto t = static_cast<const ast_try*>(s);
+				unbound_by(t->body, out);
+				for (auto h : t->handlers) {
+					if (h->name) {
+						unbound_name(h->name, out);
+					}
+					unbound_by(h->body, out);
+				}
+				unbound_by(t->orelse, out);
+				unbound_by(t->finalbody, out);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	void unbound_by_target(const ast_expr* t, std::vector<bool>& out) {
+		if (auto n = ast_cast<ast_name>(t)) {
+			unbound_name(n->id, out);
+		} else if (auto tu = ast_cast<ast_tuple>(t)) {
+			for (auto e : tu->elts) {
+				unbound_by_target(e, out);
+			}
+		} else if (auto l = ast_cast<ast_list_expr>(t)) {
+			for (auto e : l->elts) {
+				unbound_by_target(e, out);
+			}
+		}
+	}
+
+	/* entry without the locals that code may unbind, for the head of a loop or handler around it */
+	template <class T>
+	std::vector<bool> defined_around(const std::vector<bool>& entry, const T& code) {
+		std::vector<bool> gone(entry.size());
+		unbound_by(code, gone);
+		std::vector<bool> r = entry;
+		for (size_t i = 0; i < r.size(); ++i) {
+			r[i] = r[i] && !gone[i];
+		}
+		return r;
+	}
+
+	/* Joins a path that ends with (defined, reachable) into (acc, acc_reachable) */
+	static void join(std::vector<bool>& acc, bool& acc_reachable, const std::vector<bool>& defined, bool reachable) {
+		if (!reachable) {
+			return;
+		}
+		if (!acc_reachable) {
+			acc = defined;
+			acc_reachable = true;
+			return;
+		}
+		for (size_t i = 0; i < acc.size(); ++i) {
+			acc[i] = acc[i] && defined[i];
+		}
+	}
+
+	/* Joins a path into the current one, at a jump target */
+	void merge(const std::vector<bool>& defined, bool reachable) {
+		join(u->defined, u->reachable, defined, reachable);
+	}
+
+	/* Exception handler segments, see code_object::exception_table */
+
+	void close_segment() {
+		if (!u->handlers.empty() && u->segment_start < pc()) {
+			const unit::handler& h = u->handlers.back();
+			u->co->exception_table.push_back(exception_entry{ u->segment_start, pc(), h.id, h.reg });
+		}
+		u->segment_start = pc();
+	}
+
+	uint32_t push_handler(uint32_t reg) {
+		close_segment();
+		uint32_t id = static_cast<uint32_t>(u->handler_pcs.size());
+		u->handler_pcs.push_back(0);
+		u->handlers.push_back(unit::handler{ id, reg });
+		return id;
+	}
+
+	void pop_handler() {
+		close_segment();
+		u->handlers.pop_back();
+	}
+
+	/*
+	 * Runs the finally bodies from the innermost out to depth finallies,
+	 * each with the handlers that were around its try, for a return, break
+	 * or continue that leaves them.
+	 */
+	void run_finallies(size_t finallies) {
+		std::vector<unit::handler> handlers = u->handlers;
+		std::vector<unit::finally> saved = u->finallies;
+
+		while (u->finallies.size() > finallies) {
+			unit::finally f = u->finallies.back();
+			u->finallies.pop_back();
+			close_segment();
+			u->handlers.resize(f.handlers);
+			body(*f.body);
+		}
+
+		close_segment();
+		u->handlers = handlers;
+		u->finallies = saved;
+	}
+
+	void finish() {
+		if (u->reachable || u->co->code.empty()) {
+			uint32_t r = temp();
+			emit_abx(BC_LOADK, r, none_constant());
+			emit_abc(BC_RETURN, r);
+		}
+
+		for (auto& e : u->co->exception_table) {
+			e.handler = u->handler_pcs[e.handler];
+		}
+		if (u->co->n_registers < u->n_slots) {
+			u->co->n_registers = u->n_slots;
+		}
+		u->co->line_table = encode_line_table(u->lines, u->co->first_line);
+	}
+
+	/* Functions, lambdas and comprehensions */
+
+	value_type annotated_type(const ast_expr* e) const {
+		if (e && e->kind == AST_NAME) {
+			const char* id = static_cast<const ast_name*>(e)->id;
+			return id == int_name ? VT_INT : id == float_name ? VT_FLOAT : VT_ANY;
+		}
+		return VT_ANY;
+	}
+
+	uint32_t child(const ast_node* node, const char* name, const ast_arguments* args, uint32_t line) {
+		const scope* sc = st.scope_of(node);
+		std::unique_ptr<code_object> co(new code_object());
+		co->name = name;
+		co->first_line = line;
+
+		if (args) {
+			co->n_args = static_cast<uint32_t>(args->args.size());
+			co->n_kwonly = static_cast<uint32_t>(args->kwonlyargs.size());
+			co->n_defaults = static_cast<uint32_t>(args->defaults.size());
+			for (auto d : args->kw_defaults) {
+				co->kwonly_default.push_back(d != nullptr);
+			}
+			co->flags = (args->vararg ? CODE_VARARGS : 0) | (args->kwarg ? CODE_VARKEYWORDS : 0);
+			for (auto arg : args->args) {
+				co->param_types.push_back(annotated_type(arg->annotation));
+			}
+			for (auto arg : args->kwonlyargs) {
+				co->param_types.push_back(annotated_type(arg->annotation));
+			}
+		} else {
+			co->n_args = 1; /* .0, the iterator of a comprehension */
+		}
+
+		co->varnames = sc->slots;
+		for (size_t i = 0; i < sc->cells.size(); ++i) {
+			const char* cell = sc->cells[i];
+			if (i < sc->n_cells) {
+				const symbol* s = sc->lookup(cell);
+				co->cellvars.push_back(cell);
+				co->cell_params.push_back(s && (s->flags & SYM_DEF_PARAM) ? s->slot : -1);
+			} else {
+				const symbol* s = u->sc->lookup(cell);
+				if (!s || s->cell < 0) {
+					fail(line, std::string("free variable '") + cell + "' of a class body is not supported");
+				}
+				co->freevars.push_back(cell);
+				co->closure.push_back(static_cast<uint32_t>(s->cell));
+			}
+		}
+
+		unit cu(co.get(), sc);
+		cu.n_slots = static_cast<uint32_t>(sc->slots.size());
+		cu.top = cu.n_slots;
+		cu.line = line;
+		cu.defined.assign(cu.n_slots, false);
+		for (size_t i = 0; i < co->n_params() && i < cu.n_slots; ++i) {
+			cu.defined[i] = true;
+		}
+
+		unit* parent = u;
+		u = &cu;
+
+		switch (node->kind) {
+		case AST_FUNCTION_DEF:
+			body(static_cast<const ast_function_def*>(node)->body);
+			break;
+		case AST_LAMBDA:
+			{
+				uint32_t r = operand(static_cast<const ast_lambda*>(node)->body);
+				emit_abc(BC_RETURN, r);
+				u->reachable = false;
+			}
+			break;
+		default:
+			comprehension_body(static_cast<const ast_expr*>(node));
+			break;
+		}
+		finish();
+		u = parent;
+
+		if (opts.passes) {
+			opts.passes->run(*co);
+		}
+
+		if (node->kind == AST_FUNCTION_DEF) {
+			co->return_type = annotated_type(static_cast<const ast_function_def*>(node)->returns);
+		}
+		if (opts.specialize && node->kind == AST_FUNCTION_DEF) {
+			bool typed = co->return_type != VT_ANY;
+			for (auto t : co->param_types) {
+				typed |= t != VT_ANY;
+			}
+			if (typed) {
+				specialize(*co, returns);
+			}
+		}
+
+		if (u->co->children.size() > MAX_BX) {
+			fail(line, "too many functions");
+		}
+		u->co->children.push_back(std::move(co));
+		return static_cast<uint32_t>(u->co->children.size() - 1);
+	}
+
+	/* The function of node into dst, its defaults evaluated here */
+	void make_function(const ast_node* node, const char* name, const ast_arguments* args, uint32_t dst) {
+		uint32_t mark = u->top;
+		size_t n = args->defaults.size();
+		for (auto d : args->kw_defaults) {
+			n += d != nullptr;
+		}
+
+		uint32_t base = base_for(dst, n ? n : 1);
+		uint32_t r = base;
+		for (auto d : args->defaults) {
+			expr(d, r++);
+		}
+		for (auto d : args->kw_defaults) {
+			if (d) {
+				expr(d, r++);
+			}
+		}
+
+		uint32_t index = child(node, name, args, node->line);
+		emit_abx(BC_MAKEFUNC, base, index);
+		if (base != dst) {
+			emit_abc(BC_MOVE, dst, base);
+		}
+		u->top = mark;
+	}
+
+	void comprehension_body(const ast_expr* e) {
+		const ast_list<ast_comprehension>& generators = e->kind == AST_DICT_COMP
+				? static_cast<const ast_dict_comp*>(e)->generators : static_cast<const ast_comp*>(e)->generators;
+		uint32_t result = temp();
+
+		switch (e->kind) {
+		case AST_LIST_COMP: emit_abc(BC_BUILDLIST, result, 0, 0); break;
+		case AST_SET_COMP: emit_abc(BC_BUILDSET, result, 0, 0); break;
+		default: emit_abc(BC_BUILDDICT, result, 0, 0); break;
+		}
+
+		comprehension_loop(e, generators, 0, result, resolve(A.intern(".0")).index, BC_MOVE);
+		emit_abc(BC_RETURN, result);
+		u->reachable = false;
+	}
+
+	/* The loop of generators[i] and the ones after it; the first iterator is first_op of first */
+	void comprehension_loop(const ast_expr* e, const ast_list<ast_comprehension>& generators, size_t i,
+			uint32_t result, uint32_t first, opcode first_op) {
+		const ast_comprehension& gen = generators[i];
+		uint32_t mark = u->top;
+		uint32_t it = temps(2);
+
+		if (i == 0) {
+			emit_abc(first_op, it, first);
+		} else {
+			emit_abc(BC_ITER, it, operand(gen.iter));
+		}
+
+		std::vector<bool> entry = u->defined;
+		uint32_t head = pc();
+		uint32_t exit = emit_jump(BC_FORITER, it);
+		store(gen.target, it + 1);
+
+		std::vector<uint32_t> skip;
+		for (auto cond : gen.ifs) {
+			branch(cond, false, skip);
+		}
+
+		if (i + 1 < generators.size()) {
+			comprehension_loop(e, generators, i + 1, result, first, first_op);
+		} else if (auto d = ast_cast<ast_dict_comp>(e)) {
+			uint32_t k = operand(d->key);
+			uint32_t v = operand(d->value);
+			emit_abc(BC_SETITEM, result, k, v);
+		} else {
+			uint32_t v = operand(static_cast<const ast_comp*>(e)->elt);
+			emit_abc(e->kind == AST_LIST_COMP ? BC_LISTAPPEND : BC_SETADD, result, v);
+		}
+
+		for (auto j : skip) {
+			patch(j, head);
+		}
+		jump_back(head);
+		patch(exit, pc());
+		u->defined = entry;
+		u->top = mark;
+	}
+
+	/* [x for x in it]: the loop right here if the symtable inlined it, else a call of the comprehension function on iter(it) */
+	void comprehension(const ast_expr* e, const char* name, const ast_list<ast_comprehension>& generators,
+			uint32_t dst) {
+		const scope* sc = st.scope_of(e);
+		if (sc->inlined) {
+			inline_comprehension(e, sc, generators, dst);
+			return;
+		}
+
+		uint32_t mark = u->top;
+		uint32_t index = child(e, A.intern(std::string("<") + name + ">"), nullptr, e->line);
+		uint32_t base = base_for(dst, 2);
+
+		emit_abc(BC_ITER, base + 1, operand(generators[0].iter));
+		emit_abx(BC_MAKEFUNC, base, index);
+		emit_abc(BC_CALL, base, 1, 0);
+		if (base != dst) {
+			emit_abc(BC_MOVE, dst, base);
+		}
+		u->top = mark;
+	}
+
+	/*
+	 * The result is built in a temporary, as the elements may still read
+	 * dst, with room for all the items up front when there is one loop
+	 * and no if. The locals of the comprehension are unbound when it
+	 * starts, as in a call, and named in varnames for UnboundLocalError.
+	 */
+	void inline_comprehension(const ast_expr* e, const scope* sc, const ast_list<ast_comprehension>& generators,
+			uint32_t dst) {
+		uint32_t mark = u->top;
+		uint32_t first = operand(generators[0].iter);
+		uint32_t result = temp();
+
+		switch (e->kind) {
+		case AST_LIST_COMP: emit_abc(BC_BUILDLIST, result, 0, 0); break;
+		case AST_SET_COMP: emit_abc(BC_BUILDSET, result, 0, 0); break;
+		default: emit_abc(BC_BUILDDICT, result, 0, 0); break;
+		}
+		if (generators.size() == 1 && generators[0].ifs.empty()) {
+			emit_abc(BC_RESERVE, result, first);
+		}
+
+		uint32_t n = static_cast<uint32_t>(sc->slots.size());
+		uint32_t base = temps(n);
+		emit_abc(BC_CLEAR, base, n);
+
+		size_t n_defined = u->defined.size();
+		u->defined.resize(u->top, false);
+		if (u->co->varnames.size() < base + n) {
+			u->co->varnames.resize(base + n, nullptr);
+		}
+		std::copy(sc->slots.begin(), sc->slots.end(), u->co->varnames.begin() + base);
+
+		u->inlined.push_back(unit::inline_scope{ sc, base });
+		comprehension_loop(e, generators, 0, result, first, BC_ITER);
+		u->inlined.pop_back();
+		u->defined.resize(n_defined);
+
+		done(result, dst);
+		u->top = mark;
+	}
+
+	/* Expressions */
+
+	/* A register holding the value of e: a local's own register, or a new temporary */
+	uint32_t operand(const ast_expr* e) {
+		if (auto n = ast_cast<ast_name>(e)) {
+			name_ref r = resolve(n->id);
+			if (r.kind == NAME_FAST) {
+				uint32_t saved = u->line;
+				u->line = e->line;
+				check_bound(r.index);
+				u->line = saved;
+				return r.index;
+			}
+		}
+		uint32_t t = temp();
+		expr(e, t);
+		return t;
+	}
+
+	/*
+	 * Where an expression that writes its result more than once puts it
+	 * until it is done: not a local, which its operands may still read.
+	 */
+	uint32_t scratch(uint32_t dst) {
+		return is_local(dst) ? temp() : dst;
+	}
+
+	void done(uint32_t r, uint32_t dst) {
+		if (r != dst) {
+			emit_abc(BC_MOVE, dst, r);
+		}
+	}
+
+	static opcode compare_opcode(ast_cmpop op) {
+		switch (op) {
+		case CMP_EQ: return BC_EQ;
+		case CMP_NOT_EQ: return BC_NE;
+		case CMP_LT: return BC_LT;
+		case CMP_LT_E: return BC_LE;
+		case CMP_GT: return BC_GT;
+		case CMP_GT_E: return BC_GE;
+		case CMP_IS: return BC_IS;
+		case CMP_IS_NOT: return BC_ISNOT;
+		case CMP_IN: return BC_IN;
+		default: return BC_NOTIN;
+		}
+	}
+
+	void expr(const ast_expr* e, uint32_t dst) {
+		uint32_t mark = u->top;
+		uint32_t saved_line = u->line;
+		u->line = e->line;
+
+		switch (e->kind) {
+		case AST_CONSTANT:
+			emit_abx(BC_LOADK, dst, static_cast<uint32_t>(constant_index(e)));
+			break;
+
+		case AST_NAME:
+			{
+				name_ref r = resolve(static_cast<const ast_name*>(e)->id);
+				switch (r.kind) {
+				case NAME_FAST:
+					check_bound(r.index);
+					done(r.index, dst);
+					break;
+				case NAME_GLOBAL:
+					emit_abx(BC_LOADGLOBAL, dst, r.index);
+					break;
+				case NAME_DEREF:
+					emit_abc(BC_LOADDEREF, dst, r.index);
+					break;
+				}
+			}
+			break;
+
+		case AST_BIN_OP:
+			{
+				auto b = static_cast<const ast_bin_op*>(e);
+				uint32_t l = operand(b->left);
+				uint32_t r = operand(b->right);
+				emit_abc(static_cast<opcode>(BC_ADD + b->op), dst, l, r);
+			}
+			break;
+
+		case AST_UNARY_OP:
+			{
+				auto un = static_cast<const ast_unary_op*>(e);
+				static const opcode ops[] = { BC_INVERT, BC_NOT, BC_POS, BC_NEG };
+				emit_abc(ops[un->op], dst, operand(un->operand));
+			}
+			break;
+
+		case AST_BOOL_OP:
+			{
+				auto b = static_cast<const ast_bool_op*>(e);
+				uint32_t r = scratch(dst);
+				std::vector<uint32_t> end;
+				for (size_t i = 0; i < b->values.size(); ++i) {
+					expr(b->values[i], r);
+					if (i + 1 < b->values.size()) {
+						end.push_back(emit_jump(b->op == BOOL_AND ? BC_JMPIFNOT : BC_JMPIF, r));
+					}
+				}
+				patch_here(end);
+				done(r, dst);
+			}
+			break;
+
+		case AST_COMPARE:
+			{
+				auto c = static_cast<const ast_compare*>(e);
+				uint32_t r = c->ops.size() > 1 ? scratch(dst) : dst;
+				uint32_t l = operand(c->left);
+				std::vector<uint32_t> end;
+				for (size_t i = 0; i < c->ops.size(); ++i) {
+					uint32_t rhs = operand(c->comparators[i]);
+					emit_abc(compare_opcode(c->ops[i]), r, l, rhs);
+					if (i + 1 < c->ops.size()) {
+						end.push_back(emit_jump(BC_JMPIFNOT, r));
+					}
+					l = rhs;
+				}
+				patch_here(end);
+				done(r, dst);
+			}
+			break;
+
+		case AST_IF_EXP:
+			{
+				auto ie = static_cast<const ast_if_exp*>(e);
+				std::vector<uint32_t> orelse;
+				branch(ie->test, false, orelse);
+				expr(ie->body, dst);
+				uint32_t end = emit_jump(BC_JMP);
+				patch_here(orelse);
+				expr(ie->orelse, dst);
+				patch(end, pc());
+			}
+			break;
+
+		case AST_LAMBDA:
+			make_function(e, A.intern("<lambda>"), static_cast<const ast_lambda*>(e)->args, dst);
+			break;
+
+		case AST_TUPLE:
+			{
+				int64_t k = constant_index(e);
+				if (k >= 0) {
+					emit_abx(BC_LOADK, dst, static_cast<uint32_t>(k));
+					break;
+				}
+				auto& elts = static_cast<const ast_tuple*>(e)->elts;
+				uint32_t base = sequence(elts);
+				emit_abc(BC_BUILDTUPLE, dst, base, static_cast<unsigned>(elts.size()));
+			}
+			break;
+
+		case AST_LIST:
+			display(static_cast<const ast_list_expr*>(e)->elts, BC_BUILDLIST, BC_LISTAPPEND, dst);
+			break;
+
+		case AST_SET:
+			display(static_cast<const ast_set*>(e)->elts, BC_BUILDSET, BC_SETADD, dst);
+			break;
+
+		case AST_DICT:
+			dict_display(static_cast<const ast_dict*>(e), dst);
+			break;
+
+		case AST_LIST_COMP:
+			comprehension(e, "listcomp", static_cast<const ast_comp*>(e)->generators, dst);
+			break;
+		case AST_SET_COMP:
+			comprehension(e, "setcomp", static_cast<const ast_comp*>(e)->generators, dst);
+			break;
+		case AST_DICT_COMP:
+			comprehension(e, "dictcomp", static_cast<const ast_dict_comp*>(e)->generators, dst);
+			break;
+
+		case AST_CALL:
+			call(static_cast<const ast_call*>(e), dst);
+			break;
+
+		case AST_ATTRIBUTE:
+			{
+				auto a = static_cast<const ast_attribute*>(e);
+				uint32_t obj = operand(a->value);
+				emit_abc(BC_GETATTR, dst, obj, attr_index(a->attr));
+			}
+			break;
+
+		case AST_SUBSCRIPT:
+			{
+				auto s = static_cast<const ast_subscript*>(e);
+				uint32_t obj = operand(s->value);
+				uint32_t key = operand(s->slice);
+				emit_abc(BC_GETITEM, dst, obj, key);
+			}
+			break;
+
+		case AST_SLICE:
+			{
+				auto s = static_cast<const ast_slice*>(e);
+				uint32_t base = temps(3);
+				const ast_expr* parts[] = { s->lower, s->upper, s->step };
+				for (int i = 0; i < 3; ++i) {
+					if (parts[i]) {
+						expr(parts[i], base + i);
+					} else {
+						emit_abx(BC_LOADK, base + i, none_constant());
+					}
+				}
+				emit_abc(BC_BUILDSLICE, dst, base);
+			}
+			break;
+
+		case AST_GENERATOR_EXP:
+			unsupported(e, "a generator expression");
+		case AST_YIELD:
+		case AST_YIELD_FROM:
+			unsupported(e, "a generator");
+		case AST_AWAIT:
+			unsupported(e, "await");
+		case AST_STARRED:
+			unsupported(e, "a starred expression");
+
+		default:
+			unsupported(e, ast_kind_name(e->kind));
+		}
+
+		u->top = mark;
+		u->line = saved_line;
+	}
+
+	/* The items in consecutive new temporaries, the first one */
+	uint32_t sequence(const ast_exprs& items) {
+		uint32_t base = u->top;
+		for (auto item : items) {
+			if (item->kind == AST_STARRED) {
+				unsupported(item, "a starred expression");
+			}
+			expr(item, temp());
+		}
+		return base;
+	}
+
+	/* Items over this many are added one at a time, not to use a register each */
+	static const size_t DISPLAY_CHUNK = 32;
+
+	void display(const ast_exprs& elts, opcode build, opcode add, uint32_t dst) {
+		uint32_t r = elts.size() > DISPLAY_CHUNK ? scratch(dst) : dst;
+
+		if (elts.size() <= DISPLAY_CHUNK) {
+			uint32_t base = sequence(elts);
+			emit_abc(build, r, base, static_cast<unsigned>(elts.size()));
+			return;
+		}
+
+		emit_abc(build, r, 0, 0);
+		for (auto item : elts) {
+			if (item->kind == AST_STARRED) {
+				unsupported(item, "a starred expression");
+			}
+			uint32_t mark = u->top;
+			emit_abc(add, r, operand(item));
+			u->top = mark;
+		}
+		done(r, dst);
+	}
+
+	void dict_display(const ast_dict* d, uint32_t dst) {
+		for (auto k : d->keys) {
+			if (!k) {
+				unsupported(d, "** in a dict display");
+			}
+		}
+
+		if (d->keys.size() <= DISPLAY_CHUNK) {
+			uint32_t base = u->top;
+			for (size_t i = 0; i < d->keys.size(); ++i) {
+				expr(d->keys[i], temp());
+				expr(d->values[i], temp());
+			}
+			emit_abc(BC_BUILDDICT, dst, base, static_cast<unsigned>(d->keys.size()));
+			return;
+		}
+
+		uint32_t r = scratch(dst);
+		emit_abc(BC_BUILDDICT, r, 0, 0);
+		for (size_t i = 0; i < d->keys.size(); ++i) {
+			uint32_t mark = u->top;
+			uint32_t k = operand(d->keys[i]);
+			uint32_t v = operand(d->values[i]);
+			emit_abc(BC_SETITEM, r, k, v);
+			u->top = mark;
+		}
+		done(r, dst);
+	}
+
+	void call(const ast_call* c, uint32_t dst) {
+		for (auto a : c->args) {
+			if (a->kind == AST_STARRED) {
+				unsupported(a, "*args in a call");
+			}
+		}
+		for (auto& k : c->keywords) {
+			if (!k.arg) {
+				unsupported(c, "**kwargs in a call");
+			}
+		}
+		if (c->args.size() > 255 || c->keywords.size() > 255) {
+			fail(c->line, "more than 255 arguments");
+		}
+
+		uint32_t base = base_for(dst, 1);
+		expr(c->func, base);
+		sequence(c->args);
+
+		if (!c->keywords.empty()) {
+			constant names;
+			names.kind = CK_TUPLE;
+			std::string key = "t";
+			for (auto& k : c->keywords) {
+				expr(k.value, temp());
+				uint32_t i = str_constant(k.arg);
+				names.items.push_back(i);
+				key += std::to_string(i) + ",";
+			}
+			emit_abx(BC_LOADK, temp(), add_constant(key, names));
+		}
+
+		emit_abc(BC_CALL, base, static_cast<unsigned>(c->args.size()), static_cast<unsigned>(c->keywords.size()));
+		done(base, dst);
+	}
+
+	/* Jumps taken when the truth of e is when, appended to jumps */
+	void branch(const ast_expr* e, bool when, std::vector<uint32_t>& jumps) {
+		uint32_t mark = u->top;
+
+		if (auto un = ast_cast<ast_unary_op>(e)) {
+			if (un->op == UOP_NOT) {
+				branch(un->operand, !when, jumps);
+				return;
+			}
+		}
+
+		if (auto b = ast_cast<ast_bool_op>(e)) {
+			/* and jumps out on the first false, or on the first true */
+			bool out = b->op == BOOL_OR;
+			if (when == out) {
+				for (auto v : b->values) {
+					branch(v, when, jumps);
+				}
+			} else {
+				std::vector<uint32_t> skip;
+				for (size_t i = 0; i + 1 < b->values.size(); ++i) {
+					branch(b->values[i], out, skip);
+				}
+				branch(b->values[b->values.size() - 1], when, jumps);
+				patch_here(skip);
+			}
+			return;
+		}
+
+		if (auto c = ast_cast<ast_constant>(e)) {
+			if (c->value_kind == CONST_NONE || c->value_kind == CONST_BOOL || c->value_kind == CONST_INT) {
+				if ((c->value_kind != CONST_NONE && c->i != 0) == when) {
+					jumps.push_back(emit_jump(BC_JMP));
+				}
+				return;
+			}
+		}
+
+		uint32_t r = operand(e);
+		jumps.push_back(emit_jump(when ? BC_JMPIF : BC_JMPIFNOT, r));
+		u->top = mark;
+	}
+
+	/* Assignment */
+
+	void store(const ast_expr* target, uint32_t r) {
+		uint32_t mark = u->top;
+
+		switch (target->kind) {
+		case AST_NAME:
+			{
+				name_ref n = resolve(static_cast<const ast_name*>(target)->id);
+				switch (n.kind) {
+				case NAME_FAST:
+					done(r, n.index);
+					u->defined[n.index] = true;
+					break;
+				case NAME_GLOBAL:
+					emit_abx(BC_STOREGLOBAL, r, n.index);
+					break;
+				case NAME_DEREF:
+					emit_abc(BC_STOREDEREF, r, n.index);
+					break;
+				}
+			}
+			break;
+
+		case AST_ATTRIBUTE:
+			{
+				auto a = static_cast<const ast_attribute*>(target);
+				uint32_t obj = operand(a->value);
+				emit_abc(BC_SETATTR, obj, attr_index(a->attr), r);
+			}
+			break;
+
+		case AST_SUBSCRIPT:
+			{
+				auto s = static_cast<const ast_subscript*>(target);
+				uint32_t obj = operand(s->value);
+				uint32_t key = operand(s->slice);
+				emit_abc(BC_SETITEM, obj, key, r);
+			}
+			break;
+
+		case AST_TUPLE:
+		case AST_LIST:
+			{
+				const ast_exprs& elts = target->kind == AST_TUPLE ? static_cast<const ast_tuple*>(target)->elts
+						: static_cast<const ast_list_expr*>(target)->elts;
+				for (auto t : elts) {
+					if (t->kind == AST_STARRED) {
+						unsupported(t, "a starred assignment");
+					}
+				}
+				if (elts.size() > 255) {
+					fail(target->line, "more than 255 targets");
+				}
+				uint32_t base = temps(elts.size());
+				emit_abc(BC_UNPACK, base, r, static_cast<unsigned>(elts.size()));
+				for (size_t i = 0; i < elts.size(); ++i) {
+					store(elts[i], base + static_cast<uint32_t>(i));
+				}
+			}
+			break;
+
+		default:
+			unsupported(target, std::string("assigning to ") + ast_kind_name(target->kind));
+		}
+
+		u->top = mark;
+	}
+
+	static const ast_exprs* unpacked(const ast_expr* e) {
+		if (auto t = ast_cast<ast_tuple>(e)) {
+			return &t->elts;
+		}
+		if (auto l = ast_cast<ast_list_expr>(e)) {
+			return &l->elts;
+		}
+		return nullptr;
+	}
+
+	void assign(const ast_assign* a) {
+		if (a->targets.size() == 1) {
+			const ast_expr* target = a->targets[0];
+
+			/* x = e right into x */
+			if (auto n = ast_cast<ast_name>(target)) {
+				name_ref r = resolve(n->id);
+				if (r.kind == NAME_FAST) {
+					expr(a->value, r.index);
+					u->defined[r.index] = true;
+					return;
+				}
+			}
+
+			/* a, b = b, a without a tuple in between */
+			const ast_exprs* targets = unpacked(target);
+			const ast_exprs* values = ast_cast<ast_constant>(a->value) ? nullptr : unpacked(a->value);
+			if (targets && values && targets->size() == values->size()) {
+				bool plain = true;
+				for (auto t : *targets) {
+					plain = plain && t->kind != AST_STARRED;
+				}
+				if (plain) {
+					uint32_t base = sequence(*values);
+					for (size_t i = 0; i < targets->size(); ++i) {
+						store((*targets)[i], base + static_cast<uint32_t>(i));
+					}
+					return;
+				}
+			}
+		}
+
+		uint32_t r = operand(a->value);
+		for (auto t : a->targets) {
+			store(t, r);
+		}
+	}
+
+	void aug_assign(const ast_aug_assign* a) {
+		opcode op = a->op == OP_ADD ? BC_IADD : static_cast<opcode>(BC_ADD + a->op);
+
+		switch (a->target->kind) {
+		case AST_NAME:
+			{
+				name_ref n = resolve(static_cast<const ast_name*>(a->target)->id);
+				if (n.kind == NAME_FAST) {
+					check_bound(n.index);
+					emit_abc(op, n.index, n.index, operand(a->value));
+					break;
+				}
+				uint32_t t = temp();
+				if (n.kind == NAME_GLOBAL) {
+					emit_abx(BC_LOADGLOBAL, t, n.index);
+				} else {
+					emit_abc(BC_LOADDEREF, t, n.index);
+				}
+				emit_abc(op, t, t, operand(a->value));
+				if (n.kind == NAME_GLOBAL) {
+					emit_abx(BC_STOREGLOBAL, t, n.index);
+				} else {
+					emit_abc(BC_STOREDEREF, t, n.index);
+				}
+			}
+			break;
+
+		case AST_ATTRIBUTE:
+			{
+				auto at = static_cast<const ast_attribute*>(a->target);
+				uint32_t obj = operand(at->value);
+				uint32_t t = temp();
+				emit_abc(BC_GETATTR, t, obj, attr_index(at->attr));
+				emit_abc(op, t, t, operand(a->value));
+				emit_abc(BC_SETATTR, obj, attr_index(at->attr), t);
+			}
+			break;
+
+		case AST_SUBSCRIPT:
+			{
+				auto s = static_cast<const ast_subscript*>(a->target);
+				uint32_t obj = operand(s->value);
+				uint32_t key = operand(s->slice);
+				uint32_t t = temp();
+				emit_abc(BC_GETITEM, t, obj, key);
+				emit_abc(op, t, t, operand(a->value));
+				emit_abc(BC_SETITEM, obj, key, t);
+			}
+			break;
+
+		default:
+			unsupported(a->target, std::string("augmented assignment to ") + ast_kind_name(a->target->kind));
+		}
+	}
+
+	void del(const ast_expr* target) {
+		uint32_t mark = u->top;
+
+		switch (target->kind) {
+		case AST_NAME:
+			{
+				name_ref n = resolve(static_cast<const ast_name*>(target)->id);
+				switch (n.kind) {
+				case NAME_FAST:
+					emit_abc(BC_DELFAST, n.index);
+					u->defined[n.index] = false;
+					break;
+				case NAME_GLOBAL:
+					emit_abx(BC_DELGLOBAL, 0, n.index);
+					break;
+				case NAME_DEREF:
+					emit_abc(BC_DELDEREF, 0, n.index);
+					break;
+				}
+			}
+			break;
+
+		case AST_SUBSCRIPT:
+			{
+				auto s = static_cast<const ast_subscript*>(target);
+				uint32_t obj = operand(s->value);
+				uint32_t key = operand(s->slice);
+				emit_abc(BC_DELITEM, obj, key);
+			}
+			break;
+
+		case AST_TUPLE:
+			for (auto t : static_cast<const ast_tuple*>(target)->elts) {
+				del(t);
+			}
+			break;
+
+		case AST_LIST:
+			for (auto t : static_cast<const ast_list_expr*>(target)->elts) {
+				del(t);
+			}
+			break;
+
+		default:
+			unsupported(target, std::string("deleting ") + ast_kind_name(target->kind));
+		}
+
+		u->top = mark;
+	}
+
+	/* Statements */
+
+	void body(const ast_body& b) {
+		for (auto s : b) {
+			stmt(s);
+		}
+	}
+
+	void stmt(const ast_stmt* s) {
+		uint32_t mark = u->top;
+		u->line = s->line;
+
+		switch (s->kind) {
+		case AST_EXPR:
+			expr(static_cast<const ast_expr_stmt*>(s)->value, temp());
+			break;
+
+		case AST_ASSIGN:
+			assign(static_cast<const ast_assign*>(s));
+			break;
+
+		case AST_AUG_ASSIGN:
+			aug_assign(static_cast<const ast_aug_assign*>(s));
+			break;
+
+		case AST_DELETE:
+			for (auto t : static_cast<const ast_delete*>(s)->targets) {
+				del(t);
+			}
+			break;
+
+		case AST_PASS:
+		case AST_GLOBAL:
+		case AST_NONLOCAL:
+			break;
+
+		case AST_FUNCTION_DEF:
+			function_def(static_cast<const ast_function_def*>(s));
+			break;
+
+		case AST_RETURN:
+			{
+				auto r = static_cast<const ast_return*>(s);
+				uint32_t v = temp();
+				if (r->value) {
+					expr(r->value, v);
+				} else {
+					emit_abx(BC_LOADK, v, none_constant());
+				}
+				run_finallies(0);
+				u->line = s->line;
+				emit_abc(BC_RETURN, v);
+				u->reachable = false;
+			}
+			break;
+
+		case AST_IF:
+			if_stmt(static_cast<const ast_if*>(s));
+			break;
+
+		case AST_WHILE:
+			while_stmt(static_cast<const ast_while*>(s));
+			break;
+
+		case AST_FOR:
+			for_stmt(static_cast<const ast_for*>(s));
+			break;
+
+		case AST_BREAK:
+		case AST_CONTINUE:
+			{
+				unit::loop& l = u->loops.back();
+				run_finallies(l.finallies);
+				u->line = s->line;
+				if (s->kind == AST_BREAK) {
+					/* The loop may be gone from under l after run_finallies compiled more loops */
+					u->loops.back().breaks.push_back(emit_jump(BC_JMP));
+				} else {
+					jump_back(u->loops.back().head);
+				}
+				u->reachable = false;
+			}
+			break;
+
+		case AST_RAISE:
+			{
+				auto r = static_cast<const ast_raise*>(s);
+				if (!r->exc) {
+					if (u->except_regs.empty()) {
+						unsupported(s, "a bare raise outside an except block");
+					}
+					emit_abc(BC_RAISE, u->except_regs.back());
+				} else {
+					uint32_t v = operand(r->exc);
+					if (r->cause) {
+						/* Evaluated for its effects, exceptions do not keep a cause */
+						expr(r->cause, temp());
+					}
+					emit_abc(BC_RAISE, v);
+				}
+				u->reachable = false;
+			}
+			break;
+
+		case AST_TRY:
+			try_stmt(static_cast<const ast_try*>(s));
+			break;
+
+		case AST_ASSERT:
+			{
+				auto a = static_cast<const ast_assert*>(s);
+				std::vector<uint32_t> ok;
+				branch(a->test, true, ok);
+				uint32_t base = temp();
+				emit_abx(BC_LOADGLOBAL, base, name_index(A.intern("AssertionError")));
+				if (a->msg) {
+					expr(a->msg, temp());
+					emit_abc(BC_CALL, base, 1, 0);
+				}
+				emit_abc(BC_RAISE, base);
+				patch_here(ok);
+			}
+			break;
+
+		case AST_CLASS_DEF:
+			unsupported(s, "a class");
+		case AST_IMPORT:
+		case AST_IMPORT_FROM:
+			unsupported(s, "import");
+		case AST_WITH:
+			unsupported(s, "with");
+
+		default:
+			unsupported(s, ast_kind_name(s->kind));
+		}
+
+		u->top = mark;
+	}
+
+	void function_def(const ast_function_def* f) {
+		if (f->is_async) {
+			unsupported(f, "async def");
+		}
+		if (st.scope_of(f)->is_generator) {
+			unsupported(f, "a generator");
+		}
+
+		/* Decorators first, applied innermost first once the function exists */
+		uint32_t decorators = sequence(f->decorator_list);
+		uint32_t fn = temp();
+		make_function(f, f->name, f->args, fn);
+
+		for (size_t i = f->decorator_list.size(); i-- > 0; ) {
+			uint32_t base = temps(2);
+			emit_abc(BC_MOVE, base, decorators + static_cast<uint32_t>(i));
+			emit_abc(BC_MOVE, base + 1, fn);
+			emit_abc(BC_CALL, base, 1, 0);
+			emit_abc(BC_MOVE, fn, base);
+			u->top = base;
+		}
+
+		store_name(f->name, fn);
+	}
+
+	void store_name(const char* id, uint32_t r) {
+		ast_name n;
+		n.kind = AST_NAME;
+		n.line = u->line;
+		n.id = id;
+		n.ctx = CTX_STORE;
+		store(&n, r);
+	}
+
+	void if_stmt(const ast_if* s) {
+		std::vector<uint32_t> orelse;
+		branch(s->test, false, orelse);
+
+		std::vector<bool> entry = u->defined;
+		body(s->body);
+
+		if (s->orelse.empty()) {
+			patch_here(orelse);
+			merge(entry, true);
+			return;
+		}
+
+		std::vector<bool> then_defined = u->defined;
+		bool then_reachable = u->reachable;
+		uint32_t end = emit_jump(BC_JMP);
+
+		patch_here(orelse);
+		u->defined = entry;
+		u->reachable = true;
+		body(s->orelse);
+
+		patch(end, pc());
+		merge(then_defined, then_reachable);
+	}
+
+	void while_stmt(const ast_while* s) {
+		std::vector<bool> head_defined = defined_around(u->defined, s->body);
+		u->defined = head_defined;
+
+		uint32_t head = pc();
+		std::vector<uint32_t> exit;
+		branch(s->test, false, exit);
+
+		u->loops.push_back(unit::loop{ head, {}, u->handlers.size(), u->finallies.size() });
+		body(s->body);
+		jump_back(head);
+		std::vector<uint32_t> breaks = u->loops.back().breaks;
+		u->loops.pop_back();
+
+		patch_here(exit);
+		u->defined = head_defined;
+		u->reachable = true;
+		body(s->orelse);
+
+		patch_here(breaks);
+		u->defined = defined_around(head_defined, s->orelse);
+		u->reachable = true;
+	}
+
+	void for_stmt(const ast_for* s) {
+		if (s->is_async) {
+			unsupported(s, "async for");
+		}
+
+		uint32_t it = temps(2);
+		emit_abc(BC_ITER, it, operand(s->iter));
+		u->top = it + 2;
+
+		std::vector<bool> head_defined = defined_around(u->defined, s->body);
+		u->defined = head_defined;
+
+		uint32_t head = pc();
+		uint32_t exit = emit_jump(BC_FORITER, it);
+		store(s->target, it + 1);
+
+		u->loops.push_back(unit::loop{ head, {}, u->handlers.size(), u->finallies.size() });
+		body(s->body);
+		u->line = s->line;
+		jump_back(head);
+		std::vector<uint32_t> breaks = u->loops.back().breaks;
+		u->loops.pop_back();
+
+		patch(exit, pc());
+		u->defined = head_defined;
+		u->reachable = true;
+		body(s->orelse);
+
+		patch_here(breaks);
+		u->defined = defined_around(head_defined, s->orelse);
+		u->reachable = true;
+	}
+
+	/*
+	 * try/finally runs the finally body where the try body ends, where a
+	 * return, break or continue leaves it, and in a handler that raises the
+	 * exception again; the except blocks are a try of their own inside it.
+	 */
+	void try_stmt(const ast_try* s) {
+		if (s->finalbody.empty()) {
+			try_except(s);
+			return;
+		}
+
+		std::vector<bool> entry = u->defined;
+		uint32_t exc = temp();
+		uint32_t id = push_handler(exc);
+		u->finallies.push_back(unit::finally{ &s->finalbody, u->handlers.size() - 1 });
+
+		if (s->handlers.empty()) {
+			body(s->body);
+		} else {
+			try_except(s);
+		}
+
+		u->finallies.pop_back();
+		pop_handler();
+		body(s->finalbody);
+		std::vector<bool> normal_defined = u->defined;
+		bool normal_reachable = u->reachable;
+		uint32_t end = emit_jump(BC_JMP);
+
+		/* The handler runs the finally body too, then raises again */
+		u->handler_pcs[id] = pc();
+		u->defined = defined_around(entry, static_cast<const ast_stmt*>(s));
+		u->reachable = true;
+		body(s->finalbody);
+		u->line = s->line;
+		emit_abc(BC_RAISE, exc);
+
+		patch(end, pc());
+		u->defined = normal_defined;
+		u->reachable = normal_reachable;
+	}
+
+	void try_except(const ast_try* s) {
+		uint32_t mark = u->top;
+		std::vector<bool> entry = u->defined;
+		uint32_t exc = temp();
+		uint32_t id = push_handler(exc);
+
+		body(s->body);
+		pop_handler();
+		body(s->orelse);
+
+		std::vector<bool> end_defined = u->defined;
+		bool end_reachable = u->reachable;
+		std::vector<uint32_t> end;
+		end.push_back(emit_jump(BC_JMP));
+
+		u->handler_pcs[id] = pc();
+		std::vector<bool> handler_defined = defined_around(entry, s->body);
+		u->except_regs.push_back(exc);
+
+		for (auto h : s->handlers) {
+			u->line = h->line;
+			u->defined = handler_defined;
+			u->reachable = true;
+
+			std::vector<uint32_t> next;
+			if (h->type) {
+				uint32_t hmark = u->top;
+				uint32_t t = operand(h->type);
+				uint32_t match = temp();
+				emit_abc(BC_EXCMATCH, match, exc, t);
+				next.push_back(emit_jump(BC_JMPIFNOT, match));
+				u->top = hmark;
+			}
+
+			if (h->name) {
+				store_name(h->name, exc);
+			}
+			body(h->body);
+			if (h->name) {
+				/* as CPython: name = None; del name */
+				uint32_t hmark = u->top;
+				uint32_t t = temp();
+				u->line = h->line;
+				emit_abx(BC_LOADK, t, none_constant());
+				store_name(h->name, t);
+				ast_name n;
+				n.kind = AST_NAME;
+				n.line = h->line;
+				n.id = h->name;
+				n.ctx = CTX_DEL;
+				del(&n);
+				u->top = hmark;
+			}
+
+			join(end_defined, end_reachable, u->defined, u->reachable);
+			end.push_back(emit_jump(BC_JMP));
+			patch_here(next);
+		}
+
+		/* No except block matched */
+		u->line = s->line;
+		emit_abc(BC_RAISE, exc);
+		u->except_regs.pop_back();
+
+		patch_here(end);
+		u->defined = end_defined;
+		u->reachable = end_reachable;
+		u->top = mark;
+	}
+
+	const symtable& st;
+	arena& A;
+	const compile_options& opts;
+	unit* u;
+
+	const char* int_name;
+	const char* float_name;
+	std::unordered_map<const char*, value_type> returns; /* by function name, see specialize */
+};
+
+std::unique_ptr<code_object> compile_module(const ast_module* m, const symtable& st, arena& A,
+		const compile_options& opts) {
+	compiler c(st, A, opts);
+	return c.module(m);
+}
+
+} /* namespace arbusto */
@@ -0,0 +1,42 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef COMPILER_H_
+#define COMPILER_H_
+
+#include <memory>
+
+#include "ast.h"
+#include "symtable.h"
+#include "bytecode.h"
+#include "arena.h"
+
+namespace arbusto {
+
+class pass_manager;
+
+/* How compile_module compiles */
+struct compile_options {
+	/* Functions with int or float annotations also get code specialized on them, see specialize.h */
+	bool specialize{false};
+	/* Runs over every code object before it is specialized, see passes.h */
+	pass_manager* passes{nullptr};
+};
+
+/*
+ * The bytecode of a module, see bytecode.h. Fast locals stay in their
+ * registers and expressions read them in place; a local is checked for
+ * being bound only where the compiler cannot prove it was assigned.
+ *
+ * Throws std::runtime_error with the line for what it does not compile
+ * yet: classes, imports, with, generators, async, starred expressions.
+ */
+std::unique_ptr<code_object> compile_module(const ast_module* m, const symtable& st, arena& A,
+		const compile_options& opts = compile_options());
+
+} /* namespace arbusto */
+
+#endif /* COMPILER_H_ */
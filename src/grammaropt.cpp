@@ -0,0 +1,641 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <deque>
+
+#include "grammaropt.h"
+
+namespace arbusto {
+
+
+/* Rules of the form R: X, with X another rule or a terminal */
+static bool is_trivial_rule(grammar_node_rule* rule) {
+	return rule->rhs->type == GNODE_STRING;
+}
+
+class rule_inliner : public grammar_node_visitor {
+public:
+	rule_inliner(std::map<std::string, std::string>& alias_, grammar_opt_stats& stats_) : alias(alias_), stats(stats_) {}
+
+	virtual void visit_string(grammar_node_string* node) {
+		auto it = alias.find(node->value);
+
+		if (it != alias.end()) {
+			node->value = it->second;
+			stats.rules_inlined++;
+		}
+	}
+
+	std::map<std::string, std::string>& alias;
+	grammar_opt_stats& stats;
+};
+
+static void inline_trivial_rules(grammar_parser& G, const std::set<std::string>& start_rules, grammar_opt_stats& stats) {
+	std::map<std::string, std::string> alias;
+
+	for (auto& e : G.rules) {
+		grammar_node_rule* rule = static_cast<grammar_node_rule*>(e.second.get());
+
+		if (is_trivial_rule(rule) && start_rules.find(e.first) == start_rules.end()) {
+			alias[e.first] = static_cast<grammar_node_string*>(rule->rhs.get())->value;
+		}
+	}
+
+	/* R: S, S: T ends up as R: T */
+	for (auto& e : alias) {
+		for (size_t n = 0; n < alias.size(); ++n) {
+			auto it = alias.find(e.second);
+			if (it == alias.end()) {
+				break;
+			}
+			e.second = it->second;
+		}
+	}
+
+	rule_inliner W(alias, stats);
+
+	for (auto& e : G.rules) {
+		W.visit(e.second.get());
+	}
+}
+
+static void flatten(grammar_node_ptr& node, grammar_opt_stats& stats) {
+	switch (node->type) {
+	case GNODE_STRING:
+		break;
+
+	case GNODE_OPTIONAL:
+		flatten(static_cast<grammar_node_optional*>(node.get())->child, stats);
+		break;
+
+	case GNODE_REPETITION:
+		flatten(static_cast<grammar_node_repetition*>(node.get())->child, stats);
+		break;
+
+	case GNODE_SEQUENCE:
+	case GNODE_RHS:
+		{
+			/* sequence(A, sequence(B, C)) is sequence(A, B, C), the same for rhs */
+			std::vector<grammar_node_ptr>& childs = (node->type == GNODE_SEQUENCE)
+					? static_cast<grammar_node_sequence*>(node.get())->childs
+					: static_cast<grammar_node_rhs*>(node.get())->choices;
+			std::vector<grammar_node_ptr> out;
+
+			for (auto& e : childs) {
+				flatten(e, stats);
+
+				if (e->type != node->type) {
+					out.push_back(std::move(e));
+					continue;
+				}
+
+				std::vector<grammar_node_ptr>& inner = (e->type == GNODE_SEQUENCE)
+						? static_cast<grammar_node_sequence*>(e.get())->childs
+						: static_cast<grammar_node_rhs*>(e.get())->choices;
+
+				for (auto& f : inner) {
+					out.push_back(std::move(f));
+				}
+
+				stats.nodes_flattened++;
+			}
+
+			if (out.size() == 1) {
+				node = std::move(out[0]);
+				stats.nodes_flattened++;
+			} else {
+				childs = std::move(out);
+			}
+		}
+		break;
+
+	case GNODE_RULE:
+		flatten(static_cast<grammar_node_rule*>(node.get())->rhs, stats);
+		break;
+	}
+}
+
+/* The elements of a choice, a sequence is split in its childs */
+static std::vector<grammar_node_ptr> split_sequence(grammar_node_ptr node) {
+	std::vector<grammar_node_ptr> out;
+
+	if (node->type == GNODE_SEQUENCE) {
+		out = std::move(static_cast<grammar_node_sequence*>(node.get())->childs);
+	} else {
+		out.push_back(std::move(node));
+	}
+
+	return out;
+}
+
+static grammar_node_ptr make_sequence(std::vector<grammar_node_ptr>& elems) {
+	if (elems.size() == 1) {
+		return std::move(elems[0]);
+	}
+
+	auto node = new grammar_node_sequence();
+	node->childs = std::move(elems);
+	return grammar_node_ptr(node);
+}
+
+static grammar_node_ptr make_rhs(std::vector<grammar_node_ptr>& choices) {
+	if (choices.size() == 1) {
+		return std::move(choices[0]);
+	}
+
+	auto node = new grammar_node_rhs();
+	node->choices = std::move(choices);
+	return grammar_node_ptr(node);
+}
+
+static std::string first_repr(grammar_node* node) {
+	if (node->type == GNODE_SEQUENCE) {
+		return static_cast<grammar_node_sequence*>(node)->childs[0]->repr();
+	}
+	return node->repr();
+}
+
+static grammar_node_ptr clone_node(grammar_node* node) {
+	switch (node->type) {
+	case GNODE_STRING:
+		return grammar_node_ptr(new grammar_node_string(static_cast<grammar_node_string*>(node)->value));
+
+	case GNODE_OPTIONAL:
+		return grammar_node_ptr(new grammar_node_optional(clone_node(static_cast<grammar_node_optional*>(node)->child.get())));
+
+	case GNODE_REPETITION:
+		{
+			grammar_node_repetition* rep = static_cast<grammar_node_repetition*>(node);
+			return grammar_node_ptr(new grammar_node_repetition(clone_node(rep->child.get()), rep->star));
+		}
+
+	case GNODE_SEQUENCE:
+		{
+			auto copy = new grammar_node_sequence();
+			for (auto& e : static_cast<grammar_node_sequence*>(node)->childs) {
+				copy->childs.push_back(clone_node(e.get()));
+			}
+			return grammar_node_ptr(copy);
+		}
+
+	case GNODE_RHS:
+		{
+			auto copy = new grammar_node_rhs();
+			for (auto& e : static_cast<grammar_node_rhs*>(node)->choices) {
+				copy->choices.push_back(clone_node(e.get()));
+			}
+			return grammar_node_ptr(copy);
+		}
+
+	case GNODE_RULE:
+		{
+			grammar_node_rule* rule = static_cast<grammar_node_rule*>(node);
+			return grammar_node_ptr(new grammar_node_rule(rule->rule_name, clone_node(rule->rhs.get())));
+		}
+	}
+
+	return grammar_node_ptr();
+}
+
+/* The terminals a node can start with, and if it can match nothing */
+struct first_info {
+	std::set<std::string> first;
+	bool nullable;
+};
+
+class first_sets {
+public:
+	explicit first_sets(grammar_parser& G_) : G(G_) {}
+
+	first_info get(grammar_node* node);
+	first_info get_elements(const std::vector<grammar_node_ptr>& elems, size_t from);
+
+	bool disjoint(const first_info& a, const first_info& b) {
+		if (a.nullable || b.nullable) {
+			return false;
+		}
+		for (auto& e : a.first) {
+			if (b.first.find(e) != b.first.end()) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	grammar_parser& G;
+	std::map<std::string, first_info> rules;
+};
+
+first_info first_sets::get(grammar_node* node) {
+	first_info R;
+	R.nullable = false;
+
+	switch (node->type) {
+	case GNODE_STRING:
+		{
+			auto& value = static_cast<grammar_node_string*>(node)->value;
+			auto it = G.rules.find(value);
+
+			if (it == G.rules.end()) {
+				R.first.insert(value);
+				break;
+			}
+
+			auto memo = rules.find(value);
+			if (memo != rules.end()) {
+				return memo->second;
+			}
+
+			/* The grammar is LL(1), no left recursion to guard against */
+			R = get(it->second.get());
+			rules[value] = R;
+		}
+		break;
+
+	case GNODE_OPTIONAL:
+		R = get(static_cast<grammar_node_optional*>(node)->child.get());
+		R.nullable = true;
+		break;
+
+	case GNODE_REPETITION:
+		{
+			grammar_node_repetition* rep = static_cast<grammar_node_repetition*>(node);
+			R = get(rep->child.get());
+			R.nullable = R.nullable || rep->star;
+		}
+		break;
+
+	case GNODE_SEQUENCE:
+		R = get_elements(static_cast<grammar_node_sequence*>(node)->childs, 0);
+		break;
+
+	case GNODE_RHS:
+		for (auto& e : static_cast<grammar_node_rhs*>(node)->choices) {
+			auto T = get(e.get());
+			R.first.insert(T.first.begin(), T.first.end());
+			R.nullable = R.nullable || T.nullable;
+		}
+		break;
+
+	case GNODE_RULE:
+		R = get(static_cast<grammar_node_rule*>(node)->rhs.get());
+		break;
+	}
+
+	return R;
+}
+
+first_info first_sets::get_elements(const std::vector<grammar_node_ptr>& elems, size_t from) {
+	first_info R;
+	R.nullable = true;
+
+	for (size_t i = from; i < elems.size() && R.nullable; ++i) {
+		auto T = get(elems[i].get());
+		R.first.insert(T.first.begin(), T.first.end());
+		R.nullable = T.nullable;
+	}
+
+	return R;
+}
+
+/*
+ * A choice starting with [X] or (A | B) hides the element it really starts
+ * with. [X] Y is X Y | Y, and (A | B) Y is A Y | B Y, as long as the parts
+ * can not start with the same token: only then the ordered choice version
+ * never tries the second one after the first one matched.
+ */
+static bool expand_head(std::vector<grammar_node_ptr>& seq, first_sets& F, std::vector<std::vector<grammar_node_ptr> >& out) {
+	grammar_node* head = seq[0].get();
+	auto rest = F.get_elements(seq, 1);
+	std::vector<grammar_node*> parts;
+
+	if (head->type == GNODE_OPTIONAL) {
+		grammar_node* child = static_cast<grammar_node_optional*>(head)->child.get();
+
+		if (rest.nullable || !F.disjoint(F.get(child), rest)) {
+			return false;
+		}
+
+		parts.push_back(child);
+		parts.push_back(0);
+	} else if (head->type == GNODE_RHS) {
+		auto& choices = static_cast<grammar_node_rhs*>(head)->choices;
+
+		for (size_t i = 0; i < choices.size(); ++i) {
+			for (size_t j = i + 1; j < choices.size(); ++j) {
+				if (!F.disjoint(F.get(choices[i].get()), F.get(choices[j].get()))) {
+					return false;
+				}
+			}
+			parts.push_back(choices[i].get());
+		}
+	} else {
+		return false;
+	}
+
+	for (auto part : parts) {
+		std::vector<grammar_node_ptr> elems;
+
+		if (part) {
+			elems = split_sequence(clone_node(part));
+		}
+
+		for (size_t i = 1; i < seq.size(); ++i) {
+			elems.push_back(clone_node(seq[i].get()));
+		}
+
+		out.push_back(std::move(elems));
+	}
+
+	return true;
+}
+
+/* The first elements a choice could show after expand_head */
+static std::set<std::string> head_candidates(grammar_node* node) {
+	std::set<std::string> S;
+	grammar_node* head = (node->type == GNODE_SEQUENCE) ? static_cast<grammar_node_sequence*>(node)->childs[0].get() : node;
+
+	S.insert(head->repr());
+
+	if (head->type == GNODE_OPTIONAL) {
+		S.insert(first_repr(static_cast<grammar_node_optional*>(head)->child.get()));
+		if (node->type == GNODE_SEQUENCE) {
+			S.insert(static_cast<grammar_node_sequence*>(node)->childs[1]->repr());
+		}
+	} else if (head->type == GNODE_RHS) {
+		for (auto& e : static_cast<grammar_node_rhs*>(head)->choices) {
+			S.insert(first_repr(e.get()));
+		}
+	}
+
+	return S;
+}
+
+/*
+ * Expand the heads of the choices that could then share a prefix with
+ * another choice, and move each choice next to the last previous one with
+ * the same first element when it can not start like any choice in between.
+ */
+static void group_choices(grammar_node_rhs* node, first_sets& F, grammar_opt_stats& stats) {
+	auto& choices = node->choices;
+	std::vector<std::set<std::string> > heads;
+
+	for (auto& e : choices) {
+		heads.push_back(head_candidates(e.get()));
+	}
+
+	std::vector<grammar_node_ptr> expanded;
+
+	for (size_t i = 0; i < choices.size(); ++i) {
+		bool shared = false;
+
+		for (size_t j = 0; j < choices.size() && !shared; ++j) {
+			if (i == j) {
+				continue;
+			}
+			for (auto& h : heads[i]) {
+				if (heads[j].find(h) != heads[j].end() && h != choices[i]->repr()) {
+					shared = true;
+					break;
+				}
+			}
+		}
+
+		std::vector<std::vector<grammar_node_ptr> > parts;
+
+		if (shared && choices[i]->type == GNODE_SEQUENCE) {
+			auto seq = split_sequence(std::move(choices[i]));
+
+			if (expand_head(seq, F, parts)) {
+				for (auto& p : parts) {
+					expanded.push_back(make_sequence(p));
+				}
+				stats.heads_expanded++;
+				continue;
+			}
+
+			choices[i] = make_sequence(seq);
+		}
+
+		expanded.push_back(std::move(choices[i]));
+	}
+
+	choices = std::move(expanded);
+
+	for (size_t k = 1; k < choices.size(); ++k) {
+		auto key = first_repr(choices[k].get());
+		size_t i = k;
+
+		while (i > 0 && first_repr(choices[i - 1].get()) != key) {
+			--i;
+		}
+
+		if (i == 0 || i == k) {
+			continue;
+		}
+
+		/* choices[i - 1] has the same head, can choices[k] jump over [i, k) ? */
+		auto fk = F.get(choices[k].get());
+		bool movable = true;
+
+		for (size_t m = i; m < k && movable; ++m) {
+			movable = F.disjoint(F.get(choices[m].get()), fk);
+		}
+
+		if (movable) {
+			auto moved = std::move(choices[k]);
+			choices.erase(choices.begin() + k);
+			choices.insert(choices.begin() + i, std::move(moved));
+		}
+	}
+}
+
+/* Terminals fail on one token compare, only parsing a prefix with rules in it again is costly */
+static bool is_expensive(grammar_node* node, grammar_parser& G) {
+	if (node->type != GNODE_STRING) {
+		return true;
+	}
+	return G.rules.find(static_cast<grammar_node_string*>(node)->value) != G.rules.end();
+}
+
+static void factor_choices(grammar_node_rhs* node, grammar_parser& G, first_sets& F, grammar_opt_stats& stats) {
+	group_choices(node, F, stats);
+
+	auto& choices = node->choices;
+	std::vector<grammar_node_ptr> out;
+	size_t i = 0;
+
+	while (i < choices.size()) {
+		auto key = first_repr(choices[i].get());
+		size_t j = i + 1;
+
+		while (j < choices.size() && first_repr(choices[j].get()) == key) {
+			++j;
+		}
+
+		if (j - i < 2) {
+			out.push_back(std::move(choices[i]));
+			++i;
+			continue;
+		}
+
+		std::vector<std::vector<grammar_node_ptr> > seqs;
+
+		for (size_t k = i; k < j; ++k) {
+			seqs.push_back(split_sequence(std::move(choices[k])));
+		}
+
+		/* Longest prefix shared by the whole run */
+		size_t len = 1;
+		bool expensive = is_expensive(seqs[0][0].get(), G);
+
+		for (;;) {
+			bool same = seqs[0].size() > len;
+
+			for (size_t k = 1; same && k < seqs.size(); ++k) {
+				same = seqs[k].size() > len && seqs[k][len]->repr() == seqs[0][len]->repr();
+			}
+
+			if (!same) {
+				break;
+			}
+
+			expensive = expensive || is_expensive(seqs[0][len].get(), G);
+			++len;
+		}
+
+		if (!expensive) {
+			for (auto& seq : seqs) {
+				out.push_back(make_sequence(seq));
+			}
+			i = j;
+			continue;
+		}
+
+		/* A B | A C | A | A D becomes A [B | C], A D can never match */
+		std::vector<grammar_node_ptr> prefix, rest;
+		bool nullable = false;
+
+		for (size_t k = 0; k < len; ++k) {
+			prefix.push_back(std::move(seqs[0][k]));
+		}
+
+		for (auto& seq : seqs) {
+			if (seq.size() == len) {
+				nullable = true;
+				break;
+			}
+
+			std::vector<grammar_node_ptr> tail;
+			for (size_t k = len; k < seq.size(); ++k) {
+				tail.push_back(std::move(seq[k]));
+			}
+			rest.push_back(make_sequence(tail));
+		}
+
+		if (rest.size()) {
+			auto tail = make_rhs(rest);
+
+			if (nullable) {
+				tail = grammar_node_ptr(new grammar_node_optional(std::move(tail)));
+			}
+
+			prefix.push_back(std::move(tail));
+		}
+
+		out.push_back(make_sequence(prefix));
+		stats.choices_factored++;
+		i = j;
+	}
+
+	choices = std::move(out);
+}
+
+class choice_factorer : public grammar_node_visitor {
+public:
+	choice_factorer(grammar_parser& G_, grammar_opt_stats& stats_) : G(G_), F(G_), stats(stats_) {}
+
+	virtual void visit_rhs(grammar_node_rhs* node) {
+		/* Innermost first */
+		grammar_node_visitor::visit_rhs(node);
+		factor_choices(node, G, F, stats);
+	}
+
+	grammar_parser& G;
+	first_sets F;
+	grammar_opt_stats& stats;
+};
+
+class rule_ref_collector : public grammar_node_visitor {
+public:
+	rule_ref_collector(grammar_parser& G_, std::deque<std::string>& Q_) : G(G_), Q(Q_) {}
+
+	virtual void visit_string(grammar_node_string* node) {
+		if (G.rules.find(node->value) != G.rules.end()) {
+			Q.push_back(node->value);
+		}
+	}
+
+	grammar_parser& G;
+	std::deque<std::string>& Q;
+};
+
+static void remove_unreachable_rules(grammar_parser& G, const std::set<std::string>& start_rules, grammar_opt_stats& stats) {
+	std::set<std::string> reached;
+	std::deque<std::string> Q(start_rules.begin(), start_rules.end());
+	rule_ref_collector W(G, Q);
+
+	while (Q.size() > 0) {
+		auto name = Q.front();
+		Q.pop_front();
+
+		auto it = G.rules.find(name);
+
+		if (it == G.rules.end() || !reached.insert(name).second) {
+			continue;
+		}
+
+		W.visit(it->second.get());
+	}
+
+	for (auto it = G.rules.begin(); it != G.rules.end(); ) {
+		if (reached.find(it->first) == reached.end()) {
+			it = G.rules.erase(it);
+			stats.rules_removed++;
+		} else {
+			++it;
+		}
+	}
+}
+
+grammar_opt_stats optimize_grammar(grammar_parser& G, const std::set<std::string>& start_rules, bool inline_rules) {
+	grammar_opt_stats stats;
+
+	if (inline_rules) {
+		inline_trivial_rules(G, start_rules, stats);
+	}
+
+	for (auto& e : G.rules) {
+		flatten(e.second, stats);
+	}
+
+	choice_factorer W(G, stats);
+
+	for (auto& e : G.rules) {
+		W.visit(e.second.get());
+	}
+
+	for (auto& e : G.rules) {
+		flatten(e.second, stats);
+	}
+
+	remove_unreachable_rules(G, start_rules, stats);
+
+	return stats;
+}
+
+
+} /* namespace arbusto */
@@ -0,0 +1,44 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef GRAMMAROPT_H_
+#define GRAMMAROPT_H_
+
+#include <set>
+#include <string>
+
+#include "grammarparser.h"
+
+namespace arbusto {
+
+struct grammar_opt_stats {
+	size_t rules_inlined{0};
+	size_t nodes_flattened{0};
+	size_t heads_expanded{0};
+	size_t choices_factored{0};
+	size_t rules_removed{0};
+};
+
+/*
+ * Grammar to grammar rewrite, run before generate_parser:
+ *
+ *  - inline rules that are just another name (pass_stmt: 'pass'), only
+ *    when inline_rules is set, as their node disappears from the tree;
+ *  - flatten sequences in sequences and alternatives in alternatives;
+ *  - left factor alternatives sharing a prefix with a rule in it, A B | A C
+ *    becomes A (B | C), so A is parsed once. Heads like [A] B or (A | B) C
+ *    are expanded, and alternatives reordered, when the FIRST sets show
+ *    the ordered choice can not tell the difference;
+ *  - drop the rules not reachable from start_rules.
+ *
+ * The parse of any input is the same before and after: alternatives keep
+ * their order, and those made unreachable by an earlier one are dropped.
+ */
+grammar_opt_stats optimize_grammar(grammar_parser& G, const std::set<std::string>& start_rules, bool inline_rules);
+
+} /* namespace arbusto */
+
+#endif /* GRAMMAROPT_H_ */
@@ -329,6 +329,7 @@ void grammar_parser::parse_production(size_t p, size_t i) {
 			std::cout << std::endl;
 		}
 		grammar_node_rule* rule = static_cast<grammar_node_rule*>(node.get());
+		rule_names.insert(rule->rule_name);
 		rules[rule->rule_name] = std::move(node);
 	} else {
 		if (debug) {
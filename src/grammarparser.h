@@ -11,6 +11,7 @@
 #include <string>
 #include <sstream>
 #include <map>
+#include <set>
 #include <memory>
 
 
@@ -197,6 +198,7 @@ public:
 	bool debug{false};
 	std::vector<std::string> tokens;
 	std::map<std::string, grammar_node_ptr> rules;
+	std::set<std::string> rule_names; /* every rule in the file, even if later optimized away */
 
 	inline bool valid_name_char(int c) {
 		return std::isalnum(c) || c == '_';
@@ -0,0 +1,821 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+#include "native.h"
+
+namespace arbusto {
+
+/* As CPython's default sys.getrecursionlimit() */
+static const unsigned RECURSION_LIMIT = 1000;
+
+/* Items BC_RESERVE makes room for at most, a bigger container grows as it fills */
+static const size_t MAX_RESERVE = 1 << 24;
+
+/* Values in a block of the frame stack, a frame bigger than that gets a block of its own */
+static const size_t FRAME_BLOCK = 1 << 16;
+
+value* frame_stack::push(size_t n) {
+	while (current < blocks.size() && blocks[current].top + n > blocks[current].size) {
+		if (blocks[current].top == 0) {
+			blocks[current].values.reset(new value[n]);
+			blocks[current].size = n;
+			break;
+		}
+		++current;
+	}
+	if (current == blocks.size()) {
+		size_t size = std::max(n, FRAME_BLOCK);
+		blocks.push_back(block{ std::unique_ptr<value[]>(new value[size]), size, 0 });
+	}
+
+	block& b = blocks[current];
+	value* base = b.values.get() + b.top;
+	b.top += n;
+	return base;
+}
+
+void frame_stack::pop(value* base, size_t n) {
+	for (size_t i = 0; i < n; ++i) {
+		base[i] = value();
+	}
+	blocks[current].top -= n;
+	while (current > 0 && blocks[current].top == 0) {
+		--current;
+	}
+}
+
+/* A frame of the frame stack, given back however the call ends */
+class frame {
+public:
+	frame(frame_stack& stack_, size_t n_) : stack(stack_), base(stack_.push(n_)), n(n_) {}
+	~frame() {
+		stack.pop(base, n);
+	}
+
+	frame(const frame&) = delete;
+	frame& operator=(const frame&) = delete;
+
+	value* values() const { return base; }
+
+private:
+	frame_stack& stack;
+	value* base;
+	size_t n;
+};
+
+interpreter::interpreter(arena& A_, const char* file_name_) : A(A_), file_name(file_name_), depth(0) {
+	add_builtins(builtins, A);
+	globals[A.intern("__name__")] = make_str("__main__");
+}
+
+interpreter::~interpreter() {
+	/* The functions in the globals point into modules */
+	globals.clear();
+}
+
+static value load_constant(const code_object& co, uint32_t index) {
+	const constant& k = co.constants[index];
+
+	switch (k.kind) {
+	case CK_NONE: return none();
+	case CK_BOOL: return make_bool(k.i != 0);
+	case CK_INT: return make_int(k.i);
+	case CK_BIGINT:
+		{
+			bool neg = k.s[0] == '-';
+			bigint i;
+			bigint::parse(neg ? k.s.substr(1) : k.s, 10, i);
+			return make_int(neg ? -i : i);
+		}
+	case CK_FLOAT: return make_float(k.f);
+	case CK_STR: return make_str(k.s);
+	case CK_TUPLE:
+		{
+			std::vector<value> items;
+			for (auto i : k.items) {
+				items.push_back(load_constant(co, i));
+			}
+			return make_tuple(std::move(items));
+		}
+	}
+	return none();
+}
+
+runtime_code* interpreter::load(const code_object& co, const native_code*& natives) {
+	runtime_code* rc = new runtime_code();
+	rc->co = &co;
+	if (natives) {
+		rc->native = *natives++;
+	}
+	for (uint32_t i = 0; i < co.constants.size(); ++i) {
+		rc->constants.push_back(load_constant(co, i));
+	}
+	for (auto& child : co.children) {
+		rc->children.emplace_back(load(*child, natives));
+	}
+	return rc;
+}
+
+void interpreter::run_module(const code_object& co, const native_code* natives) {
+	modules.emplace_back(load(co, natives));
+	frame f(frames, co.n_registers);
+	execute(*modules.back(), f.values(), nullptr, false);
+}
+
+/* 'a', 'a' and 'b', 'a', 'b', and 'c' */
+static std::string name_list(const std::vector<const char*>& names) {
+	std::string r;
+	for (size_t i = 0; i < names.size(); ++i) {
+		if (i) {
+			r += names.size() > 2 ? ", " : " ";
+		}
+		if (i && i + 1 == names.size()) {
+			r += "and ";
+		}
+		r += std::string("'") + names[i] + "'";
+	}
+	return r;
+}
+
+[[noreturn]] static void missing_arguments(const code_object& co, const std::vector<const char*>& names,
+		const char* kind) {
+	raise_error(&type_error_type, std::string(co.name) + "() missing " + std::to_string(names.size()) + " required "
+			+ kind + " argument" + (names.size() == 1 ? "" : "s") + ": " + name_list(names));
+}
+
+value interpreter::call_function(function_object* fn, const value* args, size_t n, const keyword_args* kw) {
+	const runtime_code& rc = *fn->code;
+	const code_object& co = *rc.co;
+	size_t n_cells = co.cellvars.size() + co.freevars.size();
+	frame f(frames, co.n_registers + n_cells);
+	value* regs = f.values();
+	size_t n_named = co.n_args + co.n_kwonly;
+	size_t varargs = n_named;
+	size_t varkeywords = n_named + ((co.flags & CODE_VARARGS) != 0);
+
+	/* Positional arguments, the rest of them to *args */
+	for (size_t i = 0; i < n && i < co.n_args; ++i) {
+		regs[i] = args[i];
+	}
+	if (n > co.n_args) {
+		if (!(co.flags & CODE_VARARGS)) {
+			uint32_t least = co.n_args - co.n_defaults;
+			std::string takes = least == co.n_args ? std::to_string(co.n_args)
+					: "from " + std::to_string(least) + " to " + std::to_string(co.n_args);
+			raise_error(&type_error_type, std::string(co.name) + "() takes " + takes + " positional argument"
+					+ (co.n_args == 1 && least == co.n_args ? "" : "s") + " but " + std::to_string(n) + " "
+					+ (n == 1 ? "was" : "were") + " given");
+		}
+		regs[varargs] = make_tuple(std::vector<value>(args + co.n_args, args + n));
+	} else if (co.flags & CODE_VARARGS) {
+		regs[varargs] = make_tuple({});
+	}
+	if (co.flags & CODE_VARKEYWORDS) {
+		regs[varkeywords] = make_dict();
+	}
+
+	/* Keyword arguments by name, the unknown ones to **kwargs */
+	for (size_t k = 0; kw && k < kw->n; ++k) {
+		const std::string& name = str_of(kw->names[k]);
+		size_t slot = 0;
+		while (slot < n_named && name != co.varnames[slot]) {
+			++slot;
+		}
+
+		if (slot == n_named) {
+			if (!(co.flags & CODE_VARKEYWORDS)) {
+				raise_error(&type_error_type, std::string(co.name) + "() got an unexpected keyword argument '" + name
+						+ "'");
+			}
+			as<dict_object>(regs[varkeywords])->table.set(kw->names[k], kw->values[k]);
+		} else if (regs[slot].bound()) {
+			raise_error(&type_error_type, std::string(co.name) + "() got multiple values for argument '" + name
+					+ "'");
+		} else {
+			regs[slot] = kw->values[k];
+		}
+	}
+
+	/* Defaults, then the parameters still missing */
+	std::vector<const char*> missing;
+	uint32_t first_default = co.n_args - co.n_defaults;
+	for (uint32_t i = 0; i < co.n_args; ++i) {
+		if (!regs[i].bound() && i >= first_default) {
+			regs[i] = fn->defaults[i - first_default];
+		} else if (!regs[i].bound()) {
+			missing.push_back(co.varnames[i]);
+		}
+	}
+	if (!missing.empty()) {
+		missing_arguments(co, missing, "positional");
+	}
+	for (uint32_t i = 0; i < co.n_kwonly; ++i) {
+		value& r = regs[co.n_args + i];
+		if (!r.bound() && fn->kwdefaults[i].bound()) {
+			r = fn->kwdefaults[i];
+		} else if (!r.bound()) {
+			missing.push_back(co.varnames[co.n_args + i]);
+		}
+	}
+	if (!missing.empty()) {
+		missing_arguments(co, missing, "keyword-only");
+	}
+
+	/* Cells, the parameter ones start with the argument, after the registers */
+	value* cells = regs + co.n_registers;
+	for (size_t i = 0; i < co.cellvars.size(); ++i) {
+		cells[i] = make_cell(co.cell_params[i] >= 0 ? regs[co.cell_params[i]] : value());
+	}
+	std::copy(fn->closure.begin(), fn->closure.end(), cells + co.cellvars.size());
+
+	if (depth >= RECURSION_LIMIT) {
+		raise_error(&recursion_error_type, "maximum recursion depth exceeded");
+	}
+
+	/* The specialized code if the arguments are what the annotations say */
+	bool specialized = !co.specialized.empty();
+	for (size_t i = 0; specialized && i < co.param_types.size(); ++i) {
+		switch (co.param_types[i]) {
+		case VT_INT: specialized = regs[i].is_small_int(); break;
+		case VT_FLOAT: specialized = regs[i].is_real(); break;
+		default: break;
+		}
+	}
+
+	++depth;
+	try {
+		value r = execute(rc, regs, cells, specialized);
+		--depth;
+		return r;
+	} catch (...) {
+		--depth;
+		throw;
+	}
+}
+
+value interpreter::load_global(const char* name) const {
+	auto it = globals.find(name);
+	if (it == globals.end()) {
+		it = builtins.find(name);
+		if (it == builtins.end()) {
+			name_error(name);
+		}
+	}
+	return it->second;
+}
+
+void interpreter::del_global(const char* name) {
+	if (!globals.erase(name)) {
+		name_error(name);
+	}
+}
+
+value interpreter::make_closure(const runtime_code& child, const value* R, const value* D) {
+	const code_object& cc = *child.co;
+	value f = make_function(&child, this);
+	function_object* fn = as<function_object>(f);
+
+	for (uint32_t i = 0; i < cc.n_defaults; ++i) {
+		fn->defaults.push_back(*R++);
+	}
+	for (uint32_t i = 0; i < cc.n_kwonly; ++i) {
+		fn->kwdefaults.push_back(cc.kwonly_default[i] ? *R++ : value());
+	}
+	for (auto d : cc.closure) {
+		fn->closure.push_back(D[d]);
+	}
+	return f;
+}
+
+void interpreter::add_traceback(const py_exception& e, const code_object& co, uint32_t pc) const {
+	as<exception_object>(e.exc)->traceback.push_back({ file_name, co.name, co.line_of(pc) });
+}
+
+static const char* cell_name(const code_object& co, uint32_t d) {
+	return d < co.cellvars.size() ? co.cellvars[d] : co.freevars[d - co.cellvars.size()];
+}
+
+[[noreturn]] void unbound_cell(const code_object& co, uint32_t d) {
+	if (d < co.cellvars.size()) {
+		raise_error(&unbound_local_error_type, std::string("cannot access local variable '") + cell_name(co, d)
+				+ "' where it is not associated with a value");
+	}
+	raise_error(&name_error_type, std::string("cannot access free variable '") + cell_name(co, d)
+			+ "' where it is not associated with a value in enclosing scope");
+}
+
+[[noreturn]] void unbound_local(const code_object& co, uint32_t slot) {
+	raise_error(&unbound_local_error_type, std::string("cannot access local variable '") + co.varnames[slot]
+			+ "' where it is not associated with a value");
+}
+
+[[noreturn]] void name_error(const char* name) {
+	raise_error(&name_error_type, std::string("name '") + name + "' is not defined");
+}
+
+bool exception_matches(const value& exc, const value& spec) {
+	if (is_type(spec, tuple_type)) {
+		for (auto& t : as<tuple_object>(spec)->items) {
+			if (exception_matches(exc, t)) {
+				return true;
+			}
+		}
+		return false;
+	}
+	if (!is_type(spec, type_type) || !is_subtype(static_cast<const type_object*>(spec.get()), &base_exception_type)) {
+		raise_error(&type_error_type, "catching classes that do not inherit from BaseException is not allowed");
+	}
+	return is_instance(exc, static_cast<const type_object*>(spec.get()));
+}
+
+[[noreturn]] void raise_value(const value& v) {
+	if (is_type(v, type_type) && is_subtype(static_cast<const type_object*>(v.get()), &base_exception_type)) {
+		throw py_exception(call(v, nullptr, 0));
+	}
+	if (is_instance(v, &base_exception_type)) {
+		throw py_exception(v);
+	}
+	raise_error(&type_error_type, "exceptions must derive from BaseException");
+}
+
+void unpack(value* R, const value& v, unsigned n) {
+	std::vector<value> items = items_of(v);
+	if (items.size() > n) {
+		raise_error(&value_error_type, "too many values to unpack (expected " + std::to_string(n) + ")");
+	}
+	if (items.size() < n) {
+		raise_error(&value_error_type, "not enough values to unpack (expected " + std::to_string(n) + ", got "
+				+ std::to_string(items.size()) + ")");
+	}
+	for (unsigned i = 0; i < n; ++i) {
+		R[i] = std::move(items[i]);
+	}
+}
+
+void reserve(const value& container, const value& items) {
+	size_t n = std::min(length_hint(items), MAX_RESERVE);
+	if (is_type(container, list_type)) {
+		as<list_object>(container)->items.reserve(n);
+	} else if (is_type(container, set_type)) {
+		as<set_object>(container)->table.reserve(n);
+	} else {
+		as<dict_object>(container)->table.reserve(n);
+	}
+}
+
+value build_set(const value* items, unsigned n) {
+	value s = make_set();
+	for (unsigned i = 0; i < n; ++i) {
+		as<set_object>(s)->table.set(items[i], none());
+	}
+	return s;
+}
+
+value build_dict(const value* items, unsigned n) {
+	value d = make_dict();
+	for (unsigned i = 0; i < n; ++i) {
+		as<dict_object>(d)->table.set(items[2 * i], items[2 * i + 1]);
+	}
+	return d;
+}
+
+/*
+ * The end of every instruction jumps straight to the code of the next
+ * one through a table of label addresses, a GCC and Clang extension, so
+ * each has its own indirect branch to predict; the switch only starts the
+ * loop. Built with ARBUSTO_SWITCH_DISPATCH, to compare, it is the switch
+ * in a loop.
+ */
+#ifndef ARBUSTO_SWITCH_DISPATCH
+#define ARBUSTO_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define TARGET(op) case op: L_##op:
+#define DISPATCH() \
+	do { \
+		ins = code[pc++]; \
+		a = arg_a(ins); \
+		goto *dispatch_table[op_of(ins)]; \
+	} while (0)
+#else
+#define TARGET(op) case op:
+#define DISPATCH() continue
+#endif
+
+/*
+ * Back to the generic code, from this instruction again or from the next
+ * one. Not in a do while, where the continue of DISPATCH would stop.
+ */
+#define DEOPT() \
+	{ \
+		code = co.code.data(); \
+		--pc; \
+		DISPATCH(); \
+	}
+#define DEOPT_NEXT() \
+	{ \
+		code = co.code.data(); \
+		DISPATCH(); \
+	}
+
+value interpreter::execute(const runtime_code& rc, value* R, value* D, bool specialized) {
+	if (rc.native) {
+		return rc.native(*this, rc, R, D, specialized);
+	}
+
+	const code_object& co = *rc.co;
+	const instruction* code = specialized ? co.specialized.data() : co.code.data();
+	const value* K = rc.constants.data();
+	uint32_t pc = 0;
+	instruction ins;
+	unsigned a;
+
+#ifdef ARBUSTO_COMPUTED_GOTO
+	static const void* const dispatch_table[] = {
+		&&L_BC_NOP, &&L_BC_MOVE, &&L_BC_LOADK, &&L_BC_LOADGLOBAL, &&L_BC_STOREGLOBAL, &&L_BC_DELGLOBAL,
+		&&L_BC_LOADDEREF, &&L_BC_STOREDEREF, &&L_BC_DELDEREF, &&L_BC_CHECKBOUND, &&L_BC_DELFAST, &&L_BC_CLEAR, &&L_BC_ADD,
+		&&L_BC_SUB, &&L_BC_MUL, &&L_BC_MATMUL, &&L_BC_TRUEDIV, &&L_BC_MOD, &&L_BC_POW, &&L_BC_LSHIFT, &&L_BC_RSHIFT,
+		&&L_BC_BITOR, &&L_BC_BITXOR, &&L_BC_BITAND, &&L_BC_FLOORDIV, &&L_BC_IADD, &&L_BC_NEG, &&L_BC_POS,
+		&&L_BC_INVERT, &&L_BC_NOT, &&L_BC_LT, &&L_BC_LE, &&L_BC_EQ, &&L_BC_NE, &&L_BC_GT, &&L_BC_GE, &&L_BC_IS,
+		&&L_BC_ISNOT, &&L_BC_IN, &&L_BC_NOTIN, &&L_BC_JMP, &&L_BC_JMPIF, &&L_BC_JMPIFNOT, &&L_BC_GETITEM,
+		&&L_BC_SETITEM, &&L_BC_DELITEM, &&L_BC_GETATTR, &&L_BC_SETATTR, &&L_BC_BUILDLIST, &&L_BC_BUILDTUPLE,
+		&&L_BC_BUILDSET, &&L_BC_BUILDDICT, &&L_BC_BUILDSLICE, &&L_BC_LISTAPPEND, &&L_BC_SETADD, &&L_BC_RESERVE, &&L_BC_UNPACK,
+		&&L_BC_ITER, &&L_BC_FORITER, &&L_BC_CALL, &&L_BC_MAKEFUNC, &&L_BC_RETURN, &&L_BC_RAISE, &&L_BC_EXCMATCH,
+		&&L_BC_ADD_II, &&L_BC_SUB_II, &&L_BC_MUL_II, &&L_BC_FLOORDIV_II, &&L_BC_MOD_II, &&L_BC_ADD_FF, &&L_BC_SUB_FF,
+		&&L_BC_MUL_FF, &&L_BC_TRUEDIV_FF, &&L_BC_LT_II, &&L_BC_LE_II, &&L_BC_EQ_II, &&L_BC_NE_II, &&L_BC_GT_II,
+		&&L_BC_GE_II, &&L_BC_LT_FF, &&L_BC_LE_FF, &&L_BC_EQ_FF, &&L_BC_NE_FF, &&L_BC_GT_FF, &&L_BC_GE_FF,
+		&&L_BC_JMPIF_B, &&L_BC_JMPIFNOT_B, &&L_BC_FORITER_I, &&L_BC_CALL_I, &&L_BC_CALL_F
+	};
+	static_assert(sizeof(dispatch_table) / sizeof(dispatch_table[0]) == N_OPCODES, "dispatch_table is out of date");
+#endif
+
+	for (;;) {
+		try {
+			for (;;) {
+				ins = code[pc++];
+				a = arg_a(ins);
+
+				switch (op_of(ins)) {
+				TARGET(BC_NOP)
+					DISPATCH();
+				TARGET(BC_MOVE)
+					R[a] = R[arg_b(ins)];
+					DISPATCH();
+				TARGET(BC_LOADK)
+					R[a] = K[arg_bx(ins)];
+					DISPATCH();
+				TARGET(BC_LOADGLOBAL)
+					R[a] = load_global(co.names[arg_bx(ins)]);
+					DISPATCH();
+				TARGET(BC_STOREGLOBAL)
+					store_global(co.names[arg_bx(ins)], R[a]);
+					DISPATCH();
+				TARGET(BC_DELGLOBAL)
+					del_global(co.names[arg_bx(ins)]);
+					DISPATCH();
+				TARGET(BC_LOADDEREF)
+					{
+						cell_object* c = as<cell_object>(D[arg_b(ins)]);
+						if (!c->v.bound()) {
+							unbound_cell(co, arg_b(ins));
+						}
+						R[a] = c->v;
+					}
+					DISPATCH();
+				TARGET(BC_STOREDEREF)
+					as<cell_object>(D[arg_b(ins)])->v = R[a];
+					DISPATCH();
+				TARGET(BC_DELDEREF)
+					{
+						cell_object* c = as<cell_object>(D[arg_b(ins)]);
+						if (!c->v.bound()) {
+							unbound_cell(co, arg_b(ins));
+						}
+						c->v = value();
+					}
+					DISPATCH();
+				TARGET(BC_CHECKBOUND)
+					if (!R[a].bound()) {
+						unbound_local(co, a);
+					}
+					DISPATCH();
+				TARGET(BC_DELFAST)
+					if (!R[a].bound()) {
+						unbound_local(co, a);
+					}
+					R[a] = value();
+					DISPATCH();
+				TARGET(BC_CLEAR)
+					for (unsigned i = 0; i < arg_b(ins); ++i) {
+						R[a + i] = value();
+					}
+					DISPATCH();
+
+				TARGET(BC_ADD)
+					R[a] = arith<BIN_ADD>(R[arg_b(ins)], R[arg_c(ins)]);
+					DISPATCH();
+				TARGET(BC_SUB)
+					R[a] = arith<BIN_SUB>(R[arg_b(ins)], R[arg_c(ins)]);
+					DISPATCH();
+				TARGET(BC_MUL)
+					R[a] = arith<BIN_MUL>(R[arg_b(ins)], R[arg_c(ins)]);
+					DISPATCH();
+				TARGET(BC_MATMUL) TARGET(BC_TRUEDIV) TARGET(BC_MOD) TARGET(BC_POW) TARGET(BC_LSHIFT) TARGET(BC_RSHIFT)
+				TARGET(BC_BITOR) TARGET(BC_BITXOR) TARGET(BC_BITAND) TARGET(BC_FLOORDIV)
+					R[a] = binary(static_cast<binary_op>(op_of(ins) - BC_ADD), R[arg_b(ins)], R[arg_c(ins)]);
+					DISPATCH();
+				TARGET(BC_IADD)
+					if (is_type(R[arg_b(ins)], list_type)) {
+						R[a] = inplace_add(R[arg_b(ins)], R[arg_c(ins)]);
+					} else {
+						R[a] = arith<BIN_ADD>(R[arg_b(ins)], R[arg_c(ins)]);
+					}
+					DISPATCH();
+
+				TARGET(BC_NEG)
+					R[a] = negative(R[arg_b(ins)]);
+					DISPATCH();
+				TARGET(BC_POS)
+					R[a] = positive(R[arg_b(ins)]);
+					DISPATCH();
+				TARGET(BC_INVERT)
+					R[a] = invert(R[arg_b(ins)]);
+					DISPATCH();
+				TARGET(BC_NOT)
+					R[a] = make_bool(!truthy(R[arg_b(ins)]));
+					DISPATCH();
+
+				TARGET(BC_LT)
+					R[a] = make_bool(relation<CMP_OP_LT>(R[arg_b(ins)], R[arg_c(ins)]));
+					DISPATCH();
+				TARGET(BC_LE)
+					R[a] = make_bool(relation<CMP_OP_LE>(R[arg_b(ins)], R[arg_c(ins)]));
+					DISPATCH();
+				TARGET(BC_EQ)
+					R[a] = make_bool(relation<CMP_OP_EQ>(R[arg_b(ins)], R[arg_c(ins)]));
+					DISPATCH();
+				TARGET(BC_NE)
+					R[a] = make_bool(relation<CMP_OP_NE>(R[arg_b(ins)], R[arg_c(ins)]));
+					DISPATCH();
+				TARGET(BC_GT)
+					R[a] = make_bool(relation<CMP_OP_GT>(R[arg_b(ins)], R[arg_c(ins)]));
+					DISPATCH();
+				TARGET(BC_GE)
+					R[a] = make_bool(relation<CMP_OP_GE>(R[arg_b(ins)], R[arg_c(ins)]));
+					DISPATCH();
+				TARGET(BC_IS)
+					R[a] = make_bool(R[arg_b(ins)].is(R[arg_c(ins)]));
+					DISPATCH();
+				TARGET(BC_ISNOT)
+					R[a] = make_bool(!R[arg_b(ins)].is(R[arg_c(ins)]));
+					DISPATCH();
+				TARGET(BC_IN)
+					R[a] = make_bool(contains(R[arg_c(ins)], R[arg_b(ins)]));
+					DISPATCH();
+				TARGET(BC_NOTIN)
+					R[a] = make_bool(!contains(R[arg_c(ins)], R[arg_b(ins)]));
+					DISPATCH();
+
+				TARGET(BC_JMP)
+					pc += arg_sbx(ins);
+					DISPATCH();
+				TARGET(BC_JMPIF)
+					if (truth(R[a])) {
+						pc += arg_sbx(ins);
+					}
+					DISPATCH();
+				TARGET(BC_JMPIFNOT)
+					if (!truth(R[a])) {
+						pc += arg_sbx(ins);
+					}
+					DISPATCH();
+
+				TARGET(BC_GETITEM)
+					R[a] = get_item(R[arg_b(ins)], R[arg_c(ins)]);
+					DISPATCH();
+				TARGET(BC_SETITEM)
+					set_item(R[a], R[arg_b(ins)], R[arg_c(ins)]);
+					DISPATCH();
+				TARGET(BC_DELITEM)
+					del_item(R[a], R[arg_b(ins)]);
+					DISPATCH();
+				TARGET(BC_GETATTR)
+					R[a] = get_attr(R[arg_b(ins)], co.attrs[arg_c(ins)]);
+					DISPATCH();
+				TARGET(BC_SETATTR)
+					set_attr(R[a], co.attrs[arg_b(ins)], R[arg_c(ins)]);
+					DISPATCH();
+
+				TARGET(BC_BUILDLIST)
+					R[a] = make_list(std::vector<value>(R + arg_b(ins), R + arg_b(ins) + arg_c(ins)));
+					DISPATCH();
+				TARGET(BC_BUILDTUPLE)
+					R[a] = make_tuple(std::vector<value>(R + arg_b(ins), R + arg_b(ins) + arg_c(ins)));
+					DISPATCH();
+				TARGET(BC_BUILDSET)
+					R[a] = build_set(R + arg_b(ins), arg_c(ins));
+					DISPATCH();
+				TARGET(BC_BUILDDICT)
+					R[a] = build_dict(R + arg_b(ins), arg_c(ins));
+					DISPATCH();
+				TARGET(BC_BUILDSLICE)
+					R[a] = make_slice(R[arg_b(ins)], R[arg_b(ins) + 1], R[arg_b(ins) + 2]);
+					DISPATCH();
+				TARGET(BC_LISTAPPEND)
+					as<list_object>(R[a])->items.push_back(R[arg_b(ins)]);
+					DISPATCH();
+				TARGET(BC_SETADD)
+					as<set_object>(R[a])->table.set(R[arg_b(ins)], none());
+					DISPATCH();
+				TARGET(BC_RESERVE)
+					reserve(R[a], R[arg_b(ins)]);
+					DISPATCH();
+				TARGET(BC_UNPACK)
+					unpack(R + a, R[arg_b(ins)], arg_c(ins));
+					DISPATCH();
+
+				TARGET(BC_ITER)
+					R[a] = get_iter(R[arg_b(ins)]);
+					DISPATCH();
+				TARGET(BC_FORITER)
+					if (!for_next(R[a], R[a + 1])) {
+						pc += arg_sbx(ins);
+					}
+					DISPATCH();
+
+				TARGET(BC_CALL)
+					R[a] = call_at(R, a, arg_b(ins), arg_c(ins));
+					DISPATCH();
+				TARGET(BC_MAKEFUNC)
+					R[a] = make_closure(*rc.children[arg_bx(ins)], R + a, D);
+					DISPATCH();
+				TARGET(BC_RETURN)
+					return R[a];
+				TARGET(BC_RAISE)
+					raise_value(R[a]);
+				TARGET(BC_EXCMATCH)
+					R[a] = make_bool(exception_matches(R[arg_b(ins)], R[arg_c(ins)]));
+					DISPATCH();
+
+				TARGET(BC_ADD_II)
+					{
+						int64_t r = R[arg_b(ins)].small_int_value() + R[arg_c(ins)].small_int_value();
+						if (!value::fits_small_int(r)) {
+							DEOPT();
+						}
+						R[a] = value::small_int(r);
+					}
+					DISPATCH();
+				TARGET(BC_SUB_II)
+					{
+						int64_t r = R[arg_b(ins)].small_int_value() - R[arg_c(ins)].small_int_value();
+						if (!value::fits_small_int(r)) {
+							DEOPT();
+						}
+						R[a] = value::small_int(r);
+					}
+					DISPATCH();
+				TARGET(BC_MUL_II)
+					{
+						int64_t r;
+						if (__builtin_mul_overflow(R[arg_b(ins)].small_int_value(), R[arg_c(ins)].small_int_value(), &r)
+								|| !value::fits_small_int(r)) {
+							DEOPT();
+						}
+						R[a] = value::small_int(r);
+					}
+					DISPATCH();
+				TARGET(BC_FLOORDIV_II)
+					{
+						int64_t q;
+						if (!floordiv_small(R[arg_b(ins)].small_int_value(), R[arg_c(ins)].small_int_value(), q)) {
+							DEOPT();
+						}
+						R[a] = value::small_int(q);
+					}
+					DISPATCH();
+				TARGET(BC_MOD_II)
+					{
+						int64_t r;
+						if (!mod_small(R[arg_b(ins)].small_int_value(), R[arg_c(ins)].small_int_value(), r)) {
+							DEOPT();
+						}
+						R[a] = value::small_int(r);
+					}
+					DISPATCH();
+				TARGET(BC_ADD_FF)
+					R[a] = value::real(R[arg_b(ins)].real_value() + R[arg_c(ins)].real_value());
+					DISPATCH();
+				TARGET(BC_SUB_FF)
+					R[a] = value::real(R[arg_b(ins)].real_value() - R[arg_c(ins)].real_value());
+					DISPATCH();
+				TARGET(BC_MUL_FF)
+					R[a] = value::real(R[arg_b(ins)].real_value() * R[arg_c(ins)].real_value());
+					DISPATCH();
+				TARGET(BC_TRUEDIV_FF)
+					if (R[arg_c(ins)].real_value() == 0) {
+						DEOPT();
+					}
+					R[a] = value::real(R[arg_b(ins)].real_value() / R[arg_c(ins)].real_value());
+					DISPATCH();
+
+				TARGET(BC_LT_II)
+					R[a] = value::boolean(R[arg_b(ins)].small_int_value() < R[arg_c(ins)].small_int_value());
+					DISPATCH();
+				TARGET(BC_LE_II)
+					R[a] = value::boolean(R[arg_b(ins)].small_int_value() <= R[arg_c(ins)].small_int_value());
+					DISPATCH();
+				TARGET(BC_EQ_II)
+					R[a] = value::boolean(R[arg_b(ins)].small_int_value() == R[arg_c(ins)].small_int_value());
+					DISPATCH();
+				TARGET(BC_NE_II)
+					R[a] = value::boolean(R[arg_b(ins)].small_int_value() != R[arg_c(ins)].small_int_value());
+					DISPATCH();
+				TARGET(BC_GT_II)
+					R[a] = value::boolean(R[arg_b(ins)].small_int_value() > R[arg_c(ins)].small_int_value());
+					DISPATCH();
+				TARGET(BC_GE_II)
+					R[a] = value::boolean(R[arg_b(ins)].small_int_value() >= R[arg_c(ins)].small_int_value());
+					DISPATCH();
+				TARGET(BC_LT_FF)
+					R[a] = value::boolean(R[arg_b(ins)].real_value() < R[arg_c(ins)].real_value());
+					DISPATCH();
+				TARGET(BC_LE_FF)
+					R[a] = value::boolean(R[arg_b(ins)].real_value() <= R[arg_c(ins)].real_value());
+					DISPATCH();
+				TARGET(BC_EQ_FF)
+					R[a] = value::boolean(R[arg_b(ins)].real_value() == R[arg_c(ins)].real_value());
+					DISPATCH();
+				TARGET(BC_NE_FF)
+					R[a] = value::boolean(R[arg_b(ins)].real_value() != R[arg_c(ins)].real_value());
+					DISPATCH();
+				TARGET(BC_GT_FF)
+					R[a] = value::boolean(R[arg_b(ins)].real_value() > R[arg_c(ins)].real_value());
+					DISPATCH();
+				TARGET(BC_GE_FF)
+					R[a] = value::boolean(R[arg_b(ins)].real_value() >= R[arg_c(ins)].real_value());
+					DISPATCH();
+
+				TARGET(BC_JMPIF_B)
+					if (R[a].bool_value()) {
+						pc += arg_sbx(ins);
+					}
+					DISPATCH();
+				TARGET(BC_JMPIFNOT_B)
+					if (!R[a].bool_value()) {
+						pc += arg_sbx(ins);
+					}
+					DISPATCH();
+				TARGET(BC_FORITER_I)
+					if (!for_next(R[a], R[a + 1])) {
+						pc += arg_sbx(ins);
+					} else if (!R[a + 1].is_small_int()) {
+						DEOPT_NEXT();
+					}
+					DISPATCH();
+				TARGET(BC_CALL_I)
+					R[a] = call_at(R, a, arg_b(ins), arg_c(ins));
+					if (!R[a].is_small_int()) {
+						DEOPT_NEXT();
+					}
+					DISPATCH();
+				TARGET(BC_CALL_F)
+					R[a] = call_at(R, a, arg_b(ins), arg_c(ins));
+					if (!R[a].is_real()) {
+						DEOPT_NEXT();
+					}
+					DISPATCH();
+
+				case N_OPCODES:
+					DISPATCH();
+				}
+			}
+		} catch (py_exception& e) {
+			const exception_entry* h = co.handler_of(pc - 1);
+			if (!h) {
+				add_traceback(e, co, pc - 1);
+				throw;
+			}
+			R[h->reg] = e.exc;
+			pc = h->handler;
+		}
+	}
+}
+
+#ifdef ARBUSTO_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#undef ARBUSTO_COMPUTED_GOTO
+#endif
+#undef TARGET
+#undef DISPATCH
+#undef DEOPT
+#undef DEOPT_NEXT
+
+} /* namespace arbusto */
@@ -0,0 +1,114 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef INTERP_H_
+#define INTERP_H_
+
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+#include "bytecode.h"
+#include "runtime.h"
+#include "arena.h"
+
+namespace arbusto {
+
+struct runtime_code;
+
+/*
+ * The code object rc compiled to C++ by aot.h, which runs instead of its
+ * bytecode: what interpreter::execute would do with the same arguments.
+ */
+typedef value (*native_code)(interpreter& I, const runtime_code& rc, value* R, value* D, bool specialized);
+
+/* A code object made ready to run: its constants as values, its children too */
+struct runtime_code {
+	const code_object* co;
+	std::vector<value> constants;
+	std::vector<std::unique_ptr<runtime_code> > children;
+	native_code native{nullptr};
+};
+
+/*
+ * The registers and cells of the running frames, one frame after the
+ * other in blocks that never move. A call takes its frame from the top
+ * and gives it back, cleared, when it returns, so calls do not allocate
+ * once the blocks are there.
+ */
+class frame_stack {
+public:
+	frame_stack() : current(0) {}
+
+	frame_stack(const frame_stack&) = delete;
+	frame_stack& operator=(const frame_stack&) = delete;
+
+	/* n unbound values */
+	value* push(size_t n);
+	/* The last push, base and n as it returned them */
+	void pop(value* base, size_t n);
+
+private:
+	struct block {
+		std::unique_ptr<value[]> values;
+		size_t size;
+		size_t top;
+	};
+
+	std::vector<block> blocks;
+	size_t current;
+};
+
+/*
+ * Runs the bytecode of one module. Every call gets its own registers and
+ * cells from the frame stack, and the C++ stack holds the Python one, so
+ * a call is a C++ call of execute. Globals are keyed by the names interned in the arena of the
+ * module, the builtins behind them the same way.
+ *
+ * Python exceptions are py_exception, uncaught ones leave run_module.
+ */
+class interpreter {
+public:
+	interpreter(arena& A_, const char* file_name_);
+	~interpreter();
+
+	interpreter(const interpreter&) = delete;
+	interpreter& operator=(const interpreter&) = delete;
+
+	/* natives, if not nullptr, has the native code of co and of every child of it, in preorder */
+	void run_module(const code_object& co, const native_code* natives = nullptr);
+
+	/* fn(args, kw), binding the arguments to its parameters */
+	value call_function(function_object* fn, const value* args, size_t n, const keyword_args* kw);
+
+	/* What the instructions on globals and functions do, for native code too */
+	value load_global(const char* name) const;
+	void store_global(const char* name, const value& v) {
+		globals[name] = v;
+	}
+	void del_global(const char* name);
+	/* The function of child, its defaults from R[0] on and its closure from the cells D */
+	value make_closure(const runtime_code& child, const value* R, const value* D);
+	/* An exception leaves the code of co at pc */
+	void add_traceback(const py_exception& e, const code_object& co, uint32_t pc) const;
+
+private:
+	runtime_code* load(const code_object& co, const native_code*& natives);
+	/* From co.specialized if specialized, which the arguments must match */
+	value execute(const runtime_code& rc, value* regs, value* cells, bool specialized);
+
+	arena& A;
+	const char* file_name;
+	std::unordered_map<const char*, value> globals;
+	std::unordered_map<const char*, value> builtins;
+	std::vector<std::unique_ptr<runtime_code> > modules;
+	frame_stack frames;
+	unsigned depth;
+};
+
+} /* namespace arbusto */
+
+#endif /* INTERP_H_ */
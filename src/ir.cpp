@@ -0,0 +1,1009 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <algorithm>
+
+#include "ir.h"
+
+namespace arbusto {
+
+typedef std::vector<std::pair<unsigned, ir_field> > reg_list;
+
+void ir_operands(const code_object& co, instruction ins, reg_list& uses, reg_list& defs) {
+	unsigned a = arg_a(ins);
+	unsigned b = arg_b(ins);
+	unsigned c = arg_c(ins);
+
+	switch (op_of(ins)) {
+	case BC_MOVE: case BC_NEG: case BC_POS: case BC_INVERT: case BC_NOT: case BC_ITER: case BC_GETATTR:
+		uses.emplace_back(b, FIELD_B);
+		defs.emplace_back(a, FIELD_A);
+		break;
+	case BC_LOADK: case BC_LOADGLOBAL: case BC_LOADDEREF:
+		defs.emplace_back(a, FIELD_A);
+		break;
+	case BC_STOREGLOBAL: case BC_STOREDEREF: case BC_RETURN: case BC_RAISE:
+	case BC_JMPIF: case BC_JMPIFNOT:
+		uses.emplace_back(a, FIELD_A);
+		break;
+	case BC_CHECKBOUND:
+		/* Its error names the local of A, A stays */
+		uses.emplace_back(a, FIELD_FIXED);
+		break;
+	case BC_DELFAST:
+		uses.emplace_back(a, FIELD_FIXED);
+		defs.emplace_back(a, FIELD_FIXED);
+		break;
+	case BC_CLEAR:
+		for (unsigned i = 0; i < b; ++i) {
+			defs.emplace_back(a + i, FIELD_FIXED);
+		}
+		break;
+
+	case BC_ADD: case BC_SUB: case BC_MUL: case BC_MATMUL: case BC_TRUEDIV: case BC_MOD: case BC_POW:
+	case BC_LSHIFT: case BC_RSHIFT: case BC_BITOR: case BC_BITXOR: case BC_BITAND: case BC_FLOORDIV: case BC_IADD:
+	case BC_LT: case BC_LE: case BC_EQ: case BC_NE: case BC_GT: case BC_GE: case BC_IS: case BC_ISNOT:
+	case BC_IN: case BC_NOTIN: case BC_GETITEM: case BC_EXCMATCH:
+		uses.emplace_back(b, FIELD_B);
+		uses.emplace_back(c, FIELD_C);
+		defs.emplace_back(a, FIELD_A);
+		break;
+	case BC_SETITEM:
+		uses.emplace_back(a, FIELD_A);
+		uses.emplace_back(b, FIELD_B);
+		uses.emplace_back(c, FIELD_C);
+		break;
+	case BC_DELITEM: case BC_LISTAPPEND: case BC_SETADD: case BC_RESERVE:
+		uses.emplace_back(a, FIELD_A);
+		uses.emplace_back(b, FIELD_B);
+		break;
+	case BC_SETATTR:
+		uses.emplace_back(a, FIELD_A);
+		uses.emplace_back(c, FIELD_C);
+		break;
+
+	case BC_BUILDLIST: case BC_BUILDTUPLE: case BC_BUILDSET: case BC_BUILDDICT: case BC_BUILDSLICE:
+		{
+			unsigned n = op_of(ins) == BC_BUILDDICT ? 2 * c : op_of(ins) == BC_BUILDSLICE ? 3 : c;
+			for (unsigned i = 0; i < n; ++i) {
+				uses.emplace_back(b + i, FIELD_FIXED);
+			}
+			defs.emplace_back(a, FIELD_A);
+		}
+		break;
+	case BC_UNPACK:
+		uses.emplace_back(b, FIELD_B);
+		for (unsigned i = 0; i < c; ++i) {
+			defs.emplace_back(a + i, FIELD_FIXED);
+		}
+		break;
+	case BC_FORITER:
+		uses.emplace_back(a, FIELD_FIXED);
+		defs.emplace_back(a + 1, FIELD_FIXED);
+		break;
+	case BC_CALL:
+		{
+			/* The function, the arguments, the keyword values and the tuple of their names */
+			unsigned n = 1 + b + c + (c ? 1 : 0);
+			for (unsigned i = 0; i < n; ++i) {
+				uses.emplace_back(a + i, FIELD_FIXED);
+			}
+			defs.emplace_back(a, FIELD_FIXED);
+		}
+		break;
+	case BC_MAKEFUNC:
+		{
+			const code_object& child = *co.children[arg_bx(ins)];
+			unsigned n = child.n_defaults;
+			for (bool d : child.kwonly_default) {
+				n += d;
+			}
+			for (unsigned i = 0; i < n; ++i) {
+				uses.emplace_back(a + i, FIELD_FIXED);
+			}
+			defs.emplace_back(a, FIELD_FIXED);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static bool ends_block(opcode op) {
+	return op == BC_JMP || op == BC_JMPIF || op == BC_JMPIFNOT || op == BC_FORITER || op == BC_RETURN || op == BC_RAISE;
+}
+
+/* The blocks a block goes to, in the order of the depth first search */
+template <class F>
+static void for_successors(const ir_block* b, F f) {
+	if (b->next) {
+		f(b->next, false);
+	}
+	if (b->target) {
+		f(b->target, false);
+	}
+	if (b->handler) {
+		f(b->handler, true);
+	}
+}
+
+ir_value* ir_function::new_value(ir_value_kind kind, unsigned reg) {
+	values.emplace_back(new ir_value());
+	ir_value* v = values.back().get();
+	v->kind = kind;
+	v->id = static_cast<uint32_t>(values.size() - 1);
+	v->reg = reg;
+	return v;
+}
+
+ir_block* ir_function::new_block() {
+	blocks.emplace_back(new ir_block());
+	ir_block* b = blocks.back().get();
+	b->id = static_cast<uint32_t>(blocks.size() - 1);
+	return b;
+}
+
+ir_value* ir_function::new_phi(ir_block* b, unsigned reg) {
+	ir_value* v = new_value(IV_PHI, reg);
+	v->block = b;
+	v->operands.assign(b->preds.size(), nullptr);
+	b->phis.push_back(v);
+	return v;
+}
+
+ir_inst* ir_function::new_inst(instruction ins, uint32_t line) {
+	insts.emplace_back(new ir_inst());
+	ir_inst* i = insts.back().get();
+	i->ins = ins;
+	i->line = line;
+	return i;
+}
+
+bool ir_function::build(const code_object& co, ir_function& fn) {
+	uint32_t n = static_cast<uint32_t>(co.code.size());
+	if (n == 0 || !co.specialized.empty()) {
+		return false;
+	}
+	fn.co = &co;
+	fn.n_registers = co.n_registers;
+
+	/*
+	 * Blocks start at 0, at jump targets, after jumps and at handlers; in a
+	 * handler range every instruction is one. The one at n is past the end,
+	 * where only code no path gets to may go.
+	 */
+	std::vector<bool> leader(n + 1, false);
+	leader[0] = true;
+	leader[n] = true;
+	for (uint32_t pc = 0; pc < n; ++pc) {
+		opcode op = op_of(co.code[pc]);
+		if (op >= BC_ADD_II) {
+			return false;
+		}
+		if (op == BC_JMP || op == BC_JMPIF || op == BC_JMPIFNOT || op == BC_FORITER) {
+			int64_t to = static_cast<int64_t>(pc) + 1 + arg_sbx(co.code[pc]);
+			if (to < 0 || to > n) {
+				return false;
+			}
+			leader[to] = true;
+		}
+		if (ends_block(op)) {
+			leader[pc + 1] = true;
+		}
+	}
+	for (auto& e : co.exception_table) {
+		if (e.end > n || e.handler >= n) {
+			return false;
+		}
+		for (uint32_t pc = e.start; pc <= e.end; ++pc) {
+			leader[pc] = true;
+		}
+		leader[e.handler] = true;
+	}
+
+	/* An empty block first, where every register gets its entry value */
+	ir_block* start = fn.new_block();
+	std::vector<ir_block*> block_at(n + 1, nullptr);
+	for (uint32_t pc = 0; pc <= n; ++pc) {
+		if (leader[pc]) {
+			block_at[pc] = fn.new_block();
+		}
+	}
+	start->next = block_at[0];
+
+	for (uint32_t pc = 0; pc < n; ) {
+		ir_block* b = block_at[pc];
+		if (const exception_entry* h = co.handler_of(pc)) {
+			b->handler = block_at[h->handler];
+			b->handler_reg = h->reg;
+		}
+		uint32_t end = pc + 1;
+		while (end < n && !leader[end]) {
+			++end;
+		}
+
+		for (uint32_t i = pc; i < end; ++i) {
+			instruction ins = co.code[i];
+			opcode op = op_of(ins);
+			ir_block* to = (op == BC_JMP || op == BC_JMPIF || op == BC_JMPIFNOT || op == BC_FORITER)
+					? block_at[i + 1 + arg_sbx(ins)] : nullptr;
+			if (op == BC_JMP) {
+				b->next = to;
+				continue;
+			}
+			if (op == BC_NOP) {
+				continue;
+			}
+			if (to) {
+				b->target = to;
+			}
+
+			ir_inst* inst = fn.new_inst(ins, co.line_of(i));
+			inst->block = b;
+			b->insts.push_back(inst);
+		}
+
+		opcode last = op_of(co.code[end - 1]);
+		if (last != BC_JMP && last != BC_RETURN && last != BC_RAISE) {
+			b->next = block_at[end];
+		}
+		if (last == BC_FORITER && b->next == b->target) {
+			return false;
+		}
+		pc = end;
+	}
+
+	/* The blocks some path gets to, in the order of their code */
+	std::vector<bool> reached(fn.blocks.size(), false);
+	std::vector<ir_block*> work{ start };
+	reached[start->id] = true;
+	while (!work.empty()) {
+		ir_block* b = work.back();
+		work.pop_back();
+		for_successors(b, [&](ir_block* s, bool) {
+			if (!reached[s->id]) {
+				reached[s->id] = true;
+				work.push_back(s);
+			}
+		});
+	}
+	if (reached[block_at[n]->id]) {
+		return false;
+	}
+	for (auto& b : fn.blocks) {
+		if (reached[b->id]) {
+			fn.layout.push_back(b.get());
+			for_successors(b.get(), [&](ir_block* s, bool exceptional) {
+				s->preds.push_back(ir_edge{ b.get(), exceptional });
+			});
+		}
+	}
+
+	/* A handler is only entered by an exception, it starts with the exception in its register */
+	for (auto& e : co.exception_table) {
+		ir_block* h = block_at[e.handler];
+		for (auto& p : h->preds) {
+			if (!p.exceptional) {
+				return false;
+			}
+		}
+		if (!h->caught) {
+			h->caught = fn.new_value(IV_CATCH, e.reg);
+			h->caught->block = h;
+		} else if (h->caught->reg != e.reg) {
+			return false;
+		}
+	}
+
+	/* The operands of the instructions */
+	for (auto b : fn.layout) {
+		for (auto i : b->insts) {
+			reg_list uses, defs;
+			ir_operands(co, i->ins, uses, defs);
+			for (auto& u : uses) {
+				if (u.first >= fn.n_registers) {
+					return false;
+				}
+				i->uses.push_back(ir_use{ nullptr, u.second });
+			}
+			for (auto& d : defs) {
+				if (d.first >= fn.n_registers) {
+					return false;
+				}
+				ir_value* v = fn.new_value(IV_INST, d.first);
+				v->inst = i;
+				i->defs.push_back(v);
+			}
+			if (defs.size() == 1 && defs[0].second == FIELD_A) {
+				i->def_field = FIELD_A;
+			}
+		}
+	}
+	for (unsigned r = 0; r < fn.n_registers; ++r) {
+		fn.entry.push_back(fn.new_value(IV_ENTRY, r));
+	}
+
+	fn.analyze_order();
+	fn.place_phis();
+	fn.rename();
+	fn.clean_up();
+	return true;
+}
+
+/* Reverse postorder and the immediate dominators, as Cooper, Harvey and Kennedy do it */
+void ir_function::analyze_order() {
+	order.clear();
+	std::vector<bool> seen(blocks.size(), false);
+	std::vector<std::pair<ir_block*, int> > stack;
+	std::vector<ir_block*> post;
+
+	stack.emplace_back(layout[0], 0);
+	seen[layout[0]->id] = true;
+	while (!stack.empty()) {
+		ir_block* b = stack.back().first;
+		int k = stack.back().second++;
+		ir_block* succ[3] = { b->next, b->target, b->handler };
+		if (k < 3) {
+			ir_block* s = succ[k];
+			if (s && !seen[s->id]) {
+				seen[s->id] = true;
+				stack.emplace_back(s, 0);
+			}
+			continue;
+		}
+		post.push_back(b);
+		stack.pop_back();
+	}
+	order.assign(post.rbegin(), post.rend());
+	for (uint32_t i = 0; i < order.size(); ++i) {
+		order[i]->rpo = i;
+		order[i]->idom = nullptr;
+	}
+
+	ir_block* first = order[0];
+	first->idom = first;
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (size_t k = 1; k < order.size(); ++k) {
+			ir_block* b = order[k];
+			ir_block* d = nullptr;
+			for (auto& p : b->preds) {
+				ir_block* x = p.from;
+				if (!x->idom) {
+					continue;
+				}
+				if (!d) {
+					d = x;
+					continue;
+				}
+				ir_block* y = d;
+				while (x != y) {
+					while (x->rpo > y->rpo) {
+						x = x->idom;
+					}
+					while (y->rpo > x->rpo) {
+						y = y->idom;
+					}
+				}
+				d = x;
+			}
+			if (d != b->idom) {
+				b->idom = d;
+				changed = true;
+			}
+		}
+	}
+}
+
+bool ir_function::dominates(const ir_block* a, const ir_block* b) const {
+	while (b->rpo > a->rpo) {
+		b = b->idom;
+	}
+	return a == b;
+}
+
+static bool has_reg_phi(const ir_block* b, unsigned reg) {
+	for (auto phi : b->phis) {
+		if (phi->reg == reg) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * A phi for each register where two of its definitions meet, at the
+ * iterated dominance frontiers. Handlers get one for every register, and
+ * the exits of FORITER one for the register it writes, since the edges
+ * there leave before the instruction writes.
+ */
+void ir_function::place_phis() {
+	std::vector<std::vector<ir_block*> > frontier(blocks.size());
+	for (auto b : order) {
+		if (b->preds.size() < 2) {
+			continue;
+		}
+		for (auto& p : b->preds) {
+			for (ir_block* x = p.from; x != b->idom; x = x->idom) {
+				auto& f = frontier[x->id];
+				if (std::find(f.begin(), f.end(), b) == f.end()) {
+					f.push_back(b);
+				}
+				if (x == x->idom) {
+					break;
+				}
+			}
+		}
+	}
+
+	std::vector<std::vector<ir_block*> > defined_in(n_registers);
+	std::vector<uint32_t> has_phi(blocks.size(), UINT32_MAX);
+	std::vector<std::vector<unsigned> > forced(blocks.size());
+	for (auto b : order) {
+		if (b->caught) {
+			for (unsigned r = 0; r < n_registers; ++r) {
+				forced[b->id].push_back(r);
+			}
+		}
+		if (!b->insts.empty() && b->insts.back()->op() == BC_FORITER) {
+			forced[b->target->id].push_back(b->insts.back()->defs[0]->reg);
+		}
+	}
+	for (auto b : order) {
+		for (auto r : forced[b->id]) {
+			if (!has_reg_phi(b, r)) {
+				new_phi(b, r);
+				defined_in[r].push_back(b);
+			}
+		}
+		for (auto i : b->insts) {
+			for (auto d : i->defs) {
+				auto& in = defined_in[d->reg];
+				if (in.empty() || in.back() != b) {
+					in.push_back(b);
+				}
+			}
+		}
+	}
+
+	std::vector<uint32_t> queued(blocks.size(), UINT32_MAX);
+	for (unsigned r = 0; r < n_registers; ++r) {
+		std::vector<ir_block*> work = defined_in[r];
+		for (auto b : work) {
+			queued[b->id] = r;
+		}
+		/* The entry defines them all */
+		work.push_back(order[0]);
+		while (!work.empty()) {
+			ir_block* b = work.back();
+			work.pop_back();
+			for (auto f : frontier[b->id]) {
+				if (has_phi[f->id] == r || has_reg_phi(f, r)) {
+					continue;
+				}
+				has_phi[f->id] = r;
+				new_phi(f, r);
+				if (queued[f->id] != r) {
+					queued[f->id] = r;
+					work.push_back(f);
+				}
+			}
+		}
+	}
+}
+
+/* The operands of phis from b: on an exception edge, the registers before the instruction of b */
+static void fill_phis(ir_block* b, ir_block* s, bool exceptional, const std::vector<ir_value*>& regs) {
+	for (size_t k = 0; k < s->preds.size(); ++k) {
+		if (s->preds[k].from == b && s->preds[k].exceptional == exceptional) {
+			for (auto phi : s->phis) {
+				phi->operands[k] = regs[phi->reg];
+			}
+		}
+	}
+}
+
+/*
+ * Name every operand after the definition that reaches it, walking the
+ * dominator tree: a block starts from the registers its immediate
+ * dominator ends with, except where it has phis.
+ */
+void ir_function::rename() {
+	std::vector<std::vector<ir_block*> > children(blocks.size());
+	for (size_t k = 1; k < order.size(); ++k) {
+		children[order[k]->idom->id].push_back(order[k]);
+	}
+
+	std::vector<std::pair<ir_block*, std::vector<ir_value*> > > stack;
+	stack.emplace_back(order[0], entry);
+	while (!stack.empty()) {
+		ir_block* b = stack.back().first;
+		std::vector<ir_value*> regs = std::move(stack.back().second);
+		stack.pop_back();
+
+		for (auto phi : b->phis) {
+			regs[phi->reg] = phi;
+		}
+		if (b->caught) {
+			regs[b->caught->reg] = b->caught;
+		}
+		if (b->handler) {
+			fill_phis(b, b->handler, true, regs);
+		}
+		for (auto i : b->insts) {
+			reg_list uses, defs;
+			ir_operands(*co, i->ins, uses, defs);
+			for (size_t k = 0; k < uses.size(); ++k) {
+				i->uses[k].value = regs[uses[k].first];
+			}
+			if (i->op() == BC_FORITER) {
+				/* Exhausted, it does not write */
+				fill_phis(b, b->target, false, regs);
+			}
+			for (auto d : i->defs) {
+				regs[d->reg] = d;
+			}
+		}
+		if (b->next) {
+			fill_phis(b, b->next, false, regs);
+		}
+		if (b->target && (b->insts.empty() || b->insts.back()->op() != BC_FORITER)) {
+			fill_phis(b, b->target, false, regs);
+		}
+
+		for (auto c : children[b->id]) {
+			stack.emplace_back(c, regs);
+		}
+	}
+
+	for (auto b : order) {
+		for (auto i : b->insts) {
+			for (auto& u : i->uses) {
+				u.value->users.push_back(i);
+			}
+		}
+		for (auto phi : b->phis) {
+			for (auto v : phi->operands) {
+				v->phi_users.push_back(phi);
+			}
+		}
+	}
+}
+
+void ir_function::set_use(ir_inst* i, size_t k, ir_value* v) {
+	ir_value* old = i->uses[k].value;
+	auto it = std::find(old->users.begin(), old->users.end(), i);
+	old->users.erase(it);
+	i->uses[k].value = v;
+	v->users.push_back(i);
+}
+
+void ir_function::remove(ir_inst* i) {
+	for (auto& u : i->uses) {
+		auto& users = u.value->users;
+		users.erase(std::find(users.begin(), users.end(), i));
+	}
+	auto& in = i->block->insts;
+	in.erase(std::find(in.begin(), in.end(), i));
+	i->block = nullptr;
+}
+
+void ir_function::insert(ir_inst* i, ir_block* b, size_t pos) {
+	b->insts.insert(b->insts.begin() + pos, i);
+	i->block = b;
+	for (auto& u : i->uses) {
+		u.value->users.push_back(i);
+	}
+}
+
+void ir_function::rewrite(ir_inst* i, instruction ins, const std::vector<ir_use>& uses) {
+	for (auto& u : i->uses) {
+		auto& users = u.value->users;
+		users.erase(std::find(users.begin(), users.end(), i));
+	}
+	i->ins = ins;
+	i->uses = uses;
+	for (auto& u : i->uses) {
+		u.value->users.push_back(i);
+	}
+}
+
+void ir_function::replace_all_uses(ir_value* old, ir_value* v) {
+	std::vector<ir_inst*> users = old->users;
+	for (auto i : users) {
+		for (size_t k = 0; k < i->uses.size(); ++k) {
+			if (i->uses[k].value == old) {
+				set_use(i, k, v);
+			}
+		}
+	}
+	std::vector<ir_value*> phi_users = old->phi_users;
+	old->phi_users.clear();
+	for (auto phi : phi_users) {
+		for (auto& o : phi->operands) {
+			if (o == old) {
+				o = v;
+				v->phi_users.push_back(phi);
+			}
+		}
+	}
+}
+
+void ir_function::remove_edge(ir_block* from, ir_block* to, bool exceptional) {
+	for (size_t k = to->preds.size(); k-- > 0; ) {
+		if (to->preds[k].from == from && to->preds[k].exceptional == exceptional) {
+			to->preds.erase(to->preds.begin() + k);
+			for (auto phi : to->phis) {
+				ir_value* v = phi->operands[k];
+				auto& users = v->phi_users;
+				users.erase(std::find(users.begin(), users.end(), phi));
+				phi->operands.erase(phi->operands.begin() + k);
+			}
+			return;
+		}
+	}
+}
+
+void ir_function::clean_up() {
+	/* The blocks no path gets to */
+	std::vector<bool> reached(blocks.size(), false);
+	std::vector<ir_block*> work{ layout[0] };
+	reached[layout[0]->id] = true;
+	while (!work.empty()) {
+		ir_block* b = work.back();
+		work.pop_back();
+		for_successors(b, [&](ir_block* s, bool) {
+			if (!reached[s->id]) {
+				reached[s->id] = true;
+				work.push_back(s);
+			}
+		});
+	}
+	std::vector<ir_block*> kept;
+	for (auto b : layout) {
+		if (reached[b->id]) {
+			kept.push_back(b);
+			continue;
+		}
+		for_successors(b, [&](ir_block* s, bool exceptional) {
+			remove_edge(b, s, exceptional);
+		});
+		b->next = b->target = b->handler = nullptr;
+	}
+	for (auto b : layout) {
+		if (!reached[b->id]) {
+			while (!b->insts.empty()) {
+				remove(b->insts.back());
+			}
+			for (auto phi : b->phis) {
+				for (auto v : phi->operands) {
+					auto& users = v->phi_users;
+					users.erase(std::find(users.begin(), users.end(), phi));
+				}
+			}
+			b->phis.clear();
+		}
+	}
+	layout = kept;
+
+	/* The phis of one value, and of themselves */
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (auto b : layout) {
+			for (size_t k = 0; k < b->phis.size(); ) {
+				ir_value* phi = b->phis[k];
+				ir_value* same = nullptr;
+				bool trivial = true;
+				for (auto v : phi->operands) {
+					if (v == phi || v == same) {
+						continue;
+					}
+					if (same) {
+						trivial = false;
+						break;
+					}
+					same = v;
+				}
+				if (!trivial || !same) {
+					++k;
+					continue;
+				}
+				b->phis.erase(b->phis.begin() + k);
+				for (auto v : phi->operands) {
+					auto& users = v->phi_users;
+					users.erase(std::find(users.begin(), users.end(), phi));
+				}
+				replace_all_uses(phi, same);
+				changed = true;
+			}
+		}
+	}
+
+	analyze();
+}
+
+void ir_function::analyze() {
+	analyze_order();
+	/* Registers the passes added are unbound on entry too */
+	while (entry.size() < n_registers) {
+		entry.push_back(new_value(IV_ENTRY, static_cast<unsigned>(entry.size())));
+	}
+
+	/* A forward problem: the value of each register on entry, nullptr where two paths disagree */
+	static ir_value top_marker;
+	ir_value* const top = &top_marker;
+	for (auto b : order) {
+		b->entry_regs.assign(n_registers, top);
+	}
+
+	std::vector<ir_value*> in(n_registers);
+	std::vector<ir_value*> out(n_registers);
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (auto b : order) {
+			if (b == order[0]) {
+				in = entry;
+			} else {
+				std::fill(in.begin(), in.end(), top);
+				for (auto& p : b->preds) {
+					out = p.from->entry_regs;
+					if (!p.exceptional) {
+						for (auto i : p.from->insts) {
+							if (i->op() == BC_FORITER && p.from->target == b && p.from->next != b) {
+								break;
+							}
+							for (auto d : i->defs) {
+								out[d->reg] = d;
+							}
+						}
+					}
+					for (unsigned r = 0; r < n_registers; ++r) {
+						if (in[r] == top) {
+							in[r] = out[r];
+						} else if (out[r] != top && out[r] != in[r]) {
+							in[r] = nullptr;
+						}
+					}
+				}
+			}
+			for (auto phi : b->phis) {
+				in[phi->reg] = phi;
+			}
+			if (b->caught) {
+				in[b->caught->reg] = b->caught;
+			}
+			if (in != b->entry_regs) {
+				b->entry_regs = in;
+				changed = true;
+			}
+		}
+	}
+	for (auto b : order) {
+		std::replace(b->entry_regs.begin(), b->entry_regs.end(), top, static_cast<ir_value*>(nullptr));
+	}
+}
+
+bool ir_function::holds(const ir_value* w, const ir_inst* at) const {
+	const ir_block* b = at->block;
+	const ir_value* v = b->entry_regs[w->reg];
+	for (auto i : b->insts) {
+		if (i == at) {
+			break;
+		}
+		for (auto d : i->defs) {
+			if (d->reg == w->reg) {
+				v = d;
+			}
+		}
+	}
+	return v == w;
+}
+
+static void set_field(instruction& ins, ir_field f, unsigned reg) {
+	switch (f) {
+	case FIELD_A: ins = (ins & ~(0xffu << 8)) | reg << 8; break;
+	case FIELD_B: ins = (ins & ~(0xffu << 16)) | reg << 16; break;
+	case FIELD_C: ins = (ins & ~(0xffu << 24)) | reg << 24; break;
+	default: break;
+	}
+}
+
+bool ir_function::lower(code_object& out) const {
+	if (n_registers > MAX_REGISTERS) {
+		return false;
+	}
+
+	/* Registers the passes added and left unread go away */
+	std::vector<bool> used(n_registers, false);
+	for (auto b : layout) {
+		for (auto i : b->insts) {
+			for (auto& u : i->uses) {
+				used[u.value->reg] = true;
+			}
+			for (auto d : i->defs) {
+				used[d->reg] = true;
+			}
+		}
+	}
+	std::vector<unsigned> reg(n_registers, 0);
+	unsigned n_used = co->n_registers;
+	for (unsigned r = 0; r < n_registers; ++r) {
+		reg[r] = r < co->n_registers ? r : used[r] ? n_used++ : 0;
+	}
+
+	/* Where each block starts: its instructions, then a jump if it does not go on to the next one */
+	std::vector<uint32_t> start(blocks.size(), 0);
+	uint32_t pc = 0;
+	for (size_t k = 0; k < layout.size(); ++k) {
+		ir_block* b = layout[k];
+		start[b->id] = pc;
+		pc += static_cast<uint32_t>(b->insts.size());
+		if (b->next && (k + 1 == layout.size() || layout[k + 1] != b->next)) {
+			++pc;
+		}
+	}
+
+	std::vector<instruction> code;
+	std::vector<uint32_t> lines;
+	std::vector<exception_entry> handlers;
+	uint32_t line = out.first_line;
+
+	auto jump = [&](ir_block* to, instruction& ins) {
+		int64_t sbx = static_cast<int64_t>(start[to->id]) - static_cast<int64_t>(code.size()) - 1;
+		if (sbx < -SBX_BIAS || sbx > MAX_SBX) {
+			return false;
+		}
+		ins = (ins & 0xffffu) | static_cast<uint32_t>(sbx + SBX_BIAS) << 16;
+		return true;
+	};
+	auto emit = [&](ir_block* b, instruction ins) {
+		if (b->handler) {
+			uint32_t h = start[b->handler->id];
+			exception_entry* e = handlers.empty() ? nullptr : &handlers.back();
+			if (e && e->end == code.size() && e->handler == h && e->reg == b->handler_reg) {
+				++e->end;
+			} else {
+				handlers.push_back(exception_entry{ static_cast<uint32_t>(code.size()),
+						static_cast<uint32_t>(code.size()) + 1, h, b->handler_reg });
+			}
+		}
+		code.push_back(ins);
+		lines.push_back(line);
+	};
+
+	for (size_t k = 0; k < layout.size(); ++k) {
+		ir_block* b = layout[k];
+		for (auto i : b->insts) {
+			instruction ins = i->ins;
+			for (auto& u : i->uses) {
+				set_field(ins, u.field, reg[u.value->reg]);
+			}
+			if (i->def_field == FIELD_A) {
+				set_field(ins, FIELD_A, reg[i->defs[0]->reg]);
+			}
+			if ((i->op() == BC_JMPIF || i->op() == BC_JMPIFNOT || i->op() == BC_FORITER) && !jump(b->target, ins)) {
+				return false;
+			}
+			line = i->line;
+			emit(b, ins);
+		}
+		if (b->next && (k + 1 == layout.size() || layout[k + 1] != b->next)) {
+			instruction ins = encode_asbx(BC_JMP, 0, 0);
+			if (!jump(b->next, ins)) {
+				return false;
+			}
+			emit(b, ins);
+		}
+	}
+
+	out.code = code;
+	out.line_table = encode_line_table(lines, out.first_line);
+	out.exception_table = handlers;
+	out.n_registers = n_used;
+	return true;
+}
+
+static void dump_fact(const ir_fact& f, std::ostream& out) {
+	static const char* const names[] = { "undef", "int", "bool", "float", "str", "None", "any" };
+	out << names[f.kind];
+	if (f.kind == FACT_INT || f.kind == FACT_BOOL) {
+		if (f.lo == INT64_MIN && f.hi == INT64_MAX) {
+			return;
+		}
+		out << "[";
+		if (f.lo == INT64_MIN) {
+			out << "-inf";
+		} else {
+			out << f.lo;
+		}
+		out << ", ";
+		if (f.hi == INT64_MAX) {
+			out << "inf";
+		} else {
+			out << f.hi;
+		}
+		out << "]";
+	}
+}
+
+void ir_function::dump(std::ostream& out) const {
+	out << "ir " << co->name << " line " << co->first_line << " registers=" << n_registers << std::endl;
+
+	for (auto b : layout) {
+		out << "  b" << b->id;
+		if (!b->preds.empty()) {
+			out << " <-";
+			for (auto& p : b->preds) {
+				out << " " << (p.exceptional ? "!" : "") << "b" << p.from->id;
+			}
+		}
+		if (b->idom && b->idom != b) {
+			out << " idom b" << b->idom->id;
+		}
+		out << std::endl;
+
+		if (b == layout[0]) {
+			for (auto v : entry) {
+				if (!v->users.empty() || !v->phi_users.empty()) {
+					out << "    v" << v->id << ":r" << v->reg << " = entry" << std::endl;
+				}
+			}
+		}
+		if (b->caught) {
+			out << "    v" << b->caught->id << ":r" << b->caught->reg << " = caught" << std::endl;
+		}
+		for (auto phi : b->phis) {
+			out << "    v" << phi->id << ":r" << phi->reg << " = phi";
+			for (auto v : phi->operands) {
+				out << " v" << v->id;
+			}
+			out << std::endl;
+		}
+		for (auto i : b->insts) {
+			out << "    ";
+			for (size_t k = 0; k < i->defs.size(); ++k) {
+				out << (k ? ", " : "") << "v" << i->defs[k]->id << ":r" << i->defs[k]->reg;
+			}
+			out << (i->defs.empty() ? "" : " = ") << opcode_name(i->op());
+			for (auto& u : i->uses) {
+				out << " v" << u.value->id;
+			}
+			switch (i->op()) {
+			case BC_LOADK:
+				out << " ; " << constant_repr(*co, arg_bx(i->ins));
+				break;
+			case BC_LOADGLOBAL: case BC_STOREGLOBAL:
+				out << " ; " << co->names[arg_bx(i->ins)];
+				break;
+			default:
+				break;
+			}
+			if (i->defs.size() == 1 && i->defs[0]->fact.kind != FACT_ANY) {
+				out << " ; ";
+				dump_fact(i->defs[0]->fact, out);
+			}
+			out << std::endl;
+		}
+
+		out << "    ->";
+		if (b->next) {
+			out << " b" << b->next->id;
+		}
+		if (b->target) {
+			out << " b" << b->target->id;
+		}
+		if (b->handler) {
+			out << " !b" << b->handler->id;
+		}
+		out << std::endl;
+	}
+	out << std::endl;
+}
+
+} /* namespace arbusto */
@@ -0,0 +1,172 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef IR_H_
+#define IR_H_
+
+#include <vector>
+#include <memory>
+#include <ostream>
+#include <cstdint>
+
+#include "bytecode.h"
+
+namespace arbusto {
+
+/*
+ * The SSA form of the register code of one code object, which the passes
+ * of passes.h rewrite before it goes back to bytecode.
+ *
+ * Every value has a home register, the one its instruction writes, and
+ * the phis of a register only merge values of that register, so the
+ * phis need no code: lowering writes each operand as the register of its
+ * value. Passes keep that true. They may make an instruction read a value
+ * from another register that holds it at that point (see holds), or give
+ * a value a new register of its own when all its readers can be told.
+ *
+ * A block in the range of an exception handler has one instruction and
+ * an edge to the handler, which gets the registers as they were before
+ * that instruction.
+ */
+
+struct ir_block;
+struct ir_inst;
+
+enum ir_value_kind {
+	IV_ENTRY, /* a register on entry, a parameter or unbound */
+	IV_CATCH, /* the exception in the handler register of a handler block */
+	IV_PHI,
+	IV_INST
+};
+
+/* What the range analysis knows of a value */
+enum ir_fact_kind {
+	FACT_UNDEF, /* nothing yet */
+	FACT_INT, /* in [lo, hi], INT64_MIN and INT64_MAX mean unbounded */
+	FACT_BOOL, /* in [lo, hi] of 0 and 1 */
+	FACT_FLOAT,
+	FACT_STR,
+	FACT_NONE,
+	FACT_ANY
+};
+
+struct ir_fact {
+	ir_fact_kind kind{FACT_ANY};
+	int64_t lo{INT64_MIN};
+	int64_t hi{INT64_MAX};
+};
+
+struct ir_value {
+	ir_value_kind kind;
+	uint32_t id;
+	unsigned reg;
+	ir_inst* inst{nullptr}; /* IV_INST */
+	ir_block* block{nullptr}; /* IV_PHI and IV_CATCH */
+	std::vector<ir_value*> operands; /* IV_PHI, one for each edge of block->preds */
+	ir_fact fact;
+
+	/* Readers: the instructions, once for each operand, and the phis */
+	std::vector<ir_inst*> users;
+	std::vector<ir_value*> phi_users;
+};
+
+/* The field of the instruction word that names a register, or none when the register is implied */
+enum ir_field { FIELD_A, FIELD_B, FIELD_C, FIELD_FIXED };
+
+struct ir_use {
+	ir_value* value;
+	ir_field field;
+};
+
+struct ir_inst {
+	instruction ins; /* the register fields are written again on lowering */
+	uint32_t line;
+	ir_block* block{nullptr};
+	std::vector<ir_use> uses;
+	std::vector<ir_value*> defs;
+	ir_field def_field{FIELD_FIXED}; /* FIELD_A if it has one def and A names it */
+
+	opcode op() const { return op_of(ins); }
+};
+
+struct ir_edge {
+	ir_block* from;
+	bool exceptional;
+};
+
+struct ir_block {
+	uint32_t id;
+	std::vector<ir_inst*> insts; /* a JMPIF, JMPIFNOT, FORITER, RETURN or RAISE only as the last one */
+	ir_block* next{nullptr}; /* where it goes on, nullptr after a RETURN or a RAISE */
+	ir_block* target{nullptr}; /* of the JMPIF, JMPIFNOT or FORITER that ends it */
+	ir_block* handler{nullptr};
+	unsigned handler_reg{0};
+	std::vector<ir_edge> preds;
+	std::vector<ir_value*> phis;
+	ir_value* caught{nullptr}; /* IV_CATCH of a handler block */
+
+	/* Filled by ir_function::analyze */
+	uint32_t rpo{0};
+	ir_block* idom{nullptr};
+	std::vector<ir_value*> entry_regs; /* the value of each register on entry, nullptr if it depends on the path */
+};
+
+class ir_function {
+public:
+	/* Nothing in fn, and false, for code it does not handle */
+	static bool build(const code_object& co, ir_function& fn);
+
+	/* Write the code, lines and handlers of fn back to co; false, leaving co alone, if they do not fit */
+	bool lower(code_object& co) const;
+
+	void dump(std::ostream& out) const;
+
+	/* Reverse postorder, dominators and entry_regs, again after the blocks or the defs change */
+	void analyze();
+
+	/* Whether register w->reg holds w just before at, by entry_regs */
+	bool holds(const ir_value* w, const ir_inst* at) const;
+
+	bool dominates(const ir_block* a, const ir_block* b) const;
+
+	/* Edit, keeping the readers of every value */
+	void set_use(ir_inst* i, size_t k, ir_value* v);
+	void remove(ir_inst* i);
+	void insert(ir_inst* i, ir_block* b, size_t pos);
+	/* Make i another instruction with the same defs */
+	void rewrite(ir_inst* i, instruction ins, const std::vector<ir_use>& uses);
+	void replace_all_uses(ir_value* old, ir_value* v);
+	void remove_edge(ir_block* from, ir_block* to, bool exceptional);
+	ir_block* new_block();
+	ir_value* new_phi(ir_block* b, unsigned reg);
+	ir_inst* new_inst(instruction ins, uint32_t line);
+	/* Drop the blocks no path gets to and the phis that merge one value, then analyze */
+	void clean_up();
+
+	const code_object* co{nullptr};
+	unsigned n_registers{0};
+	std::vector<ir_block*> layout; /* the order blocks are lowered in, the entry first */
+	std::vector<ir_block*> order; /* reverse postorder, by analyze */
+	std::vector<ir_value*> entry; /* IV_ENTRY of each register */
+
+private:
+	ir_value* new_value(ir_value_kind kind, unsigned reg);
+	void analyze_order();
+	void place_phis();
+	void rename();
+
+	std::vector<std::unique_ptr<ir_block> > blocks;
+	std::vector<std::unique_ptr<ir_inst> > insts;
+	std::vector<std::unique_ptr<ir_value> > values;
+};
+
+/* The registers i reads and writes, with the fields that name them */
+void ir_operands(const code_object& co, instruction ins, std::vector<std::pair<unsigned, ir_field> >& uses,
+		std::vector<std::pair<unsigned, ir_field> >& defs);
+
+} /* namespace arbusto */
+
+#endif /* IR_H_ */
@@ -0,0 +1,416 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "literal.h"
+
+namespace arbusto {
+
+static int digit_value(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return 99;
+}
+
+/* digits in base, as a decimal string. Limbs of 10^9, least significant first. */
+static std::string to_decimal(const std::string& digits, int base) {
+	std::vector<uint32_t> limbs;
+
+	for (char c : digits) {
+		uint64_t carry = digit_value(c);
+		for (auto& limb : limbs) {
+			uint64_t v = uint64_t(limb) * base + carry;
+			limb = static_cast<uint32_t>(v % 1000000000);
+			carry = v / 1000000000;
+		}
+		if (carry) {
+			limbs.push_back(static_cast<uint32_t>(carry));
+		}
+	}
+
+	if (limbs.empty()) {
+		return "0";
+	}
+
+	std::string r = std::to_string(limbs.back());
+	for (size_t i = limbs.size() - 1; i-- > 0;) {
+		std::string part = std::to_string(limbs[i]);
+		r += std::string(9 - part.size(), '0') + part;
+	}
+	return r;
+}
+
+static literal decode_number(const std::string& text) {
+	literal r;
+	int base = 10;
+	size_t start = 0;
+
+	if (text.size() > 2 && text[0] == '0') {
+		char b = text[1] | 0x20;
+		base = b == 'x' ? 16 : b == 'o' ? 8 : b == 'b' ? 2 : 10;
+		start = base == 10 ? 0 : 2;
+	}
+
+	if (base == 10 && text.find_first_of(".eEjJ") != std::string::npos) {
+		bool imag = (text.back() | 0x20) == 'j';
+		r.kind = imag ? LIT_IMAG : LIT_FLOAT;
+		r.f = std::strtod(text.c_str(), nullptr);
+		return r;
+	}
+
+	uint64_t v = 0;
+	for (size_t i = start; i < text.size(); ++i) {
+		int d = digit_value(text[i]);
+
+		if (d >= base) {
+			throw std::runtime_error("invalid number " + text);
+		}
+		if (v > (uint64_t(INT64_MAX) - d) / base) {
+			r.kind = LIT_BIGINT;
+			r.s = to_decimal(text.substr(start), base);
+			return r;
+		}
+		v = v * base + d;
+	}
+
+	r.kind = LIT_INT;
+	r.i = static_cast<int64_t>(v);
+	return r;
+}
+
+static void append_utf8(std::string& out, uint32_t cp) {
+	if (cp < 0x80) {
+		out += static_cast<char>(cp);
+	} else if (cp < 0x800) {
+		out += static_cast<char>(0xc0 | (cp >> 6));
+		out += static_cast<char>(0x80 | (cp & 0x3f));
+	} else if (cp < 0x10000) {
+		out += static_cast<char>(0xe0 | (cp >> 12));
+		out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+		out += static_cast<char>(0x80 | (cp & 0x3f));
+	} else {
+		out += static_cast<char>(0xf0 | (cp >> 18));
+		out += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+		out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+		out += static_cast<char>(0x80 | (cp & 0x3f));
+	}
+}
+
+/* n hex digits at body[i], for \x, \u and \U */
+static uint32_t hex_escape(const std::string& body, size_t i, size_t n) {
+	uint32_t v = 0;
+
+	for (size_t k = 0; k < n; ++k) {
+		int d = i + k < body.size() ? digit_value(body[i + k]) : 99;
+		if (d >= 16) {
+			throw std::runtime_error("truncated \\" + body.substr(i - 1, 1) + " escape");
+		}
+		v = v * 16 + d;
+	}
+
+	return v;
+}
+
+static literal decode_string(const std::string& text) {
+	literal r;
+	bool raw = false;
+	size_t p = 0;
+
+	for (; p < text.size() && text[p] != '\'' && text[p] != '"'; ++p) {
+		char c = text[p] | 0x20;
+		raw = raw || c == 'r';
+		r.u_prefix = r.u_prefix || c == 'u';
+		if (c == 'b') {
+			r.kind = LIT_BYTES;
+		}
+	}
+
+	if (r.kind != LIT_BYTES) {
+		r.kind = LIT_STR;
+	}
+
+	size_t quote = text.compare(p, 3, std::string(3, text[p])) == 0 && text.size() - p >= 6 ? 3 : 1;
+	std::string body = text.substr(p + quote, text.size() - p - 2 * quote);
+
+	/* The source is read as is, the literal gets \n line breaks */
+	for (size_t i = 0; i < body.size(); ++i) {
+		if (body[i] == '\r') {
+			r.s += '\n';
+			if (i + 1 < body.size() && body[i + 1] == '\n') {
+				++i;
+			}
+			continue;
+		}
+
+		if (body[i] != '\\' || i + 1 == body.size()) {
+			r.s += body[i];
+			continue;
+		}
+
+		char c = body[++i];
+
+		if (raw) {
+			/* Both stay, the backslash only kept a quote from ending the string */
+			r.s += '\\';
+			if (c == '\r') {
+				--i;
+			} else {
+				r.s += c;
+			}
+			continue;
+		}
+
+		switch (c) {
+		case '\n': break;
+		case '\r': if (i + 1 < body.size() && body[i + 1] == '\n') { ++i; } break;
+		case '\\': r.s += '\\'; break;
+		case '\'': r.s += '\''; break;
+		case '"': r.s += '"'; break;
+		case 'a': r.s += '\a'; break;
+		case 'b': r.s += '\b'; break;
+		case 'f': r.s += '\f'; break;
+		case 'n': r.s += '\n'; break;
+		case 'r': r.s += '\r'; break;
+		case 't': r.s += '\t'; break;
+		case 'v': r.s += '\v'; break;
+		case 'x':
+			{
+				uint32_t v = hex_escape(body, i + 1, 2);
+				i += 2;
+				if (r.kind == LIT_BYTES) {
+					r.s += static_cast<char>(v);
+				} else {
+					append_utf8(r.s, v);
+				}
+			}
+			break;
+		case 'u':
+		case 'U':
+			if (r.kind == LIT_BYTES) {
+				r.s += '\\';
+				r.s += c;
+			} else {
+				size_t n = c == 'u' ? 4 : 8;
+				append_utf8(r.s, hex_escape(body, i + 1, n));
+				i += n;
+			}
+			break;
+		default:
+			if (c >= '0' && c <= '7') {
+				uint32_t v = 0;
+				size_t n = 0;
+				for (; n < 3 && i < body.size() && body[i] >= '0' && body[i] <= '7'; ++n, ++i) {
+					v = v * 8 + (body[i] - '0');
+				}
+				--i;
+				if (r.kind == LIT_BYTES) {
+					r.s += static_cast<char>(v);
+				} else {
+					append_utf8(r.s, v);
+				}
+			} else {
+				/* Not an escape, \N{...} included, the backslash stays */
+				r.s += '\\';
+				r.s += c;
+			}
+			break;
+		}
+	}
+
+	return r;
+}
+
+literal decode_literal(const token& t) {
+	if (t.tok == TOK_NUMBER) {
+		return decode_number(t.data);
+	}
+	if (t.tok == TOK_STRING) {
+		return decode_string(t.data);
+	}
+	throw std::runtime_error("not a literal: " + t.data);
+}
+
+const literal* literal_table::find(size_t token_index) const {
+	auto it = std::lower_bound(entries.begin(), entries.end(), token_index,
+			[](const std::pair<size_t, literal>& e, size_t i) { return e.first < i; });
+
+	return it != entries.end() && it->first == token_index ? &it->second : nullptr;
+}
+
+/*
+ * What unicodedata calls not printable, so repr escapes it: controls,
+ * format characters, separators other than the space, surrogates and
+ * private use. Unassigned code points are not known here.
+ */
+static bool is_printable(uint32_t cp) {
+	if (cp < 0x80) {
+		return cp >= 0x20 && cp < 0x7f;
+	}
+	return !(cp <= 0xa0 || cp == 0xad || (cp >= 0x600 && cp <= 0x605) || cp == 0x61c || cp == 0x6dd || cp == 0x70f
+			|| cp == 0x180e || cp == 0x1680 || (cp >= 0x2000 && cp <= 0x200f) || (cp >= 0x2028 && cp <= 0x202f)
+			|| (cp >= 0x205f && cp <= 0x206f) || cp == 0x3000 || (cp >= 0xd800 && cp <= 0xf8ff) || cp == 0xfeff
+			|| (cp >= 0xfff9 && cp <= 0xfffb) || cp == 0xfffe || cp == 0xffff || (cp >= 0xe0000 && cp <= 0xe007f)
+			|| cp >= 0xf0000);
+}
+
+static void write_hex(std::ostream& out, const char* prefix, uint32_t v, int digits) {
+	static const char hex[] = "0123456789abcdef";
+	out << prefix;
+	for (int i = digits - 1; i >= 0; --i) {
+		out << hex[(v >> (4 * i)) & 0xf];
+	}
+}
+
+/* The quote repr picks: ' unless the text has ' and no " */
+static char repr_quote(const char* s, size_t n) {
+	bool single = std::memchr(s, '\'', n) != nullptr;
+	bool dbl = std::memchr(s, '"', n) != nullptr;
+	return single && !dbl ? '"' : '\'';
+}
+
+void write_str_repr(std::ostream& out, const char* s, size_t n) {
+	char quote = repr_quote(s, n);
+	const unsigned char* p = reinterpret_cast<const unsigned char*>(s);
+
+	out << quote;
+
+	for (size_t i = 0; i < n;) {
+		uint32_t cp = p[i];
+		size_t len = 1;
+
+		if (cp >= 0xf0 && i + 3 < n) {
+			cp = ((cp & 0x07) << 18) | ((p[i + 1] & 0x3f) << 12) | ((p[i + 2] & 0x3f) << 6) | (p[i + 3] & 0x3f);
+			len = 4;
+		} else if (cp >= 0xe0 && i + 2 < n) {
+			cp = ((cp & 0x0f) << 12) | ((p[i + 1] & 0x3f) << 6) | (p[i + 2] & 0x3f);
+			len = 3;
+		} else if (cp >= 0xc0 && i + 1 < n) {
+			cp = ((cp & 0x1f) << 6) | (p[i + 1] & 0x3f);
+			len = 2;
+		}
+
+		if (cp == '\\' || cp == static_cast<uint32_t>(quote)) {
+			out << '\\' << static_cast<char>(cp);
+		} else if (cp == '\t') {
+			out << "\\t";
+		} else if (cp == '\n') {
+			out << "\\n";
+		} else if (cp == '\r') {
+			out << "\\r";
+		} else if (is_printable(cp)) {
+			out.write(s + i, len);
+		} else if (cp < 0x100) {
+			write_hex(out, "\\x", cp, 2);
+		} else if (cp < 0x10000) {
+			write_hex(out, "\\u", cp, 4);
+		} else {
+			write_hex(out, "\\U", cp, 8);
+		}
+
+		i += len;
+	}
+
+	out << quote;
+}
+
+void write_bytes_repr(std::ostream& out, const char* s, size_t n) {
+	char quote = repr_quote(s, n);
+
+	out << 'b' << quote;
+
+	for (size_t i = 0; i < n; ++i) {
+		unsigned char c = s[i];
+
+		if (c == '\\' || c == quote) {
+			out << '\\' << c;
+		} else if (c == '\t') {
+			out << "\\t";
+		} else if (c == '\n') {
+			out << "\\n";
+		} else if (c == '\r') {
+			out << "\\r";
+		} else if (c < 0x20 || c >= 0x7f) {
+			write_hex(out, "\\x", c, 2);
+		} else {
+			out << c;
+		}
+	}
+
+	out << quote;
+}
+
+/* Positional unless the exponent is below -4 or above 15 */
+std::string float_repr(double v, bool add_dot_0) {
+	if (std::isnan(v)) {
+		return "nan";
+	}
+	if (std::isinf(v)) {
+		return v < 0 ? "-inf" : "inf";
+	}
+	if (v == 0) {
+		std::string z = std::signbit(v) ? "-0" : "0";
+		return add_dot_0 ? z + ".0" : z;
+	}
+
+	char buf[40];
+	for (int precision = 1; precision <= 17; ++precision) {
+		std::snprintf(buf, sizeof(buf), "%.*e", precision - 1, v);
+		if (std::strtod(buf, nullptr) == v) {
+			break;
+		}
+	}
+
+	std::string text(buf);
+	std::string sign = text[0] == '-' ? "-" : "";
+	size_t e = text.find('e');
+	std::string digits;
+
+	for (size_t i = sign.size(); i < e; ++i) {
+		if (text[i] != '.') {
+			digits += text[i];
+		}
+	}
+	while (digits.size() > 1 && digits.back() == '0') {
+		digits.pop_back();
+	}
+
+	int exponent = std::atoi(text.c_str() + e + 1);
+	int decpt = exponent + 1;
+	int n = static_cast<int>(digits.size());
+
+	if (decpt > 16 || decpt < -3) {
+		std::string r = sign + digits.substr(0, 1);
+		if (n > 1) {
+			r += "." + digits.substr(1);
+		}
+		char exp[16];
+		std::snprintf(exp, sizeof(exp), "e%c%02d", exponent < 0 ? '-' : '+', std::abs(exponent));
+		return r + exp;
+	}
+
+	if (decpt <= 0) {
+		return sign + "0." + std::string(-decpt, '0') + digits;
+	}
+	if (decpt >= n) {
+		return sign + digits + std::string(decpt - n, '0') + (add_dot_0 ? ".0" : "");
+	}
+	return sign + digits.substr(0, decpt) + "." + digits.substr(decpt);
+}
+
+} /* namespace arbusto */
@@ -0,0 +1,74 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef LITERAL_H_
+#define LITERAL_H_
+
+#include <vector>
+#include <string>
+#include <ostream>
+#include <utility>
+#include <cstdint>
+
+#include "tokenizer.h"
+
+namespace arbusto {
+
+enum literal_kind {
+	LIT_INT, /* fits int64_t, in i */
+	LIT_BIGINT, /* does not, decimal digits in s */
+	LIT_FLOAT, /* in f */
+	LIT_IMAG, /* 2j, the imaginary part in f */
+	LIT_STR, /* UTF-8 in s */
+	LIT_BYTES /* in s */
+};
+
+/* The value of a NUMBER or STRING token */
+struct literal {
+	literal_kind kind{LIT_INT};
+	int64_t i{0};
+	double f{0};
+	std::string s;
+	bool u_prefix{false}; /* u'', kept for ast_dump */
+};
+
+/* Decode the text of a NUMBER or STRING token, throws std::runtime_error on a bad escape */
+literal decode_literal(const token& t);
+
+/* Python's repr of a str, s in UTF-8 */
+void write_str_repr(std::ostream& out, const char* s, size_t n);
+
+void write_bytes_repr(std::ostream& out, const char* s, size_t n);
+
+/*
+ * Python's repr of a float: the shortest digits that read back the same.
+ * Complex numbers are written without the ".0" of integral values.
+ */
+std::string float_repr(double v, bool add_dot_0 = true);
+
+/*
+ * The decoded NUMBER and STRING tokens of a file, by token index. The
+ * tokenizer fills it as it reads them, see tokenizer::literals.
+ */
+class literal_table {
+public:
+	void add(size_t token_index, const token& t) {
+		entries.emplace_back(token_index, decode_literal(t));
+	}
+
+	/* nullptr if token_index was not decoded */
+	const literal* find(size_t token_index) const;
+
+	size_t size() const { return entries.size(); }
+	void clear() { entries.clear(); }
+
+private:
+	std::vector<std::pair<size_t, literal> > entries; /* added in token order */
+};
+
+} /* namespace arbusto */
+
+#endif /* LITERAL_H_ */
@@ -0,0 +1,165 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef NATIVE_H_
+#define NATIVE_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+#include "interp.h"
+
+namespace arbusto {
+
+/*
+ * What the instructions of bytecode.h do, for the interpreter and for the
+ * C++ that aot.h writes, which is this header and calls of the runtime.
+ */
+
+[[noreturn]] void unbound_cell(const code_object& co, uint32_t d);
+[[noreturn]] void unbound_local(const code_object& co, uint32_t slot);
+[[noreturn]] void name_error(const char* name);
+
+/* As in except spec:, TypeError if spec is not an exception type or a tuple of them */
+bool exception_matches(const value& exc, const value& spec);
+
+/* raise v: an exception, or an exception type to call */
+[[noreturn]] void raise_value(const value& v);
+
+/* R[0], ... R[n-1] = the items of v, ValueError if there are not n */
+void unpack(value* R, const value& v, unsigned n);
+
+/* BC_RESERVE */
+void reserve(const value& container, const value& items);
+
+value build_set(const value* items, unsigned n);
+/* n pairs of a key and its value */
+value build_dict(const value* items, unsigned n);
+
+/* R[a] = R[a](...) of a BC_CALL with B and C */
+inline value call_at(value* R, unsigned a, unsigned n, unsigned n_kw) {
+	if (n_kw) {
+		keyword_args kw = { R + a + 1 + n, as<tuple_object>(R[a + 1 + n + n_kw])->items.data(), n_kw };
+		return call(R[a], R + a + 1, n, &kw);
+	}
+	return call(R[a], R + a + 1, n);
+}
+
+/* iter_next, a range inline */
+inline bool for_next(const value& it, value& out) {
+	if (is_type(it, iterator_type) && as<iterator_object>(it)->kind == ITER_RANGE) {
+		iterator_object* r = as<iterator_object>(it);
+		if (r->step > 0 ? r->i >= r->stop : r->i <= r->stop) {
+			return false;
+		}
+		out = make_int(r->i);
+		r->i += r->step;
+		return true;
+	}
+	return iter_next(it, out);
+}
+
+inline bool truth(const value& v) {
+	return v.is_bool() ? v.bool_value() : truthy(v);
+}
+
+/* x op y inline for two small ints or two floats, by binary otherwise */
+template <binary_op OP>
+inline value arith(const value& x, const value& y) {
+	if (x.is_small_int() && y.is_small_int()) {
+		int64_t i = x.small_int_value();
+		int64_t j = y.small_int_value();
+		int64_t r;
+		switch (OP) {
+		case BIN_ADD: return make_int(i + j);
+		case BIN_SUB: return make_int(i - j);
+		case BIN_MUL:
+			if (!__builtin_mul_overflow(i, j, &r)) {
+				return make_int(r);
+			}
+			break;
+		default: break;
+		}
+	} else if (x.is_real() && y.is_real()) {
+		switch (OP) {
+		case BIN_ADD: return make_float(x.real_value() + y.real_value());
+		case BIN_SUB: return make_float(x.real_value() - y.real_value());
+		case BIN_MUL: return make_float(x.real_value() * y.real_value());
+		default: break;
+		}
+	}
+	return binary(OP, x, y);
+}
+
+/* The same for comparisons */
+template <compare_op OP>
+inline bool relation(const value& x, const value& y) {
+	if (x.is_small_int() && y.is_small_int()) {
+		int64_t i = x.small_int_value();
+		int64_t j = y.small_int_value();
+		switch (OP) {
+		case CMP_OP_LT: return i < j;
+		case CMP_OP_LE: return i <= j;
+		case CMP_OP_EQ: return i == j;
+		case CMP_OP_NE: return i != j;
+		case CMP_OP_GT: return i > j;
+		case CMP_OP_GE: return i >= j;
+		}
+	} else if (x.is_real() && y.is_real()) {
+		double i = x.real_value();
+		double j = y.real_value();
+		switch (OP) {
+		case CMP_OP_LT: return i < j;
+		case CMP_OP_LE: return i <= j;
+		case CMP_OP_EQ: return i == j;
+		case CMP_OP_NE: return i != j;
+		case CMP_OP_GT: return i > j;
+		case CMP_OP_GE: return i >= j;
+		}
+	}
+	return compare(OP, x, y);
+}
+
+/* i // j and i % j of two small ints, false for a j of 0 or a quotient that is not one */
+inline bool floordiv_small(int64_t i, int64_t j, int64_t& q) {
+	if (j == 0) {
+		return false;
+	}
+	q = i / j;
+	if (i % j != 0 && (i < 0) != (j < 0)) {
+		--q;
+	}
+	return value::fits_small_int(q);
+}
+
+inline bool mod_small(int64_t i, int64_t j, int64_t& r) {
+	if (j == 0) {
+		return false;
+	}
+	r = i % j;
+	if (r != 0 && (r < 0) != (j < 0)) {
+		r += j;
+	}
+	return true;
+}
+
+/* A constant of a code object aot.h writes, f as its bits */
+inline constant native_constant(constant_kind kind, int64_t i, uint64_t f, const std::string& s,
+		const std::vector<uint32_t>& items) {
+	constant k;
+	k.kind = kind;
+	k.i = i;
+	std::memcpy(&k.f, &f, sizeof(k.f));
+	k.s = s;
+	k.items = items;
+	return k;
+}
+
+} /* namespace arbusto */
+
+#endif /* NATIVE_H_ */
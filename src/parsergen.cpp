@@ -10,14 +10,42 @@
 #include <set>
 #include <deque>
 #include <stdexcept>
+#include <fstream>
+#include <algorithm>
 
 #include "parsergen.h"
+#include "tokenizer.h"
+#include "parsersession.h"
+#include "astfile.h"
 
 namespace arbusto {
 
+/* One rule of the form: X: Y (op Y)* */
+struct binop_level {
+    std::string rule;
+    std::string op_rule; /* comp_op, or empty when the operators are literals in the rule */
+    std::vector<std::vector<std::string> > ops;
+};
+
+/* A stack of binop levels, loosest first, over a non binop operand rule */
+struct binop_chain {
+    std::vector<binop_level> levels;
+    std::string operand;
+};
+
 struct parser_cache {
     std::map<grammar_node*, size_t > node_code;
     std::map<grammar_node*, std::set<std::string> > FIRST;
+
+    /* Grammar terminal, as written in the Grammar ('def', NAME), to its token kind */
+    std::map<std::string, int> terminal_kind;
+    std::vector<std::string> keywords; /* sorted, keyword i has kind TOK_N_TOKENS + i */
+
+    std::vector<binop_chain> binop_chains;
+    std::map<std::string, std::pair<size_t, size_t> > binop_rules; /* rule -> (chain, level) */
+
+    /* Repetitions of a recovery rule -> the kinds that may follow them */
+    std::map<grammar_node*, std::vector<int> > recovery_sync;
 };
 
 bool is_name_terminal(const std::string& name, grammar_parser& G) {
@@ -135,6 +163,315 @@ std::set<std::string> get_FIRST_set(grammar_node* node, grammar_parser& G, parse
     return S;
 }
 
+class terminal_collector : public grammar_node_visitor {
+public:
+    terminal_collector(grammar_parser& G_, std::set<std::string>& T_) : G(G_), T(T_) {}
+
+    virtual void visit_string(grammar_node_string* node) {
+        if (is_name_terminal(node->value, G)) {
+            T.insert(node->value);
+        }
+    }
+
+    grammar_parser& G;
+    std::set<std::string>& T;
+};
+
+/*
+ * Give every terminal of the grammar an integer kind at generation time:
+ * named terminals (NAME, NEWLINE, INDENT) and operators ('+', '->') get
+ * the token_t the tokenizer produces for them, quoted names ('def', 'in')
+ * get a keyword id after TOK_N_TOKENS.
+ */
+void build_terminal_kinds(grammar_parser& G, parser_cache& C) {
+    std::set<std::string> T;
+    terminal_collector W(G, T);
+    tokenizer tk;
+
+    for (auto it = G.rules.begin(); it != G.rules.end(); ++it) {
+        W.visit(it->second.get());
+    }
+
+    for (auto& name : T) {
+        if (!G.is_token_T(name)) {
+            int kind = TOK_N_TOKENS;
+
+            for (int t = 0; t < TOK_N_TOKENS; ++t) {
+                if (tokenizer::token2str(static_cast<token_t>(t)) == "TOK_" + name) {
+                    kind = t;
+                }
+            }
+
+            if (kind == TOK_N_TOKENS) {
+                throw std::runtime_error("unknown terminal " + name);
+            }
+
+            C.terminal_kind[name] = kind;
+            continue;
+        }
+
+        auto text = name.substr(1, name.size() - 2);
+
+        if (text.size() && G.valid_name_char(text[0])) {
+            C.keywords.push_back(text);
+        } else {
+            size_t len = 0;
+            auto t = tk.get_next_operator(text, 0, len);
+
+            if (t == TOK_N_TOKENS || len != text.size()) {
+                throw std::runtime_error("unknown operator " + name);
+            }
+
+            C.terminal_kind[name] = t;
+        }
+    }
+
+    /* std::set iteration order, already sorted */
+    for (size_t i = 0; i < C.keywords.size(); ++i) {
+        C.terminal_kind["'" + C.keywords[i] + "'"] = TOK_N_TOKENS + i;
+    }
+}
+
+/* True for X or (A | X | B) with X a recovery rule */
+static bool is_recovery_point(grammar_node* node, const parser_options& opts) {
+    if (node->type == GNODE_STRING) {
+        return opts.recovery_rules.count(static_cast<grammar_node_string*>(node)->value) > 0;
+    }
+
+    if (node->type == GNODE_RHS) {
+        for (auto& e : static_cast<grammar_node_rhs*>(node)->choices) {
+            if (e->type == GNODE_STRING && is_recovery_point(e.get(), opts)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+class recovery_point_finder : public grammar_node_visitor {
+public:
+    recovery_point_finder(grammar_parser& G_, parser_cache& C_, const parser_options& O_) : G(G_), C(C_), O(O_) {}
+
+    /* The repetitions directly in a sequence, their FOLLOW is the FIRST of the rest of it */
+    virtual void visit_sequence(grammar_node_sequence* node) {
+        auto& childs = node->childs;
+
+        for (size_t i = 0; i < childs.size(); ++i) {
+            if (childs[i]->type != GNODE_REPETITION
+                    || !is_recovery_point(static_cast<grammar_node_repetition*>(childs[i].get())->child.get(), O)) {
+                continue;
+            }
+
+            std::set<std::string> follow;
+
+            for (size_t j = i + 1; j < childs.size(); ++j) {
+                auto T = get_FIRST_set(childs[j].get(), G, C);
+                bool eps = T.erase("EPS") > 0;
+
+                follow.insert(T.begin(), T.end());
+                if (!eps) {
+                    break;
+                }
+            }
+
+            auto& sync = C.recovery_sync[childs[i].get()];
+            for (auto& name : follow) {
+                sync.push_back(C.terminal_kind[name]);
+            }
+        }
+
+        grammar_node_visitor::visit_sequence(node);
+    }
+
+    grammar_parser& G;
+    parser_cache& C;
+    const parser_options& O;
+};
+
+/*
+ * Where error recovery goes: the repetitions of a recovery rule, like
+ * (NEWLINE | stmt)* ENDMARKER and stmt+ DEDENT. Skipping stops at the
+ * tokens that may follow them, ENDMARKER and DEDENT in those.
+ */
+void build_recovery_points(grammar_parser& G, parser_cache& C, const parser_options& opts) {
+    recovery_point_finder W(G, C, opts);
+
+    for (auto it = G.rules.begin(); it != G.rules.end(); ++it) {
+        W.visit(it->second.get());
+    }
+}
+
+std::string terminal_kind_name(int kind, parser_cache& C) {
+    if (kind < TOK_N_TOKENS) {
+        return tokenizer::token2str(static_cast<token_t>(kind));
+    }
+
+    return "KW_" + C.keywords[kind - TOK_N_TOKENS];
+}
+
+/* Collect the alternatives of node when each one is a run of literal terminals */
+bool get_terminal_choices(grammar_node* node, grammar_parser& G, std::vector<std::vector<std::string> >& ops) {
+    switch (node->type) {
+    case GNODE_STRING:
+        {
+            grammar_node_string* nodestr = static_cast<grammar_node_string*>(node);
+
+            if (!G.is_token_T(nodestr->value)) {
+                return false;
+            }
+
+            ops.push_back(std::vector<std::string>{nodestr->value.substr(1, nodestr->value.size() - 2)});
+        }
+        return true;
+
+    case GNODE_SEQUENCE:
+        {
+            grammar_node_sequence* nodeseq = static_cast<grammar_node_sequence*>(node);
+            std::vector<std::string> op;
+
+            for (auto& e : nodeseq->childs) {
+                if (e->type != GNODE_STRING) {
+                    return false;
+                }
+
+                auto& value = static_cast<grammar_node_string*>(e.get())->value;
+
+                if (!G.is_token_T(value)) {
+                    return false;
+                }
+
+                op.push_back(value.substr(1, value.size() - 2));
+            }
+
+            if (op.size() > 2) {
+                return false;
+            }
+
+            ops.push_back(op);
+        }
+        return true;
+
+    case GNODE_RHS:
+        {
+            grammar_node_rhs* noderhs = static_cast<grammar_node_rhs*>(node);
+
+            for (auto& e : noderhs->choices) {
+                if (e->type == GNODE_RHS || !get_terminal_choices(e.get(), G, ops)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+/* Match X: Y (op Y)* where op is a literal, a choice of literals or a rule of those */
+bool match_binop_rule(grammar_node_rule* rule, grammar_parser& G, binop_level& L, std::string& operand) {
+    if (rule->rhs->type != GNODE_SEQUENCE) {
+        return false;
+    }
+
+    grammar_node_sequence* seq = static_cast<grammar_node_sequence*>(rule->rhs.get());
+
+    if (seq->childs.size() != 2 || seq->childs[0]->type != GNODE_STRING || seq->childs[1]->type != GNODE_REPETITION) {
+        return false;
+    }
+
+    operand = static_cast<grammar_node_string*>(seq->childs[0].get())->value;
+
+    if (G.rules.find(operand) == G.rules.end()) {
+        return false;
+    }
+
+    grammar_node_repetition* rep = static_cast<grammar_node_repetition*>(seq->childs[1].get());
+
+    if (!rep->star || rep->child->type != GNODE_SEQUENCE) {
+        return false;
+    }
+
+    grammar_node_sequence* tail = static_cast<grammar_node_sequence*>(rep->child.get());
+
+    if (tail->childs.size() != 2 || tail->childs[1]->type != GNODE_STRING
+            || static_cast<grammar_node_string*>(tail->childs[1].get())->value != operand) {
+        return false;
+    }
+
+    grammar_node* op = tail->childs[0].get();
+
+    L.rule = rule->rule_name;
+    L.op_rule.clear();
+    L.ops.clear();
+
+    if (op->type == GNODE_STRING && !G.is_token_T(static_cast<grammar_node_string*>(op)->value)) {
+        auto it = G.rules.find(static_cast<grammar_node_string*>(op)->value);
+
+        if (it == G.rules.end()) {
+            return false;
+        }
+
+        L.op_rule = it->first;
+        op = static_cast<grammar_node_rule*>(it->second.get())->rhs.get();
+    }
+
+    if (!get_terminal_choices(op, G, L.ops)) {
+        return false;
+    }
+
+    /* X (',' X)* is a list, not an operator */
+    for (auto& e : L.ops) {
+        if (e[0] == ",") {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void build_binop_chains(grammar_parser& G, parser_cache& C) {
+    std::map<std::string, binop_level> levels;
+    std::map<std::string, std::string> operand_of;
+    std::set<std::string> used_as_operand;
+
+    for (auto it = G.rules.begin(); it != G.rules.end(); ++it) {
+        binop_level L;
+        std::string operand;
+
+        if (match_binop_rule(static_cast<grammar_node_rule*>(it->second.get()), G, L, operand)) {
+            levels[it->first] = L;
+            operand_of[it->first] = operand;
+        }
+    }
+
+    for (auto& e : operand_of) {
+        if (levels.find(e.second) != levels.end()) {
+            used_as_operand.insert(e.second);
+        }
+    }
+
+    for (auto& e : levels) {
+        if (used_as_operand.find(e.first) != used_as_operand.end()) {
+            continue;
+        }
+
+        /* e is the top of a chain, walk it down to the operand */
+        binop_chain chain;
+        std::string name = e.first;
+
+        while (levels.find(name) != levels.end()) {
+            C.binop_rules[name] = std::make_pair(C.binop_chains.size(), chain.levels.size());
+            chain.levels.push_back(levels[name]);
+            name = operand_of[name];
+        }
+
+        chain.operand = name;
+        C.binop_chains.push_back(chain);
+    }
+}
+
 class node_code_builder : public grammar_node_visitor {
 public:
     node_code_builder(std::deque<grammar_node*> &Q_) : Q(Q_) {}
@@ -151,7 +488,7 @@ void node_code_builder::visit(grammar_node* node) {
 
 class parser_generator : public grammar_node_visitor {
 public:
-    parser_generator(grammar_parser& G_, parser_cache& C_) : G(G_), C(C_) {}
+    parser_generator(grammar_parser& G_, parser_cache& C_, const parser_options& O_) : G(G_), C(C_), O(O_) {}
     virtual ~parser_generator() {}
 
     virtual void visit_string(grammar_node_string*);
@@ -162,39 +499,129 @@ public:
     virtual void visit_rule(grammar_node_rule*);
 
     void write_header(grammar_node* node);
+    void write_footer(grammar_node* node);
+    void begin_function(const std::string& name);
+    void end_function(const std::string& name, const std::string& rule, const std::string& repr);
+    void write_profile_table();
+    void write_includes();
+    void write_declarations();
+    void write_names();
+    void write_lazy_suite();
+    void write_binop_chain(const binop_chain& chain);
+    std::string combinator(grammar_node* node);
+    void write_combinators();
 
     grammar_parser&   G;
     parser_cache&     C;
+    const parser_options& O;
     std::stringstream S;
+    std::string current_rule;
+    std::vector<std::string> profiled; /* initializers of the profile_counters entries */
 };
 
+/* As a C string literal */
+static std::string c_string(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+/* When profiling, the code goes in parse_N_body and parse_N is a counting wrapper */
+void parser_generator::begin_function(const std::string& name) {
+    if (O.profile) {
+        S << "static bool parse_" << name << "_body(parser_session& P) {" << std::endl;
+    } else {
+        S << "bool parse_" << name << "(parser_session& P) {" << std::endl;
+    }
+}
+
+void parser_generator::end_function(const std::string& name, const std::string& rule, const std::string& repr) {
+    S << "}" << std::endl;
+    S << std::endl;
+
+    if (!O.profile) {
+        return;
+    }
+
+    size_t id = profiled.size();
+    profiled.push_back("{ " + c_string(name) + ", " + c_string(rule) + ", " + c_string(repr) + ", 0, 0, 0, 0, 0 }");
+
+    /* profile_high: the farthest a successful call got, since the caller's start */
+    S << "bool parse_" << name << "(parser_session& P) {" << std::endl;
+    S << " parser_profile_entry& e = profile_counters[" << id << "];" << std::endl;
+    S << " size_t start = P.pos, outer = profile_high;" << std::endl;
+    S << " profile_high = start;" << std::endl;
+    if (O.profile_cycles) {
+        S << " uint64_t t0 = profile_clock();" << std::endl;
+    }
+    S << " bool r = parse_" << name << "_body(P);" << std::endl;
+    if (O.profile_cycles) {
+        S << " e.cycles += profile_clock() - t0;" << std::endl;
+    }
+    S << " ++e.calls;" << std::endl;
+    S << " if (r) { ++e.successes; if (P.pos > profile_high) { profile_high = P.pos; } }" << std::endl;
+    S << " else { ++e.failures; e.backtracked += profile_high - start; }" << std::endl;
+    S << " if (outer > profile_high) { profile_high = outer; }" << std::endl;
+    S << " return r;" << std::endl;
+    S << "}" << std::endl;
+    S << std::endl;
+}
+
 void parser_generator::write_header(grammar_node* node) {
-    S << "bool parse_" << C.node_code[node] << "(std::vector<astnode*>& res) { " << std::endl;
+    begin_function(std::to_string(C.node_code[node]));
     S << " /* " << node->repr() << " */" << std::endl;
 }
 
+void parser_generator::write_footer(grammar_node* node) {
+    end_function(std::to_string(C.node_code[node]), current_rule, node->repr());
+}
+
+/* The counters used by the wrappers, and the report written at exit */
+void parser_generator::write_profile_table() {
+    S << "size_t profile_high = 0;" << std::endl;
+    S << "parser_profile_entry profile_counters[" << profiled.size() << "] = {" << std::endl;
+    for (auto& e : profiled) {
+        S << " " << e << "," << std::endl;
+    }
+    S << "};" << std::endl;
+    S << std::endl;
+
+    S << "static struct profile_reporter {" << std::endl;
+    S << " ~profile_reporter() { write_parser_profile(std::cerr, profile_counters, " << profiled.size() << ", "
+      << (O.profile_cycles ? "true" : "false") << "); }" << std::endl;
+    S << "} profile_reporter_;" << std::endl;
+    S << std::endl;
+}
+
+/*
+ * Every emitted function follows the same contract: on success the matched
+ * children are left on top of P.stack, on failure P.pos and P.stack are
+ * exactly as they were on entry. That way callers only need a mark when
+ * they have to undo the work of a previous successful child.
+ */
+
 void parser_generator::visit_string(grammar_node_string* node) {
 	/* if the string is quoted it is a literal text, otherwise a rule */
 
     write_header(node);
 
-    /* FIXME: Use smart pointers for astnode, memory leaks for backtracking ! */
-    
-    if (G.is_token_T(node->value)) {
-        /* chew a token */
-        S << " auto token = chew_next_token(\"" << node->value << "\");" << std::endl;
-        S << " if (token) { res.push_back(new astnode(NODE_TYPE_STRING, token)); }" << std::endl;
-        S << " else { return false; }" << std::endl;
+    if (is_name_terminal(node->value, G)) {
+        /* chew a token, 'def' or NAME */
+        S << " return P.chew_next_token(" << terminal_kind_name(C.terminal_kind[node->value], C) << ");" << std::endl;
+    } else if (node->value == "suite" && O.lazy_rules.count(current_rule)) {
+        /* a function body, only needed when someone looks into it */
+        S << " return P.lazy_bodies ? P.skip_suite() : parse_suite(P);" << std::endl;
     } else {
         /* chew a rule */
-        S << " astnode* n = parse_" << node->value << "();" << std::endl;
-        S << " if (n) { res.push_back(n); }" << std::endl;
-        S << " else { return false; }" << std::endl;
+        S << " return parse_" << node->value << "(P);" << std::endl;
     }
 
-    S << " return true;" << std::endl;
-    S << "}" << std::endl;
-    S << std::endl;
+    write_footer(node);
 
     grammar_node_visitor::visit_string(node);
 }
@@ -202,44 +629,48 @@ void parser_generator::visit_string(grammar_node_string* node) {
 void parser_generator::visit_optional(grammar_node_optional* node) {
     write_header(node);
 
-    S << " std::vector<astnode*> tmpresarg;" << std::endl;
-    S << " bool n;" << std::endl;
-    S << " n = parse_" << C.node_code[node->child.get()] << "(tmpresarg);" << std::endl;
-    S << " if (n) { res.insert(res.end(), tmpresarg.begin(), tmpresarg.end()); }" << std::endl;
+    S << " parse_" << C.node_code[node->child.get()] << "(P);" << std::endl;
     S << " return true;" << std::endl;
-    S << "}" << std::endl;
-    S << std::endl;
+    write_footer(node);
 
     grammar_node_visitor::visit_optional(node);
 }
 
 void parser_generator::visit_repetition(grammar_node_repetition* node) {
+    auto sync = C.recovery_sync.find(node);
+
+    if (sync != C.recovery_sync.end()) {
+        S << "static const int recovery_sync_" << C.node_code[node] << "[] = {";
+        for (auto kind : sync->second) {
+            S << " " << terminal_kind_name(kind, C) << ",";
+        }
+        S << " -1 };" << std::endl;
+        S << std::endl;
+    }
+
     write_header(node);
 
-    S << " std::vector<astnode*> tmpres;" << std::endl;
-    S << " std::vector<astnode*> tmpresarg;" << std::endl;
-    S << " bool n;" << std::endl;
     S << " int iterations = 0;" << std::endl;
-
     S << " for (;;) {" << std::endl;
-    S << "  tmpresarg.clear();" << std::endl;
-    S << "  n = parse_" << C.node_code[node->child.get()] << "(tmpresarg);" << std::endl;
-    S << "  if (n) { tmpres.insert(tmpres.end(), tmpresarg.begin(), tmpresarg.end()); }" << std::endl;
-    S << "  else { break; }" << std::endl;
+    S << "  size_t p = P.pos;" << std::endl;
+    if (sync != C.recovery_sync.end()) {
+        S << "  if (!parse_" << C.node_code[node->child.get()] << "(P) && !(P.recovery && P.recover_statement(recovery_sync_"
+          << C.node_code[node] << "))) { break; }" << std::endl;
+    } else {
+        S << "  if (!parse_" << C.node_code[node->child.get()] << "(P)) { break; }" << std::endl;
+    }
     S << "  ++iterations;" << std::endl;
+    S << "  if (P.pos == p) { break; }" << std::endl;
     S << " }" << std::endl;
 
     if (node->star) {
         S << " (void)iterations;" << std::endl;
-        S << " res.insert(res.end(), tmpres.begin(), tmpres.end());" << std::endl;
         S << " return true;" << std::endl;
     } else {
-        S << " if (iterations > 0) { res.insert(res.end(), tmpres.begin(), tmpres.end()); return true; }" << std::endl;
-        S << " else { return false; }" << std::endl;
+        S << " return iterations > 0;" << std::endl;
     }
 
-    S << "}" << std::endl;
-    S << std::endl;
+    write_footer(node);
 
     grammar_node_visitor::visit_repetition(node);
 }
@@ -247,22 +678,18 @@ void parser_generator::visit_repetition(grammar_node_repetition* node) {
 void parser_generator::visit_sequence(grammar_node_sequence* node) {
     write_header(node);
 
-    S << " std::vector<astnode*> tmpres;" << std::endl;
-    S << " std::vector<astnode*> tmpresarg;" << std::endl;
-    S << " bool n;" << std::endl;
-    //S << " tmpres.reserve(" << node->childs.size() << ");" << std::endl;
+    S << " parser_mark m = P.mark();" << std::endl;
 
-    for (auto& e : node->childs) {
-        S << " tmpresarg.clear();" << std::endl;
-        S << " n = parse_" << C.node_code[e.get()] << "(tmpresarg);" << std::endl;
-        S << " if (n) { tmpres.insert(tmpres.end(), tmpresarg.begin(), tmpresarg.end()); }" << std::endl;
-        S << " else { return false; }" << std::endl;
+    for (size_t i = 0; i < node->childs.size(); ++i) {
+        S << " if (!parse_" << C.node_code[node->childs[i].get()] << "(P)) { ";
+        if (i > 0) {
+            S << "P.reset(m); ";
+        }
+        S << "return false; }" << std::endl;
     }
 
-    S << " res.insert(res.end(), tmpres.begin(), tmpres.end());" << std::endl;
     S << " return true;" << std::endl;
-    S << "}" << std::endl;
-    S << std::endl;
+    write_footer(node);
 
     grammar_node_visitor::visit_sequence(node);
 }
@@ -270,36 +697,395 @@ void parser_generator::visit_sequence(grammar_node_sequence* node) {
 void parser_generator::visit_rhs(grammar_node_rhs* node) {
     write_header(node);
 
-    /* FIXME */
+    /* Ordered choice, the first alternative that matches wins */
+    for (auto& e : node->choices) {
+        S << " if (parse_" << C.node_code[e.get()] << "(P)) { return true; }" << std::endl;
+    }
 
     S << " return false;" << std::endl;
+    write_footer(node);
+
+    grammar_node_visitor::visit_rhs(node);
+}
+
+/*
+ * Precedence climbing over a binop chain. Each level gets a flat node, as
+ * the X: Y (op Y)* rule would build, but only when it has an operator:
+ * parsing a + b is one trip through the loop instead of a descent through
+ * every level between comparison and factor.
+ */
+void parser_generator::write_binop_chain(const binop_chain& chain) {
+    auto& top = chain.levels.front().rule;
+
+    struct binop_row {
+        int level;
+        int second;
+        bool alone;
+    };
+
+    std::vector<binop_row> rows(TOK_N_TOKENS + C.keywords.size(), binop_row{-1, -1, false});
+
+    for (size_t level = 0; level < chain.levels.size(); ++level) {
+        for (auto& op : chain.levels[level].ops) {
+            /* 'is' and 'is' 'not' share the row of 'is' */
+            auto& row = rows[C.terminal_kind["'" + op[0] + "'"]];
+
+            row.level = level;
+            if (op.size() == 2) {
+                row.second = C.terminal_kind["'" + op[1] + "'"];
+            } else {
+                row.alone = true;
+            }
+        }
+    }
+
+    S << "/* Binding powers for the " << top << " chain by token kind, level 0 is the loosest */" << std::endl;
+    S << "static const binop_entry binops_" << top << "[N_TOKEN_KINDS] = {" << std::endl;
+
+    for (size_t kind = 0; kind < rows.size(); ++kind) {
+        auto& row = rows[kind];
+        S << " { " << row.level << ", " << row.second << ", " << (row.alone ? "true" : "false") << " }, /* "
+          << terminal_kind_name(kind, C) << " */" << std::endl;
+    }
+
+    S << "};" << std::endl;
+    S << std::endl;
+
+    S << "static const int binop_nodes_" << top << "[] = {";
+    for (size_t level = 0; level < chain.levels.size(); ++level) {
+        S << (level ? ", " : " ") << "NODE_RULE_" << chain.levels[level].rule;
+    }
+    S << " };" << std::endl;
+    S << std::endl;
+
+    S << "bool parse_climb_" << top << "(parser_session& P, int min_level) {" << std::endl;
+    S << " parser_mark m = P.mark();" << std::endl;
+    S << " if (!parse_" << chain.operand << "(P)) { return false; }" << std::endl;
+    S << " for (;;) {" << std::endl;
+    S << "  size_t ntoks = 0;" << std::endl;
+    S << "  int level = P.peek_binop(binops_" << top << ", ntoks);" << std::endl;
+    S << "  if (level < min_level) { break; }" << std::endl;
+    S << "  int count = 0;" << std::endl;
+    S << "  while (P.peek_binop(binops_" << top << ", ntoks) == level) {" << std::endl;
+    S << "   parser_mark op = P.mark();" << std::endl;
+    S << "   for (size_t i = 0; i < ntoks; ++i) { P.chew_token(); }" << std::endl;
+
+    bool any_op_rule = false;
+    for (auto& L : chain.levels) {
+        any_op_rule = any_op_rule || !L.op_rule.empty();
+    }
+
+    if (any_op_rule) {
+        for (size_t level = 0; level < chain.levels.size(); ++level) {
+            auto& L = chain.levels[level];
+
+            if (L.op_rule.empty()) {
+                continue;
+            }
+
+            S << "   if (level == " << level << ") { ";
+            if (O.collapse_chains) {
+                S << "if (ntoks > 1) { P.reduce(NODE_RULE_" << L.op_rule << ", op); }";
+            } else {
+                S << "P.reduce(NODE_RULE_" << L.op_rule << ", op);";
+            }
+            S << " }" << std::endl;
+        }
+    }
+
+    S << "   if (!parse_climb_" << top << "(P, level + 1)) { P.reset(op); break; }" << std::endl;
+    S << "   ++count;" << std::endl;
+    S << "  }" << std::endl;
+    S << "  if (count == 0) { break; }" << std::endl;
+    S << "  P.reduce(binop_nodes_" << top << "[level], m);" << std::endl;
+    S << " }" << std::endl;
+    S << " return true;" << std::endl;
     S << "}" << std::endl;
     S << std::endl;
+}
 
-    grammar_node_visitor::visit_rhs(node);
+/* What every piece of the parser includes */
+void parser_generator::write_includes() {
+    S << "#include <string>" << std::endl;
+    S << std::endl;
+    S << "#include \"pyparser.h\"" << std::endl;
+    if (O.combinators) {
+        S << "#include \"pcomb.h\"" << std::endl;
+    }
+    if (O.profile) {
+        S << "#include <iostream>" << std::endl;
+        S << "#include \"parserprofile.h\"" << std::endl;
+    }
+    S << std::endl;
+}
+
+/* The node types, the keyword ids, and the declarations of every parse function */
+void parser_generator::write_declarations() {
+    /* All the rules of the file, the node types do not depend on the optimizations */
+    S << "enum node_rule_t {" << std::endl;
+    for (auto it = G.rule_names.begin(); it != G.rule_names.end(); ++it) {
+        S << " NODE_RULE_" << *it;
+        if (it == G.rule_names.begin()) {
+            S << " = NODE_TYPE_ERROR + 1";
+        }
+        S << "," << std::endl;
+    }
+    S << " N_NODE_TYPES" << std::endl;
+    S << "};" << std::endl;
+    S << std::endl;
+
+    S << "enum keyword_t {" << std::endl;
+    for (size_t i = 0; i < C.keywords.size(); ++i) {
+        S << " KW_" << C.keywords[i];
+        if (i == 0) {
+            S << " = TOK_N_TOKENS";
+        }
+        S << "," << std::endl;
+    }
+    S << " N_TOKEN_KINDS" << std::endl;
+    S << "};" << std::endl;
+    S << std::endl;
+
+    if (O.profile) {
+        /* Defined with the report, once the number of functions is known */
+        S << "extern parser_profile_entry profile_counters[];" << std::endl;
+        S << "extern size_t profile_high;" << std::endl;
+        S << std::endl;
+    }
+
+    for (auto it = G.rules.begin(); it != G.rules.end(); ++it) {
+        S << "bool parse_" << it->first << "(parser_session& P);" << std::endl;
+    }
+
+    for (auto& e : C.node_code) {
+        if (e.first->type != GNODE_RULE && !O.combinators) {
+            S << "bool parse_" << e.second << "(parser_session& P);" << std::endl;
+        }
+    }
+
+    for (auto& chain : C.binop_chains) {
+        S << "bool parse_climb_" << chain.levels.front().rule << "(parser_session& P, int min_level);" << std::endl;
+    }
+
+    S << std::endl;
+}
+
+/* The names of the node types and the keywords, and the token to kind mapping read by parser_session */
+void parser_generator::write_names() {
+    S << "static const char* const node_type_names[] = {" << std::endl;
+    S << " \"STRING\"," << std::endl;
+    S << " \"LAZY\"," << std::endl;
+    S << " \"ERROR\"," << std::endl;
+    for (auto& name : G.rule_names) {
+        S << " \"" << name << "\"," << std::endl;
+    }
+    S << "};" << std::endl;
+    S << std::endl;
+
+    S << "std::string node_type_name(int node_type) {" << std::endl;
+    S << " if (node_type < 0 || node_type >= N_NODE_TYPES) { return \"<unknown>\"; }" << std::endl;
+    S << " return node_type_names[node_type];" << std::endl;
+    S << "}" << std::endl;
+    S << std::endl;
+
+    S << "int node_type_by_name(const std::string& name) {" << std::endl;
+    S << " for (int i = 0; i < N_NODE_TYPES; ++i) {" << std::endl;
+    S << "  if (name == node_type_names[i]) { return i; }" << std::endl;
+    S << " }" << std::endl;
+    S << " return -1;" << std::endl;
+    S << "}" << std::endl;
+    S << std::endl;
+
+    S << "static const char* const keyword_names[] = {" << std::endl;
+    for (auto& kw : C.keywords) {
+        S << " \"" << kw << "\"," << std::endl;
+    }
+    S << "};" << std::endl;
+    S << std::endl;
+
+    S << "int token_kind(const token& t) {" << std::endl;
+    S << " if (t.tok != TOK_NAME) { return t.tok; }" << std::endl;
+    S << " /* keyword_names is sorted */" << std::endl;
+    S << " int lo = 0, hi = N_TOKEN_KINDS - TOK_N_TOKENS;" << std::endl;
+    S << " while (lo < hi) {" << std::endl;
+    S << "  int mid = (lo + hi) / 2;" << std::endl;
+    S << "  int c = t.data.compare(keyword_names[mid]);" << std::endl;
+    S << "  if (c == 0) { return TOK_N_TOKENS + mid; }" << std::endl;
+    S << "  if (c < 0) { hi = mid; } else { lo = mid + 1; }" << std::endl;
+    S << " }" << std::endl;
+    S << " return TOK_NAME;" << std::endl;
+    S << "}" << std::endl;
+    S << std::endl;
+
+    S << "std::string token_kind_name(int kind) {" << std::endl;
+    S << " if (kind < TOK_N_TOKENS) { return tokenizer::token2str(static_cast<token_t>(kind)); }" << std::endl;
+    S << " return std::string(\"'\") + keyword_names[kind - TOK_N_TOKENS] + \"'\";" << std::endl;
+    S << "}" << std::endl;
+    S << std::endl;
+}
+
+void parser_generator::write_lazy_suite() {
+    S << "bool parse_lazy_suite(parser_session& P) {" << std::endl;
+    if (G.rules.count("suite")) {
+        S << " return parse_suite(P);" << std::endl;
+    } else {
+        S << " return false;" << std::endl;
+    }
+    S << "}" << std::endl;
+    S << std::endl;
 }
 
 void parser_generator::visit_rule(grammar_node_rule* node) {
     auto rule_name = node->rule_name;
 
+    if (O.precedence_climbing) {
+        auto it = C.binop_rules.find(rule_name);
+
+        if (it != C.binop_rules.end()) {
+            auto& chain = C.binop_chains[it->second.first];
+
+            /* The rhs is not emitted at all, the chain loop replaces it */
+            S << "/* " << C.node_code[node] << " rule=" << rule_name << " */" << std::endl;
+            begin_function(rule_name);
+            S << " /* " << node->repr() << " */" << std::endl;
+            S << " return parse_climb_" << chain.levels.front().rule << "(P, " << it->second.second << ");" << std::endl;
+            end_function(rule_name, rule_name, node->repr());
+            return;
+        }
+    }
+
     S << "/* " << C.node_code[node] << " rule=" << rule_name << " */" << std::endl;
-    S << "astnode* parse_" << rule_name << "()" << std::endl;
+    begin_function(rule_name);
     S << " /* " << node->repr() << " */" << std::endl;
-    /* FIXME use an ENUM for the names */
-    S << " astnode* node = new astnode(NODE_RULE_" << rule_name << ");" << std::endl;
-    S << " std::vector<astnode*> tmpresarg;" << std::endl;
-    S << " bool n = parse_" << C.node_code[node->rhs.get()] << "(tmpresarg);" << std::endl;
-    S << " if (n) { node->childs.insert(node->childs.end(), tmpresarg.begin(), tmpresarg.end()); }" << std::endl;
-    S << " else { return 0; }" << std::endl;
-    S << " return node;" << std::endl;
-    S << "}" << std::endl;
-    S << std::endl;
+    S << " parser_mark m = P.mark();" << std::endl;
+    S << " if (!parse_" << C.node_code[node->rhs.get()] << "(P)) { return false; }" << std::endl;
+    current_rule = rule_name;
+
+    if (O.collapse_chains && O.start_rules.find(rule_name) == O.start_rules.end()) {
+        /* test -> or_test -> ... -> atom: only keep the levels that branch */
+        S << " if (!P.single_child(m)) { P.reduce(NODE_RULE_" << rule_name << ", m); }" << std::endl;
+    } else {
+        S << " P.reduce(NODE_RULE_" << rule_name << ", m);" << std::endl;
+    }
+
+    S << " return true;" << std::endl;
+    end_function(rule_name, rule_name, node->repr());
 
     grammar_node_visitor::visit_rule(node);
 }
 
 
 
+/* The pcomb type for a node of current_rule */
+std::string parser_generator::combinator(grammar_node* node) {
+    std::string r;
+
+    switch (node->type) {
+    case GNODE_STRING:
+        {
+            auto& value = static_cast<grammar_node_string*>(node)->value;
+
+            if (is_name_terminal(value, G)) {
+                return "tok<" + terminal_kind_name(C.terminal_kind[value], C) + ">";
+            }
+            if (value == "suite" && O.lazy_rules.count(current_rule)) {
+                return "lazy<r_suite>";
+            }
+            return "r_" + value;
+        }
+    case GNODE_OPTIONAL:
+        return "opt<" + combinator(static_cast<grammar_node_optional*>(node)->child.get()) + ">";
+    case GNODE_REPETITION:
+        {
+            auto rep = static_cast<grammar_node_repetition*>(node);
+            auto sync = C.recovery_sync.find(node);
+
+            r = combinator(rep->child.get());
+            if (sync != C.recovery_sync.end()) {
+                r = "recover<" + r;
+                for (auto kind : sync->second) {
+                    r += ", " + terminal_kind_name(kind, C);
+                }
+                r += ">";
+            }
+            return (rep->star ? "star<" : "plus<") + r + ">";
+        }
+    case GNODE_SEQUENCE:
+        {
+            auto& childs = static_cast<grammar_node_sequence*>(node)->childs;
+
+            if (childs.size() == 1) {
+                return combinator(childs[0].get());
+            }
+            for (auto& e : childs) {
+                r += (r.empty() ? "seq<" : ", ") + combinator(e.get());
+            }
+            return r + ">";
+        }
+    case GNODE_RHS:
+        {
+            auto& choices = static_cast<grammar_node_rhs*>(node)->choices;
+
+            if (choices.size() == 1) {
+                return combinator(choices[0].get());
+            }
+            for (auto& e : choices) {
+                r += (r.empty() ? "alt<" : ", ") + combinator(e.get());
+            }
+            return r + ">";
+        }
+    case GNODE_RULE:
+        break;
+    }
+
+    throw std::runtime_error("gen_parser: a rule inside a rule");
+}
+
+/*
+ * Every rule as a struct, declared first since rules refer to each other,
+ * and the parse_X entry points. The binop chains keep their climbing loop.
+ */
+void parser_generator::write_combinators() {
+    S << "using namespace pcomb;" << std::endl;
+    S << std::endl;
+
+    for (auto it = G.rules.begin(); it != G.rules.end(); ++it) {
+        S << "struct r_" << it->first << ";" << std::endl;
+    }
+    S << std::endl;
+
+    for (auto it = G.rules.begin(); it != G.rules.end(); ++it) {
+        auto& rule_name = it->first;
+        auto node = static_cast<grammar_node_rule*>(it->second.get());
+
+        S << "/* " << node->repr() << " */" << std::endl;
+
+        if (O.precedence_climbing && C.binop_rules.count(rule_name)) {
+            S << "struct r_" << rule_name << " : call<parse_" << rule_name << "> {};" << std::endl;
+        } else {
+            bool collapse = O.collapse_chains && O.start_rules.find(rule_name) == O.start_rules.end();
+
+            current_rule = rule_name;
+            S << "struct r_" << rule_name << " : rule<NODE_RULE_" << rule_name << ", " << (collapse ? "true" : "false")
+              << ", " << combinator(node->rhs.get()) << "> {};" << std::endl;
+        }
+        S << std::endl;
+    }
+
+    for (auto it = G.rules.begin(); it != G.rules.end(); ++it) {
+        auto& rule_name = it->first;
+
+        if (O.precedence_climbing && C.binop_rules.count(rule_name)) {
+            visit(it->second.get());
+        } else {
+            S << "bool parse_" << rule_name << "(parser_session& P) {" << std::endl;
+            S << " return r_" << rule_name << "::parse(P);" << std::endl;
+            S << "}" << std::endl;
+            S << std::endl;
+        }
+    }
+}
+
 void build_node_codes(grammar_parser& G, parser_cache& C) {
     std::deque<grammar_node*> Q;
     node_code_builder W(Q);
@@ -316,21 +1102,194 @@ void build_node_codes(grammar_parser& G, parser_cache& C) {
     }
 }
 
-void generate_parser(grammar_parser& G) {
+/* The generated parser in pieces, put together by generate_parser or generate_parser_shards */
+struct parser_sections {
+    size_t nodes_count;
+    std::string includes;
+    std::string declarations; /* node types, keyword ids, every parse function */
+    std::string common; /* the names, token_kind, the climbing loops */
+    std::vector<std::pair<std::string, std::string>> rules; /* the functions of each rule */
+    std::string profile; /* after every function, it has their counters */
+    uint64_t fingerprint;
+};
+
+static std::string take(std::stringstream& S) {
+    std::string code = S.str();
+    S.str("");
+    return code;
+}
+
+static parser_sections build_sections(grammar_parser& G, const parser_options& opts) {
     parser_cache C;
+    parser_sections R;
+
+    if (opts.combinators && opts.profile) {
+        throw std::runtime_error("gen_parser: the combinators have no parse functions to profile");
+    }
 
     build_node_codes(G, C);
+    build_terminal_kinds(G, C);
 
-    std::cout << "nodes count: " << C.node_code.size() << std::endl;
+    if (opts.precedence_climbing) {
+        build_binop_chains(G, C);
+    }
 
-    parser_generator PG(G, C);
+    build_recovery_points(G, C, opts);
 
-    for (auto it = G.rules.begin(); it != G.rules.end(); ++it) {
-        PG.visit(it->second.get());
+    parser_generator PG(G, C, opts);
+
+    R.nodes_count = C.node_code.size();
+
+    PG.write_includes();
+    R.includes = take(PG.S);
+
+    PG.write_declarations();
+    R.declarations = take(PG.S);
+
+    PG.write_names();
+    for (auto& chain : C.binop_chains) {
+        PG.write_binop_chain(chain);
+    }
+    PG.write_lazy_suite();
+    R.common = take(PG.S);
+
+    if (opts.combinators) {
+        /* One piece, the compiler needs every rule to inline them */
+        PG.write_combinators();
+        R.rules.emplace_back("combinators", take(PG.S));
+    } else {
+        for (auto it = G.rules.begin(); it != G.rules.end(); ++it) {
+            PG.visit(it->second.get());
+            R.rules.emplace_back(it->first, take(PG.S));
+        }
+    }
+
+    if (opts.profile) {
+        PG.write_profile_table();
+        R.profile = take(PG.S);
+    }
+
+    /* Any change in the emitted code may change the trees, cached ones included */
+    std::string code = R.includes + R.declarations + R.common;
+    for (auto& rule : R.rules) {
+        code += rule.second;
+    }
+    code += R.profile;
+    R.fingerprint = fnv1a_hash(code.data(), code.size());
+
+    return R;
+}
+
+static void write_banner(std::ostream& out, const parser_sections& R) {
+    out << "/*" << std::endl;
+    out << " * Python parser generated by arbusto gen_parser, do not edit." << std::endl;
+    out << " * nodes count: " << R.nodes_count << std::endl;
+    out << " */" << std::endl;
+    out << std::endl;
+}
+
+static void write_fingerprint(std::ostream& out, const parser_sections& R) {
+    out << "uint64_t grammar_fingerprint() {" << std::endl;
+    out << " return 0x" << std::hex << R.fingerprint << std::dec << "ULL;" << std::endl;
+    out << "}" << std::endl;
+    out << std::endl;
+}
+
+void generate_parser(grammar_parser& G, std::ostream& out, const parser_options& opts) {
+    auto R = build_sections(G, opts);
+
+    write_banner(out, R);
+    out << R.includes;
+    out << "namespace arbusto {" << std::endl;
+    out << std::endl;
+    out << R.declarations << R.common;
+
+    for (auto& rule : R.rules) {
+        out << rule.second;
     }
 
-    std::cout << PG.S.str() << std::endl;
+    out << R.profile;
+    write_fingerprint(out, R);
+    out << "} /* namespace arbusto */" << std::endl;
+}
+
+static void write_file(const std::string& file_name, const std::string& text) {
+    std::ofstream ofile(file_name);
+
+    ofile << text;
+
+    if (!ofile) {
+        throw std::runtime_error("gen_parser: can not write " + file_name);
+    }
+}
+
+void generate_parser_shards(grammar_parser& G, const std::string& dir, size_t shards, const parser_options& opts) {
+    if (shards == 0) {
+        throw std::runtime_error("gen_parser: at least one shard is needed");
+    }
 
+    auto R = build_sections(G, opts);
+
+    /* Biggest rule first, each to the smallest shard so far */
+    std::vector<size_t> order(R.rules.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&R](size_t a, size_t b) {
+        return R.rules[a].second.size() > R.rules[b].second.size();
+    });
+
+    std::vector<size_t> shard_size(shards, 0);
+    std::vector<std::vector<size_t>> shard_rules(shards);
+
+    for (auto i : order) {
+        size_t s = std::min_element(shard_size.begin(), shard_size.end()) - shard_size.begin();
+        shard_rules[s].push_back(i);
+        shard_size[s] += R.rules[i].second.size();
+    }
+
+    std::stringstream H;
+    write_banner(H, R);
+    H << "#ifndef PYPARSER_GEN_H_" << std::endl;
+    H << "#define PYPARSER_GEN_H_" << std::endl;
+    H << std::endl;
+    H << R.includes;
+    H << "namespace arbusto {" << std::endl;
+    H << std::endl;
+    H << R.declarations;
+    H << "} /* namespace arbusto */" << std::endl;
+    H << std::endl;
+    H << "#endif /* PYPARSER_GEN_H_ */" << std::endl;
+    write_file(dir + "/pyparser_gen.h", H.str());
+
+    std::vector<std::string> names{"pyparser_gen_common.cpp"};
+    for (size_t s = 0; s < shards; ++s) {
+        names.push_back("pyparser_gen_" + std::to_string(s + 1) + ".cpp");
+    }
+
+    for (size_t s = 0; s < names.size(); ++s) {
+        std::stringstream F;
+        write_banner(F, R);
+        F << "#include \"pyparser_gen.h\"" << std::endl;
+        F << std::endl;
+        F << "namespace arbusto {" << std::endl;
+        F << std::endl;
+
+        if (s == 0) {
+            F << R.common << R.profile;
+            write_fingerprint(F, R);
+        } else {
+            /* In grammar order, so a shard does not change when an unrelated rule does */
+            auto& rules = shard_rules[s - 1];
+            std::sort(rules.begin(), rules.end());
+            for (auto i : rules) {
+                F << R.rules[i].second;
+            }
+        }
+
+        F << "} /* namespace arbusto */" << std::endl;
+        write_file(dir + "/" + names[s], F.str());
+    }
 }
 
 }
\ No newline at end of file
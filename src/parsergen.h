@@ -7,11 +7,67 @@
 #ifndef GRAMMARGER_H
 #define GRAMMARGER_H
 
+#include <set>
+#include <string>
+#include <ostream>
+
 #include "grammarparser.h"
 
 namespace arbusto {
 
-void generate_parser(grammar_parser& G);
+struct parser_options {
+    parser_options()
+        : start_rules{"file_input", "eval_input", "single_input"}, lazy_rules{"funcdef"}, recovery_rules{"stmt"} {}
+
+    /* Do not create a rule node with a single child, pass the child up instead */
+    bool collapse_chains{false};
+
+    /*
+     * Parse the layered binary operator rules (comparison, expr, ..., term)
+     * with one precedence climbing loop. Those levels only get a node when
+     * they have an operator, as with collapse_chains.
+     */
+    bool precedence_climbing{false};
+
+    /* The entry points of the grammar, they always get a node */
+    std::set<std::string> start_rules;
+
+    /* Rules whose suite is skipped, not parsed, when P.lazy_bodies is set */
+    std::set<std::string> lazy_rules;
+
+    /*
+     * Repetitions of these rules skip what does not parse as one, up to a
+     * token that may follow the repetition or the next statement, when
+     * P.recovery is set. See parser_session::recover_statement.
+     */
+    std::set<std::string> recovery_rules;
+
+    /*
+     * Count the calls, results and backtracked tokens of every parse
+     * function, and write a report to stderr at exit. See parserprofile.h.
+     */
+    bool profile{false};
+    bool profile_cycles{false};
+
+    /*
+     * Write each rule as a struct of pcomb.h combinators instead of one
+     * parse_N function per grammar node, so the compiler can inline across
+     * rules and checks the grammar. Not with profile.
+     */
+    bool combinators{false};
+};
+
+/* Write the C++ source of a parser for the grammar, see pyparser.h for its interface */
+void generate_parser(grammar_parser& G, std::ostream& out, const parser_options& opts = parser_options());
+
+/*
+ * The same parser split for parallel builds, written to the directory dir:
+ * pyparser_gen.h with the declarations, pyparser_gen_common.cpp with the
+ * tables, and pyparser_gen_1.cpp up to the number of shards with the rules,
+ * balanced by code size. The names only depend on shards, which is how
+ * CMakeLists.txt lists them.
+ */
+void generate_parser_shards(grammar_parser& G, const std::string& dir, size_t shards, const parser_options& opts = parser_options());
 
 }
 
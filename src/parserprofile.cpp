@@ -0,0 +1,64 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <vector>
+#include <algorithm>
+#include <iomanip>
+#include <string>
+
+#include "parserprofile.h"
+
+namespace arbusto {
+
+void write_parser_profile(std::ostream& out, const parser_profile_entry* entries, size_t count, bool cycles) {
+	std::vector<const parser_profile_entry*> used;
+	parser_profile_entry total = parser_profile_entry();
+
+	for (size_t i = 0; i < count; ++i) {
+		if (entries[i].calls > 0) {
+			used.push_back(&entries[i]);
+			total.calls += entries[i].calls;
+			total.failures += entries[i].failures;
+			total.backtracked += entries[i].backtracked;
+		}
+	}
+
+	std::stable_sort(used.begin(), used.end(), [](const parser_profile_entry* a, const parser_profile_entry* b) {
+		if (a->backtracked != b->backtracked) {
+			return a->backtracked > b->backtracked;
+		}
+		return a->failures > b->failures;
+	});
+
+	out << "parser profile: " << used.size() << " functions, " << total.calls << " calls, " << total.failures
+			<< " failed, " << total.backtracked << " tokens backtracked" << std::endl;
+
+	out << std::setw(12) << "backtracked" << std::setw(12) << "calls" << std::setw(12) << "ok" << std::setw(12) << "failed";
+	if (cycles) {
+		out << std::setw(16) << "cycles";
+	}
+	out << "  function" << std::endl;
+
+	for (auto e : used) {
+		out << std::setw(12) << e->backtracked << std::setw(12) << e->calls << std::setw(12) << e->successes
+				<< std::setw(12) << e->failures;
+		if (cycles) {
+			out << std::setw(16) << e->cycles;
+		}
+
+		out << "  " << e->name;
+		if (std::string(e->name) != e->rule) {
+			out << " in " << e->rule;
+		}
+		std::string repr = e->repr;
+		if (repr.size() > 100) {
+			repr = repr.substr(0, 97) + "...";
+		}
+		out << ": " << repr << std::endl;
+	}
+}
+
+} /* namespace arbusto */
@@ -0,0 +1,51 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef PARSERPROFILE_H_
+#define PARSERPROFILE_H_
+
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace arbusto {
+
+/*
+ * Counters of one parse function of a parser generated with --profile.
+ * backtracked adds, for every failed call, how far past its start the
+ * call got before giving up: the tokens parsed for nothing.
+ */
+struct parser_profile_entry {
+	const char* name; /* the rule, or the node code */
+	const char* rule; /* the rule the node code is part of */
+	const char* repr;
+	uint64_t calls;
+	uint64_t successes;
+	uint64_t failures;
+	uint64_t backtracked;
+	uint64_t cycles; /* with --profile-cycles, callees included */
+};
+
+/* TSC where there is one, nanoseconds elsewhere */
+inline uint64_t profile_clock() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/* The entries that were called, most tokens backtracked first */
+void write_parser_profile(std::ostream& out, const parser_profile_entry* entries, size_t count, bool cycles);
+
+} /* namespace arbusto */
+
+#endif /* PARSERPROFILE_H_ */
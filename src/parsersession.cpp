@@ -0,0 +1,115 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <map>
+
+#include "parsersession.h"
+#include "tokenstream.h"
+
+namespace arbusto {
+
+void parser_session::fetch() {
+	kinds.pop_back();
+	kinds.push_back(stream->next(kinds) ? KIND_PENDING : -1);
+}
+
+std::vector<int> parser_session::expected() const {
+	std::vector<int> r;
+
+	for (int kind = 0; kind < MAX_EXPECTED_KINDS; ++kind) {
+		if (expected_kinds[kind / 64] & (uint64_t(1) << (kind % 64))) {
+			r.push_back(kind);
+		}
+	}
+
+	return r;
+}
+
+static bool is_sync(int kind, const int* sync) {
+	for (; *sync >= 0; ++sync) {
+		if (*sync == kind) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool parser_session::recover_statement(const int* sync) {
+	size_t end = pos;
+	size_t at = farthest;
+	int depth = 0;
+
+	for (;;) {
+		int k = kind_at(end);
+
+		if (k < 0 || k == TOK_ENDMARKER || (depth == 0 && (k == TOK_DEDENT || is_sync(k, sync)))) {
+			break;
+		}
+
+		/* A tokenizer error in the statement is the error to report */
+		if (k == TOK_ERRORTOKEN && kind_at(at) != TOK_ERRORTOKEN) {
+			at = end;
+		}
+
+		++end;
+
+		if (k == TOK_INDENT) {
+			++depth;
+		} else if (k == TOK_DEDENT && --depth == 0) {
+			break;
+		} else if (k == TOK_NEWLINE && depth == 0 && kind_at(end) != TOK_INDENT) {
+			break;
+		}
+	}
+
+	if (end == pos) {
+		return false;
+	}
+
+	errors.push_back(parse_error{at, pos, expected()});
+
+	parser_mark m = mark();
+	while (pos < end) {
+		chew_token();
+	}
+	reduce(NODE_TYPE_ERROR, m);
+
+	/* The next error is looked for from here */
+	farthest = pos;
+	clear_expected();
+	return true;
+}
+
+void parser_session::build_tree(ast_tree& tree) {
+	tree.assign_postorder(stack.data(), stack.data() + stack.size());
+
+	if (errors.empty()) {
+		return;
+	}
+
+	/* A statement recovered more than once keeps the last try */
+	std::map<size_t, parse_error> kept;
+
+	for (auto& node : tree.nodes) {
+		if (node.node_type == NODE_TYPE_ERROR) {
+			kept[node.token_index];
+		}
+	}
+
+	for (auto& e : errors) {
+		auto it = kept.find(e.first);
+		if (it != kept.end()) {
+			it->second = e;
+		}
+	}
+
+	errors.clear();
+	for (auto& e : kept) {
+		errors.push_back(e.second);
+	}
+}
+
+} /* namespace arbusto */
@@ -0,0 +1,286 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef PARSERSESSION_H_
+#define PARSERSESSION_H_
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "tokenizer.h"
+#include "astnode.h"
+
+namespace arbusto {
+
+class token_stream;
+
+/* A point to backtrack to: the token position and the child stack height */
+struct parser_mark {
+	size_t pos;
+	size_t stack;
+};
+
+/* A syntax error recovery skipped, see parser_session::recover_statement */
+struct parse_error {
+	size_t token_index; /* the farthest token the parse tried, or the ERRORTOKEN skipped */
+	size_t first; /* the first token of the NODE_TYPE_ERROR node */
+	std::vector<int> expected; /* the kinds tried at token_index */
+};
+
+/*
+ * One row of a binding power table, indexed by the token kind of the
+ * operator. second is the kind of the following token for 'not' 'in' and
+ * 'is' 'not', alone tells if the operator is also valid by itself.
+ */
+struct binop_entry {
+	int level;
+	int second;
+	bool alone;
+};
+
+/*
+ * Runtime state for the parse_N functions emitted by generate_parser.
+ *
+ * Every matched child is pushed on one session wide stack of flat nodes.
+ * A rule records the stack height when it starts, and on success pushes
+ * its own node after everything above it, with the subtree size; on
+ * failure it just truncates the stack back. The stack is the tree in
+ * postorder, build_tree turns it into the preorder ast_tree.
+ */
+class parser_session {
+public:
+	/*
+	 * kind_of maps each token to the integer kind the emitted parser
+	 * compares against: its token_t, or a keyword id for reserved NAMEs.
+	 */
+	parser_session(const std::vector<token>& toks, int (*kind_of)(const token&))
+		: tokens(toks), pos(0), farthest(0), lazy_bodies(false), recovery(false), stream(nullptr), expected_kinds{} {
+		kinds.reserve(toks.size() + 1);
+		for (auto& t : toks) {
+			kinds.push_back(kind_of(t));
+		}
+		/* Sentinel, never matches, so peeking never checks the bounds */
+		kinds.push_back(-1);
+		/* About one node per token once chains collapse */
+		stack.reserve(toks.size() + 1);
+	}
+
+	/*
+	 * Parse while stream is still tokenizing. The parse only looks at the
+	 * kinds, and the last one is KIND_PENDING instead of the sentinel until
+	 * the stream ends: the places that read a kind fetch the next batch when
+	 * they find it. toks is empty until stream.finish(toks) after the parse.
+	 */
+	parser_session(const std::vector<token>& toks, token_stream& stream_)
+		: tokens(toks), pos(0), farthest(0), lazy_bodies(false), recovery(false), stream(&stream_), expected_kinds{} {
+		kinds.push_back(KIND_PENDING);
+		stack.reserve(4096);
+	}
+
+	enum { KIND_PENDING = -2 };
+
+	/* Token kinds tracked for the expected set, more than token_t and the keywords */
+	enum { MAX_EXPECTED_KINDS = 256 };
+
+	/* Start over at token from, with an empty stack, to parse a part of the same tokens */
+	inline void restart(size_t from) {
+		pos = from;
+		farthest = from;
+		stack.clear();
+		errors.clear();
+		clear_expected();
+	}
+
+	inline parser_mark mark() const {
+		return parser_mark{pos, stack.size()};
+	}
+
+	inline void reset(const parser_mark& m) {
+		pos = m.pos;
+		stack.erase(stack.begin() + m.stack, stack.end());
+	}
+
+	/* Match a terminal, TOK_PLUS or a keyword id, against the next token */
+	inline bool chew_next_token(int kind) {
+		if (kinds[pos] != kind) {
+			if (kinds[pos] == KIND_PENDING) {
+				fetch();
+				return chew_next_token(kind);
+			}
+
+			if (pos >= farthest) {
+				expect(kind);
+			}
+			return false;
+		}
+
+		stack.emplace_back(NODE_TYPE_STRING, pos, 1);
+		++pos;
+		return true;
+	}
+
+	/* Push the next token whatever it is, the caller already looked at it */
+	inline void chew_token() {
+		stack.emplace_back(NODE_TYPE_STRING, pos, 1);
+		++pos;
+	}
+
+	/*
+	 * Look up the operator at the current position in a binding power
+	 * table. Returns its level, or -1 when the next token is not one.
+	 */
+	inline int peek_binop(const binop_entry* table, size_t& ntoks) {
+		int k = kind_at(pos);
+
+		if (k < 0) {
+			return -1;
+		}
+
+		const binop_entry& e = table[k];
+
+		if (e.level < 0) {
+			return -1;
+		}
+
+		if (e.second >= 0 && kind_at(pos + 1) == e.second) {
+			ntoks = 2;
+			return e.level;
+		}
+
+		if (!e.alone) {
+			return -1;
+		}
+
+		ntoks = 1;
+		return e.level;
+	}
+
+	/*
+	 * One past the last token of the suite starting at from: the rest of the
+	 * line, or an indented block up to its matching DEDENT. Returns from if
+	 * the tokens end first. The tokenizer emits no NEWLINE, INDENT or DEDENT
+	 * between brackets, so those are all that needs matching.
+	 */
+	inline size_t suite_end(size_t from) {
+		size_t i = from;
+
+		if (kind_at(i) == TOK_NEWLINE && kind_at(i + 1) == TOK_INDENT) {
+			int depth = 0;
+
+			for (++i; kind_at(i) >= 0 && kinds[i] != TOK_ENDMARKER; ++i) {
+				if (kinds[i] == TOK_INDENT) {
+					++depth;
+				} else if (kinds[i] == TOK_DEDENT && --depth == 0) {
+					return i + 1;
+				}
+			}
+		} else {
+			for (; kind_at(i) >= 0 && kinds[i] != TOK_ENDMARKER; ++i) {
+				if (kinds[i] == TOK_NEWLINE) {
+					return i + 1;
+				}
+			}
+		}
+
+		return from;
+	}
+
+	/*
+	 * Push a NODE_TYPE_LAZY leaf for the suite at pos instead of parsing it,
+	 * see lazy_suites. Syntax errors in it only show when it is parsed.
+	 */
+	inline bool skip_suite() {
+		size_t end = suite_end(pos);
+
+		if (end == pos) {
+			if (pos > farthest) {
+				farthest = pos;
+				clear_expected();
+			}
+			return false;
+		}
+
+		stack.emplace_back(NODE_TYPE_LAZY, pos, 1);
+		pos = end;
+		return true;
+	}
+
+	/* The kind of token i, fetching it first if it did not arrive yet. i is at most one past a known token. */
+	inline int kind_at(size_t i) {
+		while (kinds[i] == KIND_PENDING) {
+			fetch();
+		}
+		return kinds[i];
+	}
+
+	/* Append the next batch of the stream, and the sentinel after the last one */
+	void fetch();
+
+	/* kind failed to match at pos, which is at least farthest */
+	inline void expect(int kind) {
+		if (pos > farthest) {
+			farthest = pos;
+			clear_expected();
+		}
+		if (kind < MAX_EXPECTED_KINDS) {
+			expected_kinds[kind / 64] |= uint64_t(1) << (kind % 64);
+		}
+	}
+
+	inline void clear_expected() {
+		for (auto& bits : expected_kinds) {
+			bits = 0;
+		}
+	}
+
+	/* The kinds tried at farthest, what a syntax error there expected */
+	std::vector<int> expected() const;
+
+	/*
+	 * Panic mode, when no statement matches at pos. Records a parse_error
+	 * and pushes a NODE_TYPE_ERROR node over the tokens up to the next
+	 * statement: skipping stops before a token of sync (what may follow the
+	 * statements here, -1 terminated), a DEDENT closing the block or the
+	 * ENDMARKER, and after the NEWLINE ending the statement, with the block
+	 * it opens if any. False if there was nothing to skip.
+	 */
+	bool recover_statement(const int* sync);
+
+	/* Make the children pushed since m the subtree of a new node of type node_type */
+	inline void reduce(int node_type, const parser_mark& m) {
+		stack.emplace_back(node_type, m.pos, stack.size() - m.stack + 1);
+	}
+
+	/* True when exactly one subtree was pushed since m */
+	inline bool single_child(const parser_mark& m) const {
+		return stack.size() > m.stack && stack.back().size == stack.size() - m.stack;
+	}
+
+	/*
+	 * The tree of a successful start rule, in preorder. Drops the errors
+	 * whose node was backtracked over, recovered in an alternative that
+	 * failed later.
+	 */
+	void build_tree(ast_tree& tree);
+
+	const std::vector<token>& tokens;
+	std::vector<int> kinds;
+	size_t pos;
+	size_t farthest; /* the last position where a token failed to match, for errors */
+	bool lazy_bodies; /* skip function bodies, see parser_options::lazy_rules */
+	bool recovery; /* skip bad statements instead of failing, see parser_options::recovery_rules */
+	std::vector<parse_error> errors; /* the ones recovery skipped, by position */
+	token_stream* stream;
+	std::vector<astnode> stack; /* postorder */
+
+private:
+	uint64_t expected_kinds[MAX_EXPECTED_KINDS / 64]; /* bit set of the kinds tried at farthest */
+};
+
+} /* namespace arbusto */
+
+#endif /* PARSERSESSION_H_ */
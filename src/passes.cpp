@@ -0,0 +1,984 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <map>
+#include <chrono>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_set>
+
+#include "passes.h"
+
+namespace arbusto {
+
+/* Facts */
+
+static ir_fact fact(ir_fact_kind kind, int64_t lo = INT64_MIN, int64_t hi = INT64_MAX) {
+	ir_fact f;
+	f.kind = kind;
+	f.lo = lo;
+	f.hi = hi;
+	return f;
+}
+
+static bool is_int(const ir_fact& f) {
+	return f.kind == FACT_INT || f.kind == FACT_BOOL;
+}
+
+static bool is_number(const ir_fact& f) {
+	return is_int(f) || f.kind == FACT_FLOAT;
+}
+
+/* Not a container: what it holds cannot change, and operations on it do not look at anything else */
+static bool is_scalar(const ir_fact& f) {
+	return f.kind != FACT_ANY && f.kind != FACT_UNDEF;
+}
+
+/* An int within int64_t, so that it converts to a float */
+static bool is_bounded(const ir_fact& f) {
+	return is_int(f) && f.lo != INT64_MIN && f.hi != INT64_MAX;
+}
+
+static bool has_zero(const ir_fact& f) {
+	return f.lo <= 0 && f.hi >= 0;
+}
+
+static bool operator==(const ir_fact& x, const ir_fact& y) {
+	return x.kind == y.kind && x.lo == y.lo && x.hi == y.hi;
+}
+
+static bool operator!=(const ir_fact& x, const ir_fact& y) {
+	return !(x == y);
+}
+
+static ir_fact join(const ir_fact& x, const ir_fact& y) {
+	if (x.kind == FACT_UNDEF) {
+		return y;
+	}
+	if (y.kind == FACT_UNDEF) {
+		return x;
+	}
+	if (is_int(x) && is_int(y)) {
+		return fact(x.kind == y.kind ? x.kind : FACT_INT, std::min(x.lo, y.lo), std::max(x.hi, y.hi));
+	}
+	return x.kind == y.kind ? x : fact(FACT_ANY);
+}
+
+/* 1 if f is true, 0 if it is false, -1 if it depends */
+static int truth(const ir_fact& f) {
+	if (is_int(f)) {
+		if (f.lo > 0 || f.hi < 0) {
+			return 1;
+		}
+		if (f.lo == 0 && f.hi == 0) {
+			return 0;
+		}
+	}
+	return f.kind == FACT_NONE ? 0 : -1;
+}
+
+/*
+ * Interval arithmetic. INT64_MIN as the low bound and INT64_MAX as the
+ * high one mean there is none, which is also what a bound that overflows
+ * becomes: past int64_t the runtime goes on with bigints.
+ */
+
+static int64_t add_lo(int64_t x, int64_t y) {
+	int64_t r;
+	return x == INT64_MIN || y == INT64_MIN || __builtin_add_overflow(x, y, &r) ? INT64_MIN : r;
+}
+
+static int64_t add_hi(int64_t x, int64_t y) {
+	int64_t r;
+	return x == INT64_MAX || y == INT64_MAX || __builtin_add_overflow(x, y, &r) ? INT64_MAX : r;
+}
+
+static int64_t sub_lo(int64_t x, int64_t y) {
+	int64_t r;
+	return x == INT64_MIN || y == INT64_MAX || __builtin_sub_overflow(x, y, &r) ? INT64_MIN : r;
+}
+
+static int64_t sub_hi(int64_t x, int64_t y) {
+	int64_t r;
+	return x == INT64_MAX || y == INT64_MIN || __builtin_sub_overflow(x, y, &r) ? INT64_MAX : r;
+}
+
+static ir_fact mul(const ir_fact& x, const ir_fact& y) {
+	if (!is_bounded(x) || !is_bounded(y)) {
+		return fact(FACT_INT);
+	}
+	int64_t p[4];
+	if (__builtin_mul_overflow(x.lo, y.lo, &p[0]) || __builtin_mul_overflow(x.lo, y.hi, &p[1])
+			|| __builtin_mul_overflow(x.hi, y.lo, &p[2]) || __builtin_mul_overflow(x.hi, y.hi, &p[3])) {
+		return fact(FACT_INT);
+	}
+	return fact(FACT_INT, *std::min_element(p, p + 4), *std::max_element(p, p + 4));
+}
+
+static int64_t floor_div(int64_t x, int64_t y) {
+	int64_t q = x / y;
+	if (x % y != 0 && (x < 0) != (y < 0)) {
+		--q;
+	}
+	return q;
+}
+
+static ir_fact floordiv(const ir_fact& x, const ir_fact& y) {
+	if (y.lo > 0 && is_bounded(x) && is_bounded(y)) {
+		int64_t p[4] = { floor_div(x.lo, y.lo), floor_div(x.lo, y.hi), floor_div(x.hi, y.lo), floor_div(x.hi, y.hi) };
+		return fact(FACT_INT, *std::min_element(p, p + 4), *std::max_element(p, p + 4));
+	}
+	if (y.lo > 0 && x.lo >= 0) {
+		return fact(FACT_INT, 0, x.hi);
+	}
+	return fact(FACT_INT);
+}
+
+/* The sign of the result is the sign of the divisor */
+static ir_fact mod(const ir_fact& x, const ir_fact& y) {
+	if (y.lo > 0) {
+		int64_t hi = y.hi == INT64_MAX ? INT64_MAX : y.hi - 1;
+		if (x.lo >= 0) {
+			hi = std::min(hi, x.hi);
+		}
+		return fact(FACT_INT, 0, hi);
+	}
+	if (y.hi < 0) {
+		return fact(FACT_INT, y.lo == INT64_MIN ? INT64_MIN : y.lo + 1, 0);
+	}
+	return fact(FACT_INT);
+}
+
+/* Whether x op y is known, 1 true, 0 false or -1 */
+static int decide(opcode op, const ir_fact& x, const ir_fact& y) {
+	if (!is_int(x) || !is_int(y)) {
+		return -1;
+	}
+	/* Only bounds that are bounds */
+	bool lt = x.hi != INT64_MAX && y.lo != INT64_MIN && x.hi < y.lo;
+	bool gt = x.lo != INT64_MIN && y.hi != INT64_MAX && x.lo > y.hi;
+	bool le = x.hi != INT64_MAX && y.lo != INT64_MIN && x.hi <= y.lo;
+	bool ge = x.lo != INT64_MIN && y.hi != INT64_MAX && x.lo >= y.hi;
+	bool eq = is_bounded(x) && is_bounded(y) && x.lo == x.hi && y.lo == y.hi && x.lo == y.lo;
+
+	switch (op) {
+	case BC_LT: return lt ? 1 : ge ? 0 : -1;
+	case BC_LE: return le ? 1 : gt ? 0 : -1;
+	case BC_GT: return gt ? 1 : le ? 0 : -1;
+	case BC_GE: return ge ? 1 : lt ? 0 : -1;
+	case BC_EQ: return eq ? 1 : lt || gt ? 0 : -1;
+	case BC_NE: return eq ? 0 : lt || gt ? 1 : -1;
+	default: return -1;
+	}
+}
+
+static ir_fact bool_fact(int known) {
+	return known < 0 ? fact(FACT_BOOL, 0, 1) : fact(FACT_BOOL, known, known);
+}
+
+static ir_fact constant_fact(const constant& k) {
+	switch (k.kind) {
+	case CK_NONE: return fact(FACT_NONE);
+	case CK_BOOL: return fact(FACT_BOOL, k.i, k.i);
+	case CK_INT: return fact(FACT_INT, k.i, k.i);
+	case CK_BIGINT: return fact(FACT_INT);
+	case CK_FLOAT: return fact(FACT_FLOAT);
+	case CK_STR: return fact(FACT_STR);
+	default: return fact(FACT_ANY);
+	}
+}
+
+/* The fact of the value of i from the facts of its operands */
+static ir_fact transfer(const code_object& co, const ir_inst* i) {
+	if (i->defs.size() != 1) {
+		return fact(FACT_ANY);
+	}
+	for (auto& u : i->uses) {
+		if (u.value->fact.kind == FACT_UNDEF) {
+			return fact(FACT_UNDEF);
+		}
+	}
+	ir_fact x = i->uses.size() > 0 ? i->uses[0].value->fact : fact(FACT_ANY);
+	ir_fact y = i->uses.size() > 1 ? i->uses[1].value->fact : fact(FACT_ANY);
+	bool ints = is_int(x) && is_int(y);
+	bool numbers = is_number(x) && is_number(y);
+
+	switch (i->op()) {
+	case BC_MOVE:
+		return x;
+	case BC_LOADK:
+		return constant_fact(co.constants[arg_bx(i->ins)]);
+
+	case BC_ADD: case BC_IADD:
+		if (ints) {
+			return fact(FACT_INT, add_lo(x.lo, y.lo), add_hi(x.hi, y.hi));
+		}
+		return numbers ? fact(FACT_FLOAT) : x.kind == FACT_STR && y.kind == FACT_STR ? fact(FACT_STR) : fact(FACT_ANY);
+	case BC_SUB:
+		if (ints) {
+			return fact(FACT_INT, sub_lo(x.lo, y.hi), sub_hi(x.hi, y.lo));
+		}
+		return numbers ? fact(FACT_FLOAT) : fact(FACT_ANY);
+	case BC_MUL:
+		if (ints) {
+			return mul(x, y);
+		}
+		if ((x.kind == FACT_STR && is_int(y)) || (is_int(x) && y.kind == FACT_STR)) {
+			return fact(FACT_STR);
+		}
+		return numbers ? fact(FACT_FLOAT) : fact(FACT_ANY);
+	case BC_TRUEDIV:
+		return numbers ? fact(FACT_FLOAT) : fact(FACT_ANY);
+	case BC_FLOORDIV:
+		return ints ? floordiv(x, y) : numbers ? fact(FACT_FLOAT) : fact(FACT_ANY);
+	case BC_MOD:
+		if (x.kind == FACT_STR) {
+			return fact(FACT_STR);
+		}
+		return ints ? mod(x, y) : numbers ? fact(FACT_FLOAT) : fact(FACT_ANY);
+	case BC_POW:
+		return ints && y.lo >= 0 ? fact(FACT_INT) : fact(FACT_ANY);
+	case BC_LSHIFT:
+		return ints ? fact(FACT_INT) : fact(FACT_ANY);
+	case BC_RSHIFT:
+		return ints && x.lo >= 0 ? fact(FACT_INT, 0, x.hi) : ints ? fact(FACT_INT) : fact(FACT_ANY);
+	case BC_BITAND: case BC_BITOR: case BC_BITXOR:
+		if (x.kind == FACT_BOOL && y.kind == FACT_BOOL) {
+			return fact(FACT_BOOL, 0, 1);
+		}
+		if (!ints) {
+			return fact(FACT_ANY);
+		}
+		if (i->op() == BC_BITAND && (x.lo >= 0 || y.lo >= 0)) {
+			return fact(FACT_INT, 0, x.lo >= 0 && y.lo >= 0 ? std::min(x.hi, y.hi) : x.lo >= 0 ? x.hi : y.hi);
+		}
+		return x.lo >= 0 && y.lo >= 0 ? fact(FACT_INT, 0) : fact(FACT_INT);
+
+	case BC_NEG:
+		if (is_int(x)) {
+			return fact(FACT_INT, x.hi == INT64_MAX || x.hi == INT64_MIN ? INT64_MIN : -x.hi,
+					x.lo == INT64_MIN ? INT64_MAX : -x.lo);
+		}
+		return x.kind == FACT_FLOAT ? x : fact(FACT_ANY);
+	case BC_POS:
+		return is_int(x) ? fact(FACT_INT, x.lo, x.hi) : x.kind == FACT_FLOAT ? x : fact(FACT_ANY);
+	case BC_INVERT:
+		/* ~n is -n - 1 */
+		if (is_int(x)) {
+			return fact(FACT_INT, x.hi == INT64_MAX ? INT64_MIN : ~x.hi, x.lo == INT64_MIN ? INT64_MAX : ~x.lo);
+		}
+		return fact(FACT_ANY);
+	case BC_NOT:
+		{
+			int t = truth(x);
+			return bool_fact(t < 0 ? -1 : !t);
+		}
+
+	case BC_LT: case BC_LE: case BC_EQ: case BC_NE: case BC_GT: case BC_GE:
+		return bool_fact(decide(i->op(), x, y));
+	case BC_IS: case BC_ISNOT: case BC_IN: case BC_NOTIN: case BC_EXCMATCH:
+		return bool_fact(-1);
+
+	case BC_GETITEM:
+		return x.kind == FACT_STR && is_int(y) ? fact(FACT_STR) : fact(FACT_ANY);
+
+	default:
+		return fact(FACT_ANY);
+	}
+}
+
+/* What operations do */
+
+/* Whether i may raise, given the facts of its operands */
+static bool may_raise(const ir_inst* i) {
+	ir_fact x = i->uses.size() > 0 ? i->uses[0].value->fact : fact(FACT_ANY);
+	ir_fact y = i->uses.size() > 1 ? i->uses[1].value->fact : fact(FACT_ANY);
+	bool ints = is_int(x) && is_int(y);
+	/* An int and a float, where the int converts */
+	bool numbers = ints || (x.kind == FACT_FLOAT && (y.kind == FACT_FLOAT || is_bounded(y)))
+			|| (y.kind == FACT_FLOAT && is_bounded(x));
+
+	switch (i->op()) {
+	case BC_NOP: case BC_MOVE: case BC_LOADK: case BC_CLEAR: case BC_BUILDLIST: case BC_BUILDTUPLE:
+	case BC_BUILDSLICE: case BC_MAKEFUNC: case BC_IS: case BC_ISNOT: case BC_NOT: case BC_JMP:
+		return false;
+	case BC_ADD: case BC_IADD:
+		return !numbers && !(x.kind == FACT_STR && y.kind == FACT_STR);
+	case BC_SUB: case BC_MUL:
+		return !numbers;
+	case BC_TRUEDIV:
+		return !(is_bounded(x) && is_bounded(y) && !has_zero(y));
+	case BC_FLOORDIV: case BC_MOD:
+		return !(ints && !has_zero(y));
+	case BC_LSHIFT:
+		return !(ints && y.lo >= 0 && y.hi <= 64);
+	case BC_RSHIFT:
+		return !(ints && y.lo >= 0);
+	case BC_BITAND: case BC_BITOR: case BC_BITXOR:
+		return !ints;
+	case BC_NEG: case BC_POS:
+		return !is_number(x);
+	case BC_INVERT:
+		return !is_int(x);
+	case BC_LT: case BC_LE: case BC_GT: case BC_GE:
+		return !(ints || (x.kind == FACT_FLOAT && y.kind == FACT_FLOAT) || (x.kind == FACT_STR && y.kind == FACT_STR));
+	case BC_EQ: case BC_NE:
+		return !(is_scalar(x) && is_scalar(y));
+	default:
+		return true;
+	}
+}
+
+/* Whether i may change something other than its registers: the heap, the globals or the cells */
+static bool writes_memory(const ir_inst* i) {
+	switch (i->op()) {
+	case BC_STOREGLOBAL: case BC_DELGLOBAL: case BC_STOREDEREF: case BC_DELDEREF: case BC_SETITEM: case BC_DELITEM:
+	case BC_SETATTR: case BC_LISTAPPEND: case BC_SETADD: case BC_RESERVE: case BC_UNPACK: case BC_FORITER: case BC_CALL:
+		return true;
+	case BC_IADD:
+		/* A list extends in place */
+		return !is_scalar(i->uses[0].value->fact);
+	default:
+		return false;
+	}
+}
+
+/* Whether i does more than give its values */
+static bool has_effects(const ir_inst* i) {
+	switch (i->op()) {
+	case BC_RETURN: case BC_RAISE: case BC_JMPIF: case BC_JMPIFNOT: case BC_FORITER: case BC_CHECKBOUND: case BC_DELFAST:
+		return true;
+	default:
+		return writes_memory(i);
+	}
+}
+
+/*
+ * Whether the value of i depends only on the values of its operands,
+ * and is one nothing can change, so that two of them are the same.
+ */
+static bool pure_value(const ir_inst* i) {
+	if (i->defs.size() != 1 || i->def_field != FIELD_A) {
+		return false;
+	}
+	switch (i->op()) {
+	case BC_LOADK: case BC_IS: case BC_ISNOT:
+		return true;
+	case BC_ADD: case BC_SUB: case BC_MUL: case BC_TRUEDIV: case BC_MOD: case BC_POW: case BC_LSHIFT: case BC_RSHIFT:
+	case BC_BITOR: case BC_BITXOR: case BC_BITAND: case BC_FLOORDIV: case BC_IADD: case BC_NEG: case BC_POS: case BC_INVERT:
+	case BC_NOT: case BC_LT: case BC_LE: case BC_EQ: case BC_NE: case BC_GT: case BC_GE: case BC_IN: case BC_NOTIN:
+	case BC_GETITEM:
+		for (auto& u : i->uses) {
+			if (!is_scalar(u.value->fact)) {
+				return false;
+			}
+		}
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Whether the value of i depends on its operands and on what writes_memory instructions change */
+static bool reads_memory(const ir_inst* i) {
+	if (i->defs.size() != 1 || i->def_field != FIELD_A || pure_value(i)) {
+		return false;
+	}
+	switch (i->op()) {
+	case BC_LOADGLOBAL: case BC_LOADDEREF: case BC_GETITEM: case BC_NOT: case BC_LT: case BC_LE: case BC_EQ: case BC_NE:
+	case BC_GT: case BC_GE: case BC_IN: case BC_NOTIN:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Whether every reader of v names it in a field, so that it can read it from another register */
+static bool movable_readers(const ir_value* v) {
+	if (!v->phi_users.empty()) {
+		return false;
+	}
+	for (auto u : v->users) {
+		for (auto& k : u->uses) {
+			if (k.value == v && k.field == FIELD_FIXED) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/* ranges */
+
+size_t pass_ranges(ir_function& fn) {
+	const code_object& co = *fn.co;
+	for (auto v : fn.entry) {
+		v->fact = fact(FACT_ANY);
+	}
+	for (auto b : fn.order) {
+		if (b->caught) {
+			b->caught->fact = fact(FACT_ANY);
+		}
+		for (auto phi : b->phis) {
+			phi->fact = fact(FACT_UNDEF);
+		}
+		for (auto i : b->insts) {
+			for (auto d : i->defs) {
+				d->fact = fact(FACT_UNDEF);
+			}
+		}
+	}
+
+	/* A loop header has an edge from a block after it */
+	std::vector<bool> header(fn.order.size(), false);
+	for (auto b : fn.order) {
+		for (auto& p : b->preds) {
+			if (p.from->rpo >= b->rpo) {
+				header[b->rpo] = true;
+			}
+		}
+	}
+
+	/* Bounds that grow at a loop header become none, and after long enough at any phi */
+	bool changed = true;
+	for (int round = 0; changed; ++round) {
+		changed = false;
+		for (auto b : fn.order) {
+			for (auto phi : b->phis) {
+				ir_fact f = fact(FACT_UNDEF);
+				for (auto v : phi->operands) {
+					f = join(f, v->fact);
+				}
+				ir_fact old = phi->fact;
+				f = join(f, old);
+				if ((header[b->rpo] || round > 16) && is_int(old) && is_int(f)) {
+					f.lo = f.lo < old.lo ? INT64_MIN : f.lo;
+					f.hi = f.hi > old.hi ? INT64_MAX : f.hi;
+				}
+				if (f != old) {
+					phi->fact = f;
+					changed = true;
+				}
+			}
+			for (auto i : b->insts) {
+				if (i->defs.size() == 1) {
+					ir_fact f = transfer(co, i);
+					if (f != i->defs[0]->fact) {
+						i->defs[0]->fact = f;
+						changed = true;
+					}
+				} else {
+					for (auto d : i->defs) {
+						if (d->fact.kind != FACT_ANY) {
+							d->fact = fact(FACT_ANY);
+							changed = true;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	/* Branches on a known truth value go one way */
+	size_t folded = 0;
+	std::vector<ir_block*> blocks = fn.order;
+	for (auto b : blocks) {
+		if (b->insts.empty()) {
+			continue;
+		}
+		ir_inst* i = b->insts.back();
+		if (i->op() != BC_JMPIF && i->op() != BC_JMPIFNOT) {
+			continue;
+		}
+		int t = truth(i->uses[0].value->fact);
+		if (t < 0) {
+			continue;
+		}
+		bool taken = (t == 1) == (i->op() == BC_JMPIF);
+		fn.remove(i);
+		fn.remove_edge(b, taken ? b->next : b->target, false);
+		if (taken) {
+			b->next = b->target;
+		}
+		b->target = nullptr;
+		++folded;
+	}
+	if (folded) {
+		fn.clean_up();
+	}
+	return folded;
+}
+
+/* copyprop */
+
+size_t pass_copyprop(ir_function& fn) {
+	size_t changed = 0;
+	for (auto b : fn.order) {
+		for (size_t k = 0; k < b->insts.size(); ) {
+			ir_inst* i = b->insts[k];
+			if (i->op() != BC_MOVE) {
+				++k;
+				continue;
+			}
+			ir_value* v = i->defs[0];
+			ir_value* w = i->uses[0].value;
+			if (w->reg == v->reg && fn.holds(w, i)) {
+				/* The register has it already */
+				fn.replace_all_uses(v, w);
+				fn.remove(i);
+				++changed;
+				continue;
+			}
+			std::vector<ir_inst*> users = v->users;
+			for (auto u : users) {
+				for (size_t n = 0; n < u->uses.size(); ++n) {
+					if (u->uses[n].value == v && u->uses[n].field != FIELD_FIXED && fn.holds(w, u)) {
+						fn.set_use(u, n, w);
+						++changed;
+					}
+				}
+			}
+			++k;
+		}
+	}
+	return changed;
+}
+
+/* licm */
+
+static const ir_block* def_block(const ir_value* v) {
+	switch (v->kind) {
+	case IV_INST: return v->inst->block;
+	case IV_ENTRY: return nullptr;
+	default: return v->block;
+	}
+}
+
+/* Sets of blocks by id, which grow with the blocks preheaders add */
+static bool has(const std::vector<bool>& s, const ir_block* b) {
+	return b && b->id < s.size() && s[b->id];
+}
+
+static void add(std::vector<bool>& s, const ir_block* b) {
+	if (b->id >= s.size()) {
+		s.resize(b->id + 1, false);
+	}
+	s[b->id] = true;
+}
+
+/* A block before the header of a loop, that the edges from outside the loop go to instead */
+static ir_block* preheader(ir_function& fn, ir_block* h, const std::vector<bool>& body) {
+	std::vector<size_t> outside;
+	for (size_t k = 0; k < h->preds.size(); ++k) {
+		if (!has(body, h->preds[k].from)) {
+			if (h->preds[k].exceptional) {
+				return nullptr;
+			}
+			outside.push_back(k);
+		}
+	}
+
+	ir_block* p = fn.new_block();
+	p->next = h;
+	for (auto k : outside) {
+		ir_block* from = h->preds[k].from;
+		p->preds.push_back(h->preds[k]);
+		if (from->next == h) {
+			from->next = p;
+		}
+		if (from->target == h) {
+			from->target = p;
+		}
+	}
+
+	/* A phi of the header takes the value from the preheader, where a phi merges it if it differs */
+	for (auto phi : h->phis) {
+		ir_value* same = phi->operands[outside[0]];
+		for (auto k : outside) {
+			if (phi->operands[k] != same) {
+				same = nullptr;
+			}
+		}
+		if (!same) {
+			same = fn.new_phi(p, phi->reg);
+			for (size_t n = 0; n < outside.size(); ++n) {
+				same->operands[n] = phi->operands[outside[n]];
+				same->operands[n]->phi_users.push_back(same);
+			}
+		}
+		for (auto k : outside) {
+			auto& users = phi->operands[k]->phi_users;
+			users.erase(std::find(users.begin(), users.end(), phi));
+		}
+		std::vector<ir_value*> operands;
+		for (size_t k = 0; k < phi->operands.size(); ++k) {
+			if (!has(body, h->preds[k].from)) {
+				continue;
+			}
+			operands.push_back(phi->operands[k]);
+		}
+		operands.push_back(same);
+		same->phi_users.push_back(phi);
+		phi->operands = operands;
+	}
+	std::vector<ir_edge> preds;
+	for (auto& e : h->preds) {
+		if (has(body, e.from)) {
+			preds.push_back(e);
+		}
+	}
+	preds.push_back(ir_edge{ p, false });
+	h->preds = preds;
+
+	fn.layout.insert(std::find(fn.layout.begin(), fn.layout.end(), h), p);
+	return p;
+}
+
+size_t pass_licm(ir_function& fn) {
+	struct loop {
+		ir_block* header;
+		std::vector<bool> body;
+		size_t size;
+	};
+
+	/* The natural loops, a back edge goes to a block that dominates where it comes from */
+	std::vector<loop> loops;
+	for (auto h : fn.order) {
+		std::vector<ir_block*> work;
+		for (auto& p : h->preds) {
+			if (!p.exceptional && fn.dominates(h, p.from)) {
+				work.push_back(p.from);
+			}
+		}
+		if (work.empty()) {
+			continue;
+		}
+		loop l{ h, std::vector<bool>(), 1 };
+		add(l.body, h);
+		while (!work.empty()) {
+			ir_block* b = work.back();
+			work.pop_back();
+			if (has(l.body, b)) {
+				continue;
+			}
+			add(l.body, b);
+			++l.size;
+			for (auto& p : b->preds) {
+				work.push_back(p.from);
+			}
+		}
+		loops.push_back(l);
+	}
+	/* Inner loops first, so that what leaves one can leave the one around it too */
+	std::stable_sort(loops.begin(), loops.end(), [](const loop& x, const loop& y) { return x.size < y.size; });
+
+	size_t changed = 0;
+	for (size_t n = 0; n < loops.size(); ++n) {
+		loop& l = loops[n];
+		ir_block* pre = nullptr;
+		std::vector<ir_block*> blocks = fn.order;
+		for (auto b : blocks) {
+			if (!has(l.body, b)) {
+				continue;
+			}
+			for (size_t k = 0; k < b->insts.size(); ) {
+				ir_inst* i = b->insts[k];
+				bool invariant = pure_value(i) && !may_raise(i) && movable_readers(i->defs[0])
+						&& fn.n_registers < MAX_REGISTERS;
+				for (auto& u : i->uses) {
+					invariant = invariant && !has(l.body, def_block(u.value));
+				}
+				if (!invariant) {
+					++k;
+					continue;
+				}
+				if (!pre) {
+					pre = preheader(fn, l.header, l.body);
+					if (!pre) {
+						break;
+					}
+					/* The loops around this one have it too */
+					for (size_t m = n + 1; m < loops.size(); ++m) {
+						if (has(loops[m].body, l.header)) {
+							add(loops[m].body, pre);
+						}
+					}
+				}
+				fn.remove(i);
+				fn.insert(i, pre, pre->insts.size());
+				i->defs[0]->reg = fn.n_registers++;
+				++changed;
+			}
+		}
+	}
+	return changed;
+}
+
+/* gvn */
+
+size_t pass_gvn(ir_function& fn) {
+	std::vector<std::vector<ir_block*> > children(fn.order.size());
+	for (size_t k = 1; k < fn.order.size(); ++k) {
+		children[fn.order[k]->idom->rpo].push_back(fn.order[k]);
+	}
+
+	typedef std::vector<uint64_t> key;
+	std::map<key, ir_value*> table;
+	std::vector<std::pair<key, ir_value*> > undo;
+	std::vector<uint64_t> exit_epoch(fn.order.size(), 0);
+	uint64_t epochs = 0;
+
+	struct frame {
+		ir_block* b;
+		size_t undo;
+		bool done;
+	};
+	std::vector<frame> stack{ frame{ fn.order[0], 0, false } };
+	size_t changed = 0;
+	while (!stack.empty()) {
+		if (stack.back().done) {
+			size_t to = stack.back().undo;
+			while (undo.size() > to) {
+				if (undo.back().second) {
+					table[undo.back().first] = undo.back().second;
+				} else {
+					table.erase(undo.back().first);
+				}
+				undo.pop_back();
+			}
+			stack.pop_back();
+			continue;
+		}
+		ir_block* b = stack.back().b;
+		stack.back().done = true;
+		stack.back().undo = undo.size();
+
+		/* What memory holds goes on from the dominator only on the edge from it */
+		uint64_t epoch = b->preds.size() == 1 && !b->preds[0].exceptional && b->preds[0].from == b->idom
+				? exit_epoch[b->idom->rpo] : ++epochs;
+
+		for (size_t k = 0; k < b->insts.size(); ) {
+			ir_inst* i = b->insts[k];
+			key h;
+			if (pure_value(i) || reads_memory(i)) {
+				h.push_back(i->op());
+				h.push_back(i->op() == BC_LOADK || i->op() == BC_LOADGLOBAL ? arg_bx(i->ins)
+						: i->op() == BC_LOADDEREF ? arg_b(i->ins) : 0);
+				h.push_back(reads_memory(i) ? epoch : 0);
+				for (auto& u : i->uses) {
+					h.push_back(u.value->id);
+				}
+			}
+			if (writes_memory(i)) {
+				epoch = ++epochs;
+			}
+			if (h.empty()) {
+				++k;
+				continue;
+			}
+
+			ir_value* v = i->defs[0];
+			auto it = table.find(h);
+			if (it != table.end()) {
+				ir_value* w = it->second;
+				if (w->reg == v->reg && fn.holds(w, i)) {
+					/* The register has it already */
+					fn.replace_all_uses(v, w);
+					fn.remove(i);
+					++changed;
+					continue;
+				}
+				bool everywhere = movable_readers(v);
+				for (auto u : v->users) {
+					everywhere = everywhere && fn.holds(w, u);
+				}
+				if (everywhere) {
+					std::vector<ir_inst*> users = v->users;
+					for (auto u : users) {
+						for (size_t n = 0; n < u->uses.size(); ++n) {
+							if (u->uses[n].value == v) {
+								fn.set_use(u, n, w);
+							}
+						}
+					}
+					fn.remove(i);
+					++changed;
+					continue;
+				}
+				if (i->op() != BC_LOADK && fn.holds(w, i)) {
+					fn.rewrite(i, encode_abc(BC_MOVE, 0, 0, 0), std::vector<ir_use>{ ir_use{ w, FIELD_B } });
+					++changed;
+					++k;
+					continue;
+				}
+			}
+			undo.emplace_back(h, it != table.end() ? it->second : nullptr);
+			table[h] = v;
+			++k;
+		}
+		exit_epoch[b->rpo] = epoch;
+
+		for (auto c : children[b->rpo]) {
+			stack.push_back(frame{ c, 0, false });
+		}
+	}
+	return changed;
+}
+
+/* dce */
+
+size_t pass_dce(ir_function& fn) {
+	std::unordered_set<const ir_value*> live;
+	std::vector<ir_value*> work;
+	auto uses_live = [&](const ir_inst* i) {
+		for (auto& u : i->uses) {
+			work.push_back(u.value);
+		}
+	};
+
+	for (auto b : fn.layout) {
+		for (auto i : b->insts) {
+			if (has_effects(i) || may_raise(i)) {
+				for (auto d : i->defs) {
+					live.insert(d);
+				}
+				uses_live(i);
+			}
+		}
+	}
+	while (!work.empty()) {
+		ir_value* v = work.back();
+		work.pop_back();
+		if (!live.insert(v).second) {
+			continue;
+		}
+		if (v->kind == IV_INST) {
+			for (auto d : v->inst->defs) {
+				live.insert(d);
+			}
+			uses_live(v->inst);
+		} else if (v->kind == IV_PHI) {
+			for (auto o : v->operands) {
+				work.push_back(o);
+			}
+		}
+	}
+
+	size_t changed = 0;
+	for (auto b : fn.layout) {
+		for (size_t k = 0; k < b->insts.size(); ) {
+			ir_inst* i = b->insts[k];
+			if (i->defs.empty() || live.count(i->defs[0])) {
+				++k;
+				continue;
+			}
+			fn.remove(i);
+			++changed;
+		}
+		for (size_t k = 0; k < b->phis.size(); ) {
+			ir_value* phi = b->phis[k];
+			if (live.count(phi)) {
+				++k;
+				continue;
+			}
+			for (auto v : phi->operands) {
+				auto& users = v->phi_users;
+				users.erase(std::find(users.begin(), users.end(), phi));
+			}
+			b->phis.erase(b->phis.begin() + k);
+		}
+	}
+	return changed;
+}
+
+/* The pass manager */
+
+static const struct {
+	const char* name;
+	size_t (*pass)(ir_function& fn);
+} known_passes[] = {
+	{ "ranges", pass_ranges },
+	{ "copyprop", pass_copyprop },
+	{ "licm", pass_licm },
+	{ "gvn", pass_gvn },
+	{ "dce", pass_dce }
+};
+
+pass_manager::pass_manager(const std::string& pipeline) {
+	steps.push_back(step{ "ssa", nullptr, 0, 0 });
+	size_t at = 0;
+	while (at < pipeline.size()) {
+		size_t end = std::min(pipeline.find(',', at), pipeline.size());
+		std::string name = pipeline.substr(at, end - at);
+		at = end + 1;
+		if (name.empty()) {
+			continue;
+		}
+		auto it = std::find_if(std::begin(known_passes), std::end(known_passes), [&](decltype(known_passes[0]) p) {
+			return name == p.name;
+		});
+		if (it == std::end(known_passes)) {
+			throw std::runtime_error("unknown pass '" + name + "'");
+		}
+		steps.push_back(step{ name, it->pass, 0, 0 });
+	}
+	steps.push_back(step{ "lower", nullptr, 0, 0 });
+}
+
+void pass_manager::run(code_object& co) {
+	typedef std::chrono::steady_clock clock;
+	++runs;
+
+	ir_function fn;
+	auto t = clock::now();
+	bool built = ir_function::build(co, fn);
+	auto now = clock::now();
+	steps.front().seconds += std::chrono::duration<double>(now - t).count();
+	if (!built) {
+		++skipped;
+		return;
+	}
+	++steps.front().changed;
+
+	for (size_t k = 1; k + 1 < steps.size(); ++k) {
+		t = clock::now();
+		size_t n = steps[k].pass(fn);
+		if (n) {
+			fn.analyze();
+		}
+		steps[k].seconds += std::chrono::duration<double>(clock::now() - t).count();
+		steps[k].changed += n;
+	}
+
+	if (dump) {
+		fn.dump(*dump);
+	}
+
+	t = clock::now();
+	if (fn.lower(co)) {
+		++steps.back().changed;
+	} else {
+		++skipped;
+	}
+	steps.back().seconds += std::chrono::duration<double>(clock::now() - t).count();
+}
+
+void pass_manager::report(std::ostream& out) const {
+	double total = 0;
+	for (auto& s : steps) {
+		total += s.seconds;
+	}
+	out << "passes: " << runs << " code objects, " << skipped << " left as they were, "
+			<< std::fixed << std::setprecision(3) << total * 1e3 << "ms" << std::endl;
+	out << std::setw(12) << "ms" << std::setw(12) << "changed" << "  pass" << std::endl;
+	for (auto& s : steps) {
+		out << std::setw(12) << s.seconds * 1e3 << std::setw(12) << s.changed << "  " << s.name << std::endl;
+	}
+	out.unsetf(std::ios::floatfield);
+}
+
+} /* namespace arbusto */
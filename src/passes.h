@@ -0,0 +1,74 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef PASSES_H_
+#define PASSES_H_
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "ir.h"
+
+namespace arbusto {
+
+/*
+ * The passes over the ir of ir.h. Each one gives how many things it
+ * changed.
+ *
+ *   ranges    the fact of every value: its type where the operations
+ *             tell, and for ints an interval, widened at loop headers so
+ *             that it ends. A branch on a known truth value goes away.
+ *   copyprop  readers of a MOVE read its source instead, where its
+ *             register still holds it.
+ *   licm      instructions of a loop that give the same value every
+ *             time go before the loop, into a register of their own.
+ *   gvn       an instruction that computes what one that dominates it
+ *             computed is replaced by that one.
+ *   dce       instructions whose value nobody reads, and that neither
+ *             raise nor do anything else, go away.
+ *
+ * Whether an operation may raise or do something else comes from the
+ * facts, so ranges goes first.
+ */
+size_t pass_ranges(ir_function& fn);
+size_t pass_copyprop(ir_function& fn);
+size_t pass_licm(ir_function& fn);
+size_t pass_gvn(ir_function& fn);
+size_t pass_dce(ir_function& fn);
+
+const char* const DEFAULT_PASSES = "ranges,copyprop,dce,licm,gvn,copyprop,dce";
+
+/* Runs a list of passes over code objects, timing each one */
+class pass_manager {
+public:
+	/* pipeline names the passes in order, separated by commas; throws std::runtime_error for an unknown one */
+	explicit pass_manager(const std::string& pipeline = DEFAULT_PASSES);
+
+	/* co becomes the code after the passes, unless ir_function::build or lower gives up on it */
+	void run(code_object& co);
+
+	/* The time and the changes of every pass, over every run */
+	void report(std::ostream& out) const;
+
+	std::ostream* dump{nullptr}; /* gets the ir of every code object after the passes */
+
+private:
+	struct step {
+		std::string name;
+		size_t (*pass)(ir_function& fn);
+		double seconds;
+		size_t changed;
+	};
+
+	std::vector<step> steps; /* the passes, between building the ir and lowering it */
+	size_t runs{0};
+	size_t skipped{0}; /* code objects the ir did not take */
+};
+
+} /* namespace arbusto */
+
+#endif /* PASSES_H_ */
@@ -0,0 +1,185 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef PCOMB_H_
+#define PCOMB_H_
+
+#include "parsersession.h"
+
+namespace arbusto {
+
+/*
+ * Parser combinators, one per grammar_node_type. A parser is a type with
+ *
+ *   static bool parse(parser_session& P);
+ *   static constexpr bool nullable(); // can match no tokens
+ *
+ * and the same contract as the emitted parse_N functions: on success the
+ * matched children are on top of P.stack, on failure P.pos and P.stack are
+ * as they were. Everything is static, so the compiler sees the whole
+ * grammar and is free to inline across rules.
+ *
+ * A rule refers to itself, so it can not be an alias: it is a struct
+ * deriving from rule<>, declared before any use, as generate_parser emits
+ * them with parser_options::combinators:
+ *
+ *   struct r_atom;
+ *   struct r_power : rule<NODE_RULE_power, true, seq<r_atom, opt<seq<tok<TOK_DOUBLESTAR>, r_factor>>>> {};
+ *
+ * The grammar checks are static_asserts in the parse functions, they run
+ * when every rule is complete.
+ */
+namespace pcomb {
+
+/* The next token is of kind K: a token_t, or a keyword id */
+template <int K>
+struct tok {
+	static_assert(K >= 0, "tok: not a token kind");
+
+	static bool parse(parser_session& P) { return P.chew_next_token(K); }
+	static constexpr bool nullable() { return false; }
+};
+
+/* Every element in order, without undoing anything on failure */
+template <class... E>
+struct all;
+
+template <>
+struct all<> {
+	static bool parse(parser_session&) { return true; }
+	static constexpr bool nullable() { return true; }
+};
+
+template <class E, class... Rest>
+struct all<E, Rest...> {
+	static bool parse(parser_session& P) { return E::parse(P) && all<Rest...>::parse(P); }
+	static constexpr bool nullable() { return E::nullable() && all<Rest...>::nullable(); }
+};
+
+/* Every element in order, or nothing */
+template <class E, class... Rest>
+struct seq {
+	static bool parse(parser_session& P) {
+		parser_mark m = P.mark();
+
+		if (!E::parse(P)) {
+			return false;
+		}
+		if (!all<Rest...>::parse(P)) {
+			P.reset(m);
+			return false;
+		}
+		return true;
+	}
+
+	static constexpr bool nullable() { return all<E, Rest...>::nullable(); }
+};
+
+template <class... E>
+struct alt;
+
+template <>
+struct alt<> {
+	static bool parse(parser_session&) { return false; }
+	static constexpr bool nullable() { return false; }
+};
+
+/* Ordered choice, the first alternative that matches wins */
+template <class E, class... Rest>
+struct alt<E, Rest...> {
+	static bool parse(parser_session& P) { return E::parse(P) || alt<Rest...>::parse(P); }
+	static constexpr bool nullable() { return E::nullable() || alt<Rest...>::nullable(); }
+};
+
+template <class E>
+struct opt {
+	static bool parse(parser_session& P) {
+		static_assert(!E::nullable(), "opt: the element can already match nothing");
+		E::parse(P);
+		return true;
+	}
+
+	static constexpr bool nullable() { return true; }
+};
+
+/* Zero or more times, stopping if an iteration matched nothing */
+template <class E>
+struct star {
+	static bool parse(parser_session& P) {
+		static_assert(!E::nullable(), "star: repeating something that can match nothing");
+		for (;;) {
+			size_t p = P.pos;
+			if (!E::parse(P) || P.pos == p) {
+				return true;
+			}
+		}
+	}
+
+	static constexpr bool nullable() { return true; }
+};
+
+template <class E>
+struct plus {
+	static bool parse(parser_session& P) {
+		static_assert(!E::nullable(), "plus: repeating something that can match nothing");
+		return E::parse(P) && star<E>::parse(P);
+	}
+
+	static constexpr bool nullable() { return E::nullable(); }
+};
+
+/*
+ * A node of type NodeType over what Body matched. With Collapse a lone
+ * child subtree is kept as is, see parser_options::collapse_chains.
+ */
+template <int NodeType, bool Collapse, class Body>
+struct rule {
+	static bool parse(parser_session& P) {
+		parser_mark m = P.mark();
+
+		if (!Body::parse(P)) {
+			return false;
+		}
+		if (!Collapse || !P.single_child(m)) {
+			P.reduce(NodeType, m);
+		}
+		return true;
+	}
+
+	/* Rules refer to each other, so this is not computed. No Python rule matches nothing. */
+	static constexpr bool nullable() { return false; }
+};
+
+/* A parse function from elsewhere, the climbing loops of parser_options::precedence_climbing */
+template <bool (*F)(parser_session&)>
+struct call {
+	static bool parse(parser_session& P) { return F(P); }
+	static constexpr bool nullable() { return false; }
+};
+
+/* E, or the tokens up to the next statement, see parser_session::recover_statement */
+template <class E, int... Sync>
+struct recover {
+	static bool parse(parser_session& P) {
+		static const int sync[] = { Sync..., -1 };
+		return E::parse(P) || (P.recovery && P.recover_statement(sync));
+	}
+
+	static constexpr bool nullable() { return E::nullable(); }
+};
+
+/* A suite skipped when the session parses lazily, see parser_options::lazy_rules */
+template <class E>
+struct lazy {
+	static bool parse(parser_session& P) { return P.lazy_bodies ? P.skip_suite() : E::parse(P); }
+	static constexpr bool nullable() { return E::nullable(); }
+};
+
+} /* namespace pcomb */
+
+} /* namespace arbusto */
+
+#endif /* PCOMB_H_ */
@@ -0,0 +1,53 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <stdexcept>
+
+#include "pyparser.h"
+
+namespace arbusto {
+
+std::string syntax_error_message(const token& t, const std::vector<int>& expected) {
+	/* The tokenizer already said what is wrong, see tokenizer::error_tokens */
+	if (t.tok == TOK_ERRORTOKEN) {
+		return t.data;
+	}
+
+	std::string msg = "syntax error at " + tokenizer::token2str(t.tok);
+
+	/* Not the text of NEWLINE and INDENT */
+	if (t.data.find_first_not_of(" \t\r\n\f") != std::string::npos) {
+		msg += " " + t.data;
+	}
+
+	for (size_t i = 0; i < expected.size(); ++i) {
+		msg += i == 0 ? ", expected " : (i + 1 == expected.size() ? " or " : ", ");
+		msg += token_kind_name(expected[i]);
+	}
+
+	return msg;
+}
+
+const ast_tree& lazy_suites::get(const astnode& lazy) {
+	auto it = bodies.find(lazy.token_index);
+
+	if (it != bodies.end()) {
+		return it->second;
+	}
+
+	P.restart(lazy.token_index);
+
+	if (!parse_lazy_suite(P)) {
+		auto& t = P.tokens[P.farthest];
+		throw std::runtime_error("line " + std::to_string(t.line_num) + ": " + syntax_error_message(t, P.expected()));
+	}
+
+	ast_tree& body = bodies[lazy.token_index];
+	P.build_tree(body);
+	return body;
+}
+
+} /* namespace arbusto */
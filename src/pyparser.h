@@ -0,0 +1,78 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef PYPARSER_H_
+#define PYPARSER_H_
+
+#include <string>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+
+#include "tokenizer.h"
+#include "astnode.h"
+#include "parsersession.h"
+
+/*
+ * Interface to the Python parser that generate_parser emits from the
+ * Grammar file. The build runs the generator and compiles its output into
+ * the arbusto binary.
+ */
+
+namespace arbusto {
+
+/* Kind of a token for parser_session: its token_t, or a keyword id */
+int token_kind(const token& t);
+std::string token_kind_name(int kind);
+
+std::string node_type_name(int node_type);
+
+/* The node type of a rule, -1 if the grammar has no such rule */
+int node_type_by_name(const std::string& name);
+
+/* "syntax error at TOK_NAME x, expected TOK_COLON or TOK_RARROW", expected as in parser_session::expected */
+std::string syntax_error_message(const token& t, const std::vector<int>& expected);
+
+/* Hash of the generated parser, the trees it builds only change with it */
+uint64_t grammar_fingerprint();
+
+/*
+ * Start symbols. On success the root node is left on P.stack, ready for
+ * P.build_tree; the trailing ENDMARKER is part of the rule so the whole
+ * token stream was consumed. With P.recovery the bad statements become
+ * NODE_TYPE_ERROR nodes, listed in P.errors, and the parse goes on.
+ */
+bool parse_file_input(parser_session& P);
+bool parse_eval_input(parser_session& P);
+bool parse_single_input(parser_session& P);
+
+/* The suite a NODE_TYPE_LAZY leaf stands for, starting at P.pos */
+bool parse_lazy_suite(parser_session& P);
+
+/*
+ * The function bodies skipped by a lazy parse of toks. Each one is parsed
+ * the first time it is asked for, and kept. Bodies are parsed lazily too,
+ * so nested functions show up as NODE_TYPE_LAZY leafs again.
+ */
+class lazy_suites {
+public:
+	explicit lazy_suites(const std::vector<token>& toks) : P(toks, token_kind) {
+		P.lazy_bodies = true;
+	}
+
+	/* The tree of the suite of lazy, throws on a syntax error in it */
+	const ast_tree& get(const astnode& lazy);
+
+	size_t parsed() const { return bodies.size(); }
+
+private:
+	parser_session P;
+	std::unordered_map<uint32_t, ast_tree> bodies; /* by first token */
+};
+
+} /* namespace arbusto */
+
+#endif /* PYPARSER_H_ */
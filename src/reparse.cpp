@@ -0,0 +1,201 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <stdexcept>
+#include <iterator>
+#include <algorithm>
+
+#include "reparse.h"
+#include "pyparser.h"
+
+namespace arbusto {
+
+/* A top level statement where the tokenizer can start over */
+struct top_statement {
+	size_t node; /* in the tree */
+	size_t token;
+	size_t byte;
+};
+
+/*
+ * The children of file_input but the ENDMARKER. One that does not start a
+ * line, like the NEWLINE alternative of file_input, goes with the statement
+ * before it. The first one also takes the comments and blank lines before it.
+ */
+static std::vector<top_statement> top_statements(const parsed_file& F) {
+	std::vector<top_statement> out;
+	const astnode* root = F.tree.root();
+
+	for (auto& c : root->children()) {
+		if (c.next_sibling() == root->next_sibling()) {
+			break;
+		}
+
+		size_t byte = F.tokens[c.token_index].pos;
+
+		if (out.empty()) {
+			byte = 0;
+		} else if (F.source[byte - 1] != '\n' && F.source[byte - 1] != '\r') {
+			continue;
+		}
+
+		out.push_back(top_statement{static_cast<size_t>(&c - root), c.token_index, byte});
+	}
+
+	return out;
+}
+
+/* Replace v[begin, end) with the n elements at src, the tail is moved once */
+template <typename T, typename It>
+static void splice(std::vector<T>& v, size_t begin, size_t end, It src, size_t n) {
+	size_t common = std::min(end - begin, n);
+
+	std::move(src, src + common, v.begin() + begin);
+
+	if (n < end - begin) {
+		v.erase(v.begin() + begin + n, v.begin() + end);
+	} else {
+		v.insert(v.begin() + end, std::make_move_iterator(src + common), std::make_move_iterator(src + n));
+	}
+}
+
+bool parse_source(parsed_file& F) {
+	tokenizer T;
+
+	F.tokens.clear();
+	try {
+		T.tokenize_string(F.source, F.tokens);
+	} catch (const std::runtime_error&) {
+		return false;
+	}
+
+	parser_session P(F.tokens, token_kind);
+
+	if (!parse_file_input(P)) {
+		return false;
+	}
+
+	P.build_tree(F.tree);
+	return true;
+}
+
+bool reparse(parsed_file& F, const text_edit& edit, reparse_stats* stats) {
+	if (edit.offset > F.source.size() || edit.removed > F.source.size() - edit.offset) {
+		return false;
+	}
+
+	std::string source = F.source.substr(0, edit.offset) + edit.inserted + F.source.substr(edit.offset + edit.removed);
+	ptrdiff_t delta = edit.inserted.size() - edit.removed;
+	auto stmts = top_statements(F);
+
+	if (stmts.empty()) {
+		parsed_file N;
+		N.source = std::move(source);
+
+		if (!parse_source(N)) {
+			return false;
+		}
+
+		F = std::move(N);
+		return true;
+	}
+
+	/* From the statement holding the byte before the edit, an insert may continue it */
+	size_t first = 0;
+	while (first + 1 < stmts.size() && stmts[first + 1].byte < edit.offset) {
+		++first;
+	}
+
+	/* To the first one starting past the edit, untouched and still at column 0 */
+	size_t last = first + 1;
+	while (last < stmts.size() && stmts[last].byte <= edit.offset + edit.removed) {
+		++last;
+	}
+
+	size_t begin_byte = stmts[first].byte;
+	size_t begin_token = stmts[first].token;
+	size_t base_line = (begin_byte == 0) ? 0 : F.tokens[begin_token].line_num - 1;
+
+	tokenizer T;
+	std::vector<token> toks;
+	ast_tree chunk;
+	bool at_end;
+
+	for (;; ++last) {
+		at_end = (last >= stmts.size());
+		size_t end_byte = at_end ? source.size() : stmts[last].byte + delta;
+
+		toks.clear();
+
+		try {
+			T.tokenize_string(source.substr(begin_byte, end_byte - begin_byte), toks);
+		} catch (const std::runtime_error&) {
+			if (at_end) {
+				return false;
+			}
+			continue;
+		}
+
+		parser_session P(toks, token_kind);
+
+		if (parse_file_input(P)) {
+			P.build_tree(chunk);
+			break;
+		}
+
+		if (at_end) {
+			return false;
+		}
+	}
+
+	/* The ENDMARKER of the chunk stands for the rest of the file, unless it is the end */
+	size_t end_token = at_end ? F.tokens.size() : stmts[last].token;
+	size_t keep = at_end ? toks.size() : toks.size() - 1;
+	ptrdiff_t token_delta = keep - (end_token - begin_token);
+	ptrdiff_t line_delta = at_end ? 0 : static_cast<ptrdiff_t>(base_line + toks.back().line_num) - F.tokens[end_token].line_num;
+
+	for (size_t i = 0; i < keep; ++i) {
+		toks[i].pos += begin_byte;
+		toks[i].line_num += base_line;
+	}
+
+	splice(F.tokens, begin_token, end_token, toks.begin(), keep);
+
+	for (size_t i = begin_token + keep; i < F.tokens.size(); ++i) {
+		F.tokens[i].pos += delta;
+		F.tokens[i].line_num += line_delta;
+	}
+
+	/* Same for the nodes, the statements of the chunk replace the old ones */
+	size_t begin_node = stmts[first].node;
+	size_t end_node = at_end ? F.tree.nodes.size() : stmts[last].node;
+	size_t chunk_end = at_end ? chunk.nodes.size() : chunk.nodes.size() - 1;
+	auto& nodes = F.tree.nodes;
+
+	for (size_t i = 1; i < chunk_end; ++i) {
+		chunk.nodes[i].token_index += begin_token;
+	}
+
+	splice(nodes, begin_node, end_node, chunk.nodes.begin() + 1, chunk_end - 1);
+
+	for (size_t i = begin_node + (chunk_end - 1); i < nodes.size(); ++i) {
+		nodes[i].token_index += token_delta;
+	}
+
+	nodes[0].size = nodes.size();
+	F.source = std::move(source);
+
+	if (stats) {
+		stats->statements_reused = first + (stmts.size() - last);
+		auto children = chunk.root()->children();
+		stats->statements_reparsed = std::distance(children.begin(), children.end()) - 1;
+		stats->tokens_relexed = toks.size();
+	}
+
+	return true;
+}
+
+} /* namespace arbusto */
@@ -0,0 +1,59 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef REPARSE_H_
+#define REPARSE_H_
+
+#include <vector>
+#include <string>
+
+#include "tokenizer.h"
+#include "astnode.h"
+
+namespace arbusto {
+
+/* Replace removed bytes at offset with inserted */
+struct text_edit {
+	size_t offset;
+	size_t removed;
+	std::string inserted;
+};
+
+/* A source file with its tokens and tree, kept in sync by reparse */
+struct parsed_file {
+	std::string source;
+	std::vector<token> tokens;
+	ast_tree tree;
+};
+
+struct reparse_stats {
+	size_t statements_reused{0};
+	size_t statements_reparsed{0};
+	size_t tokens_relexed{0};
+};
+
+/* Tokenize and parse F.source from scratch, false on a syntax or tokenizer error */
+bool parse_source(parsed_file& F);
+
+/*
+ * Apply edit to F.source and bring the tokens and the tree up to date.
+ *
+ * Only the top level statements touched by the edit are tokenized and
+ * parsed again. At the start of a top level statement the tokenizer is in
+ * its initial state (column 0, no brackets, no indents) so it can resume
+ * there with nothing saved. The statements before and after are reused, the
+ * ones after with their token positions, lines and indexes shifted. If the
+ * new text does not parse on its own, say a decorator now is followed by
+ * the old def, the reparsed range grows one statement at a time.
+ *
+ * Returns false, leaving F as it was, on a syntax or tokenizer error or
+ * an edit past the end of the source.
+ */
+bool reparse(parsed_file& F, const text_edit& edit, reparse_stats* stats = nullptr);
+
+} /* namespace arbusto */
+
+#endif /* REPARSE_H_ */
@@ -0,0 +1,1799 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+#include <cctype>
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <climits>
+
+#include "runtime.h"
+#include "literal.h"
+#include "interp.h"
+
+namespace arbusto {
+
+type_object::type_object(type_id id_, const char* name_, const type_object* base_, builtin_fn construct_,
+		const method_def* methods_)
+	: id(id_), name(name_), base(base_), construct(construct_), methods(methods_) {
+	refs = 1;
+	type = &type_type;
+}
+
+template <class T>
+static T* new_object(const type_object* type) {
+	T* o = new T();
+	o->refs = 1;
+	o->type = type;
+	return o;
+}
+
+void destroy(object* o) {
+	switch (o->type->id) {
+	case TYPE_INT: delete static_cast<int_object*>(o); break;
+	case TYPE_STR: delete static_cast<str_object*>(o); break;
+	case TYPE_TUPLE: delete static_cast<tuple_object*>(o); break;
+	case TYPE_LIST: delete static_cast<list_object*>(o); break;
+	case TYPE_DICT: delete static_cast<dict_object*>(o); break;
+	case TYPE_SET: delete static_cast<set_object*>(o); break;
+	case TYPE_RANGE: delete static_cast<range_object*>(o); break;
+	case TYPE_SLICE: delete static_cast<slice_object*>(o); break;
+	case TYPE_FUNCTION: delete static_cast<function_object*>(o); break;
+	case TYPE_BUILTIN: delete static_cast<builtin_object*>(o); break;
+	case TYPE_CELL: delete static_cast<cell_object*>(o); break;
+	case TYPE_ITERATOR: delete static_cast<iterator_object*>(o); break;
+	case TYPE_EXCEPTION: delete static_cast<exception_object*>(o); break;
+	default:
+		/* Types are static */
+		break;
+	}
+}
+
+value make_int(const bigint& i) {
+	int64_t small;
+	if (i.to_int64(small) && value::fits_small_int(small)) {
+		return value::small_int(small);
+	}
+	int_object* o = new_object<int_object>(&int_type);
+	o->v = i;
+	return value::steal(o);
+}
+
+int64_t big_int_of(const value& v) {
+	int64_t r;
+	if (!as<int_object>(v)->v.to_int64(r)) {
+		raise_error(&overflow_error_type, "Python int too large to convert to C int64_t");
+	}
+	return r;
+}
+
+bigint bigint_of(const value& v) {
+	if (v.is_object()) {
+		return as<int_object>(v)->v;
+	}
+	return bigint(int_of(v));
+}
+
+value int_from_float(double x) {
+	if (std::isnan(x)) {
+		raise_error(&value_error_type, "cannot convert float NaN to integer");
+	}
+	if (std::isinf(x)) {
+		raise_error(&overflow_error_type, "cannot convert float infinity to integer");
+	}
+	x = std::trunc(x);
+	if (std::fabs(x) < 9e15) {
+		return make_int(static_cast<int64_t>(x));
+	}
+	return make_int(bigint::from_double(x));
+}
+
+value make_str(const std::string& s) {
+	str_object* o = new_object<str_object>(&str_type);
+	o->s = s;
+	return value::steal(o);
+}
+
+value make_tuple(std::vector<value> items) {
+	tuple_object* o = new_object<tuple_object>(&tuple_type);
+	o->items = std::move(items);
+	return value::steal(o);
+}
+
+value make_list(std::vector<value> items) {
+	list_object* o = new_object<list_object>(&list_type);
+	o->items = std::move(items);
+	return value::steal(o);
+}
+
+value make_dict() {
+	return value::steal(new_object<dict_object>(&dict_type));
+}
+
+value make_set() {
+	return value::steal(new_object<set_object>(&set_type));
+}
+
+value make_cell(const value& v) {
+	cell_object* o = new_object<cell_object>(&cell_type);
+	o->v = v;
+	return value::steal(o);
+}
+
+value make_range(int64_t start, int64_t stop, int64_t step) {
+	range_object* o = new_object<range_object>(&range_type);
+	o->start = start;
+	o->stop = stop;
+	o->step = step;
+	return value::steal(o);
+}
+
+value make_slice(const value& start, const value& stop, const value& step) {
+	slice_object* o = new_object<slice_object>(&slice_type);
+	o->start = start;
+	o->stop = stop;
+	o->step = step;
+	return value::steal(o);
+}
+
+value make_function(const runtime_code* code, interpreter* interp) {
+	function_object* o = new_object<function_object>(&function_type);
+	o->code = code;
+	o->interp = interp;
+	return value::steal(o);
+}
+
+value make_builtin(const char* name, builtin_fn fn, const value& self) {
+	builtin_object* o = new_object<builtin_object>(&builtin_type);
+	o->name = name;
+	o->fn = fn;
+	o->self = self;
+	return value::steal(o);
+}
+
+value make_exception(const type_object* type, const value& args) {
+	exception_object* o = new_object<exception_object>(type);
+	o->args = args;
+	return value::steal(o);
+}
+
+value make_iterator(iter_kind kind, const value& seq, int64_t i, int64_t stop, int64_t step) {
+	iterator_object* o = new_object<iterator_object>(&iterator_type);
+	o->kind = kind;
+	o->seq = seq;
+	o->i = i;
+	o->stop = stop;
+	o->step = step;
+	return value::steal(o);
+}
+
+bool is_subtype(const type_object* t, const type_object* base) {
+	for (; t; t = t->base) {
+		if (t == base) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool is_instance(const value& v, const type_object* t) {
+	return is_subtype(v.type(), t);
+}
+
+void raise_error(const type_object* type, const std::string& message) {
+	throw py_exception(make_exception(type, make_tuple({ make_str(message) })));
+}
+
+const char* type_name(const value& v) {
+	return v.type()->name;
+}
+
+/* dict_table */
+
+long dict_table::slot_of(const value& key, size_t hash) const {
+	size_t mask = index.size() - 1;
+
+	for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+		int32_t e = index[i];
+		if (e < 0) {
+			return -static_cast<long>(i) - 1;
+		}
+		const entry& en = entries[e];
+		if (en.key.bound() && en.hash == hash && (en.key.is(key) || equals(en.key, key))) {
+			return static_cast<long>(i);
+		}
+	}
+}
+
+void dict_table::rebuild(size_t capacity) {
+	std::vector<entry> old;
+	old.swap(entries);
+	index.assign(capacity, -1);
+	live = 0;
+
+	for (auto& e : old) {
+		if (e.key.bound()) {
+			long s = slot_of(e.key, e.hash);
+			index[-s - 1] = static_cast<int32_t>(entries.size());
+			entries.push_back(std::move(e));
+			++live;
+		}
+	}
+}
+
+value* dict_table::find(const value& key) {
+	size_t hash = hash_of(key);
+
+	if (index.empty()) {
+		return nullptr;
+	}
+	long s = slot_of(key, hash);
+	return s >= 0 ? &entries[index[s]].v : nullptr;
+}
+
+void dict_table::set(const value& key, const value& v) {
+	size_t hash = hash_of(key);
+
+	if ((entries.size() + 1) * 3 > index.size() * 2) {
+		size_t capacity = 8;
+		while (capacity * 2 < (live + 1) * 3) {
+			capacity *= 2;
+		}
+		rebuild(capacity * 2);
+	}
+
+	long s = slot_of(key, hash);
+	if (s >= 0) {
+		entries[index[s]].v = v;
+		return;
+	}
+
+	index[-s - 1] = static_cast<int32_t>(entries.size());
+	entries.push_back(entry{hash, key, v});
+	++live;
+}
+
+bool dict_table::erase(const value& key) {
+	size_t hash = hash_of(key);
+
+	if (index.empty()) {
+		return false;
+	}
+	long s = slot_of(key, hash);
+	if (s < 0) {
+		return false;
+	}
+	/* The index keeps pointing at the entry, so probing goes on past it */
+	entry& e = entries[index[s]];
+	e.key = value();
+	e.v = value();
+	--live;
+	return true;
+}
+
+void dict_table::clear() {
+	entries.clear();
+	index.clear();
+	live = 0;
+}
+
+void dict_table::reserve(size_t n) {
+	size_t capacity = 8;
+	while (capacity * 2 < n * 3) {
+		capacity *= 2;
+	}
+	if (capacity > index.size()) {
+		rebuild(capacity);
+	}
+	entries.reserve(n);
+}
+
+/* Hashing and comparing */
+
+size_t hash_of(const value& v) {
+	switch (v.type()->id) {
+	case TYPE_NONE:
+		return 0x345678;
+	case TYPE_BOOL:
+		return v.bool_value();
+	case TYPE_INT:
+		{
+			/* As the float of the same value, see below */
+			if (v.is_small_int()) {
+				return static_cast<size_t>(v.small_int_value());
+			}
+			const bigint& x = as<int_object>(v)->v;
+			int64_t i;
+			double d;
+			if (x.to_int64(i)) {
+				return static_cast<size_t>(i);
+			}
+			if (x.to_double(d) && compare(bigint::from_double(d), x) == 0) {
+				return std::hash<double>()(d);
+			}
+			return std::hash<std::string>()(x.to_string(16));
+		}
+	case TYPE_FLOAT:
+		{
+			/* Equal numbers hash the same, 1.0 like 1 */
+			double d = float_of(v);
+			if (d == std::floor(d) && std::fabs(d) < 9.2e18) {
+				return static_cast<size_t>(static_cast<int64_t>(d));
+			}
+			return std::hash<double>()(d);
+		}
+	case TYPE_STR:
+		{
+			str_object* s = as<str_object>(v);
+			if (!s->hashed) {
+				s->hash = std::hash<std::string>()(s->s);
+				s->hashed = true;
+			}
+			return s->hash;
+		}
+	case TYPE_TUPLE:
+		{
+			size_t h = 0x345678;
+			for (auto& x : as<tuple_object>(v)->items) {
+				h = (h ^ hash_of(x)) * 1000003;
+			}
+			return h;
+		}
+	case TYPE_LIST:
+	case TYPE_DICT:
+	case TYPE_SET:
+		raise_error(&type_error_type, std::string("unhashable type: '") + type_name(v) + "'");
+	default:
+		return std::hash<const void*>()(v.get());
+	}
+}
+
+static bool is_number(const value& v) {
+	return is_intlike(v) || is_float(v);
+}
+
+double number_of(const value& v) {
+	if (is_float(v)) {
+		return float_of(v);
+	}
+	if (!v.is_object()) {
+		return static_cast<double>(int_of(v));
+	}
+	double d;
+	if (!as<int_object>(v)->v.to_double(d)) {
+		raise_error(&overflow_error_type, "int too large to convert to float");
+	}
+	return d;
+}
+
+/* -1, 0 or 1 as the int a is less than, equal to or greater than d, which is not a nan */
+static int compare_int_float(const value& a, double d) {
+	if (!a.is_object()) {
+		/* 48 bits are exact in a double */
+		double x = static_cast<double>(int_of(a));
+		return x < d ? -1 : x > d ? 1 : 0;
+	}
+	if (std::isinf(d)) {
+		return d > 0 ? -1 : 1;
+	}
+	double f = std::floor(d);
+	int c = compare(as<int_object>(a)->v, bigint::from_double(f));
+	return c ? c : f < d ? -1 : 0;
+}
+
+/* Three way comparison of two numbers, exact for ints of any size, 2 if one is a nan */
+static int compare_numbers(const value& a, const value& b) {
+	if (is_float(a) || is_float(b)) {
+		double x = is_float(a) ? float_of(a) : 0;
+		double y = is_float(b) ? float_of(b) : 0;
+		if (x != x || y != y) {
+			return 2;
+		}
+		if (!is_float(a)) {
+			return compare_int_float(a, y);
+		}
+		if (!is_float(b)) {
+			return -compare_int_float(b, x);
+		}
+		return x < y ? -1 : x > y ? 1 : 0;
+	}
+	if (!a.is_object() && !b.is_object()) {
+		int64_t x = int_of(a);
+		int64_t y = int_of(b);
+		return x < y ? -1 : x > y ? 1 : 0;
+	}
+	return compare(bigint_of(a), bigint_of(b));
+}
+
+/* Containers compare their items by identity first, as CPython does */
+static bool same_or_equal(const value& a, const value& b) {
+	return a.is(b) || equals(a, b);
+}
+
+static bool sequence_equals(const std::vector<value>& a, const std::vector<value>& b) {
+	if (a.size() != b.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < a.size(); ++i) {
+		if (!same_or_equal(a[i], b[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool equals(const value& a, const value& b) {
+	if (is_number(a) && is_number(b)) {
+		return compare_numbers(a, b) == 0;
+	}
+	if (a.type() != b.type()) {
+		return false;
+	}
+
+	switch (a.type()->id) {
+	case TYPE_STR:
+		return str_of(a) == str_of(b);
+	case TYPE_TUPLE:
+		return sequence_equals(as<tuple_object>(a)->items, as<tuple_object>(b)->items);
+	case TYPE_LIST:
+		return sequence_equals(as<list_object>(a)->items, as<list_object>(b)->items);
+	case TYPE_DICT:
+		{
+			dict_table& x = as<dict_object>(a)->table;
+			dict_table& y = as<dict_object>(b)->table;
+			if (x.size() != y.size()) {
+				return false;
+			}
+			for (auto& e : x.all()) {
+				if (e.key.bound()) {
+					value* v = y.find(e.key);
+					if (!v || !same_or_equal(e.v, *v)) {
+						return false;
+					}
+				}
+			}
+			return true;
+		}
+	case TYPE_SET:
+		{
+			dict_table& x = as<set_object>(a)->table;
+			dict_table& y = as<set_object>(b)->table;
+			if (x.size() != y.size()) {
+				return false;
+			}
+			for (auto& e : x.all()) {
+				if (e.key.bound() && !y.find(e.key)) {
+					return false;
+				}
+			}
+			return true;
+		}
+	case TYPE_RANGE:
+		{
+			range_object* x = as<range_object>(a);
+			range_object* y = as<range_object>(b);
+			return x->start == y->start && x->stop == y->stop && x->step == y->step;
+		}
+	default:
+		return a.is(b);
+	}
+}
+
+static const char* const compare_symbols[] = { "<", "<=", "==", "!=", ">", ">=" };
+
+static bool ordered(compare_op op, int c) {
+	switch (op) {
+	case CMP_OP_LT: return c < 0;
+	case CMP_OP_LE: return c <= 0;
+	case CMP_OP_GT: return c > 0;
+	case CMP_OP_GE: return c >= 0;
+	case CMP_OP_EQ: return c == 0;
+	case CMP_OP_NE: return c != 0;
+	}
+	return false;
+}
+
+static bool sequence_compare(compare_op op, const std::vector<value>& a, const std::vector<value>& b) {
+	size_t n = std::min(a.size(), b.size());
+
+	for (size_t i = 0; i < n; ++i) {
+		if (!same_or_equal(a[i], b[i])) {
+			return compare(op, a[i], b[i]);
+		}
+	}
+	return ordered(op, a.size() < b.size() ? -1 : a.size() > b.size() ? 1 : 0);
+}
+
+bool compare(compare_op op, const value& a, const value& b) {
+	if (op == CMP_OP_EQ) {
+		return equals(a, b);
+	}
+	if (op == CMP_OP_NE) {
+		return !equals(a, b);
+	}
+
+	if (is_number(a) && is_number(b)) {
+		/* Every ordering with a nan is false */
+		int c = compare_numbers(a, b);
+		return c != 2 && ordered(op, c);
+	}
+	if (is_str(a) && is_str(b)) {
+		return ordered(op, str_of(a).compare(str_of(b)));
+	}
+	if (is_type(a, list_type) && is_type(b, list_type)) {
+		return sequence_compare(op, as<list_object>(a)->items, as<list_object>(b)->items);
+	}
+	if (is_type(a, tuple_type) && is_type(b, tuple_type)) {
+		return sequence_compare(op, as<tuple_object>(a)->items, as<tuple_object>(b)->items);
+	}
+
+	raise_error(&type_error_type, std::string("'") + compare_symbols[op] + "' not supported between instances of '"
+			+ type_name(a) + "' and '" + type_name(b) + "'");
+}
+
+bool contains(const value& container, const value& item) {
+	switch (container.type()->id) {
+	case TYPE_STR:
+		if (!is_str(item)) {
+			raise_error(&type_error_type, std::string("'in <string>' requires string as left operand, not ")
+					+ type_name(item));
+		}
+		return str_of(container).find(str_of(item)) != std::string::npos;
+	case TYPE_DICT:
+		return as<dict_object>(container)->table.find(item) != nullptr;
+	case TYPE_SET:
+		return as<set_object>(container)->table.find(item) != nullptr;
+	case TYPE_RANGE:
+		{
+			range_object* r = as<range_object>(container);
+			if (!is_intlike(item)) {
+				break;
+			}
+			if (item.is_object()) {
+				/* Does not fit an int64_t, as the bounds do */
+				return false;
+			}
+			int64_t i = int_of(item);
+			if (r->step > 0 ? (i < r->start || i >= r->stop) : (i > r->start || i <= r->stop)) {
+				return false;
+			}
+			return (i - r->start) % r->step == 0;
+		}
+	default:
+		break;
+	}
+
+	value it = get_iter(container);
+	value x;
+	while (iter_next(it, x)) {
+		if (same_or_equal(x, item)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool truthy(const value& v) {
+	switch (v.type()->id) {
+	case TYPE_NONE: return false;
+	case TYPE_BOOL: return v.bool_value();
+	case TYPE_INT: return !v.is_small_int() || v.small_int_value() != 0;
+	case TYPE_FLOAT: return float_of(v) != 0;
+	case TYPE_STR: return !str_of(v).empty();
+	case TYPE_TUPLE: return !as<tuple_object>(v)->items.empty();
+	case TYPE_LIST: return !as<list_object>(v)->items.empty();
+	case TYPE_DICT: return as<dict_object>(v)->table.size() != 0;
+	case TYPE_SET: return as<set_object>(v)->table.size() != 0;
+	case TYPE_RANGE:
+		{
+			range_object* r = as<range_object>(v);
+			return r->step > 0 ? r->start < r->stop : r->start > r->stop;
+		}
+	default: return true;
+	}
+}
+
+/* Arithmetic */
+
+static const char* const binary_symbols[] = {
+	"+", "-", "*", "@", "/", "%", "** or pow()", "<<", ">>", "|", "^", "&", "//"
+};
+
+[[noreturn]] static void unsupported(binary_op op, const value& a, const value& b) {
+	raise_error(&type_error_type, std::string("unsupported operand type(s) for ") + binary_symbols[op] + ": '"
+			+ type_name(a) + "' and '" + type_name(b) + "'");
+}
+
+/* Both ints fit 48 bits, so only *, ** and << can overflow an int64_t; those go on as bigints */
+static bool small_int_binary(binary_op op, int64_t x, int64_t y, value& out) {
+	int64_t r;
+
+	switch (op) {
+	case BIN_ADD:
+		out = make_int(x + y);
+		return true;
+	case BIN_SUB:
+		out = make_int(x - y);
+		return true;
+	case BIN_MUL:
+		if (__builtin_mul_overflow(x, y, &r)) {
+			return false;
+		}
+		out = make_int(r);
+		return true;
+	case BIN_TRUEDIV:
+		if (y == 0) {
+			raise_error(&zero_division_error_type, "division by zero");
+		}
+		out = make_float(static_cast<double>(x) / static_cast<double>(y));
+		return true;
+	case BIN_FLOORDIV:
+		if (y == 0) {
+			raise_error(&zero_division_error_type, "integer division or modulo by zero");
+		}
+		r = x / y;
+		if (x % y != 0 && ((x < 0) != (y < 0))) {
+			--r;
+		}
+		out = make_int(r);
+		return true;
+	case BIN_MOD:
+		if (y == 0) {
+			raise_error(&zero_division_error_type, "integer division or modulo by zero");
+		}
+		r = x % y;
+		if (r != 0 && ((r < 0) != (y < 0))) {
+			r += y;
+		}
+		out = make_int(r);
+		return true;
+	case BIN_POW:
+		if (y < 0) {
+			return false;
+		}
+		r = 1;
+		while (y) {
+			if (y & 1 && __builtin_mul_overflow(r, x, &r)) {
+				return false;
+			}
+			y >>= 1;
+			if (y && __builtin_mul_overflow(x, x, &x)) {
+				return false;
+			}
+		}
+		out = make_int(r);
+		return true;
+	case BIN_LSHIFT:
+		if (y < 0) {
+			raise_error(&value_error_type, "negative shift count");
+		}
+		/* y redundant sign bits are the room to shift into */
+		if (x != 0 && (y >= 63 || y > __builtin_clrsbll(x))) {
+			return false;
+		}
+		out = make_int(x == 0 ? 0 : static_cast<int64_t>(static_cast<uint64_t>(x) << y));
+		return true;
+	case BIN_RSHIFT:
+		if (y < 0) {
+			raise_error(&value_error_type, "negative shift count");
+		}
+		out = make_int(y >= 63 ? (x < 0 ? -1 : 0) : x >> y);
+		return true;
+	case BIN_BITOR:
+		out = make_int(x | y);
+		return true;
+	case BIN_BITXOR:
+		out = make_int(x ^ y);
+		return true;
+	case BIN_BITAND:
+		out = make_int(x & y);
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* A shift count or exponent of y, OverflowError if it is too large to do */
+static uint64_t bigint_count(const bigint& y, const char* message) {
+	int64_t n;
+	if (!y.to_int64(n) || n > (int64_t(1) << 40)) {
+		raise_error(&overflow_error_type, message);
+	}
+	return static_cast<uint64_t>(n);
+}
+
+static value int_binary(binary_op op, const value& a, const value& b) {
+	if (is_type(a, bool_type) && is_type(b, bool_type)) {
+		switch (op) {
+		case BIN_BITOR: return make_bool(a.bool_value() | b.bool_value());
+		case BIN_BITXOR: return make_bool(a.bool_value() ^ b.bool_value());
+		case BIN_BITAND: return make_bool(a.bool_value() & b.bool_value());
+		default: break;
+		}
+	}
+
+	value r;
+	if (!a.is_object() && !b.is_object() && small_int_binary(op, int_of(a), int_of(b), r)) {
+		return r;
+	}
+
+	bigint x = bigint_of(a);
+	bigint y = bigint_of(b);
+	bigint q, m;
+
+	switch (op) {
+	case BIN_ADD: return make_int(x + y);
+	case BIN_SUB: return make_int(x - y);
+	case BIN_MUL: return make_int(x * y);
+	case BIN_TRUEDIV:
+		{
+			if (y.is_zero()) {
+				raise_error(&zero_division_error_type, "division by zero");
+			}
+			/*
+			 * The quotient to 64 bits or more, the lowest set if there is a
+			 * remainder, rounds to the double of the exact quotient
+			 */
+			bool neg = x.negative() != y.negative();
+			x = x.negative() ? -x : x;
+			y = y.negative() ? -y : y;
+			int64_t shift = std::max<int64_t>(0, 64 + static_cast<int64_t>(y.bit_length() - x.bit_length()));
+			divmod(x << static_cast<uint64_t>(shift), y, q, m);
+			if (!m.is_zero()) {
+				q = q | bigint(1);
+			}
+			double d;
+			if (!q.to_double(d) || std::isinf(d = std::ldexp(d, static_cast<int>(-shift)))) {
+				raise_error(&overflow_error_type, "integer division result too large for a float");
+			}
+			return make_float(neg ? -d : d);
+		}
+	case BIN_FLOORDIV:
+	case BIN_MOD:
+		if (y.is_zero()) {
+			raise_error(&zero_division_error_type, "integer division or modulo by zero");
+		}
+		divmod(x, y, q, m);
+		return make_int(op == BIN_FLOORDIV ? q : m);
+	case BIN_POW:
+		if (y.negative()) {
+			if (x.is_zero()) {
+				raise_error(&zero_division_error_type, "0.0 cannot be raised to a negative power");
+			}
+			return make_float(std::pow(number_of(a), number_of(b)));
+		}
+		if (x.is_zero() || compare(x, bigint(1)) == 0) {
+			return make_int(x);
+		}
+		if (compare(x, bigint(-1)) == 0) {
+			return make_int((bigint(1) & y).is_zero() ? 1 : -1);
+		}
+		return make_int(pow(x, bigint_count(y, "exponent too large")));
+	case BIN_LSHIFT:
+		if (y.negative()) {
+			raise_error(&value_error_type, "negative shift count");
+		}
+		if (x.is_zero()) {
+			return make_int(0);
+		}
+		return make_int(x << bigint_count(y, "too many digits in integer"));
+	case BIN_RSHIFT:
+		{
+			if (y.negative()) {
+				raise_error(&value_error_type, "negative shift count");
+			}
+			int64_t n;
+			if (!y.to_int64(n) || static_cast<uint64_t>(n) >= x.bit_length()) {
+				return make_int(x.negative() ? -1 : 0);
+			}
+			return make_int(x >> static_cast<uint64_t>(n));
+		}
+	case BIN_BITOR: return make_int(x | y);
+	case BIN_BITXOR: return make_int(x ^ y);
+	case BIN_BITAND: return make_int(x & y);
+	default:
+		unsupported(op, a, b);
+	}
+}
+
+/* CPython's float divmod: the floor quotient and a modulo with the sign of y */
+static void float_divmod(double x, double y, double& floordiv, double& mod) {
+	mod = std::fmod(x, y);
+	double div = (x - mod) / y;
+
+	if (mod) {
+		if ((y < 0) != (mod < 0)) {
+			mod += y;
+			div -= 1.0;
+		}
+	} else {
+		mod = std::copysign(0.0, y);
+	}
+
+	if (div) {
+		floordiv = std::floor(div);
+		if (div - floordiv > 0.5) {
+			floordiv += 1.0;
+		}
+	} else {
+		floordiv = std::copysign(0.0, x / y);
+	}
+}
+
+static value float_binary(binary_op op, const value& a, const value& b) {
+	double x = number_of(a);
+	double y = number_of(b);
+	double q, m;
+
+	switch (op) {
+	case BIN_ADD: return make_float(x + y);
+	case BIN_SUB: return make_float(x - y);
+	case BIN_MUL: return make_float(x * y);
+	case BIN_TRUEDIV:
+		if (y == 0) {
+			raise_error(&zero_division_error_type, "float division by zero");
+		}
+		return make_float(x / y);
+	case BIN_FLOORDIV:
+		if (y == 0) {
+			raise_error(&zero_division_error_type, "float floor division by zero");
+		}
+		float_divmod(x, y, q, m);
+		return make_float(q);
+	case BIN_MOD:
+		if (y == 0) {
+			raise_error(&zero_division_error_type, "float modulo");
+		}
+		float_divmod(x, y, q, m);
+		return make_float(m);
+	case BIN_POW:
+		if (x == 0 && y < 0) {
+			raise_error(&zero_division_error_type, "0.0 cannot be raised to a negative power");
+		}
+		if (x < 0 && y != std::floor(y)) {
+			raise_error(&value_error_type, "negative number cannot be raised to a fractional power");
+		}
+		q = std::pow(x, y);
+		if (std::isinf(q) && std::isfinite(x) && std::isfinite(y)) {
+			raise_error(&overflow_error_type, "(34, 'Numerical result out of range')");
+		}
+		return make_float(q);
+	default:
+		unsupported(op, a, b);
+	}
+}
+
+static std::vector<value> repeat(const std::vector<value>& items, int64_t times) {
+	std::vector<value> r;
+	for (int64_t i = 0; i < times; ++i) {
+		r.insert(r.end(), items.begin(), items.end());
+	}
+	return r;
+}
+
+static std::string repeat(const std::string& s, int64_t times) {
+	std::string r;
+	for (int64_t i = 0; i < times; ++i) {
+		r += s;
+	}
+	return r;
+}
+
+static value str_format(const std::string& format, const value& args);
+
+value binary(binary_op op, const value& a, const value& b) {
+	if (is_intlike(a) && is_intlike(b)) {
+		return int_binary(op, a, b);
+	}
+	if (is_number(a) && is_number(b)) {
+		return float_binary(op, a, b);
+	}
+
+	switch (op) {
+	case BIN_ADD:
+		if (a.type() == b.type()) {
+			switch (a.type()->id) {
+			case TYPE_STR:
+				return make_str(str_of(a) + str_of(b));
+			case TYPE_LIST:
+				{
+					std::vector<value> r = as<list_object>(a)->items;
+					r.insert(r.end(), as<list_object>(b)->items.begin(), as<list_object>(b)->items.end());
+					return make_list(std::move(r));
+				}
+			case TYPE_TUPLE:
+				{
+					std::vector<value> r = as<tuple_object>(a)->items;
+					r.insert(r.end(), as<tuple_object>(b)->items.begin(), as<tuple_object>(b)->items.end());
+					return make_tuple(std::move(r));
+				}
+			default:
+				break;
+			}
+		}
+		break;
+	case BIN_MUL:
+		{
+			const value& seq = is_intlike(a) ? b : a;
+			const value& times = is_intlike(a) ? a : b;
+			if (!is_intlike(times)) {
+				break;
+			}
+			switch (seq.type()->id) {
+			case TYPE_STR: return make_str(repeat(str_of(seq), int_of(times)));
+			case TYPE_LIST: return make_list(repeat(as<list_object>(seq)->items, int_of(times)));
+			case TYPE_TUPLE: return make_tuple(repeat(as<tuple_object>(seq)->items, int_of(times)));
+			default: break;
+			}
+		}
+		break;
+	case BIN_MOD:
+		if (is_str(a)) {
+			return str_format(str_of(a), b);
+		}
+		break;
+	default:
+		break;
+	}
+
+	unsupported(op, a, b);
+}
+
+value inplace_add(const value& a, const value& b) {
+	if (is_type(a, list_type)) {
+		std::vector<value> items = items_of(b);
+		auto& dst = as<list_object>(a)->items;
+		dst.insert(dst.end(), items.begin(), items.end());
+		return a;
+	}
+	return binary(BIN_ADD, a, b);
+}
+
+value negative(const value& a) {
+	if (is_intlike(a)) {
+		return a.is_object() ? make_int(-as<int_object>(a)->v) : make_int(-int_of(a));
+	}
+	if (is_float(a)) {
+		return make_float(-float_of(a));
+	}
+	raise_error(&type_error_type, std::string("bad operand type for unary -: '") + type_name(a) + "'");
+}
+
+value positive(const value& a) {
+	if (is_int(a) || is_float(a)) {
+		return a;
+	}
+	if (is_intlike(a)) {
+		return make_int(int_of(a));
+	}
+	raise_error(&type_error_type, std::string("bad operand type for unary +: '") + type_name(a) + "'");
+}
+
+value invert(const value& a) {
+	if (is_intlike(a)) {
+		return a.is_object() ? make_int(~as<int_object>(a)->v) : make_int(~int_of(a));
+	}
+	raise_error(&type_error_type, std::string("bad operand type for unary ~: '") + type_name(a) + "'");
+}
+
+std::string printf_string(const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	va_list again;
+	va_copy(again, args);
+	int n = std::vsnprintf(nullptr, 0, format, args);
+	va_end(args);
+
+	std::string r(n > 0 ? n : 0, '\0');
+	std::vsnprintf(&r[0], r.size() + 1, format, again);
+	va_end(again);
+	return r;
+}
+
+std::string utf8_encode(int64_t cp) {
+	std::string r;
+	if (cp < 0x80) {
+		r += static_cast<char>(cp);
+	} else if (cp < 0x800) {
+		r += static_cast<char>(0xc0 | (cp >> 6));
+		r += static_cast<char>(0x80 | (cp & 0x3f));
+	} else if (cp < 0x10000) {
+		r += static_cast<char>(0xe0 | (cp >> 12));
+		r += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+		r += static_cast<char>(0x80 | (cp & 0x3f));
+	} else {
+		r += static_cast<char>(0xf0 | (cp >> 18));
+		r += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+		r += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+		r += static_cast<char>(0x80 | (cp & 0x3f));
+	}
+	return r;
+}
+
+/*
+ * The digits of a %d %i %o %x or %X conversion, the magnitude, with the
+ * sign, # prefix, precision and width of spec as Python applies them.
+ */
+static std::string printf_integer(const std::string& spec, size_t flags_end, char conv, bool negative, std::string digits) {
+	std::string flags = spec.substr(1, flags_end - 1);
+	char* end;
+	size_t width = std::strtoul(spec.c_str() + flags_end, &end, 10);
+
+	if (*end == '.') {
+		size_t precision = std::strtoul(end + 1, nullptr, 10);
+		if (digits.size() < precision) {
+			digits.insert(0, precision - digits.size(), '0');
+		}
+	}
+
+	std::string prefix = negative ? "-" : flags.find('+') != std::string::npos ? "+" : flags.find(' ') != std::string::npos ? " " : "";
+	if (flags.find('#') != std::string::npos && conv != 'd' && conv != 'i') {
+		prefix += std::string("0") + conv;
+	}
+
+	if (prefix.size() + digits.size() >= width) {
+		return prefix + digits;
+	}
+	std::string pad(width - prefix.size() - digits.size(), ' ');
+	if (flags.find('-') != std::string::npos) {
+		return prefix + digits + pad;
+	}
+	if (flags.find('0') != std::string::npos) {
+		return prefix + std::string(pad.size(), '0') + digits;
+	}
+	return pad + prefix + digits;
+}
+
+/* printf style str % args: flags, width, precision and the usual conversions */
+static value str_format(const std::string& format, const value& args) {
+	std::vector<value> items = is_type(args, tuple_type) ? as<tuple_object>(args)->items : std::vector<value>{ args };
+	size_t next = 0;
+	std::string out;
+
+	for (size_t i = 0; i < format.size(); ++i) {
+		if (format[i] != '%') {
+			out += format[i];
+			continue;
+		}
+
+		std::string spec = "%";
+		for (++i; i < format.size() && std::strchr("-+ #0", format[i]); ++i) {
+			spec += format[i];
+		}
+		size_t flags_end = spec.size();
+		for (; i < format.size() && (std::isdigit(static_cast<unsigned char>(format[i])) || format[i] == '.'); ++i) {
+			spec += format[i];
+		}
+		if (i >= format.size()) {
+			raise_error(&value_error_type, "incomplete format");
+		}
+
+		char conv = format[i];
+		if (conv == '%') {
+			out += '%';
+			continue;
+		}
+		if (next >= items.size()) {
+			raise_error(&type_error_type, "not enough arguments for format string");
+		}
+		const value& v = items[next++];
+
+		switch (conv) {
+		case 's':
+		case 'r':
+			out += printf_string((spec + "s").c_str(), (conv == 's' ? to_str(v) : repr(v)).c_str());
+			break;
+		case 'd':
+		case 'i':
+		case 'x':
+		case 'X':
+		case 'o':
+			if (!is_number(v)) {
+				raise_error(&type_error_type, std::string("%") + conv + " format: a real number is required, not "
+						+ type_name(v));
+			}
+			{
+				/* The magnitude, the sign is added by printf_integer */
+				std::string digits;
+				bool negative;
+				if (v.is_object() || (is_float(v) && !(std::fabs(float_of(v)) < 9e18))) {
+					bigint x = is_float(v) ? bigint_of(int_from_float(float_of(v))) : as<int_object>(v)->v;
+					negative = x.negative();
+					digits = (negative ? -x : x).to_string(conv == 'o' ? 8 : conv == 'x' || conv == 'X' ? 16 : 10);
+				} else {
+					int64_t x = is_float(v) ? static_cast<int64_t>(float_of(v)) : int_of(v);
+					negative = x < 0;
+					digits = printf_string(conv == 'o' ? "%llo" : conv == 'x' || conv == 'X' ? "%llx" : "%llu",
+							static_cast<unsigned long long>(negative ? 0 - static_cast<uint64_t>(x) : x));
+				}
+				if (conv == 'X') {
+					std::transform(digits.begin(), digits.end(), digits.begin(), ::toupper);
+				}
+				out += printf_integer(spec, flags_end, conv, negative, digits);
+			}
+			break;
+		case 'f':
+		case 'F':
+		case 'e':
+		case 'E':
+		case 'g':
+		case 'G':
+			if (!is_number(v)) {
+				raise_error(&type_error_type, std::string("must be real number, not ") + type_name(v));
+			}
+			out += printf_string((spec + conv).c_str(), number_of(v));
+			break;
+		case 'c':
+			{
+				std::string c;
+				if (is_str(v)) {
+					c = str_of(v);
+				} else {
+					int64_t cp = index_of(v);
+					if (cp < 0 || cp >= 0x110000) {
+						raise_error(&overflow_error_type, "%c arg not in range(0x110000)");
+					}
+					c = utf8_encode(cp);
+				}
+				out += printf_string((spec + "s").c_str(), c.c_str());
+			}
+			break;
+		default:
+			raise_error(&value_error_type, std::string("unsupported format character '") + conv + "'");
+		}
+	}
+
+	if (next < items.size()) {
+		raise_error(&type_error_type, "not all arguments converted during string formatting");
+	}
+	return make_str(out);
+}
+
+/* repr and str */
+
+/* The containers being written, so a list that holds itself is [...] */
+static std::vector<object*> repr_stack;
+
+static std::string join_repr(const std::vector<value>& items, const char* open, const char* close) {
+	std::string r = open;
+	for (size_t i = 0; i < items.size(); ++i) {
+		r += (i ? ", " : "") + repr(items[i]);
+	}
+	return r + close;
+}
+
+static std::string hex_address(const void* p) {
+	char buf[32];
+	std::snprintf(buf, sizeof(buf), "%p", p);
+	return buf;
+}
+
+std::string repr(const value& v) {
+	switch (v.type()->id) {
+	case TYPE_NONE:
+		return "None";
+	case TYPE_BOOL:
+		return v.bool_value() ? "True" : "False";
+	case TYPE_INT:
+		return v.is_small_int() ? std::to_string(v.small_int_value()) : as<int_object>(v)->v.to_string();
+	case TYPE_FLOAT:
+		return float_repr(float_of(v));
+	case TYPE_STR:
+		{
+			std::ostringstream out;
+			write_str_repr(out, str_of(v).data(), str_of(v).size());
+			return out.str();
+		}
+	case TYPE_RANGE:
+		{
+			range_object* r = as<range_object>(v);
+			return "range(" + std::to_string(r->start) + ", " + std::to_string(r->stop)
+					+ (r->step != 1 ? ", " + std::to_string(r->step) : "") + ")";
+		}
+	case TYPE_SLICE:
+		{
+			slice_object* s = as<slice_object>(v);
+			return "slice(" + repr(s->start) + ", " + repr(s->stop) + ", " + repr(s->step) + ")";
+		}
+	case TYPE_FUNCTION:
+		return std::string("<function ") + as<function_object>(v)->code->co->name + " at " + hex_address(v.get())
+				+ ">";
+	case TYPE_BUILTIN:
+		{
+			builtin_object* b = as<builtin_object>(v);
+			if (b->self.bound()) {
+				return std::string("<built-in method ") + b->name + " of " + type_name(b->self) + " object at "
+						+ hex_address(b->self.get()) + ">";
+			}
+			return std::string("<built-in function ") + b->name + ">";
+		}
+	case TYPE_TYPE:
+		return std::string("<class '") + static_cast<const type_object*>(v.get())->name + "'>";
+	case TYPE_EXCEPTION:
+		{
+			auto& args = as<tuple_object>(as<exception_object>(v)->args)->items;
+			return type_name(v) + (args.size() == 1 ? "(" + repr(args[0]) + ")" : join_repr(args, "(", ")"));
+		}
+	case TYPE_CELL:
+		return "<cell at " + hex_address(v.get()) + ">";
+	case TYPE_ITERATOR:
+		return "<iterator object at " + hex_address(v.get()) + ">";
+	default:
+		break;
+	}
+
+	/* Containers */
+	if (std::find(repr_stack.begin(), repr_stack.end(), v.get()) != repr_stack.end()) {
+		return is_type(v, list_type) ? "[...]" : is_type(v, dict_type) ? "{...}" : "(...)";
+	}
+
+	repr_stack.push_back(v.get());
+	std::string r;
+
+	try {
+		switch (v.type()->id) {
+		case TYPE_TUPLE:
+			{
+				auto& items = as<tuple_object>(v)->items;
+				r = items.size() == 1 ? "(" + repr(items[0]) + ",)" : join_repr(items, "(", ")");
+			}
+			break;
+		case TYPE_LIST:
+			r = join_repr(as<list_object>(v)->items, "[", "]");
+			break;
+		case TYPE_DICT:
+			r = "{";
+			for (auto& e : as<dict_object>(v)->table.all()) {
+				if (e.key.bound()) {
+					r += (r.size() > 1 ? ", " : "") + repr(e.key) + ": " + repr(e.v);
+				}
+			}
+			r += "}";
+			break;
+		case TYPE_SET:
+			if (as<set_object>(v)->table.size() == 0) {
+				r = "set()";
+			} else {
+				r = "{";
+				for (auto& e : as<set_object>(v)->table.all()) {
+					if (e.key.bound()) {
+						r += (r.size() > 1 ? ", " : "") + repr(e.key);
+					}
+				}
+				r += "}";
+			}
+			break;
+		default:
+			r = "<object>";
+			break;
+		}
+	} catch (...) {
+		repr_stack.pop_back();
+		throw;
+	}
+
+	repr_stack.pop_back();
+	return r;
+}
+
+std::string to_str(const value& v) {
+	if (is_str(v)) {
+		return str_of(v);
+	}
+	if (is_instance(v, &base_exception_type)) {
+		auto& args = as<tuple_object>(as<exception_object>(v)->args)->items;
+		if (args.empty()) {
+			return "";
+		}
+		if (args.size() == 1) {
+			/* A KeyError shows the key as written */
+			return is_instance(v, &key_error_type) ? repr(args[0]) : to_str(args[0]);
+		}
+		return repr(as<exception_object>(v)->args);
+	}
+	return repr(v);
+}
+
+/* Line number line of file without its indentation, empty if there is no such line */
+static std::string source_line(const char* file, uint32_t line) {
+	std::ifstream in(file);
+	std::string text;
+	for (uint32_t i = 0; i < line && std::getline(in, text); ++i) {
+		if (i + 1 == line) {
+			size_t b = text.find_first_not_of(" \t\f");
+			size_t e = text.find_last_not_of(" \t\f\r");
+			return b == std::string::npos ? "" : text.substr(b, e - b + 1);
+		}
+	}
+	return "";
+}
+
+std::string format_exception(const value& exc) {
+	std::string r = "Traceback (most recent call last):\n";
+	auto& tb = as<exception_object>(exc)->traceback;
+
+	for (auto it = tb.rbegin(); it != tb.rend(); ++it) {
+		r += std::string("  File \"") + it->file + "\", line " + std::to_string(it->line) + ", in " + it->name + "\n";
+		std::string text = source_line(it->file, it->line);
+		if (!text.empty()) {
+			r += "    " + text + "\n";
+		}
+	}
+
+	std::string message = to_str(exc);
+	return r + type_name(exc) + (message.empty() ? "" : ": " + message);
+}
+
+/* Iteration */
+
+value get_iter(const value& v) {
+	switch (v.type()->id) {
+	case TYPE_LIST:
+	case TYPE_TUPLE:
+		return make_iterator(ITER_SEQ, v);
+	case TYPE_STR:
+		return make_iterator(ITER_STR, v);
+	case TYPE_RANGE:
+		{
+			range_object* r = as<range_object>(v);
+			return make_iterator(ITER_RANGE, v, r->start, r->stop, r->step);
+		}
+	case TYPE_DICT:
+	case TYPE_SET:
+		return make_iterator(ITER_DICT, v);
+	case TYPE_ITERATOR:
+		return v;
+	default:
+		raise_error(&type_error_type, std::string("'") + type_name(v) + "' object is not iterable");
+	}
+}
+
+size_t length_hint(const value& v) {
+	switch (v.type()->id) {
+	case TYPE_LIST: return as<list_object>(v)->items.size();
+	case TYPE_TUPLE: return as<tuple_object>(v)->items.size();
+	case TYPE_DICT: return as<dict_object>(v)->table.size();
+	case TYPE_SET: return as<set_object>(v)->table.size();
+	case TYPE_RANGE: return static_cast<size_t>(range_length(as<range_object>(v)));
+	default: return 0;
+	}
+}
+
+int64_t range_length(const range_object* r) {
+	if (r->step > 0) {
+		return r->stop > r->start ? (r->stop - r->start - 1) / r->step + 1 : 0;
+	}
+	return r->start > r->stop ? (r->start - r->stop - 1) / -r->step + 1 : 0;
+}
+
+/* The length of the UTF-8 sequence that starts with c */
+static size_t utf8_length(unsigned char c) {
+	return c < 0x80 ? 1 : c < 0xe0 ? 2 : c < 0xf0 ? 3 : 4;
+}
+
+bool iter_next(const value& itv, value& out) {
+	if (!is_type(itv, iterator_type)) {
+		raise_error(&type_error_type, std::string("'") + type_name(itv) + "' object is not an iterator");
+	}
+	iterator_object* it = as<iterator_object>(itv);
+
+	switch (it->kind) {
+	case ITER_SEQ:
+		{
+			auto& items = is_type(it->seq, list_type) ? as<list_object>(it->seq)->items
+					: as<tuple_object>(it->seq)->items;
+			if (it->i >= static_cast<int64_t>(items.size())) {
+				return false;
+			}
+			out = items[it->i++];
+			return true;
+		}
+	case ITER_STR:
+		{
+			const std::string& s = str_of(it->seq);
+			if (it->i >= static_cast<int64_t>(s.size())) {
+				return false;
+			}
+			size_t n = utf8_length(s[it->i]);
+			out = make_str(s.substr(it->i, n));
+			it->i += n;
+			return true;
+		}
+	case ITER_RANGE:
+		if (it->step > 0 ? it->i >= it->stop : it->i <= it->stop) {
+			return false;
+		}
+		out = make_int(it->i);
+		it->i += it->step;
+		return true;
+	case ITER_DICT:
+		{
+			auto& entries = is_type(it->seq, dict_type) ? as<dict_object>(it->seq)->table.all()
+					: as<set_object>(it->seq)->table.all();
+			while (it->i < static_cast<int64_t>(entries.size()) && !entries[it->i].key.bound()) {
+				++it->i;
+			}
+			if (it->i >= static_cast<int64_t>(entries.size())) {
+				return false;
+			}
+			out = entries[it->i++].key;
+			return true;
+		}
+	case ITER_ENUMERATE:
+		{
+			value x;
+			if (!iter_next(it->seq, x)) {
+				return false;
+			}
+			out = make_tuple({ make_int(it->i++), x });
+			return true;
+		}
+	case ITER_ZIP:
+		{
+			std::vector<value> items(it->its.size());
+			for (size_t i = 0; i < it->its.size(); ++i) {
+				if (!iter_next(it->its[i], items[i])) {
+					return false;
+				}
+			}
+			if (items.empty()) {
+				return false;
+			}
+			out = make_tuple(std::move(items));
+			return true;
+		}
+	case ITER_MAP:
+		{
+			value x;
+			if (!iter_next(it->seq, x)) {
+				return false;
+			}
+			out = call(it->fn, &x, 1);
+			return true;
+		}
+	case ITER_FILTER:
+		{
+			value x;
+			while (iter_next(it->seq, x)) {
+				if (is_type(it->fn, none_type) ? truthy(x) : truthy(call(it->fn, &x, 1))) {
+					out = x;
+					return true;
+				}
+			}
+			return false;
+		}
+	case ITER_REVERSED:
+		{
+			auto& items = is_type(it->seq, list_type) ? as<list_object>(it->seq)->items
+					: as<tuple_object>(it->seq)->items;
+			if (it->i < 0 || it->i >= static_cast<int64_t>(items.size())) {
+				return false;
+			}
+			out = items[it->i--];
+			return true;
+		}
+	}
+	return false;
+}
+
+std::vector<value> items_of(const value& v) {
+	if (is_type(v, list_type)) {
+		return as<list_object>(v)->items;
+	}
+	if (is_type(v, tuple_type)) {
+		return as<tuple_object>(v)->items;
+	}
+
+	std::vector<value> items;
+	value it = get_iter(v);
+	value x;
+	while (iter_next(it, x)) {
+		items.push_back(x);
+	}
+	return items;
+}
+
+/* Subscripts */
+
+int64_t index_of(const value& v) {
+	if (!is_intlike(v)) {
+		raise_error(&type_error_type, std::string("'") + type_name(v) + "' object cannot be interpreted as an integer");
+	}
+	if (v.is_object()) {
+		int64_t i;
+		if (!as<int_object>(v)->v.to_int64(i)) {
+			raise_error(&index_error_type, "cannot fit 'int' into an index-sized integer");
+		}
+		return i;
+	}
+	return int_of(v);
+}
+
+/* index_of for a slice, where an int too large for it only means as far as it goes */
+static int64_t slice_bound(const value& v) {
+	if (is_intlike(v) && v.is_object()) {
+		int64_t i;
+		if (!as<int_object>(v)->v.to_int64(i)) {
+			return as<int_object>(v)->v.negative() ? -INT64_MAX : INT64_MAX;
+		}
+		return i;
+	}
+	return index_of(v);
+}
+
+/* Python's slice.indices: the start, stop and step of s over a sequence of n items, and the count */
+static int64_t slice_indices(const slice_object* s, int64_t n, int64_t& start, int64_t& stop, int64_t& step) {
+	step = s->step.bound() && !is_type(s->step, none_type) ? slice_bound(s->step) : 1;
+	if (step == 0) {
+		raise_error(&value_error_type, "slice step cannot be zero");
+	}
+
+	int64_t lower = step < 0 ? -1 : 0;
+	int64_t upper = step < 0 ? n - 1 : n;
+	auto clamp = [&](const value& v, int64_t dflt) {
+		if (!v.bound() || is_type(v, none_type)) {
+			return dflt;
+		}
+		int64_t i = slice_bound(v);
+		if (i < 0) {
+			i += n;
+			return i < lower ? lower : i;
+		}
+		return i > upper ? upper : i;
+	};
+
+	start = clamp(s->start, step < 0 ? upper : lower);
+	stop = clamp(s->stop, step < 0 ? lower : upper);
+
+	if (step < 0) {
+		return stop < start ? (start - stop - 1) / (-step) + 1 : 0;
+	}
+	return start < stop ? (stop - start - 1) / step + 1 : 0;
+}
+
+static std::vector<value> slice_of(const std::vector<value>& items, const slice_object* s) {
+	int64_t start, stop, step;
+	int64_t n = slice_indices(s, items.size(), start, stop, step);
+	std::vector<value> r;
+
+	for (int64_t i = 0, j = start; i < n; ++i, j += step) {
+		r.push_back(items[j]);
+	}
+	return r;
+}
+
+/* i as an index into n items, IndexError if it is out of range */
+static size_t sequence_index(const value& key, size_t n, const char* what) {
+	int64_t i = index_of(key);
+	if (i < 0) {
+		i += n;
+	}
+	if (i < 0 || i >= static_cast<int64_t>(n)) {
+		raise_error(&index_error_type, std::string(what) + " index out of range");
+	}
+	return static_cast<size_t>(i);
+}
+
+static bool is_ascii(const std::string& s) {
+	for (unsigned char c : s) {
+		if (c >= 0x80) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* The byte offset of every character of s, and of its end */
+static std::vector<size_t> char_offsets(const std::string& s) {
+	std::vector<size_t> offsets;
+	for (size_t i = 0; i < s.size(); i += utf8_length(s[i])) {
+		offsets.push_back(i);
+	}
+	offsets.push_back(s.size());
+	return offsets;
+}
+
+static value str_item(const std::string& s, const value& key) {
+	bool ascii = is_ascii(s);
+	std::vector<size_t> offsets;
+	size_t n = s.size();
+
+	if (!ascii) {
+		offsets = char_offsets(s);
+		n = offsets.size() - 1;
+	}
+	auto char_at = [&](size_t i) {
+		return ascii ? s.substr(i, 1) : s.substr(offsets[i], offsets[i + 1] - offsets[i]);
+	};
+
+	if (is_type(key, slice_type)) {
+		int64_t start, stop, step;
+		int64_t count = slice_indices(as<slice_object>(key), n, start, stop, step);
+		std::string r;
+		for (int64_t i = 0, j = start; i < count; ++i, j += step) {
+			r += char_at(j);
+		}
+		return make_str(r);
+	}
+	return make_str(char_at(sequence_index(key, n, "string")));
+}
+
+value get_item(const value& obj, const value& key) {
+	switch (obj.type()->id) {
+	case TYPE_LIST:
+		{
+			auto& items = as<list_object>(obj)->items;
+			if (is_type(key, slice_type)) {
+				return make_list(slice_of(items, as<slice_object>(key)));
+			}
+			return items[sequence_index(key, items.size(), "list")];
+		}
+	case TYPE_TUPLE:
+		{
+			auto& items = as<tuple_object>(obj)->items;
+			if (is_type(key, slice_type)) {
+				return make_tuple(slice_of(items, as<slice_object>(key)));
+			}
+			return items[sequence_index(key, items.size(), "tuple")];
+		}
+	case TYPE_STR:
+		return str_item(str_of(obj), key);
+	case TYPE_DICT:
+		{
+			value* v = as<dict_object>(obj)->table.find(key);
+			if (!v) {
+				throw py_exception(make_exception(&key_error_type, make_tuple({ key })));
+			}
+			return *v;
+		}
+	case TYPE_RANGE:
+		{
+			range_object* r = as<range_object>(obj);
+			int64_t n = r->step > 0 ? (r->stop > r->start ? (r->stop - r->start - 1) / r->step + 1 : 0)
+					: (r->start > r->stop ? (r->start - r->stop - 1) / -r->step + 1 : 0);
+			return make_int(r->start + r->step * static_cast<int64_t>(sequence_index(key, n, "range object")));
+		}
+	default:
+		raise_error(&type_error_type, std::string("'") + type_name(obj) + "' object is not subscriptable");
+	}
+}
+
+void set_item(const value& obj, const value& key, const value& v) {
+	switch (obj.type()->id) {
+	case TYPE_LIST:
+		{
+			auto& items = as<list_object>(obj)->items;
+			if (is_type(key, slice_type)) {
+				int64_t start, stop, step;
+				int64_t n = slice_indices(as<slice_object>(key), items.size(), start, stop, step);
+				std::vector<value> src = items_of(v);
+				if (step == 1) {
+					stop = std::max(start, stop);
+					items.erase(items.begin() + start, items.begin() + stop);
+					items.insert(items.begin() + start, src.begin(), src.end());
+					return;
+				}
+				if (static_cast<int64_t>(src.size()) != n) {
+					raise_error(&value_error_type, "attempt to assign sequence of size " + std::to_string(src.size())
+							+ " to extended slice of size " + std::to_string(n));
+				}
+				for (int64_t i = 0, j = start; i < n; ++i, j += step) {
+					items[j] = src[i];
+				}
+				return;
+			}
+			items[sequence_index(key, items.size(), "list assignment")] = v;
+			return;
+		}
+	case TYPE_DICT:
+		as<dict_object>(obj)->table.set(key, v);
+		return;
+	default:
+		raise_error(&type_error_type, std::string("'") + type_name(obj) + "' object does not support item assignment");
+	}
+}
+
+void del_item(const value& obj, const value& key) {
+	switch (obj.type()->id) {
+	case TYPE_LIST:
+		{
+			auto& items = as<list_object>(obj)->items;
+			if (is_type(key, slice_type)) {
+				int64_t start, stop, step;
+				int64_t n = slice_indices(as<slice_object>(key), items.size(), start, stop, step);
+				std::vector<bool> gone(items.size());
+				for (int64_t i = 0, j = start; i < n; ++i, j += step) {
+					gone[j] = true;
+				}
+				std::vector<value> kept;
+				for (size_t i = 0; i < items.size(); ++i) {
+					if (!gone[i]) {
+						kept.push_back(items[i]);
+					}
+				}
+				items.swap(kept);
+				return;
+			}
+			items.erase(items.begin() + sequence_index(key, items.size(), "list assignment"));
+			return;
+		}
+	case TYPE_DICT:
+		if (!as<dict_object>(obj)->table.erase(key)) {
+			throw py_exception(make_exception(&key_error_type, make_tuple({ key })));
+		}
+		return;
+	default:
+		raise_error(&type_error_type, std::string("'") + type_name(obj) + "' object doesn't support item deletion");
+	}
+}
+
+/* Attributes */
+
+value get_attr(const value& obj, const char* name) {
+	for (const type_object* t = obj.type(); t; t = t->base) {
+		for (const method_def* m = t->methods; m && m->name; ++m) {
+			if (std::strcmp(m->name, name) == 0) {
+				return make_builtin(m->name, m->fn, obj);
+			}
+		}
+	}
+
+	if (is_instance(obj, &base_exception_type) && std::strcmp(name, "args") == 0) {
+		return as<exception_object>(obj)->args;
+	}
+	if (is_type(obj, function_type) && std::strcmp(name, "__name__") == 0) {
+		return make_str(as<function_object>(obj)->code->co->name);
+	}
+	if (is_type(obj, type_type) && std::strcmp(name, "__name__") == 0) {
+		return make_str(static_cast<const type_object*>(obj.get())->name);
+	}
+
+	raise_error(&attribute_error_type, std::string("'") + type_name(obj) + "' object has no attribute '" + name + "'");
+}
+
+void set_attr(const value& obj, const char* name, const value&) {
+	raise_error(&attribute_error_type, std::string("'") + type_name(obj) + "' object has no attribute '" + name + "'");
+}
+
+/* Calls */
+
+value call(const value& f, const value* args, size_t n, const keyword_args* kw) {
+	switch (f.type()->id) {
+	case TYPE_FUNCTION:
+		{
+			function_object* fn = as<function_object>(f);
+			return fn->interp->call_function(fn, args, n, kw);
+		}
+	case TYPE_BUILTIN:
+		{
+			builtin_object* b = as<builtin_object>(f);
+			if (!b->self.bound()) {
+				return b->fn(args, n, kw);
+			}
+			std::vector<value> with_self(n + 1);
+			with_self[0] = b->self;
+			std::copy(args, args + n, with_self.begin() + 1);
+			return b->fn(with_self.data(), n + 1, kw);
+		}
+	case TYPE_TYPE:
+		{
+			const type_object* t = static_cast<const type_object*>(f.get());
+			if (!t->construct) {
+				raise_error(&type_error_type, std::string("cannot create '") + t->name + "' instances");
+			}
+			return t->construct(args, n, kw);
+		}
+	default:
+		raise_error(&type_error_type, std::string("'") + type_name(f) + "' object is not callable");
+	}
+}
+
+} /* namespace arbusto */
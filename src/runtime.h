@@ -0,0 +1,482 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef RUNTIME_H_
+#define RUNTIME_H_
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <exception>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include "arena.h"
+#include "bigint.h"
+
+namespace arbusto {
+
+/*
+ * The objects of running Python code. A value is one 64-bit word that
+ * holds an int of 48 bits, a float, a bool or None unboxed, or points to
+ * a heap object with a reference count. Reference cycles are not
+ * collected.
+ *
+ * The word is NaN-boxed the way JavaScriptCore does it, with doubles
+ * offset by 2^49 so that pointers keep their bits:
+ *
+ *   0                       unbound
+ *   2, 4, 5                 None, False, True
+ *   0000:pointer            a heap object, 8 aligned
+ *   0002:0000.. - FFFA:..   a double plus 2^49, NaNs made canonical
+ *   FFFF:int48              an int in [-2^47, 2^47)
+ *
+ * This needs heap pointers below 2^48, as on x86-64 and AArch64.
+ */
+
+struct type_object;
+struct runtime_code;
+class interpreter;
+
+struct object {
+	uint32_t refs;
+	const type_object* type;
+};
+
+void destroy(object* o);
+
+class value {
+public:
+	static const uint64_t NONE_BITS = 2;
+	static const uint64_t FALSE_BITS = 4;
+	static const uint64_t TRUE_BITS = 5;
+	static const uint64_t INT_TAG = uint64_t(0xffff) << 48;
+	static const uint64_t DOUBLE_OFFSET = uint64_t(1) << 49;
+	static const int64_t SMALL_INT_MIN = -(int64_t(1) << 47);
+	static const int64_t SMALL_INT_MAX = (int64_t(1) << 47) - 1;
+
+	value() : bits(0) {}
+	value(const value& v) : bits(v.bits) {
+		if (is_object()) {
+			++get()->refs;
+		}
+	}
+	value(value&& v) noexcept : bits(v.bits) {
+		v.bits = 0;
+	}
+	~value() {
+		release(bits);
+	}
+
+	value& operator=(const value& v) {
+		if (v.is_object()) {
+			++v.get()->refs;
+		}
+		uint64_t old = bits;
+		bits = v.bits;
+		release(old);
+		return *this;
+	}
+
+	value& operator=(value&& v) noexcept {
+		if (this != &v) {
+			uint64_t old = bits;
+			bits = v.bits;
+			v.bits = 0;
+			release(old);
+		}
+		return *this;
+	}
+
+	/* Takes over the reference the caller has to o */
+	static value steal(object* o) {
+		value v;
+		v.bits = reinterpret_cast<uintptr_t>(o);
+		return v;
+	}
+
+	/* A new reference to o */
+	static value borrow(object* o) {
+		++o->refs;
+		return steal(o);
+	}
+
+	static value none() { return from_bits(NONE_BITS); }
+	static value boolean(bool b) { return from_bits(b ? TRUE_BITS : FALSE_BITS); }
+
+	/* i must be in [SMALL_INT_MIN, SMALL_INT_MAX] */
+	static value small_int(int64_t i) { return from_bits(INT_TAG | (static_cast<uint64_t>(i) & 0xffffffffffff)); }
+
+	static value real(double d) {
+		uint64_t b;
+		if (d != d) {
+			b = 0x7ff8000000000000;
+		} else {
+			std::memcpy(&b, &d, sizeof(b));
+		}
+		return from_bits(b + DOUBLE_OFFSET);
+	}
+
+	static bool fits_small_int(int64_t i) { return i >= SMALL_INT_MIN && i <= SMALL_INT_MAX; }
+
+	bool is_object() const { return bits - 8 < (uint64_t(1) << 48) - 8; }
+	bool is_small_int() const { return (bits & INT_TAG) == INT_TAG; }
+	bool is_real() const { return bits >= DOUBLE_OFFSET && !is_small_int(); }
+	bool is_none() const { return bits == NONE_BITS; }
+	bool is_bool() const { return (bits | 1) == TRUE_BITS; }
+
+	int64_t small_int_value() const { return static_cast<int64_t>(bits << 16) >> 16; }
+	double real_value() const {
+		uint64_t b = bits - DOUBLE_OFFSET;
+		double d;
+		std::memcpy(&d, &b, sizeof(d));
+		return d;
+	}
+	bool bool_value() const { return bits == TRUE_BITS; }
+
+	/* Only for a heap object */
+	object* get() const { return reinterpret_cast<object*>(static_cast<uintptr_t>(bits)); }
+	inline const type_object* type() const;
+
+	/* False for an unbound local or cell */
+	bool bound() const { return bits != 0; }
+
+	bool is(const value& v) const { return bits == v.bits; }
+
+	uint64_t raw() const { return bits; }
+
+private:
+	static value from_bits(uint64_t b) {
+		value v;
+		v.bits = b;
+		return v;
+	}
+
+	static void release(uint64_t b) {
+		if (b - 8 < (uint64_t(1) << 48) - 8) {
+			object* p = reinterpret_cast<object*>(static_cast<uintptr_t>(b));
+			if (--p->refs == 0) {
+				destroy(p);
+			}
+		}
+	}
+
+	uint64_t bits;
+};
+
+enum type_id {
+	TYPE_NONE,
+	TYPE_BOOL,
+	TYPE_INT,
+	TYPE_FLOAT,
+	TYPE_STR,
+	TYPE_TUPLE,
+	TYPE_LIST,
+	TYPE_DICT,
+	TYPE_SET,
+	TYPE_RANGE,
+	TYPE_SLICE,
+	TYPE_FUNCTION,
+	TYPE_BUILTIN,
+	TYPE_CELL,
+	TYPE_ITERATOR,
+	TYPE_TYPE,
+	TYPE_EXCEPTION
+};
+
+/* Keyword arguments of a call: n values, and their names as str objects */
+struct keyword_args {
+	const value* values;
+	const value* names;
+	size_t n;
+};
+
+typedef value (*builtin_fn)(const value* args, size_t n, const keyword_args* kw);
+
+struct method_def {
+	const char* name;
+	builtin_fn fn; /* gets self as args[0] */
+};
+
+struct type_object : object {
+	type_object(type_id id_, const char* name_, const type_object* base_, builtin_fn construct_,
+			const method_def* methods_);
+
+	type_id id;
+	const char* name;
+	const type_object* base;
+	builtin_fn construct; /* nullptr if the type cannot be called */
+	const method_def* methods; /* ends with a nullptr name */
+};
+
+/* An int that does not fit a value */
+struct int_object : object {
+	bigint v;
+};
+
+struct str_object : object {
+	std::string s; /* UTF-8, indexed by byte */
+	size_t hash{0};
+	bool hashed{false};
+};
+
+struct tuple_object : object {
+	std::vector<value> items;
+};
+
+struct list_object : object {
+	std::vector<value> items;
+};
+
+/*
+ * Insertion ordered hash table, as CPython's dict: entries in order and
+ * an open addressing index into them. Deleted entries stay, unbound, until
+ * the next rebuild.
+ */
+class dict_table {
+public:
+	struct entry {
+		size_t hash;
+		value key;
+		value v;
+	};
+
+	/* nullptr if key is not in the table */
+	value* find(const value& key);
+
+	void set(const value& key, const value& v);
+	bool erase(const value& key);
+	void clear();
+	/* Room for n keys, so setting that many does not rebuild */
+	void reserve(size_t n);
+
+	size_t size() const { return live; }
+
+	/* Includes deleted entries, see entry::key.bound() */
+	const std::vector<entry>& all() const { return entries; }
+
+private:
+	long slot_of(const value& key, size_t hash) const;
+	void rebuild(size_t capacity);
+
+	std::vector<entry> entries;
+	std::vector<int32_t> index; /* -1 is empty */
+	size_t live{0};
+};
+
+struct dict_object : object {
+	dict_table table;
+};
+
+struct set_object : object {
+	dict_table table; /* the values are None */
+};
+
+struct range_object : object {
+	int64_t start;
+	int64_t stop;
+	int64_t step;
+};
+
+struct slice_object : object {
+	value start;
+	value stop;
+	value step;
+};
+
+struct function_object : object {
+	const runtime_code* code;
+	interpreter* interp;
+	std::vector<value> defaults; /* of the last positional parameters */
+	std::vector<value> kwdefaults; /* one per keyword only parameter, unbound without a default */
+	std::vector<value> closure; /* cells */
+};
+
+struct builtin_object : object {
+	const char* name;
+	builtin_fn fn;
+	value self; /* bound for methods */
+};
+
+struct cell_object : object {
+	value v;
+};
+
+enum iter_kind { ITER_SEQ, ITER_STR, ITER_RANGE, ITER_DICT, ITER_ENUMERATE, ITER_ZIP, ITER_MAP, ITER_FILTER, ITER_REVERSED };
+
+struct iterator_object : object {
+	iter_kind kind;
+	value seq; /* the object iterated, or the inner iterator */
+	value fn; /* ITER_MAP and ITER_FILTER */
+	std::vector<value> its; /* ITER_ZIP */
+	int64_t i;
+	int64_t stop;
+	int64_t step;
+};
+
+struct traceback_entry {
+	const char* file;
+	const char* name;
+	uint32_t line;
+};
+
+struct exception_object : object {
+	value args; /* a tuple */
+	std::vector<traceback_entry> traceback; /* innermost first */
+};
+
+/* A Python exception on its way up the C++ stack */
+class py_exception : public std::exception {
+public:
+	explicit py_exception(const value& exc_) : exc(exc_) {}
+
+	const char* what() const noexcept { return "python exception"; }
+
+	value exc; /* an exception_object */
+};
+
+extern type_object none_type, bool_type, int_type, float_type, str_type, tuple_type, list_type, dict_type,
+		set_type, range_type, slice_type, function_type, builtin_type, cell_type, iterator_type, type_type;
+
+extern type_object base_exception_type, exception_type, arithmetic_error_type, zero_division_error_type,
+		overflow_error_type, lookup_error_type, index_error_type, key_error_type, value_error_type, type_error_type,
+		name_error_type, unbound_local_error_type, attribute_error_type, assertion_error_type, runtime_error_type,
+		recursion_error_type, not_implemented_error_type, stop_iteration_type;
+
+inline const type_object* value::type() const {
+	if (is_object()) {
+		return get()->type;
+	}
+	if (is_small_int()) {
+		return &int_type;
+	}
+	if (bits >= DOUBLE_OFFSET) {
+		return &float_type;
+	}
+	return bits == NONE_BITS ? &none_type : &bool_type;
+}
+
+/* None, bools, floats and the ints of 48 bits are not allocated */
+inline value none() { return value::none(); }
+inline value make_bool(bool b) { return value::boolean(b); }
+inline value make_float(double f) { return value::real(f); }
+
+/* Unboxed if it fits, an int_object if it does not */
+value make_int(const bigint& i);
+inline value make_int(int64_t i) {
+	return value::fits_small_int(i) ? value::small_int(i) : make_int(bigint(i));
+}
+
+value make_str(const std::string& s);
+value make_tuple(std::vector<value> items);
+value make_list(std::vector<value> items);
+value make_dict();
+value make_set();
+value make_cell(const value& v);
+value make_range(int64_t start, int64_t stop, int64_t step);
+value make_slice(const value& start, const value& stop, const value& step);
+value make_function(const runtime_code* code, interpreter* interp);
+value make_builtin(const char* name, builtin_fn fn, const value& self = value());
+value make_exception(const type_object* type, const value& args);
+value make_iterator(iter_kind kind, const value& seq, int64_t i = 0, int64_t stop = 0, int64_t step = 1);
+
+inline bool is_type(const value& v, const type_object& t) { return v.type() == &t; }
+inline bool is_int(const value& v) { return v.is_small_int() || (v.is_object() && v.get()->type == &int_type); }
+inline bool is_float(const value& v) { return v.is_real(); }
+inline bool is_str(const value& v) { return v.is_object() && v.get()->type == &str_type; }
+
+/* int or bool, which Python treats as an int */
+inline bool is_intlike(const value& v) { return is_int(v) || v.is_bool(); }
+
+/* The int or bool v, OverflowError if it does not fit an int64_t */
+int64_t big_int_of(const value& v);
+inline int64_t int_of(const value& v) {
+	if (v.is_small_int()) {
+		return v.small_int_value();
+	}
+	if (v.is_bool()) {
+		return v.bool_value();
+	}
+	return big_int_of(v);
+}
+
+/* The int or bool v, whatever its size */
+bigint bigint_of(const value& v);
+
+/* An int, bool or float as a double, OverflowError if the int is too large */
+double number_of(const value& v);
+
+/* The int of the integral part of x, ValueError or OverflowError for a nan or an infinity */
+value int_from_float(double x);
+
+inline double float_of(const value& v) { return v.real_value(); }
+inline const std::string& str_of(const value& v) { return static_cast<str_object*>(v.get())->s; }
+
+template <class T>
+inline T* as(const value& v) { return static_cast<T*>(v.get()); }
+
+bool is_subtype(const type_object* t, const type_object* base);
+bool is_instance(const value& v, const type_object* t);
+
+/* Raise a new exception of type with message */
+[[noreturn]] void raise_error(const type_object* type, const std::string& message);
+
+enum binary_op {
+	BIN_ADD, BIN_SUB, BIN_MUL, BIN_MATMUL, BIN_TRUEDIV, BIN_MOD, BIN_POW,
+	BIN_LSHIFT, BIN_RSHIFT, BIN_BITOR, BIN_BITXOR, BIN_BITAND, BIN_FLOORDIV
+};
+
+enum compare_op { CMP_OP_LT, CMP_OP_LE, CMP_OP_EQ, CMP_OP_NE, CMP_OP_GT, CMP_OP_GE };
+
+value binary(binary_op op, const value& a, const value& b);
+value inplace_add(const value& a, const value& b);
+value negative(const value& a);
+value positive(const value& a);
+value invert(const value& a);
+bool compare(compare_op op, const value& a, const value& b);
+bool equals(const value& a, const value& b);
+bool contains(const value& container, const value& item);
+bool truthy(const value& v);
+size_t hash_of(const value& v);
+
+std::string repr(const value& v);
+std::string to_str(const value& v);
+/* snprintf into a string as long as the result */
+std::string printf_string(const char* format, ...);
+/* The UTF-8 bytes of the code point cp */
+std::string utf8_encode(int64_t cp);
+const char* type_name(const value& v);
+
+value get_iter(const value& v);
+/* The next item of an iterator in out, false when it is exhausted */
+bool iter_next(const value& it, value& out);
+/* How many items iterating v gives, for a range, list, tuple, dict or set; 0 for anything else */
+size_t length_hint(const value& v);
+int64_t range_length(const range_object* r);
+/* All the items of an iterable */
+std::vector<value> items_of(const value& v);
+
+value get_item(const value& obj, const value& key);
+void set_item(const value& obj, const value& key, const value& v);
+void del_item(const value& obj, const value& key);
+value get_attr(const value& obj, const char* name);
+void set_attr(const value& obj, const char* name, const value& v);
+
+value call(const value& f, const value* args, size_t n, const keyword_args* kw = nullptr);
+
+/* The int of v, TypeError if it is not an int */
+int64_t index_of(const value& v);
+
+/* builtins.cpp: add print, len, the types, the exceptions, ... to table, names interned in A */
+void add_builtins(std::unordered_map<const char*, value>& table, arena& A);
+
+/* CPython's text for an uncaught exception: the traceback with the source lines, then "TypeError: ..." */
+std::string format_exception(const value& exc);
+
+} /* namespace arbusto */
+
+#endif /* RUNTIME_H_ */
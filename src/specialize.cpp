@@ -0,0 +1,265 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <vector>
+#include <cstring>
+
+#include "specialize.h"
+
+namespace arbusto {
+
+/* What a register holds at an instruction, on every path that gets there */
+enum reg_kind {
+	RK_UNDEF, /* nothing seen yet */
+	RK_INT, /* a small int */
+	RK_FLOAT,
+	RK_BOOL,
+	RK_GLOBAL, /* the value of a global, name */
+	RK_RANGE, /* what a call of the global range gave */
+	RK_RANGE_ITER, /* iter() of that */
+	RK_ANY
+};
+
+struct reg_type {
+	reg_kind kind;
+	const char* name;
+
+	bool operator==(const reg_type& o) const { return kind == o.kind && name == o.name; }
+	bool operator!=(const reg_type& o) const { return !(*this == o); }
+};
+
+typedef std::vector<reg_type> frame_types;
+typedef std::unordered_map<const char*, value_type> return_types;
+
+static reg_type of(reg_kind kind, const char* name = nullptr) {
+	return reg_type{ kind, name };
+}
+
+static reg_type join(const reg_type& x, const reg_type& y) {
+	if (x.kind == RK_UNDEF) {
+		return y;
+	}
+	if (y.kind == RK_UNDEF || x == y) {
+		return x;
+	}
+	return of(RK_ANY);
+}
+
+static reg_kind kind_of(value_type t) {
+	switch (t) {
+	case VT_INT: return RK_INT;
+	case VT_FLOAT: return RK_FLOAT;
+	default: return RK_ANY;
+	}
+}
+
+static reg_kind kind_of(const constant& k) {
+	const int64_t small = int64_t(1) << 47; /* as value::fits_small_int */
+	switch (k.kind) {
+	case CK_INT: return k.i >= -small && k.i < small ? RK_INT : RK_ANY;
+	case CK_FLOAT: return RK_FLOAT;
+	case CK_BOOL: return RK_BOOL;
+	default: return RK_ANY;
+	}
+}
+
+static bool is_number(reg_kind k) {
+	return k == RK_INT || k == RK_FLOAT;
+}
+
+/* The typed instruction for ins with the types t before it, or ins; t becomes the types after it */
+static instruction transfer(const code_object& co, instruction ins, frame_types& t, const return_types& returns) {
+	opcode op = op_of(ins);
+	unsigned a = arg_a(ins);
+	unsigned b = arg_b(ins);
+	unsigned c = arg_c(ins);
+	opcode typed = op;
+
+	switch (op) {
+	case BC_NOP: case BC_STOREGLOBAL: case BC_DELGLOBAL: case BC_STOREDEREF: case BC_DELDEREF: case BC_CHECKBOUND:
+	case BC_JMP: case BC_SETITEM: case BC_DELITEM: case BC_SETATTR: case BC_LISTAPPEND: case BC_SETADD:
+	case BC_RESERVE: case BC_RETURN: case BC_RAISE:
+		break;
+	case BC_MOVE:
+		t[a] = t[b];
+		break;
+	case BC_LOADK:
+		t[a] = of(kind_of(co.constants[arg_bx(ins)]));
+		break;
+	case BC_LOADGLOBAL:
+		t[a] = of(RK_GLOBAL, co.names[arg_bx(ins)]);
+		break;
+
+	case BC_ADD: case BC_IADD: case BC_SUB: case BC_MUL: case BC_TRUEDIV: case BC_FLOORDIV: case BC_MOD:
+		{
+			bool ints = t[b].kind == RK_INT && t[c].kind == RK_INT;
+			bool floats = t[b].kind == RK_FLOAT && t[c].kind == RK_FLOAT;
+			switch (op) {
+			case BC_ADD: case BC_IADD: typed = ints ? BC_ADD_II : floats ? BC_ADD_FF : op; break;
+			case BC_SUB: typed = ints ? BC_SUB_II : floats ? BC_SUB_FF : op; break;
+			case BC_MUL: typed = ints ? BC_MUL_II : floats ? BC_MUL_FF : op; break;
+			case BC_TRUEDIV: typed = floats ? BC_TRUEDIV_FF : op; break;
+			case BC_FLOORDIV: typed = ints ? BC_FLOORDIV_II : op; break;
+			case BC_MOD: typed = ints ? BC_MOD_II : op; break;
+			default: break;
+			}
+			/* Two numbers and not two ints give a float, or raise */
+			if (ints && op != BC_TRUEDIV) {
+				t[a] = of(RK_INT);
+			} else if (is_number(t[b].kind) && is_number(t[c].kind)) {
+				t[a] = of(RK_FLOAT);
+			} else {
+				t[a] = of(RK_ANY);
+			}
+		}
+		break;
+	case BC_NEG: case BC_POS:
+		t[a] = of(t[b].kind == RK_FLOAT ? RK_FLOAT : RK_ANY);
+		break;
+
+	case BC_LT: case BC_LE: case BC_EQ: case BC_NE: case BC_GT: case BC_GE:
+		if (t[b].kind == RK_INT && t[c].kind == RK_INT) {
+			typed = static_cast<opcode>(BC_LT_II + (op - BC_LT));
+		} else if (t[b].kind == RK_FLOAT && t[c].kind == RK_FLOAT) {
+			typed = static_cast<opcode>(BC_LT_FF + (op - BC_LT));
+		}
+		t[a] = of(RK_BOOL);
+		break;
+	case BC_NOT: case BC_IS: case BC_ISNOT: case BC_IN: case BC_NOTIN: case BC_EXCMATCH:
+		t[a] = of(RK_BOOL);
+		break;
+	case BC_JMPIF:
+		typed = t[a].kind == RK_BOOL ? BC_JMPIF_B : op;
+		break;
+	case BC_JMPIFNOT:
+		typed = t[a].kind == RK_BOOL ? BC_JMPIFNOT_B : op;
+		break;
+
+	case BC_UNPACK:
+		for (unsigned i = 0; i < c; ++i) {
+			t[a + i] = of(RK_ANY);
+		}
+		break;
+	case BC_CLEAR:
+		for (unsigned i = 0; i < b; ++i) {
+			t[a + i] = of(RK_ANY);
+		}
+		break;
+	case BC_ITER:
+		t[a] = of(t[b].kind == RK_RANGE ? RK_RANGE_ITER : RK_ANY);
+		break;
+	case BC_FORITER:
+		if (t[a].kind == RK_RANGE_ITER) {
+			typed = BC_FORITER_I;
+			t[a + 1] = of(RK_INT);
+		} else {
+			t[a + 1] = of(RK_ANY);
+		}
+		break;
+	case BC_CALL:
+		{
+			reg_kind r = RK_ANY;
+			if (t[a].kind == RK_GLOBAL) {
+				auto it = returns.find(t[a].name);
+				if (it != returns.end()) {
+					r = kind_of(it->second);
+					typed = r == RK_INT ? BC_CALL_I : r == RK_FLOAT ? BC_CALL_F : op;
+				} else if (!std::strcmp(t[a].name, "range")) {
+					r = RK_RANGE;
+				}
+			}
+			t[a] = of(r);
+		}
+		break;
+
+	default:
+		t[a] = of(RK_ANY);
+		break;
+	}
+
+	return typed == op ? ins : (ins & ~instruction(0xff)) | typed;
+}
+
+/* Join t into the types before pc, queueing pc when they change */
+static void merge(std::vector<frame_types>& in, uint32_t pc, const frame_types& t, std::vector<uint32_t>& work) {
+	if (in[pc].empty()) {
+		in[pc] = t;
+		work.push_back(pc);
+		return;
+	}
+	bool changed = false;
+	for (size_t i = 0; i < t.size(); ++i) {
+		reg_type j = join(in[pc][i], t[i]);
+		if (j != in[pc][i]) {
+			in[pc][i] = j;
+			changed = true;
+		}
+	}
+	if (changed) {
+		work.push_back(pc);
+	}
+}
+
+void specialize(code_object& co, const std::unordered_map<const char*, value_type>& returns) {
+	uint32_t n = static_cast<uint32_t>(co.code.size());
+	std::vector<frame_types> in(n); /* empty where no path gets */
+	std::vector<uint32_t> work;
+
+	/* The guarded parameters, anything in the other ones; a handler can start from any instruction */
+	frame_types entry(co.n_registers, of(RK_UNDEF));
+	for (size_t i = 0; i < co.n_params() && i < entry.size(); ++i) {
+		entry[i] = of(i < co.param_types.size() ? kind_of(static_cast<value_type>(co.param_types[i])) : RK_ANY);
+	}
+	merge(in, 0, entry, work);
+	for (auto& e : co.exception_table) {
+		merge(in, e.handler, frame_types(co.n_registers, of(RK_ANY)), work);
+	}
+
+	while (!work.empty()) {
+		uint32_t pc = work.back();
+		work.pop_back();
+
+		instruction ins = co.code[pc];
+		frame_types t = in[pc];
+		transfer(co, ins, t, returns);
+
+		switch (op_of(ins)) {
+		case BC_RETURN: case BC_RAISE:
+			break;
+		case BC_JMP:
+			merge(in, pc + 1 + arg_sbx(ins), t, work);
+			break;
+		case BC_FORITER:
+			/* Exhausted, it does not store */
+			merge(in, pc + 1 + arg_sbx(ins), in[pc], work);
+			merge(in, pc + 1, t, work);
+			break;
+		case BC_JMPIF: case BC_JMPIFNOT:
+			merge(in, pc + 1 + arg_sbx(ins), t, work);
+			merge(in, pc + 1, t, work);
+			break;
+		default:
+			if (pc + 1 < n) {
+				merge(in, pc + 1, t, work);
+			}
+			break;
+		}
+	}
+
+	std::vector<instruction> code = co.code;
+	bool changed = false;
+	for (uint32_t pc = 0; pc < n; ++pc) {
+		if (!in[pc].empty()) {
+			code[pc] = transfer(co, co.code[pc], in[pc], returns);
+			changed |= code[pc] != co.code[pc];
+		}
+	}
+	if (changed) {
+		co.specialized = std::move(code);
+	}
+}
+
+} /* namespace arbusto */
@@ -0,0 +1,32 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef SPECIALIZE_H_
+#define SPECIALIZE_H_
+
+#include <unordered_map>
+
+#include "bytecode.h"
+
+namespace arbusto {
+
+/*
+ * Fills co.specialized, the code of co for calls whose arguments have the
+ * types of co.param_types, and leaves it empty when it would be the same.
+ *
+ * The type of every register at every instruction comes from the
+ * parameters, the constants, the typed instructions before it, which
+ * only give small ints and floats, and two guarded guesses: a loop over
+ * range() of the builtin range gives ints, and a call of the global
+ * function f gives the type returns[f], the return annotation of the
+ * function of the module with that name. An instruction whose operands
+ * are known is replaced by its typed one, see BC_ADD_II.
+ */
+void specialize(code_object& co, const std::unordered_map<const char*, value_type>& returns);
+
+} /* namespace arbusto */
+
+#endif /* SPECIALIZE_H_ */
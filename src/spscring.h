@@ -0,0 +1,61 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef SPSCRING_H_
+#define SPSCRING_H_
+
+#include <vector>
+#include <atomic>
+#include <cstddef>
+
+namespace arbusto {
+
+/*
+ * Bounded lock free queue for exactly one producer thread and one consumer
+ * thread. head is only written by the consumer and tail by the producer,
+ * each on its own cache line; the release store of one and the acquire load
+ * by the other publish the slot in between. A full ring makes try_push
+ * fail, which is the backpressure on the producer.
+ */
+template <typename T>
+class spsc_ring {
+public:
+	explicit spsc_ring(size_t capacity) : slots(capacity + 1), head(0), tail(0) {}
+
+	bool try_push(T&& value) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		size_t next = (t + 1 == slots.size()) ? 0 : t + 1;
+
+		if (next == head.load(std::memory_order_acquire)) {
+			return false;
+		}
+
+		slots[t] = std::move(value);
+		tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	bool try_pop(T& value) {
+		size_t h = head.load(std::memory_order_relaxed);
+
+		if (h == tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+
+		value = std::move(slots[h]);
+		head.store((h + 1 == slots.size()) ? 0 : h + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	std::vector<T> slots; /* one always empty, to tell full from empty */
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<size_t> tail;
+};
+
+} /* namespace arbusto */
+
+#endif /* SPSCRING_H_ */
@@ -0,0 +1,697 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include <string>
+#include <algorithm>
+#include <unordered_set>
+#include <map>
+#include <utility>
+#include <stdexcept>
+#include <cstring>
+
+#include "symtable.h"
+
+namespace arbusto {
+
+typedef std::unordered_set<const char*> name_set;
+
+/*
+ * First pass: walk the ast, open a scope for every function, class,
+ * lambda and comprehension, and record how each scope uses each name.
+ * Second pass, analyze: decide the symbol_scope of every name, top down,
+ * with the names bound by enclosing functions at hand.
+ */
+class symtable_builder {
+public:
+	symtable_builder(symtable& T_, arena& A_)
+		: T(T_), cur(nullptr), private_name(nullptr), dot0(A_.intern(".0")), class_name(A_.intern("__class__")),
+		  A(A_) {}
+
+	void build(const ast_module* m) {
+		enter(SCOPE_MODULE, "top", m, 0);
+		body(m->body);
+		cur = nullptr;
+
+		name_set free;
+		analyze(T.scopes.front().get(), name_set(), free);
+	}
+
+private:
+	[[noreturn]] void fail(uint32_t line, const std::string& what) {
+		throw std::runtime_error("line " + std::to_string(line) + ": " + what);
+	}
+
+	void enter(scope_kind kind, const char* name, const ast_node* node, uint32_t line) {
+		std::unique_ptr<scope> s(new scope());
+		s->kind = kind;
+		s->name = name;
+		s->private_name = private_name;
+		s->node = node;
+		s->line = line;
+		s->parent = cur;
+		if (cur) {
+			cur->children.push_back(s.get());
+		}
+		cur = s.get();
+		T.by_node[node] = cur;
+		T.scopes.push_back(std::move(s));
+	}
+
+	void leave() {
+		cur = cur->parent;
+	}
+
+	symbol& add(scope* s, const char* name, unsigned flags) {
+		name = mangle(private_name, name, A);
+		auto it = s->index.find(name);
+		if (it != s->index.end()) {
+			symbol& sym = s->symbols[it->second];
+			sym.flags |= flags;
+			return sym;
+		}
+		s->index[name] = static_cast<uint32_t>(s->symbols.size());
+		s->symbols.push_back(symbol{name, flags, SYM_GLOBAL_IMPLICIT, -1, -1});
+		return s->symbols.back();
+	}
+
+	void def(const char* name, unsigned flags) {
+		add(cur, name, flags);
+	}
+
+	/* global or nonlocal name, at line */
+	void declare(const char* name, unsigned flag, uint32_t line) {
+		const char* what = flag == SYM_DEF_GLOBAL ? "global" : "nonlocal";
+
+		if (flag == SYM_DEF_NONLOCAL && cur->kind == SCOPE_MODULE) {
+			fail(line, "nonlocal declaration not allowed at module level");
+		}
+
+		const symbol* sym = cur->lookup(mangle(private_name, name, A));
+		unsigned flags = sym ? sym->flags : 0;
+		std::string quoted = std::string("name '") + name + "'";
+
+		if (flags & SYM_DEF_PARAM) {
+			fail(line, quoted + " is parameter and " + what);
+		}
+		if (flags & (flag == SYM_DEF_GLOBAL ? SYM_DEF_NONLOCAL : SYM_DEF_GLOBAL)) {
+			fail(line, quoted + " is nonlocal and global");
+		}
+		if (flags & SYM_USE) {
+			fail(line, quoted + " is used prior to " + what + " declaration");
+		}
+		if (flags & (SYM_DEF_LOCAL | SYM_DEF_IMPORT)) {
+			fail(line, quoted + " is assigned to before " + what + " declaration");
+		}
+
+		def(name, flag);
+		if (flag == SYM_DEF_NONLOCAL) {
+			nonlocal_lines.emplace(std::make_pair(cur, mangle(private_name, name, A)), line);
+		}
+		if (flag == SYM_DEF_GLOBAL && cur != T.scopes.front().get()) {
+			/* CPython's symtable shows the module the globals its functions declare */
+			add(T.scopes.front().get(), name, SYM_DEF_GLOBAL);
+		}
+	}
+
+	void body(const ast_body& stmts) {
+		for (auto s : stmts) {
+			stmt(s);
+		}
+	}
+
+	void exprs(const ast_exprs& items) {
+		for (auto e : items) {
+			if (e) {
+				expr(e);
+			}
+		}
+	}
+
+	void opt(const ast_expr* e) {
+		if (e) {
+			expr(e);
+		}
+	}
+
+	/* Defaults and annotations belong to the enclosing scope */
+	void argument_values(const ast_arguments* a) {
+		exprs(a->defaults);
+		exprs(a->kw_defaults);
+		for (auto x : a->args) {
+			opt(x->annotation);
+		}
+		if (a->vararg) {
+			opt(a->vararg->annotation);
+		}
+		for (auto x : a->kwonlyargs) {
+			opt(x->annotation);
+		}
+		if (a->kwarg) {
+			opt(a->kwarg->annotation);
+		}
+	}
+
+	void parameters(const ast_arguments* a) {
+		for (auto x : a->args) {
+			def(x->arg, SYM_DEF_PARAM);
+		}
+		for (auto x : a->kwonlyargs) {
+			def(x->arg, SYM_DEF_PARAM);
+		}
+		if (a->vararg) {
+			def(a->vararg->arg, SYM_DEF_PARAM);
+		}
+		if (a->kwarg) {
+			def(a->kwarg->arg, SYM_DEF_PARAM);
+		}
+	}
+
+	void stmt(const ast_stmt* s);
+	void expr(const ast_expr* e);
+	void comprehension(const ast_expr* e, const char* name, const ast_list<ast_comprehension>& generators,
+			const ast_expr* elt, const ast_expr* value);
+
+	void analyze(scope* s, const name_set& bound, name_set& free);
+	void layout(scope* s);
+
+	static bool inlinable(const scope* parent, const scope* s) {
+		if (parent->kind == SCOPE_CLASS || s->n_cells != 0) {
+			return false;
+		}
+		switch (s->node->kind) {
+		case AST_LIST_COMP: case AST_SET_COMP: case AST_DICT_COMP: break;
+		default: return false;
+		}
+		for (auto child : s->children) {
+			if (!child->inlined) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	symtable& T;
+	scope* cur;
+	const char* private_name; /* of cur */
+	const char* dot0;
+	const char* class_name;
+	arena& A;
+
+	/* Where each nonlocal was declared, for the error when nothing binds it */
+	std::map<std::pair<const scope*, const char*>, uint32_t> nonlocal_lines;
+};
+
+void symtable_builder::stmt(const ast_stmt* s) {
+	switch (s->kind) {
+	case AST_FUNCTION_DEF:
+		{
+			auto n = static_cast<const ast_function_def*>(s);
+			exprs(n->decorator_list);
+			argument_values(n->args);
+			opt(n->returns);
+			def(n->name, SYM_DEF_LOCAL);
+
+			enter(SCOPE_FUNCTION, n->name, n, n->line);
+			parameters(n->args);
+			body(n->body);
+			leave();
+		}
+		break;
+	case AST_CLASS_DEF:
+		{
+			auto n = static_cast<const ast_class_def*>(s);
+			exprs(n->decorator_list);
+			exprs(n->bases);
+			for (auto& k : n->keywords) {
+				expr(k.value);
+			}
+			def(n->name, SYM_DEF_LOCAL);
+
+			const char* outer = private_name;
+			private_name = n->name;
+			enter(SCOPE_CLASS, n->name, n, n->line);
+			body(n->body);
+			leave();
+			private_name = outer;
+		}
+		break;
+	case AST_RETURN:
+		opt(static_cast<const ast_return*>(s)->value);
+		break;
+	case AST_DELETE:
+		exprs(static_cast<const ast_delete*>(s)->targets);
+		break;
+	case AST_ASSIGN:
+		{
+			auto n = static_cast<const ast_assign*>(s);
+			expr(n->value);
+			exprs(n->targets);
+		}
+		break;
+	case AST_AUG_ASSIGN:
+		{
+			auto n = static_cast<const ast_aug_assign*>(s);
+			expr(n->target);
+			expr(n->value);
+		}
+		break;
+	case AST_FOR:
+		{
+			auto n = static_cast<const ast_for*>(s);
+			expr(n->iter);
+			expr(n->target);
+			body(n->body);
+			body(n->orelse);
+		}
+		break;
+	case AST_WHILE:
+		{
+			auto n = static_cast<const ast_while*>(s);
+			expr(n->test);
+			body(n->body);
+			body(n->orelse);
+		}
+		break;
+	case AST_IF:
+		{
+			auto n = static_cast<const ast_if*>(s);
+			expr(n->test);
+			body(n->body);
+			body(n->orelse);
+		}
+		break;
+	case AST_WITH:
+		{
+			auto n = static_cast<const ast_with*>(s);
+			for (auto& w : n->items) {
+				expr(w.context_expr);
+				opt(w.optional_vars);
+			}
+			body(n->body);
+		}
+		break;
+	case AST_RAISE:
+		{
+			auto n = static_cast<const ast_raise*>(s);
+			opt(n->exc);
+			opt(n->cause);
+		}
+		break;
+	case AST_TRY:
+		{
+			/* In the order the compiler emits them, which is the order locals get their slots */
+			auto n = static_cast<const ast_try*>(s);
+			body(n->body);
+			body(n->orelse);
+			for (auto h : n->handlers) {
+				opt(h->type);
+				if (h->name) {
+					def(h->name, SYM_DEF_LOCAL);
+				}
+				body(h->body);
+			}
+			body(n->finalbody);
+		}
+		break;
+	case AST_ASSERT:
+		{
+			auto n = static_cast<const ast_assert*>(s);
+			expr(n->test);
+			opt(n->msg);
+		}
+		break;
+	case AST_IMPORT:
+	case AST_IMPORT_FROM:
+		{
+			const ast_list<ast_alias>& names = s->kind == AST_IMPORT ? static_cast<const ast_import*>(s)->names
+					: static_cast<const ast_import_from*>(s)->names;
+
+			for (auto& a : names) {
+				if (std::strcmp(a.name, "*") == 0) {
+					if (cur->kind != SCOPE_MODULE) {
+						fail(s->line, "import * only allowed at module level");
+					}
+					continue;
+				}
+				if (a.asname) {
+					def(a.asname, SYM_DEF_IMPORT);
+				} else {
+					/* import a.b binds a */
+					const char* dot = std::strchr(a.name, '.');
+					def(dot ? A.intern(std::string(a.name, dot)) : a.name, SYM_DEF_IMPORT);
+				}
+			}
+		}
+		break;
+	case AST_GLOBAL:
+		for (auto name : static_cast<const ast_global*>(s)->names) {
+			declare(name, SYM_DEF_GLOBAL, s->line);
+		}
+		break;
+	case AST_NONLOCAL:
+		for (auto name : static_cast<const ast_nonlocal*>(s)->names) {
+			declare(name, SYM_DEF_NONLOCAL, s->line);
+		}
+		break;
+	case AST_EXPR:
+		expr(static_cast<const ast_expr_stmt*>(s)->value);
+		break;
+	default:
+		break;
+	}
+}
+
+void symtable_builder::expr(const ast_expr* e) {
+	switch (e->kind) {
+	case AST_BOOL_OP:
+		exprs(static_cast<const ast_bool_op*>(e)->values);
+		break;
+	case AST_BIN_OP:
+		expr(static_cast<const ast_bin_op*>(e)->left);
+		expr(static_cast<const ast_bin_op*>(e)->right);
+		break;
+	case AST_UNARY_OP:
+		expr(static_cast<const ast_unary_op*>(e)->operand);
+		break;
+	case AST_LAMBDA:
+		{
+			auto n = static_cast<const ast_lambda*>(e);
+			argument_values(n->args);
+			enter(SCOPE_FUNCTION, "lambda", n, n->line);
+			parameters(n->args);
+			expr(n->body);
+			leave();
+		}
+		break;
+	case AST_IF_EXP:
+		{
+			auto n = static_cast<const ast_if_exp*>(e);
+			expr(n->test);
+			expr(n->body);
+			expr(n->orelse);
+		}
+		break;
+	case AST_DICT:
+		{
+			auto n = static_cast<const ast_dict*>(e);
+			for (size_t i = 0; i < n->values.size(); ++i) {
+				opt(n->keys[i]);
+				expr(n->values[i]);
+			}
+		}
+		break;
+	case AST_SET:
+		exprs(static_cast<const ast_set*>(e)->elts);
+		break;
+	case AST_LIST_COMP:
+	case AST_SET_COMP:
+	case AST_GENERATOR_EXP:
+		{
+			auto n = static_cast<const ast_comp*>(e);
+			const char* name = e->kind == AST_LIST_COMP ? "listcomp" : e->kind == AST_SET_COMP ? "setcomp" : "genexpr";
+			comprehension(e, name, n->generators, n->elt, nullptr);
+		}
+		break;
+	case AST_DICT_COMP:
+		{
+			auto n = static_cast<const ast_dict_comp*>(e);
+			comprehension(e, "dictcomp", n->generators, n->key, n->value);
+		}
+		break;
+	case AST_AWAIT:
+		expr(static_cast<const ast_await*>(e)->value);
+		break;
+	case AST_YIELD:
+		cur->is_generator = true;
+		opt(static_cast<const ast_yield*>(e)->value);
+		break;
+	case AST_YIELD_FROM:
+		cur->is_generator = true;
+		expr(static_cast<const ast_yield_from*>(e)->value);
+		break;
+	case AST_COMPARE:
+		expr(static_cast<const ast_compare*>(e)->left);
+		exprs(static_cast<const ast_compare*>(e)->comparators);
+		break;
+	case AST_CALL:
+		{
+			auto n = static_cast<const ast_call*>(e);
+			expr(n->func);
+			exprs(n->args);
+			for (auto& k : n->keywords) {
+				expr(k.value);
+			}
+		}
+		break;
+	case AST_ATTRIBUTE:
+		expr(static_cast<const ast_attribute*>(e)->value);
+		break;
+	case AST_SUBSCRIPT:
+		expr(static_cast<const ast_subscript*>(e)->value);
+		expr(static_cast<const ast_subscript*>(e)->slice);
+		break;
+	case AST_STARRED:
+		expr(static_cast<const ast_starred*>(e)->value);
+		break;
+	case AST_NAME:
+		{
+			auto n = static_cast<const ast_name*>(e);
+			def(n->id, n->ctx == CTX_LOAD ? SYM_USE : SYM_DEF_LOCAL);
+			/* super() finds the class through the __class__ cell */
+			if (n->ctx == CTX_LOAD && cur->kind == SCOPE_FUNCTION && std::strcmp(n->id, "super") == 0) {
+				def(class_name, SYM_USE);
+			}
+		}
+		break;
+	case AST_LIST:
+		exprs(static_cast<const ast_list_expr*>(e)->elts);
+		break;
+	case AST_TUPLE:
+		exprs(static_cast<const ast_tuple*>(e)->elts);
+		break;
+	case AST_SLICE:
+		{
+			auto n = static_cast<const ast_slice*>(e);
+			opt(n->lower);
+			opt(n->upper);
+			opt(n->step);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * A comprehension is a function called with the first iterable, which is
+ * evaluated outside, as its .0 parameter.
+ */
+void symtable_builder::comprehension(const ast_expr* e, const char* name, const ast_list<ast_comprehension>& generators,
+		const ast_expr* elt, const ast_expr* value) {
+	expr(generators[0].iter);
+
+	enter(SCOPE_FUNCTION, name, e, e->line);
+	cur->is_generator = e->kind == AST_GENERATOR_EXP;
+	def(dot0, SYM_DEF_PARAM);
+
+	for (size_t i = 0; i < generators.size(); ++i) {
+		if (i > 0) {
+			expr(generators[i].iter);
+		}
+		expr(generators[i].target);
+		exprs(generators[i].ifs);
+	}
+
+	expr(elt);
+	opt(value);
+	leave();
+}
+
+/*
+ * Decide the scope of every symbol of s. bound has the names local to the
+ * enclosing functions. On return free has the free names of s and of
+ * everything below it, which the caller turns into cells if they are its
+ * locals.
+ */
+void symtable_builder::analyze(scope* s, const name_set& bound, name_set& free) {
+	name_set local;
+	name_set child_bound;
+
+	for (auto& sym : s->symbols) {
+		if (sym.flags & SYM_DEF_GLOBAL) {
+			sym.scope = SYM_GLOBAL_EXPLICIT;
+		} else if (sym.flags & SYM_DEF_NONLOCAL) {
+			if (!bound.count(sym.name)) {
+				fail(nonlocal_lines[std::make_pair(s, sym.name)],
+						std::string("no binding for nonlocal '") + sym.name + "' found");
+			}
+			sym.scope = SYM_FREE;
+		} else if (sym.flags & SYM_DEF_BOUND) {
+			sym.scope = SYM_LOCAL;
+			local.insert(sym.name);
+		} else if (bound.count(sym.name)) {
+			sym.scope = SYM_FREE;
+		} else {
+			sym.scope = SYM_GLOBAL_IMPLICIT;
+		}
+	}
+
+	/*
+	 * Class bodies are not visible from their methods, but the class
+	 * itself is, as __class__. Module names are globals.
+	 */
+	if (s->kind == SCOPE_FUNCTION) {
+		child_bound = bound;
+		child_bound.insert(local.begin(), local.end());
+	} else if (s->kind == SCOPE_CLASS) {
+		child_bound = bound;
+		child_bound.insert(class_name);
+	}
+	for (auto& sym : s->symbols) {
+		if (sym.scope == SYM_GLOBAL_EXPLICIT) {
+			child_bound.erase(sym.name);
+		}
+	}
+
+	name_set child_free;
+	for (auto child : s->children) {
+		name_set f;
+		analyze(child, child_bound, f);
+		child->inlined = inlinable(s, child);
+		for (auto name : f) {
+			if (!child->inlined || !local.count(name)) {
+				child_free.insert(name);
+			}
+		}
+	}
+
+	for (auto name : child_free) {
+		auto it = s->index.find(name);
+		bool known = it != s->index.end();
+
+		if (s->kind == SCOPE_CLASS && name == class_name) {
+			s->needs_class_cell = true;
+			continue;
+		}
+
+		if (known && s->kind == SCOPE_FUNCTION && s->symbols[it->second].scope == SYM_LOCAL) {
+			s->symbols[it->second].scope = SYM_CELL;
+			continue;
+		}
+
+		/* Passed through to the scope that binds it */
+		symbol& sym = add(s, name, s->kind == SCOPE_CLASS ? SYM_DEF_FREE_CLASS : 0);
+		if (!known) {
+			sym.scope = SYM_FREE;
+		}
+		free.insert(name);
+	}
+
+	for (auto& sym : s->symbols) {
+		if (sym.scope == SYM_FREE) {
+			free.insert(sym.name);
+		}
+	}
+
+	layout(s);
+}
+
+void symtable_builder::layout(scope* s) {
+	std::vector<const char*> cells, frees;
+
+	/* Parameters come first in symbols, so parameter cells keep the order of their slots */
+	for (auto& sym : s->symbols) {
+		if (s->kind == SCOPE_FUNCTION && (sym.scope == SYM_LOCAL || (sym.flags & SYM_DEF_PARAM))) {
+			sym.slot = static_cast<int>(s->slots.size());
+			s->slots.push_back(sym.name);
+		}
+		if (sym.scope == SYM_CELL) {
+			(sym.flags & SYM_DEF_PARAM ? s->cells : cells).push_back(sym.name);
+		} else if (sym.scope == SYM_FREE || (sym.flags & SYM_DEF_FREE_CLASS)) {
+			frees.push_back(sym.name);
+		}
+	}
+
+	if (s->needs_class_cell) {
+		cells.push_back(class_name);
+	}
+
+	auto by_name = [](const char* a, const char* b) { return std::strcmp(a, b) < 0; };
+	std::sort(cells.begin(), cells.end(), by_name);
+	std::sort(frees.begin(), frees.end(), by_name);
+	s->cells.insert(s->cells.end(), cells.begin(), cells.end());
+
+	s->n_cells = s->cells.size();
+	s->cells.insert(s->cells.end(), frees.begin(), frees.end());
+
+	for (size_t i = 0; i < s->cells.size(); ++i) {
+		auto it = s->index.find(s->cells[i]);
+		if (it != s->index.end()) {
+			s->symbols[it->second].cell = static_cast<int>(i);
+		}
+	}
+}
+
+const char* mangle(const char* private_name, const char* name, arena& A) {
+	size_t n = std::strlen(name);
+
+	/* Not __spam__ nor a dotted import name */
+	if (!private_name || n < 3 || name[0] != '_' || name[1] != '_' || (name[n - 1] == '_' && name[n - 2] == '_')
+			|| std::strchr(name, '.')) {
+		return name;
+	}
+
+	while (*private_name == '_') {
+		++private_name;
+	}
+	if (!*private_name) {
+		return name;
+	}
+	return A.intern(std::string("_") + private_name + name);
+}
+
+symtable::symtable(const ast_module* m, arena& A) {
+	symtable_builder(*this, A).build(m);
+}
+
+static const char* const symbol_scope_names[] = { "local", "global_explicit", "global_implicit", "free", "cell" };
+
+static void dump_scope(const scope* s, size_t depth, std::ostream& out) {
+	static const char* const kinds[] = { "module", "function", "class" };
+	std::string indent(depth, ' ');
+	std::vector<const symbol*> sorted;
+
+	out << indent << kinds[s->kind] << " " << s->name << " " << s->line << (s->inlined ? " inlined" : "") << std::endl;
+
+	for (auto& sym : s->symbols) {
+		sorted.push_back(&sym);
+	}
+	std::sort(sorted.begin(), sorted.end(), [](const symbol* a, const symbol* b) { return std::strcmp(a->name, b->name) < 0; });
+
+	for (auto sym : sorted) {
+		out << indent << "  " << sym->name << " " << symbol_scope_names[sym->scope];
+		if (sym->flags & SYM_DEF_PARAM) {
+			out << " param";
+		}
+		if (sym->slot >= 0) {
+			out << " slot=" << sym->slot;
+		}
+		if (sym->cell >= 0) {
+			out << " cell=" << sym->cell;
+		}
+		out << std::endl;
+	}
+
+	for (auto child : s->children) {
+		dump_scope(child, depth + 1, out);
+	}
+}
+
+void symtable::dump(std::ostream& out) const {
+	dump_scope(top(), 0, out);
+}
+
+} /* namespace arbusto */
@@ -0,0 +1,139 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef SYMTABLE_H_
+#define SYMTABLE_H_
+
+#include <vector>
+#include <memory>
+#include <ostream>
+#include <unordered_map>
+#include <cstdint>
+
+#include "ast.h"
+#include "arena.h"
+
+namespace arbusto {
+
+/*
+ * Where a name lives, as in CPython's symtable: a local of its scope, a
+ * global (declared or not), a variable of an enclosing function (free), or
+ * a local that enclosed functions use, so it lives in a cell.
+ */
+enum symbol_scope {
+	SYM_LOCAL,
+	SYM_GLOBAL_EXPLICIT,
+	SYM_GLOBAL_IMPLICIT,
+	SYM_FREE,
+	SYM_CELL
+};
+
+/* How a scope uses a name, the flags of symbol */
+enum {
+	SYM_DEF_LOCAL = 1, /* assigned or deleted */
+	SYM_DEF_PARAM = 2,
+	SYM_DEF_GLOBAL = 4,
+	SYM_DEF_NONLOCAL = 8,
+	SYM_USE = 16,
+	SYM_DEF_IMPORT = 32,
+	SYM_DEF_FREE_CLASS = 64, /* a class passing a free variable on to its methods */
+
+	SYM_DEF_BOUND = SYM_DEF_LOCAL | SYM_DEF_PARAM | SYM_DEF_IMPORT
+};
+
+/* Lambdas and comprehensions are function scopes */
+enum scope_kind { SCOPE_MODULE, SCOPE_FUNCTION, SCOPE_CLASS };
+
+struct symbol {
+	const char* name; /* interned in the module arena */
+	unsigned flags;
+	symbol_scope scope;
+	int slot; /* fast local index in a function, -1 if it has none */
+	int cell; /* index in the cells and then frees of its scope, -1 if none */
+};
+
+/*
+ * A function, class or module body. In a function every parameter and
+ * local has a dense slot: the parameters in order (positional, keyword
+ * only, *args, **kwargs), then the locals as they first appear. Cells and
+ * free variables are laid out like CPython's co_cellvars + co_freevars:
+ * parameter cells by slot, the other cells by name, then the frees by name.
+ */
+struct scope {
+	scope_kind kind;
+	const char* name; /* "top" for the module, "lambda", "listcomp", "genexpr", ... */
+	const char* private_name; /* the class whose body holds this scope, nullptr outside classes */
+	const ast_node* node;
+	uint32_t line;
+	scope* parent;
+	std::vector<scope*> children;
+
+	std::vector<symbol> symbols; /* in order of first appearance */
+	std::vector<const char*> slots; /* the name of each slot */
+	std::vector<const char*> cells; /* cells, then frees */
+	size_t n_cells{0};
+	bool is_generator{false};
+	bool needs_class_cell{false}; /* a class whose methods use __class__ or super */
+	/*
+	 * A list, set or dict comprehension compiled as a loop inside the code
+	 * of its parent, a function or the module: it has no cells and every
+	 * scope in it is inlined too. Its locals are registers of the parent
+	 * and the locals of the parent it uses do not become cells.
+	 */
+	bool inlined{false};
+
+	/* nullptr if the scope never mentions name */
+	const symbol* lookup(const char* name) const {
+		auto it = index.find(name);
+		return it == index.end() ? nullptr : &symbols[it->second];
+	}
+
+	std::unordered_map<const char*, uint32_t> index; /* by name pointer */
+};
+
+/*
+ * name as written in a scope whose private_name is private_name: __spam
+ * inside class Ham is _Ham__spam. Returns name itself when it is not
+ * mangled, else the mangled name interned in A.
+ */
+const char* mangle(const char* private_name, const char* name, arena& A);
+
+/*
+ * The scopes of a module and the symbols in each. Names are compared by
+ * pointer, which works because lower_module interns them in A; the names
+ * the analysis makes up (.0, __class__, mangled names) are interned there
+ * too. Symbols are keyed by their mangled name.
+ *
+ * Throws std::runtime_error with the line for what CPython's symtable
+ * rejects: global after use, nonlocal without a binding, and the like.
+ */
+class symtable {
+public:
+	symtable(const ast_module* m, arena& A);
+
+	const scope* top() const { return scopes.front().get(); }
+
+	/* The scope a FunctionDef, ClassDef, Lambda or comprehension opens, nullptr for any other node */
+	const scope* scope_of(const ast_node* n) const {
+		auto it = by_node.find(n);
+		return it == by_node.end() ? nullptr : it->second;
+	}
+
+	size_t scope_count() const { return scopes.size(); }
+
+	/* Every scope and symbol, children after their parents */
+	void dump(std::ostream& out) const;
+
+private:
+	std::vector<std::unique_ptr<scope> > scopes; /* in order of creation, top first */
+	std::unordered_map<const ast_node*, scope*> by_node;
+
+	friend class symtable_builder;
+};
+
+} /* namespace arbusto */
+
+#endif /* SYMTABLE_H_ */
@@ -5,6 +5,7 @@
  */
 
 #include "tokenizer.h"
+#include "literal.h"
 
 #include <fstream>
 #include <iostream>
@@ -264,10 +265,28 @@ void tokenizer::tokenize_string(const std::string& file_str, std::vector<token>
 	int nest_level = 0;
 	bool line_new = true;
 	std::vector<size_t> indent_stack;
+	size_t next_batch = toks.size() + batch_size;
 
 	indent_stack.push_back(0);
 
+	/* A malformed token from start, p is where it was seen */
+	auto bad_token = [&](const std::string& what, size_t start) {
+		if (!error_tokens) {
+			throw std::runtime_error(what);
+		}
+		while (p < file_str.size() && !is_newline(file_str[p])) {
+			++p;
+		}
+		toks.emplace_back(TOK_ERRORTOKEN, start, p - start, line_num, what);
+		nest_level = 0;
+	};
+
 	while (p < file_str.size()) {
+		if (on_tokens && toks.size() >= next_batch) {
+			on_tokens(toks);
+			next_batch = toks.size() + batch_size;
+		}
+
 		if (is_whitespace(file_str[p]))
 		{
 			size_t i = p;
@@ -284,11 +303,16 @@ void tokenizer::tokenize_string(const std::string& file_str, std::vector<token>
 
 						if (dist > indent_stack.back()) {
 							toks.emplace_back(TOK_INDENT, i, dist, line_num);
-						} else if (dist > indent_stack.back()) {
-							while (dist > indent_stack.back()) {
+							indent_stack.push_back(dist);
+						} else if (dist < indent_stack.back()) {
+							while (dist < indent_stack.back()) {
 								toks.emplace_back(TOK_DEDENT, i, dist, line_num);
 								indent_stack.pop_back();
 							}
+							if (dist != indent_stack.back()) {
+								bad_token("tokenizer error: unindent does not match any outer level at ptr=" + std::to_string(p), p);
+								continue;
+							}
 						}
 					}
 				}
@@ -299,13 +323,17 @@ void tokenizer::tokenize_string(const std::string& file_str, std::vector<token>
 			if ((toks.size() && toks.back().tok != TOK_NEWLINE) && nest_level == 0 and !line_new) {
 				toks.emplace_back(TOK_NEWLINE, p, 1, line_num, "\n");
 			}
+			/* \r\n is a single line break */
+			if (file_str[p] == '\r' && (p + 1) < file_str.size() && file_str[p + 1] == '\n') {
+				++p;
+			}
 			++p;
 			++line_num;
 			if (nest_level == 0) {
 				line_new = true;
 			}
 		}
-		else if (line_new)
+		else if (line_new && file_str[p] != '#')
 		{
 			line_new = false;
 			/* if we reach here means the next token is not whitespace, we have zero indent, and following token is a stmt */
@@ -323,8 +351,11 @@ void tokenizer::tokenize_string(const std::string& file_str, std::vector<token>
 		}
 		else if ((p + 1) < file_str.size() && file_str[p] == '\\' && is_newline(file_str[p + 1]))
 		{
-			/* next line follows this \ */
-			++p;
+			/* next line follows this \, skip the line break too */
+			p += 2;
+			if (file_str[p - 1] == '\r' && p < file_str.size() && file_str[p] == '\n') {
+				++p;
+			}
 			++line_num;
 		}
 		else if (is_digit_dec(file_str[p]) || ((p + 1) < file_str.size() && file_str[p] == '.' && is_digit_dec(file_str[p + 1])))
@@ -343,7 +374,8 @@ void tokenizer::tokenize_string(const std::string& file_str, std::vector<token>
 				if (p - i >= 3) {
 					toks.emplace_back(TOK_NUMBER, i, p - i, line_num, file_str.substr(i, p - i));
 				} else {
-					throw std::runtime_error("tokenizer error: digits missing at ptr=" + std::to_string(p));
+					bad_token("tokenizer error: digits missing at ptr=" + std::to_string(p), i);
+					continue;
 				}
 			} else if (c1 == '0' && (c2 == 'b' || c2 == 'B')) {
 				/* bin */
@@ -354,7 +386,8 @@ void tokenizer::tokenize_string(const std::string& file_str, std::vector<token>
 				if (p - i >= 3) {
 					toks.emplace_back(TOK_NUMBER, i, p - i, line_num, file_str.substr(i, p - i));
 				} else {
-					throw std::runtime_error("tokenizer error: digits missing at ptr=" + std::to_string(p));
+					bad_token("tokenizer error: digits missing at ptr=" + std::to_string(p), i);
+					continue;
 				}
 			} else if (c1 == '0' && (c2 == 'o' || c2 == 'O')) {
 				/* oct */
@@ -365,7 +398,8 @@ void tokenizer::tokenize_string(const std::string& file_str, std::vector<token>
 				if (p - i >= 3) {
 					toks.emplace_back(TOK_NUMBER, i, p - i, line_num, file_str.substr(i, p - i));
 				} else {
-					throw std::runtime_error("tokenizer error: digits missing at ptr=" + std::to_string(p));
+					bad_token("tokenizer error: digits missing at ptr=" + std::to_string(p), i);
+					continue;
 				}
 			} else {
 				/* dec */
@@ -383,7 +417,7 @@ void tokenizer::tokenize_string(const std::string& file_str, std::vector<token>
 
 				if (p < file_str.size() && (file_str[p] == 'e' || file_str[p] == 'E')) {
 					++p;
-					if (p < file_str.size() && file_str[p] == '-') {
+					if (p < file_str.size() && (file_str[p] == '-' || file_str[p] == '+')) {
 						++p;
 					}
 					auto k = p;
@@ -391,12 +425,22 @@ void tokenizer::tokenize_string(const std::string& file_str, std::vector<token>
 						++p;
 					}
 					if (p - k < 1) {
-						throw std::runtime_error("tokenizer error: exp part missing at ptr=" + std::to_string(p));
+						bad_token("tokenizer error: exp part missing at ptr=" + std::to_string(p), i);
+						continue;
 					}
 				}
 
+				/* imaginary 2j */
+				if (p < file_str.size() && (file_str[p] == 'j' || file_str[p] == 'J')) {
+					++p;
+				}
+
 				toks.emplace_back(TOK_NUMBER, i, p - i, line_num, file_str.substr(i, p - i));
 			}
+
+			if (literals) {
+				literals->add(toks.size() - 1, toks.back());
+			}
 		}
 		else
 		{
@@ -406,9 +450,6 @@ void tokenizer::tokenize_string(const std::string& file_str, std::vector<token>
 				auto t = get_next_operator(file_str, p, tlen);
 
 				if (t != TOK_N_TOKENS) {
-					toks.emplace_back(t, p, tlen, line_num, file_str.substr(p, tlen));
-					p += tlen;
-
 					switch (t) {
 					case TOK_LPAR:
 					case TOK_LBRACE:
@@ -426,9 +467,12 @@ void tokenizer::tokenize_string(const std::string& file_str, std::vector<token>
 					}
 
 					if (nest_level < 0) {
-						throw std::runtime_error("tokenizer error: nest level negative at ptr=" + std::to_string(p));
+						bad_token("tokenizer error: nest level negative at ptr=" + std::to_string(p + tlen), p);
+						continue;
 					}
 
+					toks.emplace_back(t, p, tlen, line_num, file_str.substr(p, tlen));
+					p += tlen;
 					continue;
 				}
 			}
@@ -436,28 +480,54 @@ void tokenizer::tokenize_string(const std::string& file_str, std::vector<token>
 			/* string literals */
 			{
 				size_t tlen = 0;
-				if (get_next_string(file_str, p, tlen)) {
+				bool is_string;
+				try {
+					is_string = get_next_string(file_str, p, tlen);
+				} catch (const std::runtime_error& e) {
+					bad_token(e.what(), p);
+					continue;
+				}
+				if (is_string) {
 					toks.emplace_back(TOK_STRING, p, tlen, line_num, file_str.substr(p, tlen));
+					if (literals) {
+						literals->add(toks.size() - 1, toks.back());
+					}
+					/* long strings span lines */
+					line_num += std::count(file_str.begin() + p, file_str.begin() + p + tlen, '\n');
 					p += tlen;
 					continue;
 				}
 			}
 
 			/* names */
-			if (is_ascii_letter(file_str[p])) {
+			if (is_name_start(file_str[p])) {
 				size_t k = p;
-				while (p < file_str.size() && (is_ascii_letter(file_str[p]) || is_digit_bin(file_str[p]) || file_str[p] == '_')) {
+				while (p < file_str.size() && (is_name_start(file_str[p]) || is_digit_dec(file_str[p]))) {
 					++p;
 				}
 				toks.emplace_back(TOK_NAME, k, p - k, line_num, file_str.substr(k, p - k));
 				continue;
 			}
 
-			throw std::runtime_error("tokenizer error at ptr=" + std::to_string(p));
+			bad_token("tokenizer error at ptr=" + std::to_string(p), p);
 		}
 	}
 
+	/* Close the last logical line and every open block */
+	if (toks.size() && toks.back().tok != TOK_NEWLINE && toks.back().tok != TOK_DEDENT) {
+		toks.emplace_back(TOK_NEWLINE, p, 0, line_num, "\n");
+	}
+
+	while (0 < indent_stack.back()) {
+		toks.emplace_back(TOK_DEDENT, p, 0, line_num);
+		indent_stack.pop_back();
+	}
+
 	toks.emplace_back(TOK_ENDMARKER, p, 0, line_num);
+
+	if (on_tokens) {
+		on_tokens(toks);
+	}
 }
 
 bool tokenizer::get_next_string(const std::string& file_str, const size_t p, size_t &len) {
@@ -483,49 +553,48 @@ bool tokenizer::get_next_string(const std::string& file_str, const size_t p, siz
 	auto quote_char = (p + len < file_str.size()) ? file_str[p + len] : ' ';
 
 	if (quote_char == '"' || quote_char == '\'') {
-		if (p + len + 3 < file_str.size()) {
-			bool long_quote = ((quote_char == file_str[p + len + 1]) && (quote_char == file_str[p + len + 2]));
-			bool found = false;
-			size_t k;
-
-			if (long_quote) {
-				k = p + len + 3;
-				while (k + 2 < file_str.size()) {
-					if (file_str[k] == '\\' && (file_str[k + 1] == '"' || file_str[k + 1] == '\'')) {
-						k += 2;
-					} else if (quote_char == file_str[k] && quote_char == file_str[k + 1]
-							&& quote_char == file_str[k + 2]) {
-						found = true;
-						k += 3;
-						break;
-					} else {
-						++k;
-					}
-				}
-			} else {
-				k = p + len + 1;
-				while (k < file_str.size()) {
-					if (file_str[k] == '\\' && (file_str[k + 1] == '"' || file_str[k + 1] == '\'')) {
-						k += 2;
-					} else if (is_newline(file_str[k])) {
-						throw std::runtime_error("tokenizer error: missing closing quotes at ptr=" + std::to_string(k));
-					} else if (file_str[k] == quote_char) {
-						found = true;
-						k += 1;
-						break;
-					} else {
-						++k;
-					}
+		bool long_quote = (p + len + 2 < file_str.size()) && (quote_char == file_str[p + len + 1]) && (quote_char == file_str[p + len + 2]);
+		bool found = false;
+		size_t k;
+
+		/* A backslash always takes the next char with it, even in raw strings */
+		if (long_quote) {
+			k = p + len + 3;
+			while (k < file_str.size()) {
+				if (file_str[k] == '\\') {
+					k += 2;
+				} else if (k + 2 < file_str.size() && quote_char == file_str[k] && quote_char == file_str[k + 1]
+						&& quote_char == file_str[k + 2]) {
+					found = true;
+					k += 3;
+					break;
+				} else {
+					++k;
 				}
 			}
-
-			if (!found) {
-				throw std::runtime_error("tokenizer error: missing closing quotes at ptr=" + std::to_string(k));
+		} else {
+			k = p + len + 1;
+			while (k < file_str.size()) {
+				if (file_str[k] == '\\') {
+					k += 2;
+				} else if (is_newline(file_str[k])) {
+					throw std::runtime_error("tokenizer error: missing closing quotes at ptr=" + std::to_string(k));
+				} else if (file_str[k] == quote_char) {
+					found = true;
+					k += 1;
+					break;
+				} else {
+					++k;
+				}
 			}
+		}
 
-			len = k - p;
-			return true;
+		if (!found) {
+			throw std::runtime_error("tokenizer error: missing closing quotes at ptr=" + std::to_string(k));
 		}
+
+		len = k - p;
+		return true;
 	}
 
 	return false;
@@ -580,8 +649,15 @@ token_t tokenizer::get_next_operator(const std::string& file_str, size_t p, size
 		len = 1;
 		return TOK_TILDE;
 	case '@':
-		len = 1;
-		return TOK_AT;
+		switch (c2) {
+		case '=':
+			len = 2;
+			return TOK_ATEQUAL;
+		default:
+			len = 1;
+			return TOK_AT;
+		}
+		break;
 	case '<':
 		switch (c2) {
 		case '>':
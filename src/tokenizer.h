@@ -9,10 +9,13 @@
 
 #include <vector>
 #include <string>
+#include <functional>
 
 
 namespace arbusto {
 
+class literal_table;
+
 /* stolen from token.h */
 
 enum token_t {
@@ -97,6 +100,25 @@ public:
 
 	bool debug{false};
 
+	/*
+	 * When set, tokenize_string calls it every batch_size new tokens, and
+	 * once at the end. Tokens already in toks do not change any more, so
+	 * another thread can start on them, see token_stream.
+	 */
+	std::function<void(const std::vector<token>& toks)> on_tokens;
+	size_t batch_size{1024};
+
+	/* When set, NUMBER and STRING tokens are decoded into it as they are read */
+	literal_table* literals{nullptr};
+
+	/*
+	 * When set, a malformed token does not throw: it becomes an ERRORTOKEN
+	 * over the rest of its line, with the error message as its data, and
+	 * tokenizing goes on at the next line. The parser recovers from it as
+	 * from any bad statement.
+	 */
+	bool error_tokens{false};
+
 	void tokenize_file(const std::string& file_name, std::vector<token> &toks);
 	void tokenize_string(const std::string& file_str, std::vector<token> &toks);
 
@@ -133,6 +155,11 @@ public:
 		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
 	}
 
+	/* Letters, underscore and any non ASCII (UTF-8) byte */
+	inline bool is_name_start(char c) {
+		return is_ascii_letter(c) || c == '_' || (c & 0x80);
+	}
+
 	static std::string token2str(token_t t);
 };
 
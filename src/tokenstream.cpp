@@ -0,0 +1,103 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#include "tokenstream.h"
+
+namespace arbusto {
+
+token_stream::token_stream(const std::string& source, int (*kind_of_)(const token&), bool error_tokens, size_t batch_size,
+		size_t max_batches)
+	: kind_of(kind_of_), ring(max_batches), done(false) {
+	producer = std::thread(&token_stream::produce, this, std::cref(source), error_tokens, batch_size);
+}
+
+token_stream::~token_stream() {
+	/* A producer blocked on a full ring needs the rest popped to end */
+	drain();
+
+	if (producer.joinable()) {
+		producer.join();
+	}
+}
+
+void token_stream::push(token_batch&& batch) {
+	while (!ring.try_push(std::move(batch))) {
+		std::this_thread::yield();
+	}
+}
+
+void token_stream::produce(const std::string& source, bool error_tokens, size_t batch_size) {
+	try {
+		tokenizer T;
+		size_t seen = 0;
+
+		T.error_tokens = error_tokens;
+		T.batch_size = batch_size;
+		T.on_tokens = [this, &seen](const std::vector<token>& all) {
+			token_batch batch;
+			batch.kinds.reserve(all.size() - seen);
+			for (; seen < all.size(); ++seen) {
+				batch.kinds.push_back(kind_of(all[seen]));
+			}
+			push(std::move(batch));
+		};
+
+		T.tokenize_string(source, toks);
+	} catch (...) {
+		/* Read by the consumer only after it pops the last batch */
+		error = std::current_exception();
+	}
+
+	token_batch last;
+	last.last = true;
+	push(std::move(last));
+}
+
+void token_stream::drain() {
+	token_batch batch;
+
+	while (!done) {
+		if (ring.try_pop(batch)) {
+			done = batch.last;
+		} else {
+			std::this_thread::yield();
+		}
+	}
+}
+
+bool token_stream::next(std::vector<int>& kinds) {
+	if (done) {
+		return false;
+	}
+
+	token_batch batch;
+
+	while (!ring.try_pop(batch)) {
+		std::this_thread::yield();
+	}
+
+	if (batch.last) {
+		done = true;
+
+		if (error) {
+			std::rethrow_exception(error);
+		}
+
+		return false;
+	}
+
+	kinds.insert(kinds.end(), batch.kinds.begin(), batch.kinds.end());
+	return true;
+}
+
+void token_stream::finish(std::vector<token>& out) {
+	drain();
+	producer.join();
+
+	out = std::move(toks);
+}
+
+} /* namespace arbusto */
@@ -0,0 +1,69 @@
+/*
+ * Arbusto: A Python Compiler.
+ * Alejandro Santos, @alejolp.
+ * Licence: BSD
+ */
+
+#ifndef TOKENSTREAM_H_
+#define TOKENSTREAM_H_
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <exception>
+
+#include "tokenizer.h"
+#include "spscring.h"
+
+namespace arbusto {
+
+/* The parser kinds of the next tokens, the unit passed between the threads */
+struct token_batch {
+	std::vector<int> kinds;
+	bool last{false};
+};
+
+/*
+ * Tokenizes a source on its own thread while the parser reads it, see
+ * parser_session(const std::vector<token>&, token_stream&).
+ *
+ * While parsing only the kinds are needed, so only those cross over, in
+ * batches through a ring of at most max_batches: the tokenizer waits for
+ * the parser beyond that. The tokens stay in the tokenizer's vector, which
+ * finish hands over once it is done.
+ */
+class token_stream {
+public:
+	/* error_tokens as in tokenizer::error_tokens */
+	token_stream(const std::string& source, int (*kind_of)(const token&), bool error_tokens = false, size_t batch_size = 1024,
+			size_t max_batches = 16);
+	~token_stream();
+
+	token_stream(const token_stream&) = delete;
+	token_stream& operator=(const token_stream&) = delete;
+
+	/*
+	 * Wait for the next batch and append it to kinds. Returns false after
+	 * the last one; rethrows a tokenizer error.
+	 */
+	bool next(std::vector<int>& kinds);
+
+	/* Wait for the tokenizer to end and move all the tokens to toks */
+	void finish(std::vector<token>& toks);
+
+private:
+	void produce(const std::string& source, bool error_tokens, size_t batch_size);
+	void push(token_batch&& batch);
+	void drain();
+
+	int (*kind_of)(const token&);
+	spsc_ring<token_batch> ring;
+	std::vector<token> toks; /* written by the producer until it pushes the last batch */
+	std::exception_ptr error;
+	bool done;
+	std::thread producer;
+};
+
+} /* namespace arbusto */
+
+#endif /* TOKENSTREAM_H_ */
@@ -0,0 +1,50 @@
+# Small ints, bigints and floats, with a deterministic pseudo random walk.
+
+seed = 20240601
+
+
+def rnd(bits):
+    global seed
+    seed = (seed * 6364136223846793005 + 1442695040888963407) % 2 ** 64
+    return seed >> (64 - bits)
+
+
+def signed(bits):
+    x = 0
+    while bits > 0:
+        take = min(bits, 64)
+        x = (x << take) | rnd(take)
+        bits -= take
+    return -x if rnd(1) else x
+
+
+for i in range(300):
+    a = signed(rnd(7) + 1)
+    b = signed(rnd(7) + 1) or 7
+    print(a + b, a - b, a * b, a // b, a % b, divmod(a, b), a & b, a | b, a ^ b, ~a, -a, abs(a))
+    print(a << (rnd(7)), a >> (rnd(7)), a == b, a < b, a >= b, a ** rnd(4))
+
+for x in [1, -1, 3, -3, 2 ** 40, -(2 ** 40), 2 ** 61 - 1, -(2 ** 61), 0, 7]:
+    print([x << y for y in [0, 1, 21, 40, 61, 62, 63, 64, 100]])
+
+print(2 ** 100, -2 ** 100, (-2) ** 101, 10 ** 30 // 7, 10 ** 30 % 7, -(10 ** 30) // 7, 3 ** 200 % 1000003)
+print(7 / 2, -7 / 2, 7 // -2, 7 % -2, 2 ** -1, 10 ** 20 / 3, 1.5 * 2, 0.1 + 0.2, 1e300 * 1e10, -1e300 * 1e10)
+print(int(3.9), int(-3.9), float(7), 1e16, 1e-7, 123456789.0, 2.5e-300)
+
+for a, b in [(10.0, 400), (2.0, 1023.5), (-10.0, 401), (float('inf'), 2), (2.0, -2000), (1e300, 2), (2.5, 3)]:
+    try:
+        print(a ** b)
+    except OverflowError as e:
+        print("OverflowError", e)
+
+print(round(1e300, 10), round(0.5, 400), round(2.675, 2), round(0.125, 2), round(-0.001, 2))
+print(round(55.0, -1), round(45.0, -1), round(50.0, -2), round(150.0, -2), round(-55.0, -2), round(12345.678, -2))
+print(round(3.5), round(4.5), round(-2.5), round(1.5, -400), round(0.0, 3))
+for i in range(300):
+    x = (rnd(31) - 2 ** 30) / (rnd(10) + 1)
+    print(x, round(x, rnd(4) - 7))
+
+try:
+    print(1 // 0)
+except ZeroDivisionError as e:
+    print("ZeroDivisionError", e)
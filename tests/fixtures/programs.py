@@ -0,0 +1,65 @@
+# Functions, closures, exceptions, comprehensions and dicts.
+
+
+def fib(n: int) -> int:
+    if n < 2:
+        return n
+    return fib(n - 1) + fib(n - 2)
+
+
+def counter():
+    n = 0
+
+    def step():
+        nonlocal n
+        n += 1
+        return n
+    return step
+
+
+def squares(n):
+    return [i * i for i in range(n)]
+
+
+def integrate(a: float, b: float, n: int) -> float:
+    h = (b - a) / n
+    s = 0.0
+    x = a
+    for i in range(n):
+        s = s + x * x * h
+        x = x + h
+    return s
+
+
+print([fib(i) for i in range(20)])
+c = counter()
+print(c(), c(), c())
+print(list(squares(10)), sum(squares(100)), {k: k * k for k in range(5)}, {x % 3 for x in range(10)})
+print(sorted([5, 3, 9, 1], reverse=True), sorted(["b", "a", "c"], key=lambda s: s), min(3, 1, 2), max([4, 8, 2]))
+print(integrate(0.0, 1.0, 1000))
+
+total = 0
+i = 0
+while i < 1000:
+    if i % 3 == 0 or i % 5 == 0:
+        total += i
+    i += 1
+print(total)
+
+d = {}
+for w in "a b c a b a".split():
+    d[w] = d.get(w, 0) + 1
+print(d, list(d.items()), len(d))
+
+for v in [1, "x", None, [1], (2,), 0.5]:
+    try:
+        print(v + 1)
+    except TypeError as e:
+        print("TypeError")
+    finally:
+        pass
+
+try:
+    raise ValueError("bad")
+except ValueError as e:
+    print("caught", e)
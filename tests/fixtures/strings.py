@@ -0,0 +1,27 @@
+# str % args, format() and slicing.
+
+print(len('%600d' % 5), len('%600s' % 'x'), len('%.600f' % 1.0))
+print('%x' % -255, '%o' % -8, '%#x' % -255, '%#X' % 255, '%#o' % 8, '%05x' % -255, '%-6x|' % -255)
+print('%+d' % 5, '% d' % 5, '%.3d' % -5, '%05.3d' % 5, '%d' % 3.7, '%i' % -12)
+print('%d' % -(10 ** 30), '%x' % -(2 ** 70), '%#x' % 2 ** 70, '%30d|' % 10 ** 25, '%030d' % -10 ** 25)
+print('%c' % 300, '%c' % 65, '%3c|' % 'a', '%s %r %5s|%-5s|%.2s' % ('a', 'b', 'c', 'd', 'xyz'))
+print('%e %g %10.3f|%-10.2E|%%' % (1234.5, 0.0001, 3.14159, 2.5))
+print(len(format(1e300, '.300f')), len('{:.400f}'.format(1e200)), format(0.5, '.1%'), format(1234.5, ',.2f'))
+print(format(255, 'x'), format(-255, '#x'), format(10 ** 20, ','), format('ab', '>5'), format(3.25, '^9.1f'))
+print('{} {!r} {:>4}|{:<4}|{:^5}|{:08.3f}'.format(1, 'a', 'b', 'c', 'd', -3.14159))
+
+L = [1, 2, 3]
+print(L[-4:10 ** 20], L[-10 ** 20:2], L[10 ** 20:], L[::-10 ** 20], L[::10 ** 20], L[10 ** 20:-10 ** 20:-1])
+print("abcdef"[-10 ** 30:10 ** 30:2], (1, 2, 3)[:-10 ** 25], "abcdef"[::-1], "abcdef"[1:-1])
+M = [1, 2, 3, 4]
+M[10 ** 20:] = [9]
+del M[-10 ** 20:1]
+print(M)
+try:
+    L[10 ** 20]
+except IndexError as e:
+    print("IndexError", e)
+
+s = "The quick brown fox"
+print(s.upper(), s.lower(), s.split(), s.replace("o", "0"), s.find("q"), s.count("o"), s.startswith("The"))
+print("-".join(["a", "b", "c"]), "  x  ".strip(), "a,b,,c".split(","), "ab" * 3, "b" in "abc", len("héllo"))
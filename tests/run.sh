@@ -0,0 +1,130 @@
+#!/bin/sh
+# Arbusto: A Python Compiler.
+# Alejandro Santos, @alejolp.
+# Licence: BSD
+#
+# Checks arbusto against python3, the 3.11 whose ast.dump the lowering
+# follows:
+#
+#   - ast, plain and --lazy, on every stdlib file the grammar accepts,
+#     tests left out
+#   - run, run --specialize and the program of build on tests/fixtures
+#   - random edits, which edit checks against a full parse
+#   - damaged AST cache files, which have to be misses
+#
+#   tests/run.sh [build_dir]
+
+set -e
+
+SRC=$(cd "$(dirname "$0")/.." && pwd)
+BIN=$(cd "${1:-$SRC/build}" && pwd)/arbusto
+STDLIB=$(python3 -c 'import sysconfig; print(sysconfig.get_paths()["stdlib"])')
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+FAILED=0
+
+fail() {
+    echo "FAIL $*"
+    FAILED=1
+}
+
+# The dumps python3 gives, one file each, named by the path with % for /
+mkdir "$TMP/dumps"
+python3 - "$STDLIB" "$TMP/dumps" <<'EOF'
+import ast, os, sys
+for top, dirs, names in os.walk(sys.argv[1]):
+    dirs[:] = sorted(d for d in dirs if d not in ('test', 'tests', 'site-packages', '__pycache__'))
+    for name in sorted(names):
+        if name.endswith('.py'):
+            path = os.path.relpath(os.path.join(top, name), sys.argv[1])
+            try:
+                with open(os.path.join(sys.argv[1], path), encoding='utf-8') as f:
+                    tree = ast.parse(f.read())
+            except (SyntaxError, UnicodeDecodeError, ValueError):
+                continue
+            with open(os.path.join(sys.argv[2], path.replace('/', '%')), 'w', encoding='utf-8') as f:
+                f.write(ast.dump(tree) + '\n')
+EOF
+
+checked=0
+skipped=0
+for dump in "$TMP"/dumps/*.py; do
+    name=$(basename "$dump" | tr % /)
+    if ! "$BIN" ast "$STDLIB/$name" > "$TMP/out" 2> /dev/null; then
+        skipped=$((skipped + 1))
+        continue
+    fi
+    head -n 1 "$TMP/out" | cmp -s - "$dump" || fail "ast $name"
+    "$BIN" ast "$STDLIB/$name" --lazy 2> /dev/null | head -n 1 | cmp -s - "$dump" || fail "ast --lazy $name"
+    checked=$((checked + 1))
+done
+echo "ast: $checked stdlib files, $skipped the grammar does not accept"
+
+for f in "$SRC"/tests/fixtures/*.py; do
+    name=$(basename "$f")
+    (cd "$SRC/tests/fixtures" && python3 "$name") > "$TMP/expected" 2>&1
+    for flags in "" --specialize; do
+        (cd "$SRC/tests/fixtures" && "$BIN" run "$name" $flags) > "$TMP/out" 2>&1 || true
+        cmp -s "$TMP/expected" "$TMP/out" || fail "run${flags:+ $flags} $name"
+    done
+    if "$BIN" build "$f" -o "$TMP/native" --specialize > /dev/null 2>&1; then
+        (cd "$SRC/tests/fixtures" && "$TMP/native") > "$TMP/out" 2>&1 || true
+        cmp -s "$TMP/expected" "$TMP/out" || fail "build $name"
+    else
+        fail "build $name does not compile"
+    fi
+done
+echo "fixtures: $(ls "$SRC"/tests/fixtures/*.py | wc -l) programs"
+
+python3 - "$BIN" "$STDLIB" <<'EOF' || FAILED=1
+import os, random, subprocess, sys
+bin, stdlib = sys.argv[1:]
+random.seed(1)
+files = [os.path.join(stdlib, n) for n in sorted(os.listdir(stdlib)) if n.endswith('.py')]
+files = [f for f in files if subprocess.run([bin, 'edit', f, '0', '0', ''], capture_output=True).returncode == 0][:40]
+texts = ['', 'x', '(', ')', '\n', '\n    ', 'def f():\n    pass\n', '"', "'''", '#', ':', 'if x:\n', '  ', 'return 1\n', '[1,\n2]']
+failed = 0
+for i in range(1000):
+    f = random.choice(files)
+    size = os.path.getsize(f)
+    offset = random.randrange(size)
+    removed = min(random.choice([0, 0, 1, 2, 5, 30]), size - offset)
+    r = subprocess.run([bin, 'edit', f, str(offset), str(removed), random.choice(texts)], capture_output=True, text=True)
+    if r.returncode != 0 and not r.stderr.endswith(': syntax error after the edit\n'):
+        print('FAIL edit %s %d %d: %s' % (f, offset, removed, r.stderr.strip()))
+        failed = 1
+print('edit: 1000 edits of %d stdlib files' % len(files))
+sys.exit(failed)
+EOF
+
+python3 - "$BIN" "$STDLIB/heapq.py" "$TMP/cache" <<'EOF' || FAILED=1
+import glob, os, random, subprocess, sys
+bin, source, cache = sys.argv[1:]
+os.mkdir(cache)
+parse = [bin, 'parse', source, '--cache', cache]
+subprocess.run(parse, capture_output=True, check=True)
+name = glob.glob(os.path.join(cache, '*.ast'))[0]
+with open(name, 'rb') as f:
+    good = f.read()
+random.seed(1)
+failed = 0
+for i in range(200):
+    bad = bytearray(good)
+    for _ in range(random.randint(1, 20)):
+        bad[random.randrange(72, len(bad))] = random.randrange(256)
+    with open(name, 'wb') as f:
+        f.write(bad)
+    r = subprocess.run(parse, capture_output=True)
+    if r.returncode != 0:
+        print('FAIL cache: rc %d on a damaged file' % r.returncode)
+        failed = 1
+        break
+print('cache: 200 damaged files')
+sys.exit(failed)
+EOF
+
+if [ $FAILED -ne 0 ]; then
+    echo "failed"
+    exit 1
+fi
+echo "passed"